@@ -0,0 +1,233 @@
+#include "assets.h"
+
+#ifdef COUNTLINES_HAVE_ZLIB
+    #include <zlib.h>
+#endif
+
+static const char* content_type_for(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext) return "application/octet-stream";
+    if (strcmp(ext, ".html") == 0) return "text/html";
+    if (strcmp(ext, ".css") == 0) return "text/css";
+    if (strcmp(ext, ".js") == 0) return "application/javascript";
+    if (strcmp(ext, ".json") == 0) return "application/json";
+    if (strcmp(ext, ".svg") == 0) return "image/svg+xml";
+    if (strcmp(ext, ".txt") == 0) return "text/plain";
+    if (strcmp(ext, ".png") == 0) return "image/png";
+    if (strcmp(ext, ".ico") == 0) return "image/x-icon";
+    if (strcmp(ext, ".gz") == 0) return "application/gzip";
+    return "application/octet-stream";
+}
+
+#ifdef COUNTLINES_HAVE_ZLIB
+// Worth a gzip variant: images other than SVG and archives are compressed already
+static bool is_compressible(const char *content_type) {
+    return strncmp(content_type, "text/", 5) == 0 || strcmp(content_type, "application/javascript") == 0 ||
+           strcmp(content_type, "application/json") == 0 || strcmp(content_type, "image/svg+xml") == 0;
+}
+#endif
+
+// FNV-1a, 64 bits
+static unsigned long long hash_bytes(const char *data, size_t size) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool add_asset(AssetCache *cache, const char *filepath, const char *url_path) {
+    if (cache->count == cache->capacity) {
+        int capacity = cache->capacity ? cache->capacity * 2 : 8;
+        Asset *grown = realloc(cache->assets, sizeof(Asset) * capacity);
+        if (!grown) return false;
+        cache->assets = grown;
+        cache->capacity = capacity;
+    }
+
+    Asset *asset = &cache->assets[cache->count];
+    memset(asset, 0, sizeof(Asset));
+    asset->data = read_entire_file(filepath, &asset->size);
+    if (!asset->data) return true;      // Unreadable files are left out, as a 404
+    size_t len = strlen(url_path);
+    asset->path = malloc(len + 1);
+    if (!asset->path) {
+        free(asset->data);
+        return false;
+    }
+    memcpy(asset->path, url_path, len + 1);
+    asset->content_type = content_type_for(url_path);
+    snprintf(asset->etag, sizeof(asset->etag), "\"%016llx\"", hash_bytes(asset->data, asset->size));
+    cache->count++;
+    return true;
+}
+
+// "`head``separator``tail`" in a new allocation, or NULL
+static char* join_path(const char *head, char separator, const char *tail) {
+    size_t head_len = strlen(head), tail_len = strlen(tail);
+    char *joined = malloc(head_len + tail_len + 2);
+    if (!joined) return NULL;
+    memcpy(joined, head, head_len);
+    joined[head_len] = separator;
+    memcpy(joined + head_len + 1, tail, tail_len + 1);
+    return joined;
+}
+
+// Add the files below `dir`, served under `url_prefix`
+static bool load_directory(AssetCache *cache, const char *dir, const char *url_prefix, int depth) {
+#ifdef _WIN32
+    char *search_path = join_path(dir, '\\', "*");
+    if (!search_path) return false;
+    WIN32_FIND_DATA find_data;
+    HANDLE hFind = FindFirstFile(search_path, &find_data);
+    free(search_path);
+    if (hFind == INVALID_HANDLE_VALUE) return true;
+    bool ok = true;
+    do {
+        const char *name = find_data.cFileName;
+        bool is_dir = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    DIR *handle = opendir(dir);
+    if (!handle) return true;
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(handle)) != NULL) {
+        const char *name = entry->d_name;
+#endif
+        // Dot files are never served, which also skips "." and ".."
+        if (name[0] == '.') continue;
+        char *filepath = join_path(dir, PATH_SEPARATOR, name);
+        char *url_path = join_path(url_prefix, '/', name);
+        ok = filepath && url_path;
+#ifdef _WIN32
+        bool wanted = ok;
+#else
+        struct stat file_stat;
+        bool wanted = ok && stat(filepath, &file_stat) == 0;
+        bool is_dir = wanted && S_ISDIR(file_stat.st_mode);
+        if (wanted && !is_dir) wanted = S_ISREG(file_stat.st_mode);
+#endif
+        if (wanted && is_dir) {
+            if (depth < ASSET_MAX_DEPTH) ok = load_directory(cache, filepath, url_path, depth + 1);
+        } else if (wanted) {
+            ok = add_asset(cache, filepath, url_path);
+        }
+        free(filepath);
+        free(url_path);
+#ifdef _WIN32
+    } while (ok && FindNextFile(hFind, &find_data));
+    FindClose(hFind);
+#else
+    }
+    closedir(handle);
+#endif
+    return ok;
+}
+
+static void set_gzip(Asset *asset, char *data, size_t size) {
+    if (size >= asset->size) {
+        free(data);
+        return;
+    }
+    asset->gzip_data = data;
+    asset->gzip_size = size;
+    // Same hash as the identity variant: both change together
+    snprintf(asset->gzip_etag, sizeof(asset->gzip_etag), "\"%.16s-gz\"", asset->etag + 1);
+}
+
+#ifdef COUNTLINES_HAVE_ZLIB
+static void compress_asset(Asset *asset) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 window bits, plus 16 for a gzip header and trailer
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+    size_t bound = deflateBound(&stream, (uLong)asset->size);
+    char *compressed = malloc(bound);
+    if (compressed) {
+        stream.next_in = (Bytef *)asset->data;
+        stream.avail_in = (uInt)asset->size;
+        stream.next_out = (Bytef *)compressed;
+        stream.avail_out = (uInt)bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+            set_gzip(asset, compressed, stream.total_out);
+        } else {
+            free(compressed);
+        }
+    }
+    deflateEnd(&stream);
+}
+#endif
+
+// Turn "NAME.gz" files into the gzip variants of NAME, then compress the
+// text assets still without one
+static void attach_gzip_variants(AssetCache *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        Asset *asset = &cache->assets[i];
+        size_t len = strlen(asset->path);
+        if (len <= 3 || strcmp(asset->path + len - 3, ".gz") != 0) continue;
+        for (int j = 0; j < cache->count; j++) {
+            Asset *base = &cache->assets[j];
+            if (j == i || !base->path || strlen(base->path) != len - 3 || memcmp(base->path, asset->path, len - 3) != 0) continue;
+            if (!base->gzip_data) {
+                set_gzip(base, asset->data, asset->size);
+                asset->data = NULL;
+            }
+            free(asset->path);
+            free(asset->data);
+            asset->path = NULL;
+            break;
+        }
+    }
+    int kept = 0;
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->assets[i].path) cache->assets[kept++] = cache->assets[i];
+    }
+    cache->count = kept;
+
+#ifdef COUNTLINES_HAVE_ZLIB
+    for (int i = 0; i < cache->count; i++) {
+        Asset *asset = &cache->assets[i];
+        if (!asset->gzip_data && asset->size > 0 && asset->size <= UINT32_MAX &&
+            is_compressible(asset->content_type)) {
+            compress_asset(asset);
+        }
+    }
+#endif
+}
+
+AssetCache* asset_cache_load(const char *dir) {
+    AssetCache *cache = calloc(1, sizeof(AssetCache));
+    if (!cache) return NULL;
+    if (!load_directory(cache, dir, "", 0)) {
+        asset_cache_destroy(cache);
+        return NULL;
+    }
+    attach_gzip_variants(cache);
+    return cache;
+}
+
+void asset_cache_destroy(AssetCache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->assets[i].path);
+        free(cache->assets[i].data);
+        free(cache->assets[i].gzip_data);
+    }
+    free(cache->assets);
+    free(cache);
+}
+
+const Asset* asset_cache_find(const AssetCache *cache, const char *path) {
+    if (!cache) return NULL;
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->assets[i].path, path) == 0) return &cache->assets[i];
+    }
+    return NULL;
+}
+
+size_t asset_cache_size(const AssetCache *cache) {
+    size_t size = 0;
+    for (int i = 0; cache && i < cache->count; i++) size += cache->assets[i].size + cache->assets[i].gzip_size;
+    return size;
+}
@@ -0,0 +1,47 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include "countlines.h"
+
+// Static files of the web interface, read into memory once when the server
+// starts and served from there.
+//
+// Each asset carries a strong ETag (a hash of its contents), so a client
+// revalidating with If-None-Match gets 304 without the body. Text assets
+// also get a gzip variant with its own ETag: "NAME.gz" next to the file when
+// one exists, otherwise compressed at load time when the build found zlib.
+// The variant is kept only if it is smaller. The cache is read-only once
+// loaded, so responses point into it instead of copying the body.
+
+#define ASSET_MAX_DEPTH 8           // Subdirectories of the web directory that are served
+#define ASSET_ETAG_SIZE 32
+
+typedef struct {
+    char *path;                     // URL path, e.g. "/index.html"
+    const char *content_type;
+    char *data;
+    size_t size;
+    char *gzip_data;                // NULL without a smaller gzip variant
+    size_t gzip_size;
+    char etag[ASSET_ETAG_SIZE];     // Quoted, as sent
+    char gzip_etag[ASSET_ETAG_SIZE];
+} Asset;
+
+typedef struct {
+    Asset *assets;
+    int count;
+    int capacity;
+} AssetCache;
+
+// Load every file below `dir`; a missing directory gives an empty cache.
+// Returns NULL only when out of memory.
+AssetCache* asset_cache_load(const char *dir);
+void asset_cache_destroy(AssetCache *cache);
+
+// The asset served at URL path `path`, NULL if there is none
+const Asset* asset_cache_find(const AssetCache *cache, const char *path);
+
+// Total bytes held, both variants
+size_t asset_cache_size(const AssetCache *cache);
+
+#endif // ASSETS_H
@@ -0,0 +1,123 @@
+#include "batch.h"
+#include "webserver.h"
+#include "threading.h"
+
+// Records waiting to be written, shared by the workers reporting roots
+typedef struct {
+    cl_mutex_t lock;
+    HttpBuffer buffer;
+    unsigned long long last_flush;
+    bool sniff;                 // Records carry the skipped files
+    bool failed;                // A root could not be opened
+} BatchWriter;
+
+// Split the list into its roots, in place; `*roots` points into `list`
+static int split_roots(char *list, size_t size, const char ***roots) {
+    int count = 0, capacity = 0;
+    *roots = NULL;
+    char *line = list;
+    while (line < list + size) {
+        char *end = memchr(line, '\n', (size_t)(list + size - line));
+        char *next = end ? end + 1 : list + size;
+        if (!end) end = list + size;
+        if (end > line && end[-1] == '\r') end--;
+        *end = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                const char **grown = realloc((void *)*roots, sizeof(char*) * capacity);
+                if (!grown) {
+                    free((void *)*roots);
+                    *roots = NULL;
+                    return -1;
+                }
+                *roots = grown;
+            }
+            (*roots)[count++] = line;
+        }
+        line = next;
+    }
+    return count;
+}
+
+// Write out the records buffered so far; the writer is locked
+static void flush_records(BatchWriter *writer) {
+    if (writer->buffer.length > 0) {
+        fwrite(writer->buffer.data, 1, writer->buffer.length, stdout);
+        fflush(stdout);
+        writer->buffer.length = 0;
+    }
+    writer->last_flush = cl_monotonic_ns();
+}
+
+// BatchVisitor: format the root's record and write the buffer out when it
+// is full or the last write was a while ago
+static void write_root(void *ctx, const BatchRoot *root) {
+    BatchWriter *writer = ctx;
+    cl_mutex_lock(&writer->lock);
+    HttpBuffer *json = &writer->buffer;
+    http_buffer_printf(json, "{\"index\":%d,\"target_path\":", root->index);
+    json_append_string(json, root->path);
+    if (!root->ok) {
+        http_buffer_append(json, ",\"error\":\"Cannot open\"}\n", 24);
+        writer->failed = true;
+    } else {
+        http_buffer_printf(json,
+            ",\"total_files\":%llu,"
+            "\"total_lines\":%llu,"
+            "\"code_lines\":%llu,"
+            "\"comment_lines\":%llu,"
+            "\"blank_lines\":%llu,"
+            "\"directories\":%llu,",
+            root->totals.total_files,
+            root->totals.total_lines,
+            root->totals.code_lines,
+            root->totals.comment_lines,
+            root->totals.blank_lines,
+            root->directories);
+        if (writer->sniff) {
+            unsigned long long skipped = 0;
+            for (int i = SNIFF_TEXT + 1; i < SNIFF_REASON_COUNT; i++) skipped += root->skipped.files[i];
+            http_buffer_printf(json, "\"skipped_files\":%llu,", skipped);
+        }
+        http_buffer_printf(json, "\"elapsed\":%.3f}\n", root->elapsed);
+    }
+    unsigned long long now = cl_monotonic_ns();
+    if (json->length >= BATCH_FLUSH_BYTES || now - writer->last_flush >= BATCH_FLUSH_MS * 1000000ULL) {
+        flush_records(writer);
+    }
+    cl_mutex_unlock(&writer->lock);
+}
+
+int run_batch(const char *list_path, const CountOptions *options) {
+    bool from_stdin = strcmp(list_path, "-") == 0;
+    FILE *file = from_stdin ? stdin : fopen(list_path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open root list '%s'\n", list_path);
+        return 1;
+    }
+    size_t size = 0;
+    char *list = read_entire_stream(file, &size);
+    if (!from_stdin) fclose(file);
+    const char **roots = NULL;
+    int root_count = list ? split_roots(list, size, &roots) : -1;
+    if (root_count < 0) {
+        fprintf(stderr, "Error: Cannot read root list '%s'\n", list_path);
+        free(list);
+        return 1;
+    }
+
+    BatchWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    cl_mutex_init(&writer.lock);
+    writer.sniff = options->sniff != NULL;
+    CountResult totals = {0, 0, 0, 0, 0};
+    if (root_count > 0) count_lines_batch(roots, root_count, options, &totals, write_root, &writer);
+    flush_records(&writer);
+
+    http_buffer_free(&writer.buffer);
+    cl_mutex_destroy(&writer.lock);
+    free((void *)roots);
+    free(list);
+    return writer.failed ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "countlines.h"
+
+// Many roots counted by one process (--batch).
+//
+// The roots are read from a list, one path per line ("-" reads the list from
+// standard input; blank lines and lines starting with '#' are skipped), and
+// counted together by count_lines_batch on one pool, so the process starts,
+// the exclude patterns are compiled and the threads are created once for all
+// of them. Each root is written to standard output as one NDJSON record as
+// soon as it finishes, in the order they finish:
+//
+//   {"index":0,"target_path":"repos/a","total_files":12,"total_lines":840,...}
+//
+// "index" is the root's position among the listed roots. A root that cannot
+// be opened gets {"index":..,"target_path":..,"error":"..."} instead.
+//
+// Records are formatted into one buffer shared by the workers, under a lock,
+// and the buffer is written out whole: once it holds BATCH_FLUSH_BYTES, when
+// a record arrives BATCH_FLUSH_MS or more after the last write, and when the
+// batch ends. A slow trickle of roots therefore shows up record by record and
+// a fast stream costs one write per buffer.
+
+#define BATCH_FLUSH_BYTES (64 * 1024)
+#define BATCH_FLUSH_MS 100
+
+// Count the roots listed in `list_path` with `options`. Returns the exit
+// status: 0, or 1 if the list cannot be read or any root could not be opened.
+int run_batch(const char *list_path, const CountOptions *options);
+
+#endif // BATCH_H
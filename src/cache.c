@@ -0,0 +1,328 @@
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#define CACHE_MAGIC "CLCACHE\0"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t config;
+    uint64_t entry_count;
+    uint64_t index_slots;       // Power of two; index[i] = entry number + 1, 0 = empty
+    uint64_t checksum;          // Over the entries and the index
+    uint64_t reserved[2];
+} CacheHeader;
+
+struct CountCache {
+    char *path;
+    uint64_t config;
+    bool rebuild;
+    int64_t racy_after_ns;      // Files modified after this are not cached
+    const char *status;
+
+    void *map;
+    size_t map_size;
+    const CacheEntry *entries;
+    const uint32_t *index;
+    uint64_t entry_count;
+    uint64_t index_mask;
+};
+
+uint64_t count_cache_config(bool classic, uint64_t sniff) {
+    return language_tables_hash ^ (classic ? 0x636C61737369630AULL : 0) ^ ((uint64_t)sizeof(CacheEntry) << 56) ^ sniff;
+}
+
+static uint64_t mix_checksum(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+static uint64_t identity_hash(uint64_t dev, uint64_t ino) {
+    uint64_t h = (ino ^ ((dev << 32) | (dev >> 32))) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 31);
+}
+
+static bool same_identity(const CacheEntry *a, const CacheEntry *b) {
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+bool cache_entry_list_add(CacheEntryList *list, const CacheEntry *entry) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        CacheEntry *items = realloc(list->items, capacity * sizeof(CacheEntry));
+        if (!items) return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *entry;
+    return true;
+}
+
+void cache_entry_list_free(CacheEntryList *list) {
+    if (!list) return;
+    free(list->items);
+    list->items = NULL;
+    list->count = list->capacity = 0;
+}
+
+#ifdef _WIN32
+
+CountCache* count_cache_open(const char *path, uint64_t config, bool rebuild) {
+    (void)path; (void)config; (void)rebuild;
+    return NULL;
+}
+
+void count_cache_close(CountCache *cache) { (void)cache; }
+
+bool count_cache_key(const CountCache *cache, int dirfd, const char *name, LanguageId language, CacheEntry *key) {
+    (void)cache; (void)dirfd; (void)name; (void)language; (void)key;
+    return false;
+}
+
+const CacheEntry* count_cache_lookup(const CountCache *cache, const CacheEntry *key) {
+    (void)cache; (void)key;
+    return NULL;
+}
+
+bool count_cache_save(CountCache *cache, const CacheEntryList *lists, int list_count,
+                      unsigned long long misses, CacheStats *stats) {
+    (void)cache; (void)lists; (void)list_count; (void)misses; (void)stats;
+    return false;
+}
+
+#else
+
+#if defined(__APPLE__)
+    #define STAT_MTIME_NS(st) ((int64_t)(st).st_mtimespec.tv_sec * 1000000000LL + (st).st_mtimespec.tv_nsec)
+#else
+    #define STAT_MTIME_NS(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000LL + (st).st_mtim.tv_nsec)
+#endif
+
+// Check the mapped file; returns NULL if valid, otherwise the reason
+static const char* validate(CountCache *cache) {
+    if (cache->map_size < sizeof(CacheHeader)) return "truncated";
+
+    const CacheHeader *header = cache->map;
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0) return "not a cache file";
+    if (header->version != CACHE_VERSION || header->entry_size != sizeof(CacheEntry)) return "old format";
+    if (header->config != cache->config) return "counting rules changed";
+
+    uint64_t slots = header->index_slots;
+    uint64_t count = header->entry_count;
+    if (slots == 0 || (slots & (slots - 1)) != 0 || count >= slots) return "corrupt index";
+    if (count > (SIZE_MAX - sizeof(CacheHeader)) / sizeof(CacheEntry) / 2) return "corrupt header";
+    size_t body = (size_t)count * sizeof(CacheEntry) + (size_t)slots * sizeof(uint32_t);
+    if (cache->map_size != sizeof(CacheHeader) + body) return "truncated";
+
+    const unsigned char *data = (const unsigned char *)cache->map + sizeof(CacheHeader);
+    if (mix_checksum(header->config, data, body) != header->checksum) return "checksum mismatch";
+
+    cache->entries = (const CacheEntry *)data;
+    cache->index = (const uint32_t *)(data + count * sizeof(CacheEntry));
+    cache->entry_count = count;
+    cache->index_mask = slots - 1;
+    return NULL;
+}
+
+CountCache* count_cache_open(const char *path, uint64_t config, bool rebuild) {
+    if (!path) return NULL;
+    CountCache *cache = calloc(1, sizeof(CountCache));
+    if (!cache) return NULL;
+    cache->path = malloc(strlen(path) + 1);
+    if (!cache->path) {
+        free(cache);
+        return NULL;
+    }
+    strcpy(cache->path, path);
+    cache->config = config;
+    cache->rebuild = rebuild;
+    cache->status = rebuild ? "rebuilt" : "new";
+
+    // Like git's racy-clean check: a file modified in the last two seconds
+    // could change again without its size or timestamp changing
+    cache->racy_after_ns = ((int64_t)time(NULL) - 2) * 1000000000LL;
+
+    if (rebuild) return cache;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return cache;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            cache->map = map;
+            cache->map_size = (size_t)st.st_size;
+            const char *problem = validate(cache);
+            if (problem) {
+                fprintf(stderr, "Warning: ignoring cache %s: %s\n", path, problem);
+                munmap(map, cache->map_size);
+                cache->map = NULL;
+                cache->entries = NULL;
+                cache->index = NULL;
+                cache->entry_count = 0;
+                cache->status = problem;
+            } else {
+                cache->status = "loaded";
+            }
+        }
+    }
+    close(fd);
+    return cache;
+}
+
+void count_cache_close(CountCache *cache) {
+    if (!cache) return;
+    if (cache->map) munmap(cache->map, cache->map_size);
+    free(cache->path);
+    free(cache);
+}
+
+bool count_cache_key(const CountCache *cache, int dirfd, const char *name, LanguageId language, CacheEntry *key) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) != 0) return false;
+
+    memset(key, 0, sizeof(CacheEntry));
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+    key->size = (uint64_t)st.st_size;
+    key->mtime_ns = STAT_MTIME_NS(st);
+    key->language = (uint16_t)language;
+    return key->mtime_ns < cache->racy_after_ns;
+}
+
+const CacheEntry* count_cache_lookup(const CountCache *cache, const CacheEntry *key) {
+    if (!cache || cache->entry_count == 0) return NULL;
+
+    uint64_t slot = identity_hash(key->dev, key->ino) & cache->index_mask;
+    for (;;) {
+        uint32_t number = cache->index[slot];
+        if (number == 0 || number > cache->entry_count) return NULL;
+        const CacheEntry *entry = &cache->entries[number - 1];
+        if (same_identity(entry, key)) {
+            bool fresh = entry->size == key->size && entry->mtime_ns == key->mtime_ns &&
+                         entry->language == key->language;
+            return fresh ? entry : NULL;
+        }
+        slot = (slot + 1) & cache->index_mask;
+    }
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return false;
+        p += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+bool count_cache_save(CountCache *cache, const CacheEntryList *lists, int list_count,
+                      unsigned long long misses, CacheStats *stats) {
+    if (!cache) return false;
+
+    size_t total = 0;
+    for (int i = 0; i < list_count; i++) total += lists[i].count;
+    if (total >= UINT32_MAX / 2) return false;
+
+    uint64_t slots = 16;
+    while (slots < (uint64_t)total * 2) slots *= 2;
+
+    CacheEntry *entries = malloc((total ? total : 1) * sizeof(CacheEntry));
+    uint32_t *index = calloc((size_t)slots, sizeof(uint32_t));
+    if (!entries || !index) {
+        free(entries);
+        free(index);
+        return false;
+    }
+
+    // Dense entries in scan order; hard links seen twice are stored once
+    size_t count = 0;
+    for (int i = 0; i < list_count; i++) {
+        for (size_t k = 0; k < lists[i].count; k++) {
+            const CacheEntry *entry = &lists[i].items[k];
+            uint64_t slot = identity_hash(entry->dev, entry->ino) & (slots - 1);
+            while (index[slot] != 0 && !same_identity(&entries[index[slot] - 1], entry)) {
+                slot = (slot + 1) & (slots - 1);
+            }
+            if (index[slot] != 0) continue;
+            entries[count] = *entry;
+            index[slot] = (uint32_t)++count;
+        }
+    }
+
+    if (stats) {
+        stats->entries_loaded = cache->entry_count;
+        stats->status = cache->status;
+    }
+
+    // Every file was a hit and none disappeared: the file on disk is current
+    if (!cache->rebuild && cache->map && misses == 0 && count == cache->entry_count) {
+        free(entries);
+        free(index);
+        return true;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.entry_size = sizeof(CacheEntry);
+    header.config = cache->config;
+    header.entry_count = count;
+    header.index_slots = slots;
+    uint64_t checksum = mix_checksum(cache->config, entries, count * sizeof(CacheEntry));
+    header.checksum = mix_checksum(checksum, index, (size_t)slots * sizeof(uint32_t));
+
+    // Write next to the old file and rename over it, so readers never see a partial cache
+    size_t tmp_len = strlen(cache->path) + 32;
+    char *tmp_path = malloc(tmp_len);
+    bool ok = tmp_path != NULL;
+    if (ok) {
+        snprintf(tmp_path, tmp_len, "%s.tmp.%ld", cache->path, (long)getpid());
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        ok = fd >= 0;
+        if (ok) {
+            ok = write_all(fd, &header, sizeof(header)) &&
+                 write_all(fd, entries, count * sizeof(CacheEntry)) &&
+                 write_all(fd, index, (size_t)slots * sizeof(uint32_t));
+            ok = close(fd) == 0 && ok;
+            ok = ok && rename(tmp_path, cache->path) == 0;
+            if (!ok) unlink(tmp_path);
+        }
+        free(tmp_path);
+    }
+
+    if (stats) {
+        stats->written = ok;
+        stats->entries_written = ok ? count : 0;
+    }
+
+    free(entries);
+    free(index);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lexer.h"
+
+// Persistent per-file count cache.
+//
+// The cache file (CACHE_FILE_NAME in the scanned root) is a header followed by
+// a dense array of CacheEntry records and an open-addressed index of 32-bit
+// entry numbers. It is mapped read-only and looked up in place by every
+// worker. A file is a hit when its device, inode, size, nanosecond mtime and
+// language all match; a hit costs one fstatat and no read.
+//
+// Entries seen during a scan, hits and freshly counted files alike, are
+// collected per worker and written to a new file that atomically replaces
+// the old one, so deleted files drop out. Nothing is written when the tree
+// was unchanged. The header carries a magic, format version, a fingerprint of
+// the counting rules (see count_cache_config) and a checksum of the body;
+// a file failing any check is ignored and rebuilt.
+//
+// POSIX only: on Windows count_cache_open always returns NULL.
+
+#define CACHE_FILE_NAME ".countlines-cache"
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t lines;
+    uint32_t blank;
+    uint32_t comments;
+    uint16_t language;
+    uint16_t skipped;           // SniffReason the file was skipped for; 0 = counted
+} CacheEntry;
+
+// Entries collected by one worker during a scan
+typedef struct {
+    CacheEntry *items;
+    size_t count;
+    size_t capacity;
+} CacheEntryList;
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long entries_loaded;
+    unsigned long long entries_written;
+    bool written;
+    const char *status;     // "loaded", "new", "rebuilt" or why the old file was ignored
+} CacheStats;
+
+typedef struct CountCache CountCache;
+
+// Fingerprint of everything besides file identity that affects counts;
+// `sniff` is sniff_options_hash of the scan's sniff options, 0 without sniffing
+uint64_t count_cache_config(bool classic, uint64_t sniff);
+
+// Map the cache file at `path`; a missing or invalid file (or `rebuild`)
+// gives an empty cache that will be written from scratch
+CountCache* count_cache_open(const char *path, uint64_t config, bool rebuild);
+void count_cache_close(CountCache *cache);
+
+// Fill the identity fields of `key` for `name` relative to `dirfd`.
+// Returns false if the file cannot be stat'ed or is too recent to be cached
+// safely (it could still change within the mtime granularity).
+bool count_cache_key(const CountCache *cache, int dirfd, const char *name, LanguageId language, CacheEntry *key);
+
+// The cached entry with the same identity as `key`, or NULL
+const CacheEntry* count_cache_lookup(const CountCache *cache, const CacheEntry *key);
+
+bool cache_entry_list_add(CacheEntryList *list, const CacheEntry *entry);
+void cache_entry_list_free(CacheEntryList *list);
+
+// Write the collected entries unless nothing changed since the file was loaded
+bool count_cache_save(CountCache *cache, const CacheEntryList *lists, int list_count,
+                      unsigned long long misses, CacheStats *stats);
+
+#endif // CACHE_H
@@ -0,0 +1,251 @@
+#include "classifier.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define CLASSIFIER_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define CLASSIFIER_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+    static inline int lowest_bit(uint64_t mask) {
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (int)index;
+    }
+    #define cl_getc(f) _fgetc_nolock(f)
+#else
+    #define lowest_bit(mask) __builtin_ctzll(mask)
+    #define cl_getc(f) getc_unlocked(f)
+#endif
+
+// The classifier works on 64-byte blocks. For each block it builds two
+// bitmasks: bytes that can change the comment state or end a line ('\n',
+// '/', '*') and bytes that are not whitespace. Only bytes selected by the
+// masks are run through the state machine; everything else provably leaves
+// the state unchanged, so long runs of code or comment text are skipped a
+// block at a time.
+#define BLOCK_SIZE 64
+
+static inline bool is_blank_char(unsigned char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+#if defined(CLASSIFIER_AVX2)
+
+static inline void build_masks(const unsigned char *p, uint64_t *special, uint64_t *blank) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    uint64_t sp = 0, bl = 0;
+    for (int k = 0; k < 2; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + k * 32));
+        __m256i is_nl = _mm256_cmpeq_epi8(v, nl);
+        __m256i s = _mm256_or_si256(is_nl, _mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(v, star)));
+        __m256i w = _mm256_or_si256(is_nl, _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr))));
+        sp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (k * 32);
+        bl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(w) << (k * 32);
+    }
+    *special = sp;
+    *blank = bl;
+}
+
+#elif defined(CLASSIFIER_SSE2)
+
+static inline void build_masks(const unsigned char *p, uint64_t *special, uint64_t *blank) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    uint64_t sp = 0, bl = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + k * 16));
+        __m128i is_nl = _mm_cmpeq_epi8(v, nl);
+        __m128i s = _mm_or_si128(is_nl, _mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(v, star)));
+        __m128i w = _mm_or_si128(is_nl, _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr))));
+        sp |= (uint64_t)(uint32_t)_mm_movemask_epi8(s) << (k * 16);
+        bl |= (uint64_t)(uint32_t)_mm_movemask_epi8(w) << (k * 16);
+    }
+    *special = sp;
+    *blank = bl;
+}
+
+#else
+
+static inline void build_masks(const unsigned char *p, uint64_t *special, uint64_t *blank) {
+    uint64_t sp = 0, bl = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        unsigned char ch = p[i];
+        sp |= (uint64_t)(ch == '\n' || ch == '/' || ch == '*') << i;
+        bl |= (uint64_t)is_blank_char(ch) << i;
+    }
+    *special = sp;
+    *blank = bl;
+}
+
+#endif
+
+const char* classifier_backend_name(void) {
+#if defined(CLASSIFIER_AVX2)
+    return "avx2";
+#elif defined(CLASSIFIER_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void classifier_init(LineClassifier *c) {
+    memset(c, 0, sizeof(LineClassifier));
+    c->prev = '\n';
+}
+
+static inline void end_of_line(LineClassifier *c) {
+    c->lines++;
+    if (!c->line_has_code && !c->in_line_comment && !c->in_block_comment) {
+        c->blank++;
+    } else if (c->in_line_comment || c->in_block_comment) {
+        c->comments++;
+    }
+    c->in_line_comment = false;
+    c->line_has_code = false;
+}
+
+// One transition of the original per-character state machine
+static inline void step(LineClassifier *c, unsigned char prev, unsigned char ch) {
+    if (prev == '/' && ch == '/' && !c->in_block_comment) {
+        c->in_line_comment = true;
+    }
+    if (prev == '/' && ch == '*' && !c->in_line_comment) {
+        c->in_block_comment = true;
+    }
+    if (prev == '*' && ch == '/' && c->in_block_comment) {
+        c->in_block_comment = false;
+        return;
+    }
+    if (!c->in_line_comment && !c->in_block_comment && !is_blank_char(ch)) {
+        c->line_has_code = true;
+    }
+    if (ch == '\n') {
+        end_of_line(c);
+    }
+}
+
+// Non-blank bytes only matter until the line is known to contain code
+static inline bool wants_code_bytes(const LineClassifier *c) {
+    return !c->in_line_comment && !c->in_block_comment && !c->line_has_code;
+}
+
+void classifier_feed(LineClassifier *c, const unsigned char *data, size_t len) {
+    if (len == 0) return;
+
+    unsigned char carried_prev = c->prev;
+    size_t i = 0;
+
+    for (; i + BLOCK_SIZE <= len; i += BLOCK_SIZE) {
+        uint64_t special, blank;
+        build_masks(data + i, &special, &blank);
+        uint64_t code = ~blank;
+
+        uint64_t mask = special | (wants_code_bytes(c) ? code : 0);
+        while (mask) {
+            int bit = lowest_bit(mask);
+            size_t pos = i + bit;
+            step(c, pos > 0 ? data[pos - 1] : carried_prev, data[pos]);
+
+            uint64_t rest = bit == BLOCK_SIZE - 1 ? 0 : ~0ULL << (bit + 1);
+            mask = (special | (wants_code_bytes(c) ? code : 0)) & rest;
+        }
+    }
+
+    for (; i < len; i++) {
+        step(c, i > 0 ? data[i - 1] : carried_prev, data[i]);
+    }
+
+    c->prev = data[len - 1];
+}
+
+void classifier_finish(LineClassifier *c) {
+    // Handle input not ending with newline
+    if (c->prev != '\n') {
+        end_of_line(c);
+        c->prev = '\n';
+    }
+}
+
+void classify_stream_reference(FILE *file, LineClassifier *c) {
+    unsigned long long lines = 0;
+    unsigned long long blank = 0;
+    unsigned long long comments = 0;
+    int ch, prev_ch = '\n';
+    bool in_line_comment = false;
+    bool in_block_comment = false;
+    bool line_has_code = false;
+
+    while ((ch = cl_getc(file)) != EOF) {
+        // Handle line comments (// style)
+        if (prev_ch == '/' && ch == '/' && !in_block_comment) {
+            in_line_comment = true;
+        }
+
+        // Handle block comments (/* style)
+        if (prev_ch == '/' && ch == '*' && !in_line_comment) {
+            in_block_comment = true;
+        }
+
+        // End block comment
+        if (prev_ch == '*' && ch == '/' && in_block_comment) {
+            in_block_comment = false;
+            prev_ch = ch;
+            continue;
+        }
+
+        // Check if character is code (not whitespace or comment)
+        if (!in_line_comment && !in_block_comment && ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n') {
+            line_has_code = true;
+        }
+
+        // Handle end of line
+        if (ch == '\n') {
+            lines++;
+            if (!line_has_code && !in_line_comment && !in_block_comment) {
+                blank++;
+            } else if (in_line_comment || in_block_comment) {
+                comments++;
+            }
+
+            in_line_comment = false;
+            line_has_code = false;
+        }
+
+        prev_ch = ch;
+    }
+
+    // Handle file not ending with newline
+    if (prev_ch != '\n' && prev_ch != EOF) {
+        lines++;
+        if (!line_has_code && !in_line_comment && !in_block_comment) {
+            blank++;
+        } else if (in_line_comment || in_block_comment) {
+            comments++;
+        }
+    }
+
+    classifier_init(c);
+    c->lines = lines;
+    c->blank = blank;
+    c->comments = comments;
+}
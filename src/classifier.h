@@ -0,0 +1,33 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bytes read per block by the block-buffered file readers
+#define CLASSIFIER_CHUNK_SIZE 65536
+
+// Streaming blank/comment/code line classifier for C-style comments.
+// Feed any number of blocks, then call classifier_finish once.
+typedef struct {
+    unsigned long long lines;
+    unsigned long long blank;
+    unsigned long long comments;
+    unsigned char prev;         // Last byte fed so far ('\n' before any input)
+    bool in_line_comment;
+    bool in_block_comment;
+    bool line_has_code;
+} LineClassifier;
+
+void classifier_init(LineClassifier *c);
+void classifier_feed(LineClassifier *c, const unsigned char *data, size_t len);
+void classifier_finish(LineClassifier *c);
+
+// Name of the vector instruction set the classifier was built for
+const char* classifier_backend_name(void);
+
+// The original fgetc state machine, kept as the reference for self-check mode
+void classify_stream_reference(FILE *file, LineClassifier *c);
+
+#endif // CLASSIFIER_H
@@ -1,4 +1,6 @@
 #include "countlines.h"
+#include "classifier.h"
+#include "uring.h"
 
 // Create and initialize exclude list
 ExcludeList* create_exclude_list(void) {
@@ -13,6 +15,7 @@ ExcludeList* create_exclude_list(void) {
     }
     
     list->count = 0;
+    list->matcher = NULL;
     return list;
 }
 
@@ -31,6 +34,8 @@ void add_exclude_pattern(ExcludeList *list, const char *pattern) {
     if (list->patterns[list->count]) {
         strcpy(list->patterns[list->count], pattern);
         list->count++;
+        exclude_matcher_free(list->matcher);
+        list->matcher = exclude_matcher_create(list->patterns, list->count);
     }
 }
 
@@ -42,223 +47,236 @@ void free_exclude_list(ExcludeList *list) {
         free(list->patterns[i]);
     }
     free(list->patterns);
+    exclude_matcher_free(list->matcher);
     free(list);
 }
 
-// Check if path matches any exclusion pattern
+// Check if a path relative to the scanned root matches any exclusion pattern,
+// with the list's compiled matcher. Scans match one path component at a time
+// instead.
 bool is_excluded(const char *path, const ExcludeList *exclude_list) {
-    if (!path || !exclude_list) return false;
-    
-    for (int i = 0; i < exclude_list->count; i++) {
-        if (strstr(path, exclude_list->patterns[i]) != NULL) {
-            return true;
-        }
-    }
-    return false;
+    if (!path || !exclude_list || !exclude_list->matcher) return false;
+    return exclude_matcher_match_path(exclude_list->matcher, path, true);
 }
 
-// Check if file is likely a text file based on extension
 bool is_text_file(const char *filename) {
-    if (!filename) return false;
-    
-    const char *ext = strrchr(filename, '.');
-    if (!ext) return false;
-    
-    // Common text file extensions
-    const char *text_extensions[] = {
-        ".c", ".cpp", ".cc", ".cxx", ".c++",
-        ".h", ".hpp", ".hh", ".hxx", ".h++",
-        ".java", ".js", ".ts", ".jsx", ".tsx",
-        ".py", ".rb", ".php", ".go", ".rs",
-        ".cs", ".vb", ".fs", ".swift", ".kt",
-        ".scala", ".clj", ".hs", ".ml", ".r",
-        ".sql", ".html", ".htm", ".xml", ".css",
-        ".scss", ".sass", ".less", ".json", ".yaml",
-        ".yml", ".toml", ".ini", ".cfg", ".conf",
-        ".txt", ".md", ".rst", ".tex", ".sh",
-        ".bash", ".zsh", ".fish", ".ps1", ".bat",
-        ".cmd", ".vim", ".el", ".lua", ".perl",
-        ".pl", ".tcl", ".awk", ".sed", ".m",
-        ".mm", ".f", ".f90", ".f95", ".pas",
-        ".ada", ".d", ".dart", ".elm", ".ex",
-        ".exs", ".erl", ".hrl", ".jl", ".nim",
-        ".v", ".vhd", ".vhdl", ".sv", ".svh",
-        NULL
-    };
-    
-    for (int i = 0; text_extensions[i]; i++) {
-        if (strcmp(ext, text_extensions[i]) == 0) {
-            return true;
-        }
-    }
-    
-    return false;
+    return language_from_filename(filename) != LANG_UNKNOWN;
 }
 
-// Count lines in a single file
-unsigned long long count_lines_in_file(const char *filepath, CountResult *result) {
-    FILE *file = fopen(filepath, "r");
-    if (!file) return 0;
-    
-    unsigned long long lines = 0;
-    unsigned long long blank = 0;
-    unsigned long long comments = 0;
-    int ch, prev_ch = '\n';
-    bool in_line_comment = false;
-    bool in_block_comment = false;
-    bool line_has_code = false;
-    
-    while ((ch = fgetc(file)) != EOF) {
-        // Handle line comments (// style)
-        if (prev_ch == '/' && ch == '/' && !in_block_comment) {
-            in_line_comment = true;
-        }
-        
-        // Handle block comments (/* style)
-        if (prev_ch == '/' && ch == '*' && !in_line_comment) {
-            in_block_comment = true;
-        }
-        
-        // End block comment
-        if (prev_ch == '*' && ch == '/' && in_block_comment) {
-            in_block_comment = false;
-            prev_ch = ch;
-            continue;
-        }
-        
-        // Check if character is code (not whitespace or comment)
-        if (!in_line_comment && !in_block_comment && ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n') {
-            line_has_code = true;
-        }
-        
-        // Handle end of line
-        if (ch == '\n') {
-            lines++;
-            if (!line_has_code && !in_line_comment && !in_block_comment) {
-                blank++;
-            } else if (in_line_comment || in_block_comment) {
-                comments++;
-            }
-            
-            in_line_comment = false;
-            line_has_code = false;
-        }
-        
-        prev_ch = ch;
+static void add_file_counts(CountResult *result, unsigned long long lines, unsigned long long blank, unsigned long long comments) {
+    if (!result) return;
+    result->total_files++;
+    result->blank_lines += blank;
+    result->comment_lines += comments;
+    result->code_lines += (lines - blank - comments);
+}
+
+void file_counter_init(FileCounter *counter, LanguageId language, bool classic) {
+    counter->classic = classic;
+    if (classic) {
+        classifier_init(&counter->classifier);
+    } else {
+        lexer_init(&counter->lexer, language);
     }
-    
-    // Handle file not ending with newline
-    if (prev_ch != '\n' && prev_ch != EOF) {
-        lines++;
-        if (!line_has_code && !in_line_comment && !in_block_comment) {
-            blank++;
-        } else if (in_line_comment || in_block_comment) {
-            comments++;
-        }
+}
+
+void file_counter_feed(void *ctx, const unsigned char *data, size_t len) {
+    FileCounter *counter = ctx;
+    if (counter->classic) {
+        classifier_feed(&counter->classifier, data, len);
+    } else {
+        lexer_feed(&counter->lexer, data, len);
     }
-    
-    fclose(file);
-    
-    if (result) {
-        result->total_files++;
-        result->blank_lines += blank;
-        result->comment_lines += comments;
-        result->code_lines += (lines - blank - comments);
+}
+
+// Add the file's blank/comment/code lines to result; returns its total lines
+unsigned long long file_counter_finish(FileCounter *counter, CountResult *result) {
+    unsigned long long lines, blank, comments;
+    if (counter->classic) {
+        classifier_finish(&counter->classifier);
+        lines = counter->classifier.lines;
+        blank = counter->classifier.blank;
+        comments = counter->classifier.comments;
+    } else {
+        lexer_finish(&counter->lexer, &lines, &blank, &comments);
     }
+    add_file_counts(result, lines, blank, comments);
+    return lines;
+}
+
+// Count lines in a file with the language's lexer; `name` is relative to `dirfd`
+unsigned long long count_lines_at(FileReader *reader, int dirfd, const char *name, LanguageId language, CountResult *result) {
+    FileCounter counter;
+    file_counter_init(&counter, language, false);
+    if (!file_reader_read_at(reader, dirfd, name, file_counter_feed, &counter)) return 0;
+    return file_counter_finish(&counter, result);
+}
+
+// Count lines in a file with the original C-style rules; `name` is relative to `dirfd`
+unsigned long long count_lines_classic_at(FileReader *reader, int dirfd, const char *name, CountResult *result) {
+    FileCounter counter;
+    file_counter_init(&counter, LANG_UNKNOWN, true);
+    if (!file_reader_read_at(reader, dirfd, name, file_counter_feed, &counter)) return 0;
+    return file_counter_finish(&counter, result);
+}
+
+// Count lines in a single file with the language's lexer, reusing the reader's buffer
+unsigned long long count_lines_with_reader(FileReader *reader, const char *filepath, LanguageId language, CountResult *result) {
+    return count_lines_at(reader, CWD_FD, filepath, language, result);
+}
+
+// Count lines in a single file with the original C-style rules
+unsigned long long count_lines_classic_with_reader(FileReader *reader, const char *filepath, CountResult *result) {
+    return count_lines_classic_at(reader, CWD_FD, filepath, result);
+}
+
+// Count lines in a single file
+unsigned long long count_lines_in_file(const char *filepath, CountResult *result) {
+    FileReader reader;
+    if (!file_reader_init(&reader, IO_AUTO)) return 0;
     
+    const char *name = strrchr(filepath, PATH_SEPARATOR);
+    LanguageId language = language_from_filename(name ? name + 1 : filepath);
+    unsigned long long lines = count_lines_with_reader(&reader, filepath, language, result);
+    file_reader_free(&reader);
     return lines;
 }
 
-// Recursively count lines in directory
-void count_lines_in_directory(const char *dirpath, const ExcludeList *exclude_list, CountResult *result) {
-    if (!dirpath || !result) return;
+static bool report_mismatch(const char *filepath, const char *what,
+                            unsigned long long ref_lines, unsigned long long ref_blank, unsigned long long ref_comments,
+                            unsigned long long lines, unsigned long long blank, unsigned long long comments) {
+    if (lines == ref_lines && blank == ref_blank && comments == ref_comments) return true;
     
-    if (is_excluded(dirpath, exclude_list)) {
-        return;
-    }
+    fprintf(stderr, "MISMATCH %s (%s): reference %llu/%llu/%llu, fast path %llu/%llu/%llu (lines/blank/comment)\n",
+            filepath, what, ref_lines, ref_blank, ref_comments, lines, blank, comments);
+    return false;
+}
+
+// Compare the fast paths against their reference implementations for one file:
+// the SIMD-skipping lexer against a plain table walk, and the block classifier
+// used by --classic against the original fgetc state machine
+bool self_check_file(const char *filepath, LanguageId language, CountResult *result) {
+    FILE *file = fopen(filepath, "rb");
+    if (!file) return true;
     
-#ifdef _WIN32
-    char search_path[MAX_PATH_LEN];
-    snprintf(search_path, sizeof(search_path), "%s\\*", dirpath);
+    // The second fast instance of each pair gets odd-sized pieces, so the
+    // carry of state across block boundaries is exercised on real input
+    const size_t odd_block = 4093;
+    unsigned char buffer[CLASSIFIER_CHUNK_SIZE];
+    Lexer lex_ref, lex_fast, lex_odd;
+    LineClassifier classic_ref, classic_fast, classic_odd;
+    lexer_init(&lex_ref, language);
+    lexer_init(&lex_fast, language);
+    lexer_init(&lex_odd, language);
+    classifier_init(&classic_fast);
+    classifier_init(&classic_odd);
     
-    WIN32_FIND_DATA find_data;
-    HANDLE hFind = FindFirstFile(search_path, &find_data);
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        lexer_feed_reference(&lex_ref, buffer, bytes_read);
+        lexer_feed(&lex_fast, buffer, bytes_read);
+        classifier_feed(&classic_fast, buffer, bytes_read);
+        for (size_t off = 0; off < bytes_read; off += odd_block) {
+            size_t piece = bytes_read - off < odd_block ? bytes_read - off : odd_block;
+            lexer_feed(&lex_odd, buffer + off, piece);
+            classifier_feed(&classic_odd, buffer + off, piece);
+        }
+    }
+    classifier_finish(&classic_fast);
+    classifier_finish(&classic_odd);
     
-    if (hFind == INVALID_HANDLE_VALUE) return;
+    rewind(file);
+    classify_stream_reference(file, &classic_ref);
+    fclose(file);
     
-    do {
-        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
-            continue;
-        }
-        
-        char full_path[MAX_PATH_LEN];
-        snprintf(full_path, sizeof(full_path), "%s\\%s", dirpath, find_data.cFileName);
-        
-        if (is_excluded(full_path, exclude_list)) {
-            continue;
-        }
-        
-        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            count_lines_in_directory(full_path, exclude_list, result);
-        } else if (is_text_file(find_data.cFileName)) {
-            unsigned long long file_lines = count_lines_in_file(full_path, result);
-            result->total_lines += file_lines;
-        }
-    } while (FindNextFile(hFind, &find_data));
+    unsigned long long lines, blank, comments, ref_lines, ref_blank, ref_comments;
+    lexer_finish(&lex_ref, &ref_lines, &ref_blank, &ref_comments);
     
-    FindClose(hFind);
-#else
-    DIR *dir = opendir(dirpath);
-    if (!dir) return;
+    bool match = true;
+    lexer_finish(&lex_fast, &lines, &blank, &comments);
+    match = report_mismatch(filepath, "lexer", ref_lines, ref_blank, ref_comments, lines, blank, comments) && match;
+    lexer_finish(&lex_odd, &lines, &blank, &comments);
+    match = report_mismatch(filepath, "lexer, odd blocks", ref_lines, ref_blank, ref_comments, lines, blank, comments) && match;
+    match = report_mismatch(filepath, "classic", classic_ref.lines, classic_ref.blank, classic_ref.comments,
+                            classic_fast.lines, classic_fast.blank, classic_fast.comments) && match;
+    match = report_mismatch(filepath, "classic, odd blocks", classic_ref.lines, classic_ref.blank, classic_ref.comments,
+                            classic_odd.lines, classic_odd.blank, classic_odd.comments) && match;
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        char full_path[MAX_PATH_LEN];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dirpath, entry->d_name);
-        
-        if (is_excluded(full_path, exclude_list)) {
-            continue;
-        }
-        
-        struct stat file_stat;
-        if (stat(full_path, &file_stat) == 0) {
-            if (S_ISDIR(file_stat.st_mode)) {
-                count_lines_in_directory(full_path, exclude_list, result);
-            } else if (S_ISREG(file_stat.st_mode) && is_text_file(entry->d_name)) {
-                unsigned long long file_lines = count_lines_in_file(full_path, result);
-                result->total_lines += file_lines;
-            }
-        }
-    }
+    add_file_counts(result, ref_lines, ref_blank, ref_comments);
+    if (result) result->total_lines += ref_lines;
     
-    closedir(dir);
-#endif
+    return match;
 }
 
 // Print usage information
 void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS] <directory>\n", program_name);
-    printf("   or: %s --web [PORT]\n", program_name);
+    printf("   or: %s --tar [OPTIONS] <archive.tar | ->\n", program_name);
+    printf("   or: %s --batch <roots.txt | -> [OPTIONS]\n", program_name);
+    printf("   or: %s --coordinate ADDRESS [--coordinate ADDRESS ...] [OPTIONS] <directory>\n", program_name);
+    printf("   or: %s --worker ADDRESS [-j N] [--io MODE] [--verbose]\n", program_name);
+    printf("   or: %s --web [PORT] [WEB OPTIONS]\n", program_name);
     printf("\nA high-performance CLI tool for counting lines of code in projects.\n");
     printf("\nOptions:\n");
-    printf("  -e, --exclude DIR     Exclude directory or pattern (can be used multiple times)\n");
+    printf("  -e, --exclude PATTERN Exclude matching files/directories (can be used multiple times);\n");
+    printf("                        globs like '*.min.js', '**/build/', '/out' (anchored)\n");
+    printf("  -j, --jobs N          Use N worker threads (default: 1, 0 = one per CPU)\n");
+    printf("      --io MODE         File I/O backend: auto, read, mmap, direct or uring (reports MB/s)\n");
+    printf("      --io-depth N      Files in flight per thread with --io uring (default: %d)\n", URING_DEFAULT_DEPTH);
+    printf("      --max-open-dirs N Directory handles kept open for queued entries (default: half of\n");
+    printf("                        the descriptor limit); past it, files are counted as listed\n");
+    printf("  -b, --breakdown       Also show totals per language and per top-level directory\n");
+    printf("      --git             Count only the files tracked in the git index (no directory walk)\n");
+    printf("      --tar             The target is a tar archive, or - for standard input; count it\n");
+    printf("                        without extracting (pipe compressed archives through gzip -dc)\n");
+    printf("      --sniff           Skip binary files, minified files (lines over %d bytes) and\n", SNIFF_DEFAULT_MAX_LINE);
+    printf("                        generated files (\"@generated\", \"DO NOT EDIT\", ...) on their first block\n");
+    printf("      --max-size SIZE   Also skip files over SIZE bytes, e.g. 512K or 2M (implies --sniff)\n");
+    printf("      --max-line N      Longest line --sniff allows (default: %d, 0 = no limit)\n", SNIFF_DEFAULT_MAX_LINE);
+    printf("      --generated-marker TEXT  Also skip files with TEXT near the top as generated\n");
+    printf("                        (implies --sniff; can be used multiple times)\n");
+    printf("      --verbose         List every file with its line count, or why it was skipped\n");
+    printf("      --dedupe          Count files with identical contents once and report the copies\n");
+    printf("      --batch FILE      Count every root listed in FILE (one per line, - for standard input)\n");
+    printf("                        on one thread pool; print one JSON line per root as it finishes\n");
+    printf("      --worker ADDRESS  Serve shards of trees to coordinators on HOST:PORT, PORT or unix:PATH\n");
+    printf("      --coordinate ADDRESS  Split the tree by top-level directory among the worker at\n");
+    printf("                        ADDRESS and the others given (can be used multiple times)\n");
+    printf("      --watch           Keep running and print updated totals whenever files change (Linux)\n");
+    printf("      --profile[=N]     Show wall and CPU time per phase, latency histograms and the\n");
+    printf("                        N slowest files and directories (default: %d)\n", PROFILE_DEFAULT_SLOWEST);
+    printf("      --ext .EXT=LANG   Count files with extension .EXT as LANG (e.g. --ext .proto=c)\n");
+    printf("      --cache           Reuse per-file counts from " CACHE_FILE_NAME " in the scanned\n");
+    printf("                        directory, and write it there\n");
+    printf("      --no-cache        Do not read or write the cache file (the default)\n");
+    printf("      --rebuild-cache   Ignore the existing cache, recount every file and write it anew\n");
+    printf("      --classic         Use the original C-style comment rules for every file\n");
+    printf("      --self-check      Verify the fast lexer and classifier against their references\n");
     printf("  -h, --help           Show this help message\n");
     printf("  -v, --version        Show version information\n");
     printf("  -w, --web [PORT]     Start web server mode (default port: 8080)\n");
+    printf("\nWeb options:\n");
+    printf("      --backlog N       Listen backlog (default: 128)\n");
+    printf("      --web-workers N   Concurrent /api/count scans (default: 4, 0 = one per CPU)\n");
+    printf("      --web-queue N     Scans that may wait for a worker before 503 (default: 16)\n");
+    printf("      --web-cache-ttl N Reuse /api/count results for up to N seconds (default: 300, 0 = off)\n");
     printf("\nExamples:\n");
     printf("  %s /path/to/project\n", program_name);
     printf("  %s -e node_modules -e .git /path/to/project\n", program_name);
     printf("  %s --exclude=build --exclude=dist /path/to/project\n", program_name);
+    printf("  %s -j 8 /path/to/project\n", program_name);
+    printf("  %s --ext .proto=c --ext .inc=php /path/to/project\n", program_name);
+    printf("  %s --batch roots.txt -j 0 > counts.ndjson\n", program_name);
+    printf("  %s --worker 7070 -j 0                            # on each machine\n", program_name);
+    printf("  %s --coordinate host1:7070 --coordinate host2:7070 /shared/project\n", program_name);
     printf("  %s --web              # Start web server on port 8080\n", program_name);
     printf("  %s --web 3000         # Start web server on port 3000\n", program_name);
+    printf("  %s --web --web-workers 8 --backlog 1024\n", program_name);
     printf("\nSupported file types:\n");
     printf("  C/C++, Java, JavaScript, TypeScript, Python, Ruby, PHP, Go, Rust,\n");
     printf("  C#, Visual Basic, F#, Swift, Kotlin, Scala, HTML, CSS, JSON, YAML,\n");
-    printf("  Shell scripts, and many more text-based source files.\n");
+    printf("  Shell scripts, and many more text-based source files. Comments and\n");
+    printf("  string literals are recognised with each language's own syntax.\n");
 }
 
 // Print counting results
@@ -281,4 +299,68 @@ void print_results(const CountResult *result, const char *target_path) {
         printf("Comments: %.1f%%\n", comment_ratio);
         printf("Blank:    %.1f%%\n", blank_ratio);
     }
-}
\ No newline at end of file
+}
+
+// Print what a deduplicated scan left out, and the totals with the copies
+void print_dedupe_stats(const DedupeStats *stats, const CountResult *result) {
+    printf("\nDuplicates: %llu files, %.1f MB left out (%llu lines)\n", stats->files,
+           stats->bytes / (1024.0 * 1024.0), stats->counts.total_lines);
+    printf("With duplicates: %llu files, %llu lines (%llu code, %llu comments, %llu blank)\n",
+           result->total_files + stats->counts.total_files, result->total_lines + stats->counts.total_lines,
+           result->code_lines + stats->counts.code_lines, result->comment_lines + stats->counts.comment_lines,
+           result->blank_lines + stats->counts.blank_lines);
+}
+
+static void print_breakdown_table(const char *title, const BreakdownEntry *entries, int count,
+                                  unsigned long long total_lines) {
+    printf("\n%s:\n", title);
+    printf("  %-24s %10s %12s %12s %12s %12s %7s\n", "Name", "Files", "Lines", "Code", "Comments", "Blank", "Share");
+    for (int i = 0; i < count; i++) {
+        const CountResult *r = &entries[i].result;
+        double share = total_lines > 0 ? (double)r->total_lines / total_lines * 100.0 : 0.0;
+        printf("  %-24s %10llu %12llu %12llu %12llu %12llu %6.1f%%\n", entries[i].name, r->total_files,
+               r->total_lines, r->code_lines, r->comment_lines, r->blank_lines, share);
+    }
+}
+
+// Print per-language and per-top-level-directory totals
+void print_breakdown(const CountBreakdown *breakdown) {
+    unsigned long long total_lines = 0;
+    for (int i = 0; i < breakdown->language_count; i++) {
+        total_lines += breakdown->languages[i].result.total_lines;
+    }
+    print_breakdown_table("By language", breakdown->languages, breakdown->language_count, total_lines);
+    print_breakdown_table("By directory", breakdown->directories, breakdown->directory_count, total_lines);
+}
+
+bool copy_count_breakdown(CountBreakdown *dst, const CountBreakdown *src) {
+    memset(dst, 0, sizeof(CountBreakdown));
+    if (!src->languages) return true;
+
+    dst->languages = malloc(sizeof(BreakdownEntry) * (src->language_count + 1));
+    dst->directories = malloc(sizeof(BreakdownEntry) * (src->directory_count + 1));
+    dst->names = malloc(src->names_size + 1);
+    if (!dst->languages || !dst->directories || !dst->names) {
+        free_count_breakdown(dst);
+        return false;
+    }
+    memcpy(dst->languages, src->languages, sizeof(BreakdownEntry) * src->language_count);
+    memcpy(dst->directories, src->directories, sizeof(BreakdownEntry) * src->directory_count);
+    memcpy(dst->names, src->names, src->names_size);
+    dst->language_count = src->language_count;
+    dst->directory_count = src->directory_count;
+    dst->names_size = src->names_size;
+    // Directory names point into the copied storage
+    for (int i = 0; i < dst->directory_count; i++) {
+        dst->directories[i].name = dst->names + (src->directories[i].name - src->names);
+    }
+    return true;
+}
+
+void free_count_breakdown(CountBreakdown *breakdown) {
+    if (!breakdown) return;
+    free(breakdown->languages);
+    free(breakdown->directories);
+    free(breakdown->names);
+    memset(breakdown, 0, sizeof(CountBreakdown));
+}
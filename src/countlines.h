@@ -5,6 +5,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include "fileio.h"
+#include "classifier.h"
+#include "lexer.h"
+#include "exclude.h"
+#include "cache.h"
+#include "gitindex.h"
 
 // Platform-specific includes
 #ifdef _WIN32
@@ -12,12 +18,15 @@
     #include <io.h>
     #define PATH_SEPARATOR '\\'
     #define PATH_SEPARATOR_STR "\\"
+    #define CWD_FD -1       // No directory descriptors; *_at paths are cwd-relative
 #else
     #include <dirent.h>
+    #include <fcntl.h>
     #include <sys/stat.h>
     #include <unistd.h>
     #define PATH_SEPARATOR '/'
     #define PATH_SEPARATOR_STR "/"
+    #define CWD_FD AT_FDCWD
 #endif
 
 // Maximum path length
@@ -29,6 +38,7 @@ typedef struct {
     char **patterns;
     int count;
     int capacity;
+    ExcludeMatcher *matcher;    // The patterns compiled for is_excluded, rebuilt as they are added
 } ExcludeList;
 
 // Structure to hold counting results
@@ -40,6 +50,131 @@ typedef struct {
     unsigned long long code_lines;
 } CountResult;
 
+// Top-level directories tracked separately by a breakdown; files below any
+// further ones are summed under "(other)"
+#define BREAKDOWN_MAX_DIRECTORIES 1024
+
+// Totals of one language or one top-level directory
+typedef struct {
+    const char *name;
+    CountResult result;
+} BreakdownEntry;
+
+// Per-language and per-top-level-directory totals of a scan, each sorted by
+// total lines, largest first. Files directly in the scanned directory are
+// listed under ".". Release with free_count_breakdown.
+typedef struct {
+    BreakdownEntry *languages;
+    int language_count;
+    BreakdownEntry *directories;
+    int directory_count;
+    char *names;                // Storage for the directory names
+    size_t names_size;
+} CountBreakdown;
+
+// Files left out of a deduplicated scan's totals as copies of files counted
+// already, with the lines they would have added
+typedef struct {
+    unsigned long long files;
+    unsigned long long bytes;
+    CountResult counts;
+} DedupeStats;
+
+// Called for every directory a scan opens, on the worker thread that opened
+// it, before its entries are read. `dir_fd` is the open directory (CWD_FD on
+// Windows) and `path` its full path.
+typedef void (*DirectoryVisitor)(void *ctx, int dir_fd, const char *path);
+
+// Called for every file once it has been counted (or answered from the
+// cache), on the worker thread that counted it, with its directory's full
+// path and its own name
+typedef void (*FileVisitor)(void *ctx, const char *dir_path, const char *name,
+                            LanguageId language, const CountResult *counts);
+
+// Called for every file sniffing turned down instead of counting it, on the
+// worker thread that read it; see sniff.h
+typedef void (*SkipVisitor)(void *ctx, const char *dir_path, const char *name,
+                            LanguageId language, const SniffVerdict *verdict);
+
+// Called for every file a scan would count, before it is read, on the
+// worker thread listing its directory; returning false leaves the file out
+typedef bool (*FileFilter)(void *ctx, const char *dir_path, const char *name, LanguageId language);
+
+// Running totals of a scan in progress
+typedef struct {
+    CountResult totals;
+    unsigned long long directories;
+    double elapsed;                 // Seconds since the scan started
+    const char *current_directory;  // Valid during the callback only
+} ScanProgress;
+
+// Called about every progress_interval_ms from one worker thread at a time
+typedef void (*ProgressCallback)(void *ctx, const ScanProgress *progress);
+
+// One root of a batch scan, once everything below it has been counted
+typedef struct {
+    const char *path;
+    int index;                      // Position in the list of roots
+    bool ok;                        // false if the root could not be opened
+    CountResult totals;
+    unsigned long long directories;
+    SniffStats skipped;             // Files turned down, with options->sniff
+    double elapsed;                 // Seconds from the start of the batch until the root finished
+} BatchRoot;
+
+// Called once per root of a batch as soon as its last file is done, on the
+// worker thread that finished it; calls for different roots may overlap
+typedef void (*BatchVisitor)(void *ctx, const BatchRoot *root);
+
+// Options controlling a directory scan
+typedef struct {
+    const ExcludeList *exclude_list;
+    const char *exclude_base;   // Optional: where the scanned directory lies below the
+                                // directory exclude patterns are anchored at ("src/lib")
+    int jobs;               // Worker threads; 1 = single-threaded, <= 0 = one per CPU
+    IoMode io_mode;         // How file contents are read
+    int io_depth;           // Files in flight per worker with IO_URING; 0 = default
+    IoStats *io_stats;      // Optional: receives per-backend throughput
+    const ExtensionMap *extensions; // Optional: overrides of the built-in extension table
+    bool classic;           // Original C-style comment rules instead of the per-language lexers
+    bool list_only;         // Walk and match entries but read no file; each counts as a file with no lines
+    int max_depth;          // Levels of directories listed, the scanned one being the first;
+                            // 0 = no limit. Not used with git or tar.
+    int max_open_dirs;      // Directory handles kept open for the entries queued below them;
+                            // 0 = half the descriptor limit. Past it, a directory's files are
+                            // counted as it is listed and its handle closed. POSIX only.
+    const GitRepo *git;     // Optional: count only the files tracked in this repository's index,
+                            // for the directory git_repo_open was given
+    bool tar;               // The scanned path is a tar archive ("-" for standard input), counted
+                            // member by member as it streams; see tar.h
+    bool dedupe;            // Count files with the same language and contents once; see dedupe.h
+    DedupeStats *dedupe_stats;  // Optional: receives the copies left out with dedupe
+    const SniffOptions *sniff;  // Optional: skip binary, minified, generated and oversized files
+                                // on their first block; see sniff.h
+    SniffStats *sniff_stats;    // Optional: receives the files skipped with sniff
+    bool use_cache;         // Reuse counts from CACHE_FILE_NAME in the scanned directory
+    bool rebuild_cache;     // Ignore the existing cache file and write a fresh one
+    CacheStats *cache_stats;    // Optional: receives cache hits and misses
+    CountBreakdown *breakdown;  // Optional: receives per-language and per-directory totals
+    ScanProfile *profile;       // Optional: receives phase times; set up with scan_profile_init
+    DirectoryVisitor on_directory;  // Optional
+    FileVisitor on_file;            // Optional
+    SkipVisitor on_skip;            // Optional
+    FileFilter want_file;           // Optional
+    void *visitor_ctx;
+    ProgressCallback on_progress;   // Optional
+    void *progress_ctx;
+    int progress_interval_ms;
+} CountOptions;
+
+// Streaming per-file counter: the language's lexer, or the C-style
+// classifier in classic mode. file_counter_feed is a BlockSink.
+typedef struct {
+    bool classic;
+    Lexer lexer;
+    LineClassifier classifier;
+} FileCounter;
+
 // Function declarations
 ExcludeList* create_exclude_list(void);
 void add_exclude_pattern(ExcludeList *list, const char *pattern);
@@ -48,9 +183,28 @@ bool is_excluded(const char *path, const ExcludeList *exclude_list);
 
 bool is_text_file(const char *filename);
 unsigned long long count_lines_in_file(const char *filepath, CountResult *result);
+unsigned long long count_lines_with_reader(FileReader *reader, const char *filepath, LanguageId language, CountResult *result);
+unsigned long long count_lines_classic_with_reader(FileReader *reader, const char *filepath, CountResult *result);
+void file_counter_init(FileCounter *counter, LanguageId language, bool classic);
+void file_counter_feed(void *counter, const unsigned char *data, size_t len);
+unsigned long long file_counter_finish(FileCounter *counter, CountResult *result);
+unsigned long long count_lines_at(FileReader *reader, int dirfd, const char *name, LanguageId language, CountResult *result);
+unsigned long long count_lines_classic_at(FileReader *reader, int dirfd, const char *name, CountResult *result);
+bool self_check_file(const char *filepath, LanguageId language, CountResult *result);
 void count_lines_in_directory(const char *dirpath, const ExcludeList *exclude_list, CountResult *result);
 
+void init_count_options(CountOptions *options);
+bool count_lines_with_options(const char *dirpath, const CountOptions *options, CountResult *result);
+unsigned long long self_check_directory(const char *dirpath, const CountOptions *options, CountResult *result);
+void count_lines_batch(const char *const *roots, int root_count, const CountOptions *options, CountResult *result,
+                       BatchVisitor on_root, void *ctx);
+
 void print_usage(const char *program_name);
 void print_results(const CountResult *result, const char *target_path);
+void print_breakdown(const CountBreakdown *breakdown);
+void print_dedupe_stats(const DedupeStats *stats, const CountResult *result);
+
+bool copy_count_breakdown(CountBreakdown *dst, const CountBreakdown *src);
+void free_count_breakdown(CountBreakdown *breakdown);
 
 #endif // COUNTLINES_H
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "dedupe.h"
+#include "countlines.h"
+#include "threading.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define DEDUPE_INITIAL_SLOTS 1024       // Per shard, on first use
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xxh64_round(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void xxh64_init(Xxh64 *state) {
+    state->lanes[0] = PRIME64_1 + PRIME64_2;
+    state->lanes[1] = PRIME64_2;
+    state->lanes[2] = 0;
+    state->lanes[3] = 0 - PRIME64_1;
+    state->stripe_len = 0;
+    state->length = 0;
+}
+
+static void xxh64_stripe(Xxh64 *state, const unsigned char *p) {
+    for (int i = 0; i < 4; i++) state->lanes[i] = xxh64_round(state->lanes[i], read64(p + 8 * i));
+}
+
+static void xxh64_update(Xxh64 *state, const unsigned char *data, size_t len) {
+    state->length += len;
+    if (state->stripe_len > 0) {
+        size_t take = 32 - state->stripe_len;
+        if (take > len) take = len;
+        memcpy(state->stripe + state->stripe_len, data, take);
+        state->stripe_len += take;
+        data += take;
+        len -= take;
+        if (state->stripe_len < 32) return;
+        xxh64_stripe(state, state->stripe);
+        state->stripe_len = 0;
+    }
+    for (; len >= 32; data += 32, len -= 32) xxh64_stripe(state, data);
+    memcpy(state->stripe, data, len);
+    state->stripe_len = len;
+}
+
+static uint64_t xxh64_digest(const Xxh64 *state) {
+    uint64_t hash;
+    if (state->length >= 32) {
+        const uint64_t *v = state->lanes;
+        hash = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+        for (int i = 0; i < 4; i++) hash = xxh64_merge(hash, v[i]);
+    } else {
+        hash = PRIME64_5;
+    }
+    hash += state->length;
+
+    const unsigned char *p = state->stripe;
+    size_t len = state->stripe_len;
+    for (; len >= 8; p += 8, len -= 8) {
+        hash ^= xxh64_round(0, read64(p));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (len >= 4) {
+        hash ^= (uint64_t)read32(p) * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) {
+        hash ^= *p * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+void content_hasher_init(ContentHasher *hasher) {
+    xxh64_init(&hasher->full);
+}
+
+void content_hasher_feed(void *arg, const unsigned char *data, size_t len) {
+    ContentHasher *hasher = arg;
+    xxh64_update(&hasher->full, data, len);
+}
+
+uint64_t content_hasher_finish(const ContentHasher *hasher) {
+    return xxh64_digest(&hasher->full);
+}
+
+typedef struct {
+    cl_mutex_t lock;
+    uint64_t *sizes;                // Hashed (size, language) pairs seen; 0 = empty slot
+    size_t size_slots;
+    size_t size_count;
+    DedupeEntry *entries;           // Open-addressed by size, language and hash
+    size_t entry_slots;
+    size_t entry_count;
+    char pad[64];
+} DedupeShard;
+
+struct DedupeTable {
+    DedupeShard shards[DEDUPE_SHARDS];
+};
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Shard from the top bits, slot from the bottom ones
+static DedupeShard* shard_for(DedupeTable *table, uint64_t hash) {
+    return &table->shards[hash >> 58];
+}
+
+static uint64_t size_key(uint64_t size, LanguageId language) {
+    uint64_t key = mix64(size * LANG_COUNT + (uint64_t)language);
+    return key ? key : 1;
+}
+
+static uint64_t entry_hash(const DedupeEntry *key) {
+    return mix64(key->size ^ mix64(key->full ^ key->language));
+}
+
+DedupeTable* dedupe_table_create(void) {
+    DedupeTable *table = calloc(1, sizeof(DedupeTable));
+    if (!table) return NULL;
+    for (int i = 0; i < DEDUPE_SHARDS; i++) cl_mutex_init(&table->shards[i].lock);
+    return table;
+}
+
+void dedupe_table_destroy(DedupeTable *table) {
+    if (!table) return;
+    for (int i = 0; i < DEDUPE_SHARDS; i++) {
+        cl_mutex_destroy(&table->shards[i].lock);
+        free(table->shards[i].sizes);
+        free(table->shards[i].entries);
+    }
+    free(table);
+}
+
+// Keep each shard at most three quarters full
+static bool grow_sizes(DedupeShard *shard) {
+    if ((shard->size_count + 1) * 4 <= shard->size_slots * 3) return true;
+    size_t slots = shard->size_slots ? shard->size_slots * 2 : DEDUPE_INITIAL_SLOTS;
+    uint64_t *sizes = calloc(slots, sizeof(uint64_t));
+    if (!sizes) return false;
+    for (size_t i = 0; i < shard->size_slots; i++) {
+        uint64_t key = shard->sizes[i];
+        if (!key) continue;
+        size_t slot = key & (slots - 1);
+        while (sizes[slot]) slot = (slot + 1) & (slots - 1);
+        sizes[slot] = key;
+    }
+    free(shard->sizes);
+    shard->sizes = sizes;
+    shard->size_slots = slots;
+    return true;
+}
+
+static bool grow_entries(DedupeShard *shard) {
+    if ((shard->entry_count + 1) * 4 <= shard->entry_slots * 3) return true;
+    size_t slots = shard->entry_slots ? shard->entry_slots * 2 : DEDUPE_INITIAL_SLOTS;
+    DedupeEntry *entries = calloc(slots, sizeof(DedupeEntry));
+    if (!entries) return false;
+    for (size_t i = 0; i < shard->entry_slots; i++) {
+        const DedupeEntry *entry = &shard->entries[i];
+        if (!entry->used) continue;
+        size_t slot = entry_hash(entry) & (slots - 1);
+        while (entries[slot].used) slot = (slot + 1) & (slots - 1);
+        entries[slot] = *entry;
+    }
+    free(shard->entries);
+    shard->entries = entries;
+    shard->entry_slots = slots;
+    return true;
+}
+
+bool dedupe_table_add_size(DedupeTable *table, uint64_t size, LanguageId language) {
+    uint64_t key = size_key(size, language);
+    DedupeShard *shard = shard_for(table, key);
+    cl_mutex_lock(&shard->lock);
+    bool seen = false;
+    if (grow_sizes(shard)) {
+        size_t slot = key & (shard->size_slots - 1);
+        while (shard->sizes[slot] && shard->sizes[slot] != key) slot = (slot + 1) & (shard->size_slots - 1);
+        seen = shard->sizes[slot] == key;
+        if (!seen) {
+            shard->sizes[slot] = key;
+            shard->size_count++;
+        }
+    }
+    cl_mutex_unlock(&shard->lock);
+    return seen;
+}
+
+// The slot holding a match for `key`, or the empty slot ending its probe run;
+// the shard is locked
+static DedupeEntry* probe(DedupeShard *shard, uint64_t hash, const DedupeEntry *key) {
+    size_t slot = hash & (shard->entry_slots - 1);
+    for (;;) {
+        DedupeEntry *entry = &shard->entries[slot];
+        if (!entry->used) return entry;
+        if (entry->size == key->size && entry->full == key->full && entry->language == key->language) {
+            return entry;
+        }
+        slot = (slot + 1) & (shard->entry_slots - 1);
+    }
+}
+
+bool dedupe_table_find(DedupeTable *table, const DedupeEntry *key, DedupeEntry *found) {
+    uint64_t hash = entry_hash(key);
+    DedupeShard *shard = shard_for(table, hash);
+    cl_mutex_lock(&shard->lock);
+    const DedupeEntry *entry = shard->entry_slots > 0 ? probe(shard, hash, key) : NULL;
+    bool hit = entry && entry->used;
+    if (hit) *found = *entry;
+    cl_mutex_unlock(&shard->lock);
+    return hit;
+}
+
+bool dedupe_table_insert(DedupeTable *table, DedupeEntry *key) {
+    uint64_t hash = entry_hash(key);
+    DedupeShard *shard = shard_for(table, hash);
+    cl_mutex_lock(&shard->lock);
+    bool inserted = true;
+    if (grow_entries(shard)) {
+        DedupeEntry *entry = probe(shard, hash, key);
+        if (entry->used) {
+            *key = *entry;
+            inserted = false;
+        } else {
+            *entry = *key;
+            entry->used = 1;
+            shard->entry_count++;
+        }
+    }
+    cl_mutex_unlock(&shard->lock);
+    return inserted;
+}
@@ -0,0 +1,68 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lexer.h"
+
+// Content-hash deduplication (--dedupe).
+//
+// Copies of a file (same language, same contents) are counted once, and
+// every file is read once. A file whose size matches no earlier one, which
+// costs only the stat to learn, cannot be a copy; it is hashed (XXH64) from
+// the same bytes the counter reads. A file whose size does match is hashed
+// first, its bytes held until the hash is looked up: a copy reuses the counts
+// stored for the first one and is never classified.
+//
+// The table is shared by the scan's workers. It is split into
+// DEDUPE_SHARDS open-addressed shards, each behind its own lock and grown by
+// doubling, so it holds any number of files, at 45 to 110 bytes each.
+
+#define DEDUPE_SHARDS 64
+#define DEDUPE_HOLD_MAX (4 * 1024 * 1024)  // Larger files are hashed as they are counted
+
+// Streaming XXH64 of a file's contents. content_hasher_feed is a BlockSink.
+typedef struct {
+    uint64_t lanes[4];
+    unsigned char stripe[32];       // Input not yet making up a whole stripe
+    size_t stripe_len;
+    uint64_t length;
+} Xxh64;
+
+typedef struct {
+    Xxh64 full;
+} ContentHasher;
+
+void content_hasher_init(ContentHasher *hasher);
+void content_hasher_feed(void *hasher, const unsigned char *data, size_t len);
+uint64_t content_hasher_finish(const ContentHasher *hasher);
+
+// A file as the table knows it: its key and, once counted, its counts
+typedef struct {
+    uint64_t size;
+    uint64_t full;
+    uint32_t lines;
+    uint32_t blank;
+    uint32_t comments;
+    uint16_t language;
+    uint16_t used;
+} DedupeEntry;
+
+typedef struct DedupeTable DedupeTable;
+
+DedupeTable* dedupe_table_create(void);
+void dedupe_table_destroy(DedupeTable *table);
+
+// Note a file of `size` bytes in `language`; true if one had been noted before
+bool dedupe_table_add_size(DedupeTable *table, uint64_t size, LanguageId language);
+
+// The stored file with the size, language and hash of `key`
+bool dedupe_table_find(DedupeTable *table, const DedupeEntry *key, DedupeEntry *found);
+
+// Store `key` with its counts. Returns false if a file with the same contents
+// was stored first (by another worker counting a copy at the same time);
+// `key` then receives that file's counts.
+bool dedupe_table_insert(DedupeTable *table, DedupeEntry *key);
+
+#endif // DEDUPE_H
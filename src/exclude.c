@@ -0,0 +1,490 @@
+#include "exclude.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+    static inline int lowest_bit(uint64_t mask) {
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (int)index;
+    }
+#else
+    #define lowest_bit(mask) __builtin_ctzll(mask)
+#endif
+
+// One compiled glob. The literal prefix (before the first wildcard) and
+// literal suffix (after the last '*') reject most names with two memcmps
+// before the backtracking matcher runs.
+typedef struct {
+    char *text;
+    size_t len;
+    size_t prefix_len;
+    size_t suffix_len;      // Only meaningful when has_star
+    bool has_star;
+    bool suffix_literal;
+} Glob;
+
+// A component pattern: matches an entry name at any depth
+typedef struct {
+    Glob glob;
+    bool dir_only;
+} ComponentGlob;
+
+// One segment of an anchored pattern; the NFA state is a set of positions
+typedef struct {
+    Glob glob;
+    bool any_depth;         // "**": zero or more components
+    bool last;              // Matching this segment matches the pattern
+    bool dir_only;
+} Position;
+
+enum {
+    MATCH_ANY = 1,
+    MATCH_DIR = 2
+};
+
+typedef struct {
+    const char *name;       // NULL for an empty slot
+    size_t len;
+    unsigned char flags;
+} LiteralSlot;
+
+struct ExcludeMatcher {
+    // Literal component names ("node_modules", ".git"): one hash probe per entry
+    LiteralSlot *literals;
+    size_t literal_mask;
+    int literal_count;
+
+    ComponentGlob *globs;
+    int glob_count;
+
+    Position *positions;
+    int position_count;
+    int state_words;
+    uint64_t *root_state;
+
+    // Owned copies of every pattern segment
+    char **strings;
+    int string_count;
+};
+
+static bool is_wildcard(char ch) {
+    return ch == '*' || ch == '?' || ch == '[' || ch == '\\';
+}
+
+static void compile_glob(Glob *glob, char *text) {
+    glob->text = text;
+    size_t len = strlen(text);
+    glob->len = len;
+
+    size_t prefix = 0;
+    while (prefix < len && !is_wildcard(text[prefix])) prefix++;
+    glob->prefix_len = prefix;
+
+    const char *star = strrchr(text, '*');
+    glob->has_star = star != NULL;
+    glob->suffix_literal = false;
+    glob->suffix_len = 0;
+    if (star) {
+        const char *tail = star + 1;
+        bool literal = true;
+        for (const char *p = tail; *p; p++) {
+            if (is_wildcard(*p)) literal = false;
+        }
+        glob->suffix_literal = literal;
+        glob->suffix_len = literal ? strlen(tail) : 0;
+    }
+}
+
+// Match one pattern element against `ch`; *advance receives its length
+static bool match_element(const char *p, char ch, size_t *advance) {
+    if (*p == '?') {
+        *advance = 1;
+        return true;
+    }
+    if (*p == '\\' && p[1]) {
+        *advance = 2;
+        return p[1] == ch;
+    }
+    if (*p == '[') {
+        const char *q = p + 1;
+        bool negate = *q == '!' || *q == '^';
+        if (negate) q++;
+        bool matched = false;
+        bool first = true;
+        while (*q && (*q != ']' || first)) {
+            unsigned char lo = (unsigned char)*q;
+            unsigned char hi = lo;
+            if (q[1] == '-' && q[2] && q[2] != ']') {
+                hi = (unsigned char)q[2];
+                q += 2;
+            }
+            if ((unsigned char)ch >= lo && (unsigned char)ch <= hi) matched = true;
+            q++;
+            first = false;
+        }
+        if (*q == ']') {
+            *advance = (size_t)(q + 1 - p);
+            return matched != negate;
+        }
+        // No closing bracket: a literal '['
+    }
+    *advance = 1;
+    return *p == ch;
+}
+
+bool glob_match(const char *pattern, const char *name) {
+    const char *p = pattern;
+    const char *n = name;
+    const char *star_p = NULL;
+    const char *star_n = NULL;
+
+    while (*n) {
+        if (*p == '*') {
+            while (*p == '*') p++;
+            star_p = p;
+            star_n = n;
+            continue;
+        }
+        size_t advance;
+        if (*p && match_element(p, *n, &advance)) {
+            p += advance;
+            n++;
+            continue;
+        }
+        if (!star_p) return false;
+        // Let the last '*' absorb one more character and retry
+        p = star_p;
+        n = ++star_n;
+    }
+    while (*p == '*') p++;
+    return *p == '\0';
+}
+
+static bool glob_matches(const Glob *glob, const char *name, size_t len) {
+    if (glob->prefix_len > len || memcmp(glob->text, name, glob->prefix_len) != 0) return false;
+    if (glob->prefix_len == glob->len) return len == glob->len;
+    if (glob->suffix_literal) {
+        if (glob->prefix_len + glob->suffix_len > len) return false;
+        const char *suffix = glob->text + glob->len - glob->suffix_len;
+        if (memcmp(suffix, name + len - glob->suffix_len, glob->suffix_len) != 0) return false;
+    }
+    return glob_match(glob->text, name);
+}
+
+static size_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+static const LiteralSlot* find_literal(const ExcludeMatcher *m, const char *name, size_t len) {
+    size_t slot = hash_name(name, len) & m->literal_mask;
+    while (m->literals[slot].name) {
+        const LiteralSlot *entry = &m->literals[slot];
+        if (entry->len == len && memcmp(entry->name, name, len) == 0) return entry;
+        slot = (slot + 1) & m->literal_mask;
+    }
+    return NULL;
+}
+
+static char* keep_string(ExcludeMatcher *m, const char *text, size_t len) {
+    char **strings = realloc(m->strings, sizeof(char*) * (m->string_count + 1));
+    if (!strings) return NULL;
+    m->strings = strings;
+
+    char *copy = malloc(len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    m->strings[m->string_count++] = copy;
+    return copy;
+}
+
+static bool add_component(ExcludeMatcher *m, char *segment, bool dir_only) {
+    ComponentGlob *globs = realloc(m->globs, sizeof(ComponentGlob) * (m->glob_count + 1));
+    if (!globs) return false;
+    m->globs = globs;
+    compile_glob(&m->globs[m->glob_count].glob, segment);
+    m->globs[m->glob_count].dir_only = dir_only;
+    m->glob_count++;
+    return true;
+}
+
+static bool add_anchored(ExcludeMatcher *m, char **segments, int count, bool dir_only) {
+    Position *positions = realloc(m->positions, sizeof(Position) * (m->position_count + count));
+    if (!positions) return false;
+    m->positions = positions;
+
+    for (int i = 0; i < count; i++) {
+        Position *pos = &m->positions[m->position_count + i];
+        memset(pos, 0, sizeof(Position));
+        pos->any_depth = strcmp(segments[i], "**") == 0;
+        if (!pos->any_depth) compile_glob(&pos->glob, segments[i]);
+        pos->last = i == count - 1;
+        pos->dir_only = dir_only;
+    }
+    m->position_count += count;
+    return true;
+}
+
+// Split one pattern into segments and file it as a literal name, a
+// component glob or an anchored pattern
+static bool add_pattern(ExcludeMatcher *m, const char *pattern) {
+    size_t len = strlen(pattern);
+    bool dir_only = false;
+    while (len > 0 && pattern[len - 1] == '/') {
+        dir_only = true;
+        len--;
+    }
+    bool anchored = len > 0 && pattern[0] == '/';
+
+    char *segments[256];
+    int count = 0;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && pattern[i] == '/') i++;
+        size_t start = i;
+        while (i < len && pattern[i] != '/') i++;
+        size_t seg_len = i - start;
+        if (seg_len == 0 || (seg_len == 1 && pattern[start] == '.')) continue;
+        if (seg_len == 2 && memcmp(pattern + start, "**", 2) == 0 &&
+            count > 0 && strcmp(segments[count - 1], "**") == 0) {
+            continue;
+        }
+        if (count == (int)(sizeof(segments) / sizeof(segments[0]))) return false;
+        segments[count] = keep_string(m, pattern + start, seg_len);
+        if (!segments[count]) return false;
+        count++;
+    }
+    if (count == 0) return true;
+
+    // "name" and "**/name" match a component at any depth
+    char *component = NULL;
+    if (!anchored && count == 1) component = segments[0];
+    if (count == 2 && strcmp(segments[0], "**") == 0 && strcmp(segments[1], "**") != 0) component = segments[1];
+    if (!component) return add_anchored(m, segments, count, dir_only);
+
+    bool literal = true;
+    for (const char *p = component; *p; p++) {
+        if (is_wildcard(*p)) literal = false;
+    }
+    if (!literal) return add_component(m, component, dir_only);
+
+    // Literals go into the hash table, which is sized once all are known
+    LiteralSlot *literals = realloc(m->literals, sizeof(LiteralSlot) * (m->literal_count + 1));
+    if (!literals) return false;
+    m->literals = literals;
+    m->literals[m->literal_count].name = component;
+    m->literals[m->literal_count].len = strlen(component);
+    m->literals[m->literal_count].flags = dir_only ? MATCH_DIR : MATCH_ANY;
+    m->literal_count++;
+    return true;
+}
+
+static bool build_literal_table(ExcludeMatcher *m) {
+    size_t size = 16;
+    while (size < (size_t)m->literal_count * 2) size *= 2;
+
+    LiteralSlot *table = calloc(size, sizeof(LiteralSlot));
+    if (!table) return false;
+
+    for (int i = 0; i < m->literal_count; i++) {
+        const LiteralSlot *entry = &m->literals[i];
+        size_t slot = hash_name(entry->name, entry->len) & (size - 1);
+        while (table[slot].name &&
+               !(table[slot].len == entry->len && memcmp(table[slot].name, entry->name, entry->len) == 0)) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot].name = entry->name;
+        table[slot].len = entry->len;
+        table[slot].flags |= entry->flags;
+    }
+
+    free(m->literals);
+    m->literals = table;
+    m->literal_mask = size - 1;
+    return true;
+}
+
+// Add `pos` and every position reachable from it through "**" matching zero components
+static void add_closure(const ExcludeMatcher *m, uint64_t *state, int pos) {
+    for (;;) {
+        state[pos / 64] |= 1ULL << (pos % 64);
+        if (!m->positions[pos].any_depth || m->positions[pos].last) return;
+        pos++;
+    }
+}
+
+ExcludeMatcher* exclude_matcher_create(char *const *patterns, int count) {
+    ExcludeMatcher *m = calloc(1, sizeof(ExcludeMatcher));
+    if (!m) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        if (patterns[i] && !add_pattern(m, patterns[i])) {
+            exclude_matcher_free(m);
+            return NULL;
+        }
+    }
+
+    if (!build_literal_table(m)) {
+        exclude_matcher_free(m);
+        return NULL;
+    }
+
+    m->state_words = (m->position_count + 63) / 64;
+    if (m->state_words > 0) {
+        m->root_state = calloc(m->state_words, sizeof(uint64_t));
+        if (!m->root_state) {
+            exclude_matcher_free(m);
+            return NULL;
+        }
+        // Every anchored pattern starts right after the previous one's last segment
+        for (int pos = 0; pos < m->position_count; pos++) {
+            if (pos == 0 || m->positions[pos - 1].last) add_closure(m, m->root_state, pos);
+        }
+    }
+    return m;
+}
+
+void exclude_matcher_free(ExcludeMatcher *matcher) {
+    if (!matcher) return;
+    for (int i = 0; i < matcher->string_count; i++) free(matcher->strings[i]);
+    free(matcher->strings);
+    free(matcher->literals);
+    free(matcher->globs);
+    free(matcher->positions);
+    free(matcher->root_state);
+    free(matcher);
+}
+
+int exclude_matcher_state_words(const ExcludeMatcher *matcher) {
+    return matcher ? matcher->state_words : 0;
+}
+
+void exclude_matcher_root_state(const ExcludeMatcher *matcher, uint64_t *state) {
+    if (!matcher || matcher->state_words == 0) return;
+    memcpy(state, matcher->root_state, sizeof(uint64_t) * matcher->state_words);
+}
+
+bool exclude_matcher_step(const ExcludeMatcher *matcher, const uint64_t *state,
+                          const char *name, bool is_dir, uint64_t *child_state) {
+    if (!matcher) return false;
+    size_t len = strlen(name);
+
+    const LiteralSlot *literal = find_literal(matcher, name, len);
+    if (literal && (literal->flags & (is_dir ? (MATCH_ANY | MATCH_DIR) : MATCH_ANY))) return true;
+
+    for (int i = 0; i < matcher->glob_count; i++) {
+        const ComponentGlob *g = &matcher->globs[i];
+        if (g->dir_only && !is_dir) continue;
+        if (glob_matches(&g->glob, name, len)) return true;
+    }
+
+    if (matcher->state_words == 0) return false;
+    if (child_state) memset(child_state, 0, sizeof(uint64_t) * matcher->state_words);
+
+    for (int w = 0; w < matcher->state_words; w++) {
+        uint64_t bits = state[w];
+        while (bits) {
+            int index = w * 64 + lowest_bit(bits);
+            bits &= bits - 1;
+
+            const Position *pos = &matcher->positions[index];
+            if (pos->any_depth) {
+                // A trailing "**" matches everything below; otherwise it
+                // absorbs this component and stays alive
+                if (pos->last) {
+                    if (!pos->dir_only || is_dir) return true;
+                } else if (child_state) {
+                    add_closure(matcher, child_state, index);
+                }
+                continue;
+            }
+
+            if (!glob_matches(&pos->glob, name, len)) continue;
+            if (pos->last) {
+                if (!pos->dir_only || is_dir) return true;
+            } else if (child_state) {
+                add_closure(matcher, child_state, index + 1);
+            }
+        }
+    }
+    return false;
+}
+
+bool exclude_matcher_match_path(const ExcludeMatcher *matcher, const char *path, bool is_dir) {
+    if (!matcher || !path) return false;
+
+    size_t len = strlen(path);
+    char *copy = malloc(len + 1);
+    int words = matcher->state_words;
+    uint64_t *states = calloc(words > 0 ? 2 * words : 1, sizeof(uint64_t));
+    if (!copy || !states) {
+        free(copy);
+        free(states);
+        return false;
+    }
+    memcpy(copy, path, len + 1);
+    exclude_matcher_root_state(matcher, states);
+
+    bool excluded = false;
+    uint64_t *state = states;
+    uint64_t *child = states + words;
+    char *p = copy;
+    while (*p && !excluded) {
+        while (*p == '/' || *p == '\\') p++;
+        if (!*p) break;
+        char *name = p;
+        while (*p && *p != '/' && *p != '\\') p++;
+        if (*p) *p++ = '\0';
+        while (*p == '/' || *p == '\\') p++;
+
+        bool last = *p == '\0';
+        excluded = exclude_matcher_step(matcher, state, name, last ? is_dir : true, last ? NULL : child);
+        uint64_t *swap = state;
+        state = child;
+        child = swap;
+    }
+
+    free(copy);
+    free(states);
+    return excluded;
+}
+
+bool exclude_matcher_path_state(const ExcludeMatcher *matcher, const char *path, uint64_t *state) {
+    exclude_matcher_root_state(matcher, state);
+    if (!path) return false;
+
+    size_t len = strlen(path);
+    int words = matcher->state_words;
+    char *copy = malloc(len + 1);
+    uint64_t *child = calloc(words > 0 ? words : 1, sizeof(uint64_t));
+    if (!copy || !child) {
+        free(copy);
+        free(child);
+        return false;
+    }
+    memcpy(copy, path, len + 1);
+
+    bool excluded = false;
+    char *p = copy;
+    while (*p && !excluded) {
+        while (*p == '/' || *p == '\\') p++;
+        if (!*p) break;
+        char *name = p;
+        while (*p && *p != '/' && *p != '\\') p++;
+        if (*p) *p++ = '\0';
+
+        excluded = exclude_matcher_step(matcher, state, name, true, child);
+        if (words > 0) memcpy(state, child, sizeof(uint64_t) * words);
+    }
+
+    free(copy);
+    free(child);
+    return excluded;
+}
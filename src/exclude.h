@@ -0,0 +1,48 @@
+#ifndef EXCLUDE_H
+#define EXCLUDE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Exclusion patterns compiled once per scan and matched one path component
+// at a time while the tree is walked.
+//
+// Pattern forms (gitignore-like, paths relative to the scanned root):
+//   name, *.min.js   no '/': matches any file or directory with that name at
+//                    any depth ('*', '?' and [a-z] / [!a-z] classes)
+//   src/gen, /out    contains '/': anchored at the root, one glob per component
+//   **/build, a/**/b '**' matches zero or more whole components
+//   build/           trailing '/': directories only
+//
+// Anchored patterns need per-directory state: the set of pattern positions
+// still alive after the components leading to that directory. It is a small
+// bitset of exclude_matcher_state_words() words, copied into each pending
+// directory; matchers without anchored patterns have zero-word states.
+typedef struct ExcludeMatcher ExcludeMatcher;
+
+ExcludeMatcher* exclude_matcher_create(char *const *patterns, int count);
+void exclude_matcher_free(ExcludeMatcher *matcher);
+
+int exclude_matcher_state_words(const ExcludeMatcher *matcher);
+
+// State of the scan root itself
+void exclude_matcher_root_state(const ExcludeMatcher *matcher, uint64_t *state);
+
+// Match `name`, an entry of the directory whose state is `state`. Returns true
+// if it is excluded. Otherwise, when `child_state` is not NULL (directories),
+// it receives the state for the entry's own listing.
+bool exclude_matcher_step(const ExcludeMatcher *matcher, const uint64_t *state,
+                          const char *name, bool is_dir, uint64_t *child_state);
+
+// Match a whole relative path ('/' or '\\' separated) component by component
+bool exclude_matcher_match_path(const ExcludeMatcher *matcher, const char *path, bool is_dir);
+
+// State for the entries of the directory at relative path `path`, stepping
+// from the root. Returns true if the directory or one of its parents is excluded.
+bool exclude_matcher_path_state(const ExcludeMatcher *matcher, const char *path, uint64_t *state);
+
+// fnmatch-style glob match of a single component
+bool glob_match(const char *pattern, const char *name);
+
+#endif // EXCLUDE_H
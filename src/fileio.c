@@ -0,0 +1,358 @@
+// O_DIRECT is a GNU extension in glibc's fcntl.h
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include "fileio.h"
+#include "threading.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+    #include <malloc.h>
+    #include <sys/types.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <errno.h>
+#endif
+
+#ifndef O_CLOEXEC
+    #define O_CLOEXEC 0
+#endif
+
+static const char *io_mode_names[IO_MODE_COUNT] = { "auto", "read", "mmap", "direct", "uring" };
+
+bool parse_io_mode(const char *name, IoMode *mode) {
+    if (!name || !mode) return false;
+    for (int i = 0; i < IO_MODE_COUNT; i++) {
+        if (strcmp(name, io_mode_names[i]) == 0) {
+            *mode = (IoMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* io_mode_name(IoMode mode) {
+    return (mode >= 0 && mode < IO_MODE_COUNT) ? io_mode_names[mode] : "unknown";
+}
+
+bool file_reader_init(FileReader *reader, IoMode mode) {
+    if (!reader) return false;
+    memset(reader, 0, sizeof(FileReader));
+    reader->mode = mode;
+    reader->buffer_size = IO_BUFFER_SIZE;
+#ifdef _WIN32
+    reader->buffer = _aligned_malloc(reader->buffer_size, IO_BUFFER_ALIGN);
+#else
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, IO_BUFFER_ALIGN, reader->buffer_size) != 0) buffer = NULL;
+    reader->buffer = buffer;
+#endif
+    return reader->buffer != NULL;
+}
+
+void file_reader_free(FileReader *reader) {
+    if (!reader) return;
+#ifdef _WIN32
+    _aligned_free(reader->buffer);
+#else
+    free(reader->buffer);
+#endif
+    reader->buffer = NULL;
+}
+
+// A sink that times the one it wraps as the classify phase
+typedef struct {
+    BlockSink sink;
+    void *sink_ctx;
+    ScanProfile *profile;
+} ProfiledSink;
+
+static void profiled_sink(void *arg, const unsigned char *data, size_t len) {
+    ProfiledSink *profiled = arg;
+    ProfileStamp start = profile_now();
+    profiled->sink(profiled->sink_ctx, data, len);
+    profile_phase(profiled->profile, PHASE_CLASSIFY, start);
+}
+
+// With reader->sniff, check a file's first block, and its size when known
+// (0 = not known), before any of it reaches the sink; false turns it down
+static bool sniff_first(FileReader *reader, const unsigned char *data, size_t len, unsigned long long size) {
+    if (!reader->sniff) return true;
+    if (size && sniff_size(reader->sniff, size, &reader->verdict) != SNIFF_TEXT) return false;
+    return sniff_block(reader->sniff, data, len, &reader->verdict) == SNIFF_TEXT;
+}
+
+#ifdef _WIN32
+
+// Windows only has the buffered read path; every mode maps onto it
+bool file_reader_read(FileReader *reader, const char *filepath, BlockSink sink, void *sink_ctx) {
+    unsigned long long start = cl_monotonic_ns();
+    ScanProfile *profile = reader->profile;
+    ProfileStamp stamp = {0, 0}, classified = {0, 0};
+    ProfiledSink profiled;
+    reader->verdict.reason = SNIFF_TEXT;
+    if (profile) stamp = profile_now();
+    int fd = _open(filepath, _O_RDONLY | _O_BINARY);
+    if (fd < 0) return false;
+    if (profile) {
+        stamp = profile_phase(profile, PHASE_OPEN, stamp);
+        classified = profile_total(profile, PROFILE_MASK(PHASE_CLASSIFY));
+        profiled.sink = sink;
+        profiled.sink_ctx = sink_ctx;
+        profiled.profile = profile;
+        sink = profiled_sink;
+        sink_ctx = &profiled;
+    }
+
+    unsigned long long total = 0;
+    int bytes_read;
+    while ((bytes_read = _read(fd, reader->buffer, (unsigned int)reader->buffer_size)) > 0) {
+        total += (unsigned long long)bytes_read;
+        if (total == (unsigned long long)bytes_read && reader->sniff) {
+            struct _stat64 st;
+            unsigned long long size = 0;
+            if ((size_t)bytes_read == reader->buffer_size && _fstat64(fd, &st) == 0) size = (unsigned long long)st.st_size;
+            if (!sniff_first(reader, reader->buffer, (size_t)bytes_read, size)) break;
+        }
+        sink(sink_ctx, reader->buffer, (size_t)bytes_read);
+    }
+    _close(fd);
+    if (profile) profile_phase_except(profile, PHASE_READ, stamp, PROFILE_MASK(PHASE_CLASSIFY), classified);
+
+    IoBackendStats *stats = &reader->stats.backends[IO_READ];
+    stats->files++;
+    stats->bytes += total;
+    stats->nanoseconds += cl_monotonic_ns() - start;
+    return true;
+}
+
+bool file_reader_read_at(FileReader *reader, int dirfd, const char *name, BlockSink sink, void *sink_ctx) {
+    (void)dirfd;
+    return file_reader_read(reader, name, sink, sink_ctx);
+}
+
+#else
+
+// Read from the current offset to EOF through the reusable buffer; with
+// `sniff` the first block is checked before it is fed
+static unsigned long long read_rest(FileReader *reader, int fd, bool sniff, BlockSink sink, void *sink_ctx) {
+    unsigned long long total = 0;
+    for (;;) {
+        ssize_t bytes_read = read(fd, reader->buffer, reader->buffer_size);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) break;
+        total += (unsigned long long)bytes_read;
+        if (sniff) {
+            // Only a file filling the first block can be over a size limit
+            struct stat st;
+            bool sized = (size_t)bytes_read == reader->buffer_size && fstat(fd, &st) == 0;
+            if (!sniff_first(reader, reader->buffer, (size_t)bytes_read, sized ? (unsigned long long)st.st_size : 0)) break;
+            sniff = false;
+        }
+        sink(sink_ctx, reader->buffer, (size_t)bytes_read);
+    }
+    return total;
+}
+
+// Map [offset, size) and feed it in one go; returns false if mmap is
+// unavailable. With `sniff` the start of the mapping is checked first.
+static bool map_rest(FileReader *reader, int fd, off_t offset, off_t size, bool sniff, BlockSink sink, void *sink_ctx) {
+    if (size <= offset) return true;
+
+    size_t length = (size_t)(size - offset);
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset);
+    if (map == MAP_FAILED) return false;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, length, MADV_SEQUENTIAL);
+#endif
+    if (!sniff || sniff_first(reader, map, length, 0)) sink(sink_ctx, map, length);
+    munmap(map, length);
+    return true;
+}
+
+static int open_direct(int dirfd, const char *filepath, bool *direct) {
+    *direct = false;
+#ifdef O_DIRECT
+    int fd = openat(dirfd, filepath, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd >= 0) {
+        *direct = true;
+        return fd;
+    }
+    // Filesystems such as tmpfs reject O_DIRECT; fall through to a normal open
+    if (errno != EINVAL) return -1;
+#endif
+    int fd_plain = openat(dirfd, filepath, O_RDONLY | O_CLOEXEC);
+#ifdef F_NOCACHE
+    if (fd_plain >= 0) {
+        fcntl(fd_plain, F_NOCACHE, 1);
+        *direct = true;
+    }
+#endif
+    return fd_plain;
+}
+
+bool file_reader_read(FileReader *reader, const char *filepath, BlockSink sink, void *sink_ctx) {
+    return file_reader_read_at(reader, AT_FDCWD, filepath, sink, sink_ctx);
+}
+
+bool file_reader_read_at(FileReader *reader, int dirfd, const char *name, BlockSink sink, void *sink_ctx) {
+    unsigned long long start = cl_monotonic_ns();
+    IoMode used = reader->mode;
+    unsigned long long total = 0;
+    int fd;
+    ScanProfile *profile = reader->profile;
+    ProfileStamp stamp = {0, 0}, classified = {0, 0};
+    ProfiledSink profiled;
+    reader->verdict.reason = SNIFF_TEXT;
+    if (profile) stamp = profile_now();
+
+    // io_uring is driven by the walker (uring.c); a FileReader in that mode
+    // serves the files it cannot take and the fallback when it is unavailable
+    if (used == IO_URING) used = IO_READ;
+
+    if (used == IO_DIRECT) {
+        bool direct;
+        fd = open_direct(dirfd, name, &direct);
+        if (fd < 0) return false;
+        if (!direct) used = IO_READ;
+    } else {
+        fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+    }
+
+    if (profile) {
+        stamp = profile_phase(profile, PHASE_OPEN, stamp);
+        classified = profile_total(profile, PROFILE_MASK(PHASE_CLASSIFY));
+        profiled.sink = sink;
+        profiled.sink_ctx = sink_ctx;
+        profiled.profile = profile;
+        sink = profiled_sink;
+        sink_ctx = &profiled;
+    }
+
+    switch (used) {
+    case IO_MMAP: {
+        struct stat st;
+        bool sized = fstat(fd, &st) == 0;
+        if (sized && reader->sniff && sniff_size(reader->sniff, (unsigned long long)st.st_size, &reader->verdict) != SNIFF_TEXT) {
+            break;
+        }
+        if (sized && map_rest(reader, fd, 0, st.st_size, reader->sniff != NULL, sink, sink_ctx)) {
+            total = (unsigned long long)st.st_size;
+        } else {
+            used = IO_READ;
+            total = read_rest(reader, fd, reader->sniff != NULL, sink, sink_ctx);
+        }
+        break;
+    }
+    case IO_AUTO: {
+        // Small files are done after one read(). Only when the first block
+        // comes back full is the file large enough to be worth an fstat,
+        // possibly a mapping of the remainder (the buffer size is page
+        // aligned) and a check against a size limit.
+        used = IO_READ;
+        ssize_t first;
+        do {
+            first = read(fd, reader->buffer, reader->buffer_size);
+        } while (first < 0 && errno == EINTR);
+        if (first <= 0) break;
+
+        total = (unsigned long long)first;
+        struct stat st;
+        bool full = (size_t)first == reader->buffer_size;
+        bool sized = full && fstat(fd, &st) == 0;
+        if (!sniff_first(reader, reader->buffer, (size_t)first, sized ? (unsigned long long)st.st_size : 0)) break;
+        sink(sink_ctx, reader->buffer, (size_t)first);
+        if (!full) break;
+
+        if (sized && st.st_size >= IO_MMAP_THRESHOLD &&
+            map_rest(reader, fd, (off_t)first, st.st_size, false, sink, sink_ctx)) {
+            used = IO_MMAP;
+            total = (unsigned long long)st.st_size;
+        } else {
+            total += read_rest(reader, fd, false, sink, sink_ctx);
+        }
+        break;
+    }
+    default:
+        total = read_rest(reader, fd, reader->sniff != NULL, sink, sink_ctx);
+        break;
+    }
+
+    close(fd);
+    if (profile) profile_phase_except(profile, PHASE_READ, stamp, PROFILE_MASK(PHASE_CLASSIFY), classified);
+
+    IoBackendStats *stats = &reader->stats.backends[used];
+    stats->files++;
+    stats->bytes += total;
+    stats->nanoseconds += cl_monotonic_ns() - start;
+    return true;
+}
+
+#endif
+
+char* read_entire_stream(FILE *file, size_t *size) {
+    char *data = NULL;
+    size_t length = 0, capacity = 0;
+    for (;;) {
+        if (capacity - length < 65536) {
+            capacity = capacity ? capacity * 2 : 65536;
+            char *grown = realloc(data, capacity + 1);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        size_t got = fread(data + length, 1, capacity - length, file);
+        length += got;
+        if (got == 0) break;
+    }
+    if (ferror(file)) {
+        free(data);
+        return NULL;
+    }
+    char *fitted = realloc(data, length + 1);     // Callers may keep it for long
+    if (fitted) data = fitted;
+    data[length] = '\0';
+    *size = length;
+    return data;
+}
+
+char* read_entire_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char *data = read_entire_stream(file, size);
+    fclose(file);
+    return data;
+}
+
+void merge_io_stats(IoStats *dst, const IoStats *src) {
+    if (!dst || !src) return;
+    for (int i = 0; i < IO_MODE_COUNT; i++) {
+        dst->backends[i].files += src->backends[i].files;
+        dst->backends[i].bytes += src->backends[i].bytes;
+        dst->backends[i].nanoseconds += src->backends[i].nanoseconds;
+    }
+}
+
+void print_io_stats(const IoStats *stats) {
+    printf("\nI/O backends (per-thread time, read + classify):\n");
+    printf("  %-8s %12s %14s %10s %12s\n", "Backend", "Files", "Bytes", "Time (s)", "MB/s");
+    for (int i = IO_READ; i < IO_MODE_COUNT; i++) {
+        const IoBackendStats *b = &stats->backends[i];
+        if (b->files == 0) continue;
+        double seconds = b->nanoseconds / 1e9;
+        double mb_per_sec = seconds > 0 ? (b->bytes / (1024.0 * 1024.0)) / seconds : 0.0;
+        printf("  %-8s %12llu %14llu %10.3f %12.1f\n", io_mode_names[i], b->files, b->bytes, seconds, mb_per_sec);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "profile.h"
+#include "sniff.h"
+
+// How file contents are brought into memory
+typedef enum {
+    IO_AUTO,        // read() for small files, mmap for large ones
+    IO_READ,        // open + read into a reused per-worker buffer
+    IO_MMAP,        // mmap the whole file with MADV_SEQUENTIAL
+    IO_DIRECT,      // O_DIRECT reads that bypass the page cache
+    IO_URING,       // Batched asynchronous openat/read/close through io_uring (Linux)
+    IO_MODE_COUNT
+} IoMode;
+
+// Files at least this large are mapped instead of read in IO_AUTO mode
+#define IO_MMAP_THRESHOLD (4 * 1024 * 1024)
+
+// Alignment and size of the reusable read buffer (O_DIRECT needs both aligned)
+#define IO_BUFFER_ALIGN 4096
+#define IO_BUFFER_SIZE (256 * 1024)
+
+typedef struct {
+    unsigned long long files;
+    unsigned long long bytes;
+    unsigned long long nanoseconds;     // Wall time spent reading and classifying
+} IoBackendStats;
+
+// Throughput per backend actually used (IO_AUTO is reported as READ or MMAP)
+typedef struct {
+    IoBackendStats backends[IO_MODE_COUNT];
+} IoStats;
+
+// Receives file contents block by block
+typedef void (*BlockSink)(void *ctx, const unsigned char *data, size_t len);
+
+// Per-worker reader state: the buffer is allocated once and reused for every file
+typedef struct {
+    IoMode mode;
+    unsigned char *buffer;
+    size_t buffer_size;
+    IoStats stats;
+    ScanProfile *profile;   // Optional: receives the open, read and classify times
+    const SniffOptions *sniff;  // Optional: check each file's first block before feeding it
+    SniffVerdict verdict;   // Of the last file read; reason SNIFF_TEXT unless sniff turned it down
+} FileReader;
+
+bool file_reader_init(FileReader *reader, IoMode mode);
+void file_reader_free(FileReader *reader);
+
+// Stream a file through the sink; returns false if the file could not be opened.
+// A file turned down by reader->sniff returns true with nothing fed to the sink.
+bool file_reader_read(FileReader *reader, const char *filepath, BlockSink sink, void *sink_ctx);
+
+// Same, opening `name` relative to the directory descriptor `dirfd` (or
+// CWD_FD) so the kernel does not resolve the full path again. Windows has no
+// directory descriptors: `dirfd` is ignored and `name` is a path.
+bool file_reader_read_at(FileReader *reader, int dirfd, const char *name, BlockSink sink, void *sink_ctx);
+
+// Everything left in `file`, or the whole file at `path`, in one new
+// NUL-terminated buffer of `*size` bytes; NULL if it cannot be read. For
+// small files read whole (lists, configuration, indexes), not for counting.
+char* read_entire_stream(FILE *file, size_t *size);
+char* read_entire_file(const char *path, size_t *size);
+
+bool parse_io_mode(const char *name, IoMode *mode);
+const char* io_mode_name(IoMode mode);
+
+void merge_io_stats(IoStats *dst, const IoStats *src);
+void print_io_stats(const IoStats *stats);
+
+#endif // FILEIO_H
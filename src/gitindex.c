@@ -0,0 +1,346 @@
+#include "countlines.h"
+#include "gitindex.h"
+#include <ctype.h>
+#ifndef _WIN32
+    #include <errno.h>
+#endif
+
+// Fixed part of an index entry: ctime and mtime (seconds, nanoseconds), dev,
+// ino, mode, uid, gid and size, all 32-bit big-endian, then the object hash
+// and 16 bits of flags
+#define ENTRY_STAT_SIZE 40
+#define ENTRY_MODE_OFFSET 24
+
+#define FLAG_EXTENDED 0x4000
+#define FLAG_STAGE_SHIFT 12
+#define EXTENDED_SKIP_WORKTREE 0x4000
+
+static uint32_t be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t be16(const unsigned char *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static bool is_separator(char c) {
+#ifdef _WIN32
+    return c == '\\' || c == '/';
+#else
+    return c == '/';
+#endif
+}
+
+static bool is_absolute(const char *path) {
+#ifdef _WIN32
+    if (isalpha((unsigned char)path[0]) && path[1] == ':') return true;
+#endif
+    return is_separator(path[0]);
+}
+
+// 1 for a directory, 2 for a regular file, 0 otherwise
+static int path_kind(const char *path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributes(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) return 0;
+    return (attributes & FILE_ATTRIBUTE_DIRECTORY) ? 1 : 2;
+#else
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) return 0;
+    if (S_ISDIR(path_stat.st_mode)) return 1;
+    return S_ISREG(path_stat.st_mode) ? 2 : 0;
+#endif
+}
+
+static bool join_path(char *out, size_t out_size, const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    bool separator = dir_len > 0 && !is_separator(dir[dir_len - 1]);
+    int written = snprintf(out, out_size, "%s%s%s", dir, separator ? PATH_SEPARATOR_STR : "", name);
+    return written >= 0 && (size_t)written < out_size;
+}
+
+// Drop the last component of an absolute path; false at the root
+static bool strip_component(char *path) {
+    size_t len = strlen(path);
+    while (len > 0 && is_separator(path[len - 1])) len--;
+    size_t end = len;
+    while (end > 0 && !is_separator(path[end - 1])) end--;
+    if (end == 0 || end == len) return false;
+    size_t keep = end;
+    while (keep > 1 && is_separator(path[keep - 1])) keep--;
+#ifdef _WIN32
+    if (keep == 2 && path[1] == ':') keep = 3;      // "C:\"
+#endif
+    path[keep] = '\0';
+    return true;
+}
+
+static void trim_end(char *text) {
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1])) text[--len] = '\0';
+}
+
+// Resolve a path written in a file of `base`, relative to `base` unless absolute
+static bool read_path_file(const char *path, const char *prefix, const char *base, char *out, size_t out_size) {
+    size_t size;
+    char *text = read_entire_file(path, &size);
+    if (!text) return false;
+    trim_end(text);
+    size_t prefix_len = strlen(prefix);
+    bool ok = strncmp(text, prefix, prefix_len) == 0;
+    if (ok) {
+        const char *target = text + prefix_len;
+        while (*target == ' ') target++;
+        if (is_absolute(target)) {
+            ok = strlen(target) < out_size;
+            if (ok) strcpy(out, target);
+        } else {
+            ok = join_path(out, out_size, base, target);
+        }
+    }
+    free(text);
+    return ok;
+}
+
+// Object hash size from extensions.objectFormat in the repository config
+static int config_hash_size(const char *git_dir) {
+    char path[GIT_PATH_MAX], common[GIT_PATH_MAX];
+    // Linked worktrees keep the shared config in the common directory
+    if (join_path(path, sizeof(path), git_dir, "commondir") && read_path_file(path, "", git_dir, common, sizeof(common))) {
+        git_dir = common;
+    }
+    if (!join_path(path, sizeof(path), git_dir, "config")) return 20;
+
+    size_t size;
+    char *config = read_entire_file(path, &size);
+    if (!config) return 20;
+    int hash_size = 20;
+    for (char *line = config; line && *line; ) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        while (isspace((unsigned char)*line)) line++;
+        const char *key = "objectformat";
+        size_t i = 0;
+        while (key[i] && tolower((unsigned char)line[i]) == key[i]) i++;
+        if (key[i] == '\0') {
+            const char *value = line + i;
+            while (*value == ' ' || *value == '\t') value++;
+            if (*value == '=') {
+                value++;
+                while (*value == ' ' || *value == '\t') value++;
+                char lower[8];
+                size_t n = 0;
+                while (n < sizeof(lower) - 1 && value[n] && !isspace((unsigned char)value[n])) {
+                    lower[n] = (char)tolower((unsigned char)value[n]);
+                    n++;
+                }
+                lower[n] = '\0';
+                if (strcmp(lower, "sha256") == 0) hash_size = 32;
+            }
+        }
+        line = next;
+    }
+    free(config);
+    return hash_size;
+}
+
+bool git_repo_open(GitRepo *repo, const char *path, const char **error) {
+    const char *unused;
+    if (!error) error = &unused;
+    *error = NULL;
+    if (!repo || !path) {
+        *error = "no path";
+        return false;
+    }
+
+    char scanned[GIT_PATH_MAX];
+#ifdef _WIN32
+    if (!_fullpath(scanned, path, sizeof(scanned))) {
+#else
+    if (!realpath(path, scanned)) {
+#endif
+        *error = "cannot resolve the path";
+        return false;
+    }
+
+    // Walk up to the first directory holding .git
+    char dir[GIT_PATH_MAX], candidate[GIT_PATH_MAX], git_dir[GIT_PATH_MAX];
+    strcpy(dir, scanned);
+    for (;;) {
+        if (!join_path(candidate, sizeof(candidate), dir, ".git")) {
+            *error = "path too long";
+            return false;
+        }
+        int kind = path_kind(candidate);
+        if (kind == 1) {
+            strcpy(git_dir, candidate);
+            break;
+        }
+        if (kind == 2) {
+            if (!read_path_file(candidate, "gitdir:", dir, git_dir, sizeof(git_dir))) {
+                *error = "cannot read the gitdir of a .git file";
+                return false;
+            }
+            break;
+        }
+        if (!strip_component(dir)) {
+            *error = "not inside a git work tree";
+            return false;
+        }
+    }
+
+    strcpy(repo->root, dir);
+    if (!join_path(repo->index_path, sizeof(repo->index_path), git_dir, "index")) {
+        *error = "path too long";
+        return false;
+    }
+    repo->hash_size = config_hash_size(git_dir);
+
+    const char *rest = scanned + strlen(dir);
+    while (is_separator(*rest)) rest++;
+    size_t i = 0;
+    for (; rest[i]; i++) repo->prefix[i] = is_separator(rest[i]) ? '/' : rest[i];
+    while (i > 0 && repo->prefix[i - 1] == '/') i--;
+    repo->prefix[i] = '\0';
+    return true;
+}
+
+// Decode the entry at index->offset into index->name; false if it does not
+// fit in the entry table
+static bool read_entry(GitIndex *index, GitIndexEntry *entry) {
+    const unsigned char *start = index->data + index->offset;
+    const unsigned char *end = index->data + index->size - index->hash_size;
+    size_t fixed = ENTRY_STAT_SIZE + index->hash_size + 2;
+    if (start > end || (size_t)(end - start) < fixed) return false;
+
+    uint32_t mode = be32(start + ENTRY_MODE_OFFSET);
+    uint16_t flags = be16(start + ENTRY_STAT_SIZE + index->hash_size);
+    uint16_t extended = 0;
+    const unsigned char *p = start + fixed;
+    if (flags & FLAG_EXTENDED) {
+        if (index->version < 3 || end - p < 2) return false;
+        extended = be16(p);
+        p += 2;
+    }
+
+    if (index->version == 4) {
+        // Drop `strip` bytes from the previous path, then append the suffix;
+        // the count uses git's offset varint (each continuation adds one)
+        if (p >= end) return false;
+        unsigned char c = *p++;
+        uint64_t strip = c & 127;
+        while (c & 128) {
+            if (p >= end || strip > (UINT64_MAX >> 8)) return false;
+            c = *p++;
+            strip = ((strip + 1) << 7) | (c & 127);
+        }
+        const unsigned char *nul = memchr(p, 0, end - p);
+        if (!nul || strip > index->name_len) return false;
+        size_t keep = index->name_len - (size_t)strip;
+        size_t suffix = nul - p;
+        if (keep + suffix >= GIT_PATH_MAX) return false;
+        memcpy(index->name + keep, p, suffix);
+        index->name_len = keep + suffix;
+        index->offset = (nul + 1) - index->data;
+    } else {
+        // NUL-terminated and padded with NULs to a multiple of 8 bytes
+        const unsigned char *nul = memchr(p, 0, end - p);
+        if (!nul) return false;
+        size_t len = nul - p;
+        size_t entry_size = ((size_t)(p - start) + len + 8) & ~(size_t)7;
+        if (len >= GIT_PATH_MAX || entry_size > (size_t)(end - start)) return false;
+        memcpy(index->name, p, len);
+        index->name_len = len;
+        index->offset += entry_size;
+    }
+    index->name[index->name_len] = '\0';
+
+    entry->path = index->name;
+    entry->path_len = index->name_len;
+    entry->mode = mode;
+    entry->stage = (flags >> FLAG_STAGE_SHIFT) & 3;
+    entry->skip_worktree = (extended & EXTENDED_SKIP_WORKTREE) != 0;
+    return true;
+}
+
+static void rewind_index(GitIndex *index) {
+    index->offset = 12;
+    index->next = 0;
+    index->name_len = 0;
+}
+
+bool git_index_open(GitIndex *index, const GitRepo *repo, const char **error) {
+    const char *unused;
+    if (!error) error = &unused;
+    *error = NULL;
+    memset(index, 0, sizeof(GitIndex));
+    index->hash_size = repo->hash_size;
+
+    index->data = (unsigned char*)read_entire_file(repo->index_path, &index->size);
+    if (!index->data) {
+#ifdef _WIN32
+        bool missing = GetFileAttributes(repo->index_path) == INVALID_FILE_ATTRIBUTES;
+#else
+        bool missing = errno == ENOENT;
+#endif
+        // Nothing has been added yet
+        if (missing) return true;
+        *error = "cannot read the index";
+        return false;
+    }
+
+    if (index->size < 12 + (size_t)index->hash_size || memcmp(index->data, "DIRC", 4) != 0) {
+        *error = "not a git index";
+        git_index_close(index);
+        return false;
+    }
+    index->version = be32(index->data + 4);
+    index->entry_count = be32(index->data + 8);
+    if (index->version < 2 || index->version > 4) {
+        *error = "unsupported index version";
+        git_index_close(index);
+        return false;
+    }
+
+    // Check every entry now, so iteration needs no error path
+    rewind_index(index);
+    GitIndexEntry entry;
+    for (uint32_t i = 0; i < index->entry_count; i++) {
+        if (!read_entry(index, &entry)) {
+            *error = "corrupt index";
+            git_index_close(index);
+            return false;
+        }
+    }
+
+    // Extensions: 4-byte signature, 32-bit size, data
+    size_t offset = index->offset;
+    size_t end = index->size - index->hash_size;
+    while (end - offset >= 8) {
+        uint32_t size = be32(index->data + offset + 4);
+        if (memcmp(index->data + offset, "link", 4) == 0) {
+            *error = "split index (core.splitIndex) is not supported";
+            git_index_close(index);
+            return false;
+        }
+        if (size > end - offset - 8) break;
+        offset += 8 + (size_t)size;
+    }
+
+    rewind_index(index);
+    return true;
+}
+
+void git_index_close(GitIndex *index) {
+    if (!index) return;
+    free(index->data);
+    index->data = NULL;
+    index->size = 0;
+    index->entry_count = 0;
+}
+
+bool git_index_next(GitIndex *index, GitIndexEntry *entry) {
+    if (!index->data || index->next >= index->entry_count) return false;
+    index->next++;
+    return read_entry(index, entry);
+}
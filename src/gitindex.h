@@ -0,0 +1,69 @@
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Tracked files of a git work tree, read straight from the on-disk index
+// (.git/index) without git or libgit2 (--git).
+//
+// Index versions 2, 3 and 4 (prefix-compressed paths) are read, for SHA-1
+// and SHA-256 repositories. The whole entry table is bounds-checked when the
+// index is opened, so iterating it afterwards cannot fail. Split indexes
+// (core.splitIndex) keep most entries in a second file and are refused. The
+// trailing checksum is not verified: git writes the index by renaming a
+// finished temporary file, so a torn index is not expected. A repository
+// without an index yet has no tracked files.
+
+#define GIT_PATH_MAX 4096
+
+// Mode bits of an index entry
+#define GIT_MODE_TYPE 0170000
+#define GIT_MODE_FILE 0100000
+#define GIT_MODE_SYMLINK 0120000
+#define GIT_MODE_GITLINK 0160000      // Submodule commit
+
+// Where a scanned directory lies in its repository
+typedef struct {
+    char root[GIT_PATH_MAX];        // Work tree, absolute
+    char index_path[GIT_PATH_MAX];
+    char prefix[GIT_PATH_MAX];      // Scanned directory below the root, '/' separated; "" for the root
+    int hash_size;                  // 20 (SHA-1) or 32 (SHA-256)
+} GitRepo;
+
+// Find the work tree containing `path`, following a .git file ("gitdir: ..."
+// as in linked worktrees and submodules) to its git directory. On failure
+// `error` (optional) says why.
+bool git_repo_open(GitRepo *repo, const char *path, const char **error);
+
+typedef struct {
+    const char *path;               // Relative to the work tree, '/' separated, NUL-terminated
+    size_t path_len;
+    uint32_t mode;
+    int stage;                      // 0, or 1-3 for the sides of a merge conflict
+    bool skip_worktree;             // Not checked out (sparse checkout)
+} GitIndexEntry;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    uint32_t version;
+    uint32_t entry_count;
+    int hash_size;
+    // Iteration
+    size_t offset;
+    uint32_t next;
+    char name[GIT_PATH_MAX];        // Current path; version 4 paths build on the previous one
+    size_t name_len;
+} GitIndex;
+
+// Read and validate the index; `error` (optional) receives why it failed
+bool git_index_open(GitIndex *index, const GitRepo *repo, const char **error);
+void git_index_close(GitIndex *index);
+
+// Next entry in index order (sorted by path, then stage); false at the end.
+// The entry's path is valid until the following call.
+bool git_index_next(GitIndex *index, GitIndexEntry *entry);
+
+#endif // GITINDEX_H
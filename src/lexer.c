@@ -0,0 +1,256 @@
+#include "lexer.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define LEXER_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define LEXER_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+    static inline int lowest_bit(uint64_t mask) {
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (int)index;
+    }
+#else
+    #define lowest_bit(mask) __builtin_ctzll(mask)
+#endif
+
+// The transition tables are complete DFAs, so lexer_feed_reference is just
+// `state = transitions[state][byte]` for every byte. The fast path relies on
+// the per-state skip descriptors computed by genlang: in most states only a
+// handful of bytes (newline, quote, the first byte of a comment marker) lead
+// out of the state. A 64-byte block is compared against those bytes with
+// SIMD and every byte in between is skipped, because it maps the state to
+// itself. The visited bytes still go through the same single table lookup.
+#define BLOCK_SIZE 64
+
+#if defined(LEXER_AVX2)
+
+static inline uint64_t match_bytes(const unsigned char *p, const unsigned char *bytes, int count) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i mlo = _mm256_setzero_si256();
+    __m256i mhi = _mm256_setzero_si256();
+    for (int k = 0; k < count; k++) {
+        __m256i b = _mm256_set1_epi8((char)bytes[k]);
+        mlo = _mm256_or_si256(mlo, _mm256_cmpeq_epi8(lo, b));
+        mhi = _mm256_or_si256(mhi, _mm256_cmpeq_epi8(hi, b));
+    }
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(mlo) |
+           ((uint64_t)(uint32_t)_mm256_movemask_epi8(mhi) << 32);
+}
+
+#elif defined(LEXER_SSE2)
+
+static inline uint64_t match_bytes(const unsigned char *p, const unsigned char *bytes, int count) {
+    uint64_t mask = 0;
+    for (int q = 0; q < 4; q++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + q * 16));
+        __m128i m = _mm_setzero_si128();
+        for (int k = 0; k < count; k++) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)bytes[k])));
+        }
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(m) << (q * 16);
+    }
+    return mask;
+}
+
+#else
+
+static inline uint64_t match_bytes(const unsigned char *p, const unsigned char *bytes, int count) {
+    unsigned char member[256];
+    memset(member, 0, sizeof(member));
+    for (int k = 0; k < count; k++) member[bytes[k]] = 1;
+
+    uint64_t mask = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        mask |= (uint64_t)member[p[i]] << i;
+    }
+    return mask;
+}
+
+#endif
+
+// Bitmask of the bytes in this block that may leave `info`'s state
+static inline uint64_t stop_mask(const unsigned char *p, const LexerStateInfo *info) {
+    uint64_t matched = match_bytes(p, info->skip_bytes, info->skip_count);
+    return info->skip_mode == LEXER_STOP_IN ? matched : ~matched;
+}
+
+void lexer_init(Lexer *lexer, LanguageId language) {
+    memset(lexer, 0, sizeof(Lexer));
+    if (language <= LANG_UNKNOWN || language >= LANG_COUNT) language = LANG_TEXT;
+    lexer->table = language_table[language].table;
+}
+
+void lexer_feed_reference(Lexer *lexer, const unsigned char *data, size_t len) {
+    if (len == 0) return;
+
+    const unsigned char (*transitions)[256] = lexer->table->transitions;
+    const LexerStateInfo *states = lexer->table->states;
+    unsigned int state = lexer->state;
+
+    for (size_t i = 0; i < len; i++) {
+        state = transitions[state][data[i]];
+        lexer->tally[states[state].line_end]++;
+    }
+
+    lexer->state = (unsigned char)state;
+    lexer->any_input = true;
+}
+
+void lexer_feed(Lexer *lexer, const unsigned char *data, size_t len) {
+    if (len == 0) return;
+
+    const unsigned char (*transitions)[256] = lexer->table->transitions;
+    const LexerStateInfo *states = lexer->table->states;
+    unsigned int state = lexer->state;
+    size_t i = 0;
+
+    while (i + BLOCK_SIZE <= len) {
+        const LexerStateInfo *info = &states[state];
+        if (info->skip_mode == LEXER_STOP_ALL) {
+            state = transitions[state][data[i]];
+            lexer->tally[states[state].line_end]++;
+            i++;
+            continue;
+        }
+
+        // Offsets of bytes in [i, i + 64) that can leave the current state
+        uint64_t mask = stop_mask(data + i, info);
+        if (mask == 0) {
+            i += BLOCK_SIZE;
+            continue;
+        }
+
+        size_t base = i;
+        for (;;) {
+            size_t pos = base + lowest_bit(mask);
+            unsigned int next = transitions[state][data[pos]];
+            lexer->tally[states[next].line_end]++;
+            i = pos + 1;
+
+            // Same skip set (typical for the status-only changes within a
+            // line): keep using this block's mask instead of recomputing it
+            const LexerStateInfo *next_info = &states[next];
+            bool same_skip = next_info->skip_mode == info->skip_mode &&
+                             next_info->skip_count == info->skip_count &&
+                             memcmp(next_info->skip_bytes, info->skip_bytes, LEXER_SKIP_BYTES) == 0;
+            state = next;
+            if (!same_skip) break;
+
+            mask &= mask - 1;
+            if (mask == 0) {
+                i = base + BLOCK_SIZE;
+                break;
+            }
+        }
+    }
+
+    for (; i < len; i++) {
+        state = transitions[state][data[i]];
+        lexer->tally[states[state].line_end]++;
+    }
+
+    lexer->state = (unsigned char)state;
+    lexer->any_input = true;
+}
+
+void lexer_finish(Lexer *lexer, unsigned long long *lines, unsigned long long *blank, unsigned long long *comments) {
+    const LexerStateInfo *info = &lexer->table->states[lexer->state];
+
+    // Input not ending with newline still has one last line
+    if (lexer->any_input && info->line_end == 0) {
+        lexer->tally[1 + info->eof_class]++;
+        lexer->state = 0;
+    }
+
+    if (blank) *blank = lexer->tally[1 + LINE_BLANK];
+    if (comments) *comments = lexer->tally[1 + LINE_COMMENT];
+    if (lines) *lines = lexer->tally[1 + LINE_BLANK] + lexer->tally[1 + LINE_COMMENT] + lexer->tally[1 + LINE_CODE];
+}
+
+void extension_map_init(ExtensionMap *map) {
+    if (map) map->count = 0;
+}
+
+bool extension_map_add(ExtensionMap *map, const char *extension, LanguageId language) {
+    if (!map || !extension || extension[0] != '.' || extension[1] == '\0') return false;
+    if (strlen(extension) >= MAX_EXTENSION_LEN) return false;
+    if (language <= LANG_UNKNOWN || language >= LANG_COUNT) return false;
+
+    for (int i = 0; i < map->count; i++) {
+        if (strcmp(map->entries[i].extension, extension) == 0) {
+            map->entries[i].language = language;
+            return true;
+        }
+    }
+    if (map->count >= MAX_EXTENSION_OVERRIDES) return false;
+
+    ExtensionOverride *entry = &map->entries[map->count++];
+    strcpy(entry->extension, extension);
+    entry->language = language;
+    return true;
+}
+
+// Look up the language for a file name by its extension
+LanguageId language_from_filename(const char *filename) {
+    if (!filename) return LANG_UNKNOWN;
+
+    const char *ext = strrchr(filename, '.');
+    if (!ext) return LANG_UNKNOWN;
+
+    // Pack the bytes after the dot into the hash key; longer extensions
+    // cannot be in the table
+    uint64_t key = 0;
+    for (int i = 1; ext[i]; i++) {
+        if (i > EXTENSION_KEY_BYTES) return LANG_UNKNOWN;
+        key |= (uint64_t)(unsigned char)ext[i] << (8 * (i - 1));
+    }
+    if (key == 0) return LANG_UNKNOWN;
+
+    const ExtensionSlot *slot = &extension_slots[(key * extension_hash.multiplier) >> extension_hash.shift];
+    return slot->key == key ? slot->language : LANG_UNKNOWN;
+}
+
+LanguageId language_from_filename_mapped(const ExtensionMap *map, const char *filename) {
+    if (map && map->count > 0 && filename) {
+        const char *ext = strrchr(filename, '.');
+        if (ext) {
+            for (int i = 0; i < map->count; i++) {
+                if (strcmp(ext, map->entries[i].extension) == 0) return map->entries[i].language;
+            }
+        }
+    }
+    return language_from_filename(filename);
+}
+
+static int strcasecmp_ascii(const char *a, const char *b) {
+    for (;; a++, b++) {
+        int ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : (unsigned char)*a;
+        int cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : (unsigned char)*b;
+        if (ca != cb || ca == 0) return ca - cb;
+    }
+}
+
+LanguageId language_from_name(const char *name) {
+    if (!name) return LANG_UNKNOWN;
+    for (int i = LANG_UNKNOWN + 1; i < LANG_COUNT; i++) {
+        if (strcasecmp_ascii(name, language_table[i].name) == 0 ||
+            strcasecmp_ascii(name, language_table[i].id) == 0) {
+            return (LanguageId)i;
+        }
+    }
+    return LANG_UNKNOWN;
+}
+
+const char* language_name(LanguageId language) {
+    if (language < 0 || language >= LANG_COUNT) language = LANG_UNKNOWN;
+    return language_table[language].name;
+}
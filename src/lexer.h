@@ -0,0 +1,126 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Language identifiers, one per descriptor in languages.def
+typedef enum {
+    LANG_UNKNOWN = 0,
+#define LANGUAGE(id, name, extensions, line_comments, block_comments, strings) LANG_##id,
+#include "languages.def"
+#undef LANGUAGE
+    LANG_COUNT
+} LanguageId;
+
+// Classification of a finished line
+enum {
+    LINE_BLANK = 0,
+    LINE_COMMENT = 1,
+    LINE_CODE = 2
+};
+
+// How the fast path finds the next byte that leaves the current state
+enum {
+    LEXER_STOP_ALL = 0,     // Every byte may change the state
+    LEXER_STOP_IN = 1,      // Only the bytes in skip_bytes change the state
+    LEXER_STOP_NOT_IN = 2   // Every byte except those in skip_bytes changes the state
+};
+
+#define LEXER_SKIP_BYTES 8
+
+// Per-state data emitted by tools/genlang.c next to the transition table
+typedef struct {
+    unsigned char line_end;     // 0, or 1 + line class of the line ended by the '\n' that entered this state
+    unsigned char eof_class;    // Line class of the current line if the input ends in this state
+    unsigned char skip_mode;
+    unsigned char skip_count;
+    unsigned char skip_bytes[LEXER_SKIP_BYTES];
+} LexerStateInfo;
+
+// A compiled language: state = transitions[state][byte]
+typedef struct {
+    int state_count;
+    const unsigned char (*transitions)[256];
+    const LexerStateInfo *states;
+} LexerTable;
+
+typedef struct {
+    const char *name;           // Display name, e.g. "C++"
+    const char *id;             // Lower-case identifier, e.g. "cpp"
+    const LexerTable *table;
+} LanguageInfo;
+
+// Extensions of up to this many bytes (after the dot) are packed into a
+// 64-bit key for the generated perfect hash
+#define EXTENSION_KEY_BYTES 8
+
+// Slot = (key * multiplier) >> shift
+typedef struct {
+    uint64_t multiplier;
+    int shift;
+} ExtensionHash;
+
+typedef struct {
+    uint64_t key;               // 0 for an empty slot
+    LanguageId language;
+} ExtensionSlot;
+
+// Generated tables (langtables.c)
+extern const LanguageInfo language_table[LANG_COUNT];
+extern const ExtensionHash extension_hash;
+extern const ExtensionSlot extension_slots[];
+
+// Fingerprint of all generated tables; changes whenever the counting rules do
+extern const unsigned long long language_tables_hash;
+
+// Streaming lexer: feed any number of blocks, then call lexer_finish once
+typedef struct {
+    const LexerTable *table;
+    unsigned char state;
+    bool any_input;
+    unsigned long long tally[4];    // Indexed by LexerStateInfo.line_end
+} Lexer;
+
+void lexer_init(Lexer *lexer, LanguageId language);
+void lexer_feed(Lexer *lexer, const unsigned char *data, size_t len);
+void lexer_finish(Lexer *lexer, unsigned long long *lines, unsigned long long *blank, unsigned long long *comments);
+
+// One table lookup per byte with no skipping; the reference for self-check mode
+void lexer_feed_reference(Lexer *lexer, const unsigned char *data, size_t len);
+
+// Language of a file by its extension in the built-in table, LANG_UNKNOWN
+// if it is not counted. Does not allocate; safe to call from any thread.
+LanguageId language_from_filename(const char *filename);
+const char* language_name(LanguageId language);
+
+// Match a language by display name or identifier, ignoring case ("c++", "cpp")
+LanguageId language_from_name(const char *name);
+
+// Extensions mapped to a language (".proto" -> C), taking precedence over
+// the built-in table. Plain data owned by the caller, so every scan can have
+// its own; fill it in before counting starts and leave it alone meanwhile.
+#define MAX_EXTENSION_OVERRIDES 64
+#define MAX_EXTENSION_LEN 32
+
+typedef struct {
+    char extension[MAX_EXTENSION_LEN];
+    LanguageId language;
+} ExtensionOverride;
+
+typedef struct {
+    ExtensionOverride entries[MAX_EXTENSION_OVERRIDES];
+    int count;
+} ExtensionMap;
+
+void extension_map_init(ExtensionMap *map);
+
+// Add or replace an override; false if the extension does not start with
+// '.', is too long, or the map is full
+bool extension_map_add(ExtensionMap *map, const char *extension, LanguageId language);
+
+// language_from_filename with the overrides in `map` (may be NULL) first
+LanguageId language_from_filename_mapped(const ExtensionMap *map, const char *filename);
+
+#endif // LEXER_H
@@ -0,0 +1,101 @@
+#include "libcountlines.h"
+
+struct CountLinesContext {
+    ExcludeList *exclude_list;
+    ExtensionMap extensions;
+    int jobs;
+    IoMode io_mode;
+    bool classic;
+};
+
+CountLinesContext* countlines_context_create(void) {
+    CountLinesContext *context = malloc(sizeof(CountLinesContext));
+    if (!context) return NULL;
+    context->exclude_list = create_exclude_list();
+    if (!context->exclude_list) {
+        free(context);
+        return NULL;
+    }
+    extension_map_init(&context->extensions);
+    context->jobs = 1;
+    context->io_mode = IO_AUTO;
+    context->classic = false;
+    return context;
+}
+
+void countlines_context_destroy(CountLinesContext *context) {
+    if (!context) return;
+    free_exclude_list(context->exclude_list);
+    free(context);
+}
+
+bool countlines_exclude(CountLinesContext *context, const char *pattern) {
+    if (!context || !pattern || pattern[0] == '\0') return false;
+    int count = context->exclude_list->count;
+    add_exclude_pattern(context->exclude_list, pattern);
+    return context->exclude_list->count > count;
+}
+
+bool countlines_map_extension(CountLinesContext *context, const char *extension, LanguageId language) {
+    return context && extension_map_add(&context->extensions, extension, language);
+}
+
+void countlines_set_jobs(CountLinesContext *context, int jobs) {
+    if (context) context->jobs = jobs;
+}
+
+void countlines_set_io_mode(CountLinesContext *context, IoMode io_mode) {
+    if (context && io_mode >= 0 && io_mode < IO_MODE_COUNT) context->io_mode = io_mode;
+}
+
+void countlines_set_classic(CountLinesContext *context, bool classic) {
+    if (context) context->classic = classic;
+}
+
+LanguageId countlines_language(const CountLinesContext *context, const char *filename) {
+    return language_from_filename_mapped(context ? &context->extensions : NULL, filename);
+}
+
+CountResult countlines_count_buffer(const CountLinesContext *context, const char *data, size_t len,
+                                    LanguageId language) {
+    CountResult result = {0, 0, 0, 0, 0};
+    FileCounter counter;
+    file_counter_init(&counter, language, context && context->classic);
+    if (data && len > 0) file_counter_feed(&counter, (const unsigned char *)data, len);
+    result.total_lines = file_counter_finish(&counter, &result);
+    return result;
+}
+
+CountResult count_buffer(const char *data, size_t len, LanguageId language) {
+    return countlines_count_buffer(NULL, data, len, language);
+}
+
+static bool is_directory(const char *path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributes(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+#endif
+}
+
+bool countlines_count_directory(const CountLinesContext *context, const char *path,
+                                const CountLinesVisitor *visitor, CountResult *result) {
+    if (!context || !path || !result || !is_directory(path)) return false;
+
+    CountOptions options;
+    init_count_options(&options);
+    options.exclude_list = context->exclude_list;
+    options.extensions = &context->extensions;
+    options.jobs = context->jobs;
+    options.io_mode = context->io_mode;
+    options.classic = context->classic;
+    if (visitor) {
+        options.want_file = visitor->want_file;
+        options.on_file = visitor->on_file;
+        options.visitor_ctx = visitor->ctx;
+    }
+    count_lines_with_options(path, &options, result);
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef LIBCOUNTLINES_H
+#define LIBCOUNTLINES_H
+
+#include "countlines.h"
+
+// Embedding API of the countlines library (libcountlines.a / libcountlines.so).
+//
+// A CountLinesContext holds everything a scan depends on: exclude patterns,
+// extension overrides, worker threads, the I/O mode and the counting rules.
+// The library keeps no global state, so any number of contexts can be used
+// from any threads at once, and one context can run several scans at the
+// same time as long as nothing reconfigures it meanwhile.
+
+typedef struct CountLinesContext CountLinesContext;
+
+// A context with the defaults of the command line tool minus its default
+// exclusions: one thread, IO_AUTO, the per-language lexers, no cache.
+// Returns NULL when out of memory.
+CountLinesContext* countlines_context_create(void);
+void countlines_context_destroy(CountLinesContext *context);
+
+// Configuration; not synchronised with scans running on the same context.
+// The pattern syntax is that of --exclude. Both return false on bad input
+// or when out of memory.
+bool countlines_exclude(CountLinesContext *context, const char *pattern);
+bool countlines_map_extension(CountLinesContext *context, const char *extension, LanguageId language);
+void countlines_set_jobs(CountLinesContext *context, int jobs);             // <= 0 = one per CPU
+void countlines_set_io_mode(CountLinesContext *context, IoMode io_mode);
+void countlines_set_classic(CountLinesContext *context, bool classic);
+
+// Language a scan with this context counts `filename` as; LANG_UNKNOWN if
+// it would skip the file
+LanguageId countlines_language(const CountLinesContext *context, const char *filename);
+
+// Counts of one file whose contents are already in memory, with the
+// language's lexer (LANG_UNKNOWN counts every non-blank line as code)
+CountResult count_buffer(const char *data, size_t len, LanguageId language);
+
+// count_buffer under the context's rules (--classic)
+CountResult countlines_count_buffer(const CountLinesContext *context, const char *data, size_t len,
+                                    LanguageId language);
+
+// Per-file callbacks of a directory scan. Both are optional and are called
+// on the scan's worker threads, concurrently when jobs > 1.
+typedef struct {
+    // Before a file is read: return false to leave it out of the scan, for
+    // instance because the caller holds its contents and uses count_buffer
+    FileFilter want_file;
+    // Once a file has been counted
+    FileVisitor on_file;
+    void *ctx;
+} CountLinesVisitor;
+
+// Count the tree below `path` into `result` (which is not cleared first).
+// `visitor` may be NULL. Returns false if `path` is not a directory.
+bool countlines_count_directory(const CountLinesContext *context, const char *path,
+                                const CountLinesVisitor *visitor, CountResult *result);
+
+#endif // LIBCOUNTLINES_H
@@ -1,30 +1,96 @@
 #include "countlines.h"
 #include "webserver.h"
+#include "classifier.h"
+#include "uring.h"
+#include "watch.h"
+#include "batch.h"
+#include "shard.h"
+#include "threading.h"
 #include <time.h>
 
 #define VERSION "1.0.0"
 
+// The value of option argv[*i], named `name`: what follows "--name=", or else
+// the next argument, which *i then moves past. NULL if there is none.
+static const char* option_value(int argc, char *argv[], int *i, const char *name) {
+    size_t name_len = strlen(name);
+    if (argv[*i][name_len] == '=') return argv[*i] + name_len + 1;
+    return *i + 1 < argc ? argv[++*i] : NULL;
+}
+
+// Parse the integer value of option argv[*i] ("--name N" or "--name=N") into *out
+static bool parse_int_option(int argc, char *argv[], int *i, const char *name, long min, long max, int *out) {
+    const char *value = option_value(argc, argv, i, name);
+    char *end = NULL;
+    long parsed = value ? strtol(value, &end, 10) : min - 1;
+    if (!value || *value == '\0' || *end != '\0' || parsed < min || parsed > max) {
+        fprintf(stderr, "Error: %s option requires a number between %ld and %ld\n", name, min, max);
+        return false;
+    }
+    *out = (int)parsed;
+    return true;
+}
+
+// Parse a byte count with an optional K, M or G suffix (powers of 1024)
+static bool parse_size(const char *value, unsigned long long *out) {
+    char *end = NULL;
+    if (!value || *value < '0' || *value > '9') return false;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') shift = 10;
+    else if (*end == 'M' || *end == 'm') shift = 20;
+    else if (*end == 'G' || *end == 'g') shift = 30;
+    if (shift) end++;
+    if (*end != '\0' || parsed == 0 || parsed > (~0ULL >> shift)) return false;
+    *out = parsed << shift;
+    return true;
+}
+
+static bool is_option(const char *arg, const char *name) {
+    size_t name_len = strlen(name);
+    return strncmp(arg, name, name_len) == 0 && (arg[name_len] == '\0' || arg[name_len] == '=');
+}
+
+// WatchCallback: one line per applied batch of changes
+static void print_watch_update(void *ctx, const WatchUpdate *update) {
+    (void)ctx;
+    char stamp[16];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&now));
+    printf("[%s] %llu changed: %llu files (%+lld), %llu lines (%+lld), code %llu (%+lld), "
+           "comments %llu (%+lld), blank %llu (%+lld)\n",
+           stamp, update->changed_files,
+           update->totals.total_files, update->delta.files,
+           update->totals.total_lines, update->delta.lines,
+           update->totals.code_lines, update->delta.code,
+           update->totals.comment_lines, update->delta.comments,
+           update->totals.blank_lines, update->delta.blank);
+    fflush(stdout);
+}
+
+// FileVisitor and SkipVisitor for --verbose: one line per file, from
+// whichever worker thread finished it
+static void print_counted_file(void *ctx, const char *dir_path, const char *name, LanguageId language,
+                               const CountResult *counts) {
+    (void)ctx;
+    printf("counted  %s%c%s: %s, %llu lines\n", dir_path, PATH_SEPARATOR, name, language_name(language),
+           counts->total_lines);
+}
+
+static void print_skipped_file(void *ctx, const char *dir_path, const char *name, LanguageId language,
+                               const SniffVerdict *verdict) {
+    (void)language;
+    char reason[256];
+    sniff_describe(ctx, verdict, reason, sizeof(reason));
+    printf("skipped  %s%c%s: %s\n", dir_path, PATH_SEPARATOR, name, reason);
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
     }
     
-    // Check for web server mode
-    if (argc == 2 && (strcmp(argv[1], "--web") == 0 || strcmp(argv[1], "-w") == 0)) {
-        return start_web_server(WEB_PORT);
-    }
-    
-    // Check for web server with custom port
-    if (argc == 3 && (strcmp(argv[1], "--web") == 0 || strcmp(argv[1], "-w") == 0)) {
-        int port = atoi(argv[2]);
-        if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Error: Invalid port number '%s'\n", argv[2]);
-            return 1;
-        }
-        return start_web_server(port);
-    }
-    
     ExcludeList *exclude_list = create_exclude_list();
     if (!exclude_list) {
         fprintf(stderr, "Error: Failed to initialize exclude list\n");
@@ -41,6 +107,34 @@ int main(int argc, char *argv[]) {
     add_exclude_pattern(exclude_list, ".vscode");
     
     char *target_path = NULL;
+    const char *batch_path = NULL;
+    const char *worker_address = NULL;
+    const char *coordinators[SHARD_MAX_WORKERS];
+    int coordinator_count = 0;
+    int jobs = 1;
+    bool self_check = false;
+    bool classic = false;
+    ExtensionMap extensions;
+    extension_map_init(&extensions);
+    bool use_cache = false;     // --cache: the scanned tree is not written to otherwise
+    bool rebuild_cache = false;
+    bool web = false;
+    WebServerOptions web_options;
+    init_web_server_options(&web_options);
+    IoMode io_mode = IO_AUTO;
+    int io_depth = 0;
+    int max_open_dirs = 0;      // 0 = half the descriptor limit
+    bool report_io = false;
+    bool breakdown = false;
+    bool watch = false;
+    bool git = false;
+    bool tar = false;
+    bool dedupe = false;
+    bool sniff = false;
+    bool verbose = false;
+    SniffOptions sniff_options;
+    sniff_options_init(&sniff_options);
+    int profile_slowest = -1;   // Slowest files and directories listed; -1 = no profile
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -55,20 +149,219 @@ int main(int argc, char *argv[]) {
             free_exclude_list(exclude_list);
             return 0;
         }
-        else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--exclude") == 0) {
-            if (i + 1 < argc) {
-                add_exclude_pattern(exclude_list, argv[i + 1]);
-                i++; // Skip next argument as it's the exclude pattern
-            } else {
+        else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--web") == 0) {
+            web = true;
+            // An optional port follows
+            if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                int port = atoi(argv[++i]);
+                if (port <= 0 || port > 65535) {
+                    fprintf(stderr, "Error: Invalid port number '%s'\n", argv[i]);
+                    free_exclude_list(exclude_list);
+                    return 1;
+                }
+                web_options.port = port;
+            }
+        }
+        else if (is_option(argv[i], "--backlog")) {
+            if (!parse_int_option(argc, argv, &i, "--backlog", 1, 65535, &web_options.backlog)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (is_option(argv[i], "--web-workers")) {
+            if (!parse_int_option(argc, argv, &i, "--web-workers", 0, 1024, &web_options.workers)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (is_option(argv[i], "--web-queue")) {
+            if (!parse_int_option(argc, argv, &i, "--web-queue", 0, 65535, &web_options.queue_limit)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (is_option(argv[i], "--web-cache-ttl")) {
+            if (!parse_int_option(argc, argv, &i, "--web-cache-ttl", 0, 86400, &web_options.cache_ttl)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0 || is_option(argv[i], "--exclude")) {
+            const char *pattern = option_value(argc, argv, &i, argv[i][1] == '-' ? "--exclude" : "-e");
+            if (!pattern) {
                 fprintf(stderr, "Error: --exclude option requires an argument\n");
                 free_exclude_list(exclude_list);
                 return 1;
             }
+            add_exclude_pattern(exclude_list, pattern);
+        }
+        else if (is_option(argv[i], "--io")) {
+            const char *value = option_value(argc, argv, &i, "--io");
+            if (!parse_io_mode(value, &io_mode)) {
+                fprintf(stderr, "Error: --io option requires one of: auto, read, mmap, direct, uring\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            report_io = true;
+        }
+        else if (is_option(argv[i], "--max-open-dirs")) {
+            if (!parse_int_option(argc, argv, &i, "--max-open-dirs", 1, 1000000, &max_open_dirs)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
         }
-        else if (strncmp(argv[i], "--exclude=", 10) == 0) {
-            add_exclude_pattern(exclude_list, argv[i] + 10);
+        else if (is_option(argv[i], "--io-depth")) {
+            const char *value = option_value(argc, argv, &i, "--io-depth");
+            char *end = NULL;
+            long parsed = value ? strtol(value, &end, 10) : -1;
+            if (!value || *value == '\0' || *end != '\0' || parsed < 1 || parsed > URING_MAX_DEPTH) {
+                fprintf(stderr, "Error: --io-depth option requires a queue depth between 1 and %d\n", URING_MAX_DEPTH);
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            io_depth = (int)parsed;
         }
-        else if (argv[i][0] == '-') {
+        else if (is_option(argv[i], "--ext")) {
+            const char *value = option_value(argc, argv, &i, "--ext");
+            const char *equals = value ? strchr(value, '=') : NULL;
+            char extension[MAX_EXTENSION_LEN];
+            size_t ext_len = equals ? (size_t)(equals - value) : 0;
+            LanguageId language = equals ? language_from_name(equals + 1) : LANG_UNKNOWN;
+            if (!equals || ext_len >= sizeof(extension)) {
+                fprintf(stderr, "Error: --ext option requires .EXT=LANGUAGE, e.g. --ext .proto=c\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            memcpy(extension, value, ext_len);
+            extension[ext_len] = '\0';
+            if (language == LANG_UNKNOWN) {
+                fprintf(stderr, "Error: Unknown language '%s' for --ext\n", equals + 1);
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            if (!extension_map_add(&extensions, extension, language)) {
+                fprintf(stderr, "Error: Cannot map extension '%s' (must start with '.', at most %d overrides)\n",
+                        extension, MAX_EXTENSION_OVERRIDES);
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        }
+        else if (strcmp(argv[i], "--rebuild-cache") == 0) {
+            rebuild_cache = true;
+        }
+        else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--breakdown") == 0) {
+            breakdown = true;
+        }
+        else if (strcmp(argv[i], "--git") == 0) {
+            git = true;
+        }
+        else if (strcmp(argv[i], "--tar") == 0) {
+            tar = true;
+        }
+        else if (strcmp(argv[i], "--sniff") == 0) {
+            sniff = true;
+        }
+        else if (is_option(argv[i], "--max-size")) {
+            const char *value = option_value(argc, argv, &i, "--max-size");
+            if (!parse_size(value, &sniff_options.max_size)) {
+                fprintf(stderr, "Error: --max-size option requires a size in bytes, e.g. 1M or 512K\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            sniff = true;
+        }
+        else if (is_option(argv[i], "--max-line")) {
+            int max_line;
+            if (!parse_int_option(argc, argv, &i, "--max-line", 0, SNIFF_WINDOW - 1, &max_line)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            sniff_options.max_line_length = (size_t)max_line;
+            sniff = true;
+        }
+        else if (is_option(argv[i], "--generated-marker")) {
+            const char *value = option_value(argc, argv, &i, "--generated-marker");
+            if (!value || !sniff_add_marker(&sniff_options, value)) {
+                fprintf(stderr, "Error: --generated-marker option requires text of 1 to %d bytes (at most %d markers)\n",
+                        SNIFF_MAX_MARKER_LEN - 1, SNIFF_MAX_MARKERS);
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            sniff = true;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        }
+        else if (strcmp(argv[i], "--dedupe") == 0) {
+            dedupe = true;
+        }
+        else if (is_option(argv[i], "--batch")) {
+            batch_path = option_value(argc, argv, &i, "--batch");
+            if (!batch_path || *batch_path == '\0') {
+                fprintf(stderr, "Error: --batch option requires a file listing the roots (\"-\" for standard input)\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (is_option(argv[i], "--worker")) {
+            worker_address = option_value(argc, argv, &i, "--worker");
+            if (!worker_address || *worker_address == '\0') {
+                fprintf(stderr, "Error: --worker option requires an address (HOST:PORT, PORT or unix:PATH)\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (is_option(argv[i], "--coordinate")) {
+            const char *address = option_value(argc, argv, &i, "--coordinate");
+            if (!address || *address == '\0') {
+                fprintf(stderr, "Error: --coordinate option requires a worker address (HOST:PORT or unix:PATH)\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            if (coordinator_count >= SHARD_MAX_WORKERS) {
+                fprintf(stderr, "Error: Too many workers (maximum %d)\n", SHARD_MAX_WORKERS);
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            coordinators[coordinator_count++] = address;
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile_slowest = PROFILE_DEFAULT_SLOWEST;
+        }
+        else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            // The count is attached with '=' only, since the target directory may follow
+            if (!parse_int_option(argc, argv, &i, "--profile", 0, PROFILE_MAX_SLOWEST, &profile_slowest)) {
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--classic") == 0) {
+            classic = true;
+        }
+        else if (strcmp(argv[i], "--self-check") == 0) {
+            self_check = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 || is_option(argv[i], "--jobs")) {
+            const char *value = option_value(argc, argv, &i, argv[i][1] == '-' ? "--jobs" : "-j");
+            char *end = NULL;
+            long parsed = value ? strtol(value, &end, 10) : -1;
+            if (!value || *value == '\0' || *end != '\0' || parsed < 0 || parsed > 1024) {
+                fprintf(stderr, "Error: --jobs option requires a thread count between 0 and 1024\n");
+                free_exclude_list(exclude_list);
+                return 1;
+            }
+            jobs = (int)parsed;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') {
             fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
             print_usage(argv[0]);
             free_exclude_list(exclude_list);
@@ -87,6 +380,106 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    if (web) {
+        free_exclude_list(exclude_list);
+        if (target_path) {
+            fprintf(stderr, "Error: --web does not take a target directory\n");
+            return 1;
+        }
+        return start_web_server_with_options(&web_options);
+    }
+    
+    if (watch && self_check) {
+        fprintf(stderr, "Error: --watch cannot be combined with --self-check\n");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if (watch && git) {
+        fprintf(stderr, "Error: --watch cannot be combined with --git\n");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if (tar && (watch || git || self_check)) {
+        fprintf(stderr, "Error: --tar cannot be combined with %s\n",
+                watch ? "--watch" : git ? "--git" : "--self-check");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if ((sniff || verbose) && (watch || self_check)) {
+        fprintf(stderr, "Error: %s cannot be combined with %s\n", sniff ? "--sniff" : "--verbose",
+                watch ? "--watch" : "--self-check");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if (dedupe && (watch || self_check)) {
+        fprintf(stderr, "Error: --dedupe cannot be combined with %s\n", watch ? "--watch" : "--self-check");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if (profile_slowest >= 0 && self_check) {
+        fprintf(stderr, "Error: --profile cannot be combined with --self-check\n");
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    
+    if (worker_address || coordinator_count > 0) {
+        const char *mode = worker_address ? "--worker" : "--coordinate";
+        const char *conflict = (worker_address && target_path) ? "a target directory" :
+                               (worker_address && coordinator_count > 0) ? "--coordinate" :
+                               batch_path ? "--batch" : watch ? "--watch" : self_check ? "--self-check" :
+                               git ? "--git" : tar ? "--tar" : dedupe ? "--dedupe" : breakdown ? "--breakdown" :
+                               sniff ? "--sniff" : (verbose && !worker_address) ? "--verbose" :
+                               profile_slowest >= 0 ? "--profile" : NULL;
+        if (conflict) {
+            fprintf(stderr, "Error: %s cannot be combined with %s\n", mode, conflict);
+            free_exclude_list(exclude_list);
+            return 1;
+        }
+    }
+    
+    if (worker_address) {
+        // The exclusions and counting rules come from each coordinator
+        CountOptions options;
+        init_count_options(&options);
+        options.jobs = jobs;
+        options.io_mode = io_mode;
+        options.io_depth = io_depth;
+        options.max_open_dirs = max_open_dirs;
+        int status = shard_worker_run(worker_address, &options, verbose);
+        free_exclude_list(exclude_list);
+        return status;
+    }
+    
+    if (batch_path) {
+        const char *conflict = target_path ? "a target directory" : watch ? "--watch" : self_check ? "--self-check" :
+                               git ? "--git" : dedupe ? "--dedupe" : breakdown ? "--breakdown" :
+                               verbose ? "--verbose" : profile_slowest >= 0 ? "--profile" : NULL;
+        if (conflict) {
+            fprintf(stderr, "Error: --batch cannot be combined with %s\n", conflict);
+            free_exclude_list(exclude_list);
+            return 1;
+        }
+        CountOptions options;
+        init_count_options(&options);
+        options.exclude_list = exclude_list;
+        options.jobs = jobs;
+        options.io_mode = io_mode;
+        options.io_depth = io_depth;
+        options.max_open_dirs = max_open_dirs;
+        options.classic = classic;
+        options.extensions = &extensions;
+        options.tar = tar;
+        if (sniff) options.sniff = &sniff_options;
+        int status = run_batch(batch_path, &options);
+        free_exclude_list(exclude_list);
+        return status;
+    }
+    
     if (target_path == NULL) {
         fprintf(stderr, "Error: No target directory specified\n");
         print_usage(argv[0]);
@@ -94,34 +487,57 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    // Check if target path exists
+    // Check if target path exists; an archive is a file, "-" standard input
+    bool stdin_archive = tar && strcmp(target_path, "-") == 0;
 #ifdef _WIN32
-    DWORD attributes = GetFileAttributes(target_path);
+    DWORD attributes = stdin_archive ? 0 : GetFileAttributes(target_path);
     if (attributes == INVALID_FILE_ATTRIBUTES) {
         fprintf(stderr, "Error: Path '%s' does not exist\n", target_path);
         free_exclude_list(exclude_list);
         return 1;
     }
-    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    if (tar && (attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        fprintf(stderr, "Error: '%s' is a directory, not a tar archive\n", target_path);
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    if (!tar && !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
         fprintf(stderr, "Error: '%s' is not a directory\n", target_path);
         free_exclude_list(exclude_list);
         return 1;
     }
 #else
     struct stat path_stat;
-    if (stat(target_path, &path_stat) != 0) {
+    if (!stdin_archive && stat(target_path, &path_stat) != 0) {
         fprintf(stderr, "Error: Path '%s' does not exist\n", target_path);
         free_exclude_list(exclude_list);
         return 1;
     }
-    if (!S_ISDIR(path_stat.st_mode)) {
+    if (tar && !stdin_archive && S_ISDIR(path_stat.st_mode)) {
+        fprintf(stderr, "Error: '%s' is a directory, not a tar archive\n", target_path);
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    if (!tar && !S_ISDIR(path_stat.st_mode)) {
         fprintf(stderr, "Error: '%s' is not a directory\n", target_path);
         free_exclude_list(exclude_list);
         return 1;
     }
 #endif
     
-    printf("Counting lines in: %s\n", target_path);
+    GitRepo git_repo;
+    if (git) {
+        const char *reason = NULL;
+        if (!git_repo_open(&git_repo, target_path, &reason)) {
+            fprintf(stderr, "Error: --git: %s: %s\n", target_path, reason);
+            free_exclude_list(exclude_list);
+            return 1;
+        }
+    }
+    
+    const char *target_name = stdin_archive ? "(standard input)" : target_path;
+    printf("Counting lines in: %s\n", target_name);
+    if (git) printf("Tracked files from: %s\n", git_repo.index_path);
     if (exclude_list->count > 0) {
         printf("Excluding patterns: ");
         for (int i = 0; i < exclude_list->count; i++) {
@@ -135,16 +551,137 @@ int main(int argc, char *argv[]) {
     // Initialize result structure
     CountResult result = {0, 0, 0, 0, 0};
     
-    // Start counting
-    clock_t start_time = clock();
-    count_lines_in_directory(target_path, exclude_list, &result);
-    clock_t end_time = clock();
+    if (coordinator_count > 0) {
+        CountOptions options;
+        init_count_options(&options);
+        options.exclude_list = exclude_list;
+        options.jobs = jobs;
+        options.classic = classic;
+        options.extensions = &extensions;
+        ShardStats shard_stats;
+        unsigned long long start_time = cl_monotonic_ns();
+        bool ok = shard_coordinate(target_path, coordinators, coordinator_count, &options, &result, &shard_stats);
+        double elapsed_time = (cl_monotonic_ns() - start_time) / 1e9;
+        if (ok) {
+            print_results(&result, target_name);
+            printf("\nProcessing completed in %.3f seconds\n", elapsed_time);
+            print_shard_stats(&shard_stats);
+        }
+        free_exclude_list(exclude_list);
+        return ok ? 0 : 1;
+    }
+    
+    CountOptions options;
+    init_count_options(&options);
+    options.exclude_list = exclude_list;
+    options.jobs = jobs;
+    options.io_mode = io_mode;
+    options.io_depth = io_depth;
+    options.max_open_dirs = max_open_dirs;
+    options.classic = classic;
+    options.extensions = &extensions;
+    options.git = git ? &git_repo : NULL;
+    options.tar = tar;
+    options.dedupe = dedupe;
+    if (sniff) options.sniff = &sniff_options;
+    if (verbose) {
+        options.on_file = print_counted_file;
+        options.on_skip = print_skipped_file;
+        options.visitor_ctx = &sniff_options;
+    }
+    options.use_cache = use_cache || rebuild_cache;
+    options.rebuild_cache = rebuild_cache;
+    
+    CacheStats cache_stats;
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    options.cache_stats = &cache_stats;
+    
+    IoStats io_stats;
+    memset(&io_stats, 0, sizeof(io_stats));
+    options.io_stats = &io_stats;
+    
+    CountBreakdown count_breakdown;
+    memset(&count_breakdown, 0, sizeof(count_breakdown));
+    if (breakdown) options.breakdown = &count_breakdown;
+    
+    SniffStats sniff_stats;
+    memset(&sniff_stats, 0, sizeof(sniff_stats));
+    options.sniff_stats = &sniff_stats;
+    
+    DedupeStats dedupe_stats;
+    memset(&dedupe_stats, 0, sizeof(dedupe_stats));
+    if (dedupe) options.dedupe_stats = &dedupe_stats;
+    
+    ScanProfile profile;
+    scan_profile_init(&profile, profile_slowest);
+    if (profile_slowest >= 0) options.profile = &profile;
+    
+    if (self_check) {
+        unsigned long long mismatches = self_check_directory(target_path, &options, &result);
+        printf("\nSelf-check (%s): %llu files compared, %llu mismatches\n",
+               classifier_backend_name(), result.total_files, mismatches);
+        free_exclude_list(exclude_list);
+        return mismatches == 0 ? 0 : 2;
+    }
+    
+    Watcher *watcher = NULL;
+    if (watch) {
+        const char *reason = NULL;
+        watcher = watcher_create(&reason);
+        if (!watcher) {
+            fprintf(stderr, "Error: Cannot watch for changes: %s\n", reason);
+            free_exclude_list(exclude_list);
+            return 1;
+        }
+    }
+    
+    // Start counting; wall time, since the scan waits for I/O and runs on several threads
+    unsigned long long start_time = cl_monotonic_ns();
+    unsigned long long start_cpu = cl_process_cpu_ns();
+    if (watcher) {
+        watcher_scan(watcher, target_path, &options, &result);
+    } else if (!count_lines_with_options(target_path, &options, &result)) {
+        // The reason is already out; a count of what was read would look complete
+        free_exclude_list(exclude_list);
+        return 1;
+    }
+    double elapsed_time = (cl_monotonic_ns() - start_time) / 1e9;
+    double cpu_time = (cl_process_cpu_ns() - start_cpu) / 1e9;
     
     // Print results
-    print_results(&result, target_path);
+    print_results(&result, target_name);
+    if (dedupe) print_dedupe_stats(&dedupe_stats, &result);
+    if (sniff) print_sniff_stats(&sniff_stats);
+    if (breakdown) {
+        print_breakdown(&count_breakdown);
+        free_count_breakdown(&count_breakdown);
+    }
+    
+    printf("\nProcessing completed in %.3f seconds (%.3f s CPU)\n", elapsed_time, cpu_time);
     
-    double elapsed_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
-    printf("\nProcessing completed in %.3f seconds\n", elapsed_time);
+    if (cache_stats.status) {
+        printf("Cache: %llu hits, %llu files read (%s, %s)\n", cache_stats.hits, cache_stats.misses,
+               cache_stats.status, cache_stats.written ? "updated" : "unchanged");
+    }
+    
+    if (report_io) {
+        print_io_stats(&io_stats);
+    }
+    
+    if (options.profile) {
+        print_scan_profile(&profile);
+        scan_profile_free(&profile);
+    }
+    
+    if (watcher) {
+        printf("\nWatching for changes (Ctrl+C to stop)...\n");
+        fflush(stdout);
+        int status = watcher_run(watcher, print_watch_update, NULL);
+        if (status != 0) fprintf(stderr, "Error: Watching for changes failed\n");
+        watcher_destroy(watcher);
+        free_exclude_list(exclude_list);
+        return status == 0 ? 0 : 1;
+    }
     
     // Cleanup
     free_exclude_list(exclude_list);
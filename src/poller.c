@@ -0,0 +1,187 @@
+#include "poller.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+
+struct Poller {
+    int epoll_fd;
+    struct epoll_event *ready;
+    int ready_capacity;
+};
+
+static unsigned to_epoll(int events) {
+    unsigned mask = 0;
+    if (events & POLLER_IN) mask |= EPOLLIN;
+    if (events & POLLER_OUT) mask |= EPOLLOUT;
+    return mask;
+}
+
+Poller* poller_create(void) {
+    Poller *poller = calloc(1, sizeof(Poller));
+    if (!poller) return NULL;
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epoll_fd < 0) {
+        free(poller);
+        return NULL;
+    }
+    return poller;
+}
+
+void poller_destroy(Poller *poller) {
+    if (!poller) return;
+    close(poller->epoll_fd);
+    free(poller->ready);
+    free(poller);
+}
+
+static bool control(Poller *poller, int op, int fd, int events, void *data) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events);
+    ev.data.ptr = data;
+    return epoll_ctl(poller->epoll_fd, op, fd, &ev) == 0;
+}
+
+bool poller_add(Poller *poller, int fd, int events, void *data) {
+    return control(poller, EPOLL_CTL_ADD, fd, events, data);
+}
+
+bool poller_modify(Poller *poller, int fd, int events, void *data) {
+    return control(poller, EPOLL_CTL_MOD, fd, events, data);
+}
+
+void poller_remove(Poller *poller, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int poller_wait(Poller *poller, PollEvent *events, int max_events, int timeout_ms) {
+    if (max_events > poller->ready_capacity) {
+        struct epoll_event *grown = realloc(poller->ready, sizeof(struct epoll_event) * max_events);
+        if (!grown) return -1;
+        poller->ready = grown;
+        poller->ready_capacity = max_events;
+    }
+
+    int count = epoll_wait(poller->epoll_fd, poller->ready, max_events, timeout_ms);
+    if (count < 0) return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < count; i++) {
+        unsigned mask = poller->ready[i].events;
+        events[i].data = poller->ready[i].data.ptr;
+        events[i].events = ((mask & EPOLLIN) ? POLLER_IN : 0) |
+                           ((mask & EPOLLOUT) ? POLLER_OUT : 0) |
+                           ((mask & (EPOLLERR | EPOLLHUP)) ? POLLER_ERR : 0);
+    }
+    return count;
+}
+
+#else
+
+// Portable fallback: one pollfd per descriptor, removal swaps in the last entry
+
+#ifdef _WIN32
+    #define poll WSAPoll
+    typedef ULONG poll_count_t;
+#else
+    #include <poll.h>
+    #include <errno.h>
+    typedef nfds_t poll_count_t;
+#endif
+
+struct Poller {
+    struct pollfd *fds;
+    void **data;
+    int count;
+    int capacity;
+};
+
+static short to_poll(int events) {
+    short mask = 0;
+    if (events & POLLER_IN) mask |= POLLIN;
+    if (events & POLLER_OUT) mask |= POLLOUT;
+    return mask;
+}
+
+static int find_fd(const Poller *poller, poll_fd_t fd) {
+    for (int i = 0; i < poller->count; i++) {
+        if (poller->fds[i].fd == fd) return i;
+    }
+    return -1;
+}
+
+Poller* poller_create(void) {
+    return calloc(1, sizeof(Poller));
+}
+
+void poller_destroy(Poller *poller) {
+    if (!poller) return;
+    free(poller->fds);
+    free(poller->data);
+    free(poller);
+}
+
+bool poller_add(Poller *poller, poll_fd_t fd, int events, void *data) {
+    if (poller->count == poller->capacity) {
+        int capacity = poller->capacity ? poller->capacity * 2 : 64;
+        struct pollfd *fds = realloc(poller->fds, sizeof(struct pollfd) * capacity);
+        if (!fds) return false;
+        poller->fds = fds;
+        void **user = realloc(poller->data, sizeof(void*) * capacity);
+        if (!user) return false;
+        poller->data = user;
+        poller->capacity = capacity;
+    }
+    poller->fds[poller->count].fd = fd;
+    poller->fds[poller->count].events = to_poll(events);
+    poller->fds[poller->count].revents = 0;
+    poller->data[poller->count] = data;
+    poller->count++;
+    return true;
+}
+
+bool poller_modify(Poller *poller, poll_fd_t fd, int events, void *data) {
+    int i = find_fd(poller, fd);
+    if (i < 0) return false;
+    poller->fds[i].events = to_poll(events);
+    poller->data[i] = data;
+    return true;
+}
+
+void poller_remove(Poller *poller, poll_fd_t fd) {
+    int i = find_fd(poller, fd);
+    if (i < 0) return;
+    poller->count--;
+    poller->fds[i] = poller->fds[poller->count];
+    poller->data[i] = poller->data[poller->count];
+}
+
+int poller_wait(Poller *poller, PollEvent *events, int max_events, int timeout_ms) {
+    int ready = poll(poller->fds, (poll_count_t)poller->count, timeout_ms);
+    if (ready < 0) {
+#ifndef _WIN32
+        if (errno == EINTR) return 0;
+#endif
+        return -1;
+    }
+
+    int stored = 0;
+    for (int i = 0; i < poller->count && stored < max_events && stored < ready; i++) {
+        short mask = poller->fds[i].revents;
+        if (!mask) continue;
+        events[stored].data = poller->data[i];
+        events[stored].events = ((mask & POLLIN) ? POLLER_IN : 0) |
+                                ((mask & POLLOUT) ? POLLER_OUT : 0) |
+                                ((mask & (POLLERR | POLLHUP | POLLNVAL)) ? POLLER_ERR : 0);
+        stored++;
+    }
+    return stored;
+}
+
+#endif
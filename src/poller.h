@@ -0,0 +1,41 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdbool.h>
+
+// Readiness notification for the web server's event loop: epoll on Linux,
+// poll() on other POSIX systems and WSAPoll on Windows. Level-triggered;
+// each registered descriptor carries a user pointer that is handed back
+// with its events.
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    typedef SOCKET poll_fd_t;
+#else
+    typedef int poll_fd_t;
+#endif
+
+enum {
+    POLLER_IN = 1,
+    POLLER_OUT = 2,
+    POLLER_ERR = 4      // Error or hang-up; reported even when not requested
+};
+
+typedef struct {
+    void *data;
+    int events;
+} PollEvent;
+
+typedef struct Poller Poller;
+
+Poller* poller_create(void);
+void poller_destroy(Poller *poller);
+
+bool poller_add(Poller *poller, poll_fd_t fd, int events, void *data);
+bool poller_modify(Poller *poller, poll_fd_t fd, int events, void *data);
+void poller_remove(Poller *poller, poll_fd_t fd);
+
+// Wait up to timeout_ms (-1 = forever); returns the number of events stored, or -1
+int poller_wait(Poller *poller, PollEvent *events, int max_events, int timeout_ms);
+
+#endif // POLLER_H
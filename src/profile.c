@@ -0,0 +1,249 @@
+#include "countlines.h"
+#include "threading.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+    "enumerate", "metadata", "exclude", "open", "read", "classify"
+};
+
+const char* profile_phase_name(ProfilePhase phase) {
+    return (phase >= 0 && phase < PHASE_COUNT) ? phase_names[phase] : "unknown";
+}
+
+void scan_profile_init(ScanProfile *profile, int slowest_limit) {
+    if (!profile) return;
+    memset(profile, 0, sizeof(ScanProfile));
+    if (slowest_limit < 0) slowest_limit = 0;
+    if (slowest_limit > PROFILE_MAX_SLOWEST) slowest_limit = PROFILE_MAX_SLOWEST;
+    profile->slowest_limit = slowest_limit;
+}
+
+static void free_slowest(SlowestList *list) {
+    for (int i = 0; i < list->count; i++) free(list->entries[i].path);
+    free(list->entries);
+    list->entries = NULL;
+    list->count = 0;
+}
+
+void scan_profile_free(ScanProfile *profile) {
+    if (!profile) return;
+    free_slowest(&profile->slowest_files);
+    free_slowest(&profile->slowest_directories);
+}
+
+ProfileStamp profile_now(void) {
+    ProfileStamp stamp;
+    stamp.wall = cl_monotonic_ns();
+    stamp.cpu = cl_thread_cpu_ns();
+    return stamp;
+}
+
+ProfileStamp profile_phase(ScanProfile *profile, ProfilePhase phase, ProfileStamp start) {
+    ProfileStamp now = profile_now();
+    PhaseTime *time = &profile->phases[phase];
+    time->calls++;
+    time->wall_ns += now.wall - start.wall;
+    time->cpu_ns += now.cpu >= start.cpu ? now.cpu - start.cpu : 0;
+    return now;
+}
+
+ProfileStamp profile_total(const ScanProfile *profile, unsigned mask) {
+    ProfileStamp total = {0, 0};
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (!(mask & PROFILE_MASK(i))) continue;
+        total.wall += profile->phases[i].wall_ns;
+        total.cpu += profile->phases[i].cpu_ns;
+    }
+    return total;
+}
+
+void profile_phase_except(ScanProfile *profile, ProfilePhase phase, ProfileStamp start,
+                          unsigned nested, ProfileStamp nested_before) {
+    ProfileStamp now = profile_now();
+    ProfileStamp inner = profile_total(profile, nested);
+    unsigned long long wall = now.wall - start.wall;
+    unsigned long long cpu = now.cpu >= start.cpu ? now.cpu - start.cpu : 0;
+    unsigned long long inner_wall = inner.wall - nested_before.wall;
+    unsigned long long inner_cpu = inner.cpu - nested_before.cpu;
+
+    // The CPU clock can be coarser than the nested sections it covers
+    PhaseTime *time = &profile->phases[phase];
+    time->calls++;
+    time->wall_ns += wall > inner_wall ? wall - inner_wall : 0;
+    time->cpu_ns += cpu > inner_cpu ? cpu - inner_cpu : 0;
+}
+
+static int bucket_of(unsigned long long ns) {
+    unsigned long long us = ns / 1000;
+    int bucket = 0;
+    while (us > 0 && bucket < PROFILE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+unsigned long long profile_bucket_limit_us(int bucket) {
+    return bucket < PROFILE_BUCKETS - 1 ? 1ULL << bucket : 0;
+}
+
+// Keep `entry` if it is among the `limit` slowest; takes ownership of its path
+static void add_slowest(SlowestList *list, int limit, ProfileEntry entry) {
+    if (list->count < limit) {
+        ProfileEntry *grown = realloc(list->entries, sizeof(ProfileEntry) * (list->count + 1));
+        if (!grown) {
+            free(entry.path);
+            return;
+        }
+        list->entries = grown;
+        list->count++;
+    } else {
+        free(list->entries[0].path);
+        memmove(list->entries, list->entries + 1, sizeof(ProfileEntry) * (list->count - 1));
+    }
+
+    int i = list->count - 1;
+    while (i > 0 && list->entries[i - 1].ns > entry.ns) {
+        list->entries[i] = list->entries[i - 1];
+        i--;
+    }
+    list->entries[i] = entry;
+}
+
+// Whether an entry taking `ns` would be kept; checked before its path is built
+static bool is_slowest(const SlowestList *list, int limit, unsigned long long ns) {
+    return limit > 0 && (list->count < limit || ns > list->entries[0].ns);
+}
+
+void profile_file(ScanProfile *profile, const char *dir_path, const char *name,
+                  unsigned long long ns, unsigned long long bytes) {
+    profile->file_histogram[bucket_of(ns)]++;
+    if (!is_slowest(&profile->slowest_files, profile->slowest_limit, ns)) return;
+
+    size_t dir_len = strlen(dir_path), name_len = strlen(name);
+    ProfileEntry entry;
+    entry.path = malloc(dir_len + 1 + name_len + 1);
+    if (!entry.path) return;
+    memcpy(entry.path, dir_path, dir_len);
+    entry.path[dir_len] = PATH_SEPARATOR;
+    memcpy(entry.path + dir_len + 1, name, name_len + 1);
+    entry.ns = ns;
+    entry.bytes = bytes;
+    add_slowest(&profile->slowest_files, profile->slowest_limit, entry);
+}
+
+void profile_directory(ScanProfile *profile, const char *path, unsigned long long ns) {
+    profile->directory_histogram[bucket_of(ns)]++;
+    if (!is_slowest(&profile->slowest_directories, profile->slowest_limit, ns)) return;
+
+    ProfileEntry entry;
+    entry.path = malloc(strlen(path) + 1);
+    if (!entry.path) return;
+    strcpy(entry.path, path);
+    entry.ns = ns;
+    entry.bytes = 0;
+    add_slowest(&profile->slowest_directories, profile->slowest_limit, entry);
+}
+
+static void merge_slowest(SlowestList *dst, SlowestList *src, int limit) {
+    for (int i = 0; i < src->count; i++) {
+        if (is_slowest(dst, limit, src->entries[i].ns)) {
+            add_slowest(dst, limit, src->entries[i]);
+        } else {
+            free(src->entries[i].path);
+        }
+    }
+    free(src->entries);
+    src->entries = NULL;
+    src->count = 0;
+}
+
+void merge_scan_profile(ScanProfile *dst, ScanProfile *src) {
+    if (!dst || !src) return;
+    dst->cpu_ns += src->cpu_ns;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        dst->phases[i].calls += src->phases[i].calls;
+        dst->phases[i].wall_ns += src->phases[i].wall_ns;
+        dst->phases[i].cpu_ns += src->phases[i].cpu_ns;
+    }
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        dst->file_histogram[i] += src->file_histogram[i];
+        dst->directory_histogram[i] += src->directory_histogram[i];
+    }
+    merge_slowest(&dst->slowest_files, &src->slowest_files, dst->slowest_limit);
+    merge_slowest(&dst->slowest_directories, &src->slowest_directories, dst->slowest_limit);
+}
+
+static void format_duration(unsigned long long ns, char *out, size_t out_size) {
+    if (ns < 1000000ULL) snprintf(out, out_size, "%.0f us", ns / 1e3);
+    else if (ns < 1000000000ULL) snprintf(out, out_size, "%.1f ms", ns / 1e6);
+    else snprintf(out, out_size, "%.2f s", ns / 1e9);
+}
+
+static void print_histogram(const char *title, const unsigned long long *buckets) {
+    int first = -1, last = -1;
+    unsigned long long peak = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        if (buckets[i] == 0) continue;
+        if (first < 0) first = i;
+        last = i;
+        if (buckets[i] > peak) peak = buckets[i];
+    }
+    if (first < 0) return;
+
+    printf("\n%s:\n", title);
+    for (int i = first; i <= last; i++) {
+        char label[32], limit[24];
+        unsigned long long limit_us = profile_bucket_limit_us(i);
+        if (limit_us) {
+            format_duration(limit_us * 1000ULL, limit, sizeof(limit));
+            snprintf(label, sizeof(label), "< %s", limit);
+        } else {
+            format_duration(profile_bucket_limit_us(i - 1) * 1000ULL, limit, sizeof(limit));
+            snprintf(label, sizeof(label), ">= %s", limit);
+        }
+        int width = (int)((buckets[i] * 40 + peak - 1) / peak);
+        printf("  %-10s %10llu  %.*s\n", label, buckets[i], width, "########################################");
+    }
+}
+
+static void print_slowest(const char *title, const SlowestList *list, bool files) {
+    if (list->count == 0) return;
+    printf("\n%s:\n", title);
+    for (int i = list->count - 1; i >= 0; i--) {
+        const ProfileEntry *entry = &list->entries[i];
+        char duration[24];
+        format_duration(entry->ns, duration, sizeof(duration));
+        if (files) {
+            printf("  %10s %12llu  %s\n", duration, entry->bytes, entry->path);
+        } else {
+            printf("  %10s  %s\n", duration, entry->path);
+        }
+    }
+}
+
+void print_scan_profile(const ScanProfile *profile) {
+    if (!profile) return;
+    printf("\nProfile (%.3f s wall, %.3f s CPU on %d threads):\n",
+           profile->wall_ns / 1e9, profile->cpu_ns / 1e9, profile->threads);
+    unsigned long long total_wall = profile_total(profile, ~0u).wall;
+    printf("  %-10s %12s %12s %12s %7s\n", "Phase", "Calls", "Wall (s)", "CPU (s)", "Share");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseTime *time = &profile->phases[i];
+        double share = total_wall > 0 ? (double)time->wall_ns / total_wall * 100.0 : 0.0;
+        printf("  %-10s %12llu %12.3f %12.3f %6.1f%%\n", phase_names[i], time->calls,
+               time->wall_ns / 1e9, time->cpu_ns / 1e9, share);
+    }
+    printf("  Phase times are summed over all threads.\n");
+
+    print_histogram("File latency", profile->file_histogram);
+    print_histogram("Directory latency", profile->directory_histogram);
+    print_slowest("Slowest files", &profile->slowest_files, true);
+    print_slowest("Slowest directories", &profile->slowest_directories, false);
+
+    printf("\nMemory:\n");
+    printf("  Directory nodes:     %llu at most, %.1f KB\n", profile->peak_directories,
+           profile->peak_directory_bytes / 1024.0);
+    printf("  Directory handles:   %d open at most (limit %d)\n", profile->peak_open_directories,
+           profile->open_directory_limit);
+    if (profile->peak_rss) printf("  Peak RSS:            %.1f MB\n", profile->peak_rss / (1024.0 * 1024.0));
+}
@@ -0,0 +1,108 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Where a scan spends its time (--profile).
+//
+// Every worker thread times its own phases into a private ScanProfile and
+// the shards are merged when the scan ends, so profiling takes no locks.
+// Each phase is timed on the wall clock and on the thread's CPU clock:
+// waiting for the disk shows up as wall time without CPU time. The thread
+// CPU clock is a system call on most platforms, which can make a profiled
+// scan around a tenth slower.
+
+typedef enum {
+    PHASE_ENUMERATE,    // Opening directories and reading their entries
+    PHASE_METADATA,     // fstatat for entries without a d_type, file identity for the cache
+    PHASE_EXCLUDE,      // Matching entry names against the exclude patterns
+    PHASE_OPEN,         // Opening files
+    PHASE_READ,         // read(), mmap and close; with io_uring also the open, done by the kernel
+    PHASE_CLASSIFY,     // Lexers over the file contents (with mmap, including the page faults)
+    PHASE_COUNT
+} ProfilePhase;
+
+#define PROFILE_MASK(phase) (1u << (phase))
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long wall_ns;
+    unsigned long long cpu_ns;
+} PhaseTime;
+
+// A moment on the calling thread's wall and CPU clocks
+typedef struct {
+    unsigned long long wall;
+    unsigned long long cpu;
+} ProfileStamp;
+
+// Latency histograms: bucket 0 counts times under 1 us, bucket i those under
+// 2^i us, the last one everything longer
+#define PROFILE_BUCKETS 24
+
+#define PROFILE_DEFAULT_SLOWEST 10
+#define PROFILE_MAX_SLOWEST 1000
+
+typedef struct {
+    char *path;
+    unsigned long long ns;
+    unsigned long long bytes;       // Files only
+} ProfileEntry;
+
+// The slowest entries seen so far, fastest first
+typedef struct {
+    ProfileEntry *entries;
+    int count;
+} SlowestList;
+
+typedef struct {
+    int slowest_limit;                  // Slowest files and directories kept
+    unsigned long long wall_ns;         // Whole scan
+    unsigned long long cpu_ns;          // Summed over the worker threads
+    int threads;
+    PhaseTime phases[PHASE_COUNT];      // Summed over the worker threads
+    unsigned long long file_histogram[PROFILE_BUCKETS];         // Cache lookup or open to counted
+    unsigned long long directory_histogram[PROFILE_BUCKETS];    // Opening and listing one directory
+    SlowestList slowest_files;
+    SlowestList slowest_directories;
+    // Peaks over the whole scan, set when it ends
+    int open_directory_limit;           // Directory handles kept open for queued entries
+    int peak_open_directories;
+    unsigned long long peak_directories;        // Directory nodes alive at once: listed, queued, or above one
+    unsigned long long peak_directory_bytes;    // Their nodes, names included
+    unsigned long long peak_rss;        // Of the process, in bytes; 0 where unknown
+} ScanProfile;
+
+void scan_profile_init(ScanProfile *profile, int slowest_limit);
+void scan_profile_free(ScanProfile *profile);
+
+ProfileStamp profile_now(void);
+
+// Add the time since `start` to `phase`; returns the current time, so
+// consecutive phases can be chained
+ProfileStamp profile_phase(ScanProfile *profile, ProfilePhase phase, ProfileStamp start);
+
+// Sum of the phases in `mask` so far
+ProfileStamp profile_total(const ScanProfile *profile, unsigned mask);
+
+// Add the time since `start` to `phase`, less what the phases in `nested`
+// gained since their total was `nested_before`
+void profile_phase_except(ScanProfile *profile, ProfilePhase phase, ProfileStamp start,
+                          unsigned nested, ProfileStamp nested_before);
+
+void profile_file(ScanProfile *profile, const char *dir_path, const char *name,
+                  unsigned long long ns, unsigned long long bytes);
+void profile_directory(ScanProfile *profile, const char *path, unsigned long long ns);
+
+// Add a worker's shard to `dst`, moving its slowest entries
+void merge_scan_profile(ScanProfile *dst, ScanProfile *src);
+
+const char* profile_phase_name(ProfilePhase phase);
+
+// Upper bound of a histogram bucket in microseconds; 0 for the last, open-ended one
+unsigned long long profile_bucket_limit_us(int bucket);
+
+void print_scan_profile(const ScanProfile *profile);
+
+#endif // PROFILE_H
@@ -0,0 +1,345 @@
+#include "resultcache.h"
+#include "threading.h"
+#include <time.h>
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <errno.h>
+    #define HAVE_INOTIFY 1
+
+    // Anything that can change a count: file contents, entries appearing,
+    // disappearing or moving, and the watched directory itself going away
+    #define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                        IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+typedef struct {
+    char *key;                  // Normalized path and patterns, '\0' separated
+    size_t key_len;
+    bool pending;               // A scan is filling this entry
+    bool valid;                 // Nothing changed since the scan started
+    int waiters;                // Requests waiting for the pending scan
+    CountResult result;
+    CountBreakdown breakdown;
+    double processing_time;
+    unsigned long long finished_at;
+    unsigned long long last_used;
+    int *watches;               // inotify descriptors, sorted once the scan is done
+    int watch_count;
+    int watch_capacity;
+} CacheSlot;
+
+struct ResultCache {
+    cl_mutex_t lock;
+    cl_cond_t scan_done;
+    unsigned long long ttl_ns;
+    int inotify_fd;
+    CacheSlot slots[RESULT_CACHE_MAX_ENTRIES];
+};
+
+typedef struct {
+    ResultCache *cache;
+    CacheSlot *slot;
+} WatchContext;
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Resolved path followed by the sorted, deduplicated patterns
+static char* build_key(const char *path, const ExcludeList *exclude_list, size_t *key_len) {
+#ifdef _WIN32
+    char *resolved = _fullpath(NULL, path, 0);
+#else
+    char *resolved = realpath(path, NULL);
+#endif
+    if (!resolved) return NULL;
+
+    int count = exclude_list ? exclude_list->count : 0;
+    char **sorted = count > 0 ? malloc(sizeof(char*) * count) : NULL;
+    if (count > 0 && !sorted) {
+        free(resolved);
+        return NULL;
+    }
+    size_t len = strlen(resolved) + 1;
+    for (int i = 0; i < count; i++) {
+        sorted[i] = exclude_list->patterns[i];
+        len += strlen(sorted[i]) + 1;
+    }
+    if (count > 1) qsort(sorted, count, sizeof(char*), compare_strings);
+
+    char *key = malloc(len);
+    if (key) {
+        size_t pos = strlen(resolved) + 1;
+        memcpy(key, resolved, pos);
+        for (int i = 0; i < count; i++) {
+            if (i > 0 && strcmp(sorted[i], sorted[i - 1]) == 0) continue;
+            size_t pattern_len = strlen(sorted[i]) + 1;
+            memcpy(key + pos, sorted[i], pattern_len);
+            pos += pattern_len;
+        }
+        *key_len = pos;
+    }
+    free(sorted);
+    free(resolved);
+    return key;
+}
+
+static bool slot_has_watch(const CacheSlot *slot, int wd) {
+    if (!slot->key) return false;
+    if (!slot->pending) {
+        return bsearch(&wd, slot->watches, slot->watch_count, sizeof(int), compare_ints) != NULL;
+    }
+    for (int i = 0; i < slot->watch_count; i++) {
+        if (slot->watches[i] == wd) return true;
+    }
+    return false;
+}
+
+// Drop the slot's watches, removing those no other entry shares
+static void release_watches(ResultCache *cache, CacheSlot *slot) {
+#ifdef HAVE_INOTIFY
+    for (int i = 0; i < slot->watch_count; i++) {
+        int wd = slot->watches[i];
+        bool shared = false;
+        for (int j = 0; j < RESULT_CACHE_MAX_ENTRIES && !shared; j++) {
+            CacheSlot *other = &cache->slots[j];
+            shared = other != slot && slot_has_watch(other, wd);
+        }
+        if (!shared) inotify_rm_watch(cache->inotify_fd, wd);
+    }
+#else
+    (void)cache;
+#endif
+    slot->watch_count = 0;
+}
+
+static void clear_slot(ResultCache *cache, CacheSlot *slot) {
+    release_watches(cache, slot);
+    free(slot->key);
+    slot->key = NULL;
+    free_count_breakdown(&slot->breakdown);
+    slot->valid = false;
+}
+
+static void invalidate_slot(ResultCache *cache, CacheSlot *slot) {
+    slot->valid = false;
+    // A running scan keeps collecting watches; they are released when it ends
+    if (!slot->pending) release_watches(cache, slot);
+}
+
+ResultCache* result_cache_create(int ttl_seconds) {
+    ResultCache *cache = calloc(1, sizeof(ResultCache));
+    if (!cache) return NULL;
+    cl_mutex_init(&cache->lock);
+    cl_cond_init(&cache->scan_done);
+    cache->ttl_ns = (unsigned long long)(ttl_seconds > 0 ? ttl_seconds : RESULT_CACHE_DEFAULT_TTL) * 1000000000ULL;
+#ifdef HAVE_INOTIFY
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    cache->inotify_fd = -1;
+#endif
+    return cache;
+}
+
+void result_cache_destroy(ResultCache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < RESULT_CACHE_MAX_ENTRIES; i++) {
+        free(cache->slots[i].key);
+        free(cache->slots[i].watches);
+        free_count_breakdown(&cache->slots[i].breakdown);
+    }
+#ifdef HAVE_INOTIFY
+    if (cache->inotify_fd >= 0) close(cache->inotify_fd);
+#endif
+    cl_cond_destroy(&cache->scan_done);
+    cl_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+int result_cache_event_fd(const ResultCache *cache) {
+    return cache ? cache->inotify_fd : -1;
+}
+
+void result_cache_process_events(ResultCache *cache) {
+#ifdef HAVE_INOTIFY
+    if (!cache || cache->inotify_fd < 0) return;
+
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(cache->inotify_fd, buffer, sizeof(buffer));
+        if (len < 0 && errno == EINTR) continue;
+        if (len <= 0) break;
+
+        cl_mutex_lock(&cache->lock);
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) continue;
+
+            for (int i = 0; i < RESULT_CACHE_MAX_ENTRIES; i++) {
+                CacheSlot *slot = &cache->slots[i];
+                if (!slot->valid) continue;
+                // A lost event could be about any directory
+                if ((event->mask & IN_Q_OVERFLOW) || slot_has_watch(slot, event->wd)) {
+                    invalidate_slot(cache, slot);
+                }
+            }
+        }
+        cl_mutex_unlock(&cache->lock);
+    }
+#else
+    (void)cache;
+#endif
+}
+
+// DirectoryVisitor: watch every directory the scan opens
+static void watch_directory(void *arg, int dir_fd, const char *path) {
+    (void)dir_fd;
+#ifdef HAVE_INOTIFY
+    WatchContext *ctx = arg;
+    ResultCache *cache = ctx->cache;
+    CacheSlot *slot = ctx->slot;
+
+    int wd = inotify_add_watch(cache->inotify_fd, path, WATCH_MASK);
+
+    cl_mutex_lock(&cache->lock);
+    if (wd >= 0 && slot->watch_count == slot->watch_capacity) {
+        int capacity = slot->watch_capacity ? slot->watch_capacity * 2 : 64;
+        int *grown = realloc(slot->watches, sizeof(int) * capacity);
+        if (grown) {
+            slot->watches = grown;
+            slot->watch_capacity = capacity;
+        }
+    }
+    // A directory that cannot be watched (over the watch limit) relies on the TTL
+    if (wd >= 0 && slot->watch_count < slot->watch_capacity) {
+        slot->watches[slot->watch_count++] = wd;
+    }
+    cl_mutex_unlock(&cache->lock);
+#else
+    (void)arg;
+    (void)path;
+#endif
+}
+
+static void fill_result(CachedCount *out, const CacheSlot *slot, bool hit, unsigned long long now) {
+    out->result = slot->result;
+    // A copy that fails only loses the breakdown
+    copy_count_breakdown(&out->breakdown, &slot->breakdown);
+    out->processing_time = slot->processing_time;
+    out->hit = hit;
+    out->age = now > slot->finished_at ? (now - slot->finished_at) / 1e9 : 0.0;
+}
+
+// Slot for a new key: a free one, else the least recently used idle one
+static CacheSlot* claim_slot(ResultCache *cache) {
+    CacheSlot *victim = NULL;
+    for (int i = 0; i < RESULT_CACHE_MAX_ENTRIES; i++) {
+        CacheSlot *slot = &cache->slots[i];
+        if (!slot->key) return slot;
+        if (slot->pending || slot->waiters > 0) continue;
+        if (!victim || slot->last_used < victim->last_used) victim = slot;
+    }
+    if (victim) clear_slot(cache, victim);
+    return victim;
+}
+
+static void scan(const char *path, const CountOptions *base, WatchContext *watch,
+                 CountResult *result, CountBreakdown *breakdown, double *processing_time) {
+    CountOptions options = *base;
+    options.breakdown = breakdown;
+    if (watch) {
+        options.on_directory = watch_directory;
+        options.visitor_ctx = watch;
+    }
+
+    memset(result, 0, sizeof(CountResult));
+    unsigned long long start = cl_monotonic_ns();
+    count_lines_with_options(path, &options, result);
+    *processing_time = (cl_monotonic_ns() - start) / 1e9;
+}
+
+bool result_cache_count(ResultCache *cache, const char *path, const CountOptions *options, CachedCount *out) {
+    size_t key_len = 0;
+    char *key = build_key(path, options->exclude_list, &key_len);
+    if (!key) return false;
+
+    cl_mutex_lock(&cache->lock);
+    CacheSlot *slot = NULL;
+    for (int i = 0; i < RESULT_CACHE_MAX_ENTRIES; i++) {
+        CacheSlot *candidate = &cache->slots[i];
+        if (candidate->key && candidate->key_len == key_len && memcmp(candidate->key, key, key_len) == 0) {
+            slot = candidate;
+            break;
+        }
+    }
+
+    unsigned long long now = cl_monotonic_ns();
+    if (slot && slot->pending) {
+        // Share the scan already running for this key
+        slot->waiters++;
+        while (slot->pending) cl_cond_wait(&cache->scan_done, &cache->lock);
+        slot->waiters--;
+        fill_result(out, slot, true, cl_monotonic_ns());
+        cl_mutex_unlock(&cache->lock);
+        free(key);
+        return true;
+    }
+    if (slot && slot->valid && now - slot->finished_at < cache->ttl_ns) {
+        slot->last_used = now;
+        fill_result(out, slot, true, now);
+        cl_mutex_unlock(&cache->lock);
+        free(key);
+        return true;
+    }
+
+    if (slot) {
+        release_watches(cache, slot);
+        free(key);
+    } else {
+        slot = claim_slot(cache);
+        if (!slot) {
+            // Every entry is busy with a scan: count without caching
+            cl_mutex_unlock(&cache->lock);
+            scan(path, options, NULL, &out->result, &out->breakdown, &out->processing_time);
+            out->hit = false;
+            out->age = 0.0;
+            free(key);
+            return true;
+        }
+        slot->key = key;
+        slot->key_len = key_len;
+    }
+    slot->pending = true;
+    slot->valid = true;
+    cl_mutex_unlock(&cache->lock);
+
+    WatchContext watch;
+    watch.cache = cache;
+    watch.slot = slot;
+    CountResult result;
+    CountBreakdown breakdown;
+    double processing_time;
+    scan(path, options, cache->inotify_fd >= 0 ? &watch : NULL, &result, &breakdown, &processing_time);
+
+    cl_mutex_lock(&cache->lock);
+    slot->result = result;
+    free_count_breakdown(&slot->breakdown);
+    slot->breakdown = breakdown;
+    slot->processing_time = processing_time;
+    slot->finished_at = cl_monotonic_ns();
+    slot->last_used = slot->finished_at;
+    slot->pending = false;
+    if (slot->watch_count > 1) qsort(slot->watches, slot->watch_count, sizeof(int), compare_ints);
+    if (!slot->valid) release_watches(cache, slot);
+    fill_result(out, slot, false, slot->finished_at);
+    cl_cond_broadcast(&cache->scan_done);
+    cl_mutex_unlock(&cache->lock);
+    return true;
+}
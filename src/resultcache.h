@@ -0,0 +1,43 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include "countlines.h"
+
+// In-process cache of scan results for the web server, keyed by the
+// normalized path and the sorted, deduplicated exclude patterns.
+//
+// A request that finds a scan of the same key in progress waits for it
+// instead of starting another. On Linux every directory a scan opens gets an
+// inotify watch, and any change below it invalidates the entry; changes made
+// while the scan runs leave the result uncached. Entries also expire after
+// the TTL, which is all that applies where inotify is unavailable (other
+// platforms, or when the watch limit is reached).
+
+#define RESULT_CACHE_DEFAULT_TTL 300        // Seconds
+#define RESULT_CACHE_MAX_ENTRIES 64
+
+typedef struct ResultCache ResultCache;
+
+typedef struct {
+    CountResult result;
+    double processing_time;     // Seconds the scan took
+    bool hit;                   // Answered by an earlier or concurrent scan
+    double age;                 // Seconds since that scan finished
+    CountBreakdown breakdown;   // Owned by the caller; release with free_count_breakdown
+} CachedCount;
+
+ResultCache* result_cache_create(int ttl_seconds);
+void result_cache_destroy(ResultCache *cache);
+
+// Count `path` with options->exclude_list, from the cache when possible.
+// The other options apply if a scan runs; a request that joins a scan in
+// progress gets no progress callbacks. Returns false if the path cannot be
+// resolved.
+bool result_cache_count(ResultCache *cache, const char *path, const CountOptions *options, CachedCount *out);
+
+// Readable when watched directories changed (-1 without inotify); the owner
+// polls it and calls result_cache_process_events
+int result_cache_event_fd(const ResultCache *cache);
+void result_cache_process_events(ResultCache *cache);
+
+#endif // RESULTCACHE_H
@@ -0,0 +1,817 @@
+#include "shard.h"
+#include "poller.h"
+#include "threading.h"
+#include <stdarg.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib")
+#else
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netdb.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <signal.h>
+    #define closesocket close
+    #define SOCKET int
+    #define INVALID_SOCKET -1
+    #define SOCKET_ERROR -1
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+#define SHARD_LISTEN_BACKLOG 16
+
+// A worker address: "unix:PATH", "HOST:PORT" or "PORT"
+typedef struct {
+    bool is_unix;
+    char host[256];             // Empty: every interface
+    char port[16];
+    char path[108];             // Of the Unix socket
+} ShardAddress;
+
+// Bytes received and not yet taken as lines, in a buffer that grows to at
+// most SHARD_MAX_LINE
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    size_t taken;               // Of the line last handed out, dropped on the next call
+} LineBuffer;
+
+// A directory (or the root's own files) counted by one worker
+typedef struct {
+    char *path;                 // Relative to the root; "." for the root itself
+    int depth;                  // max_depth sent with it
+    unsigned long long estimate;
+    int worker;                 // Counting it, or -1 while queued
+    bool done;
+    int refusals;               // Workers that answered FAILED, marked in `refused`
+    unsigned char refused[SHARD_MAX_WORKERS / 8];
+    char *failure;              // The last of their reasons
+} Shard;
+
+typedef struct {
+    Shard *items;
+    int count;
+    int capacity;
+} ShardList;
+
+typedef struct {
+    const char *address;
+    SOCKET socket;
+    bool alive;
+    int held;                   // Shards sent and not yet answered
+    unsigned long long last_heard;  // Last line received, or first shard sent while idle
+    LineBuffer in;
+} ShardWorker;
+
+// BUSY lines sent from the scan's progress callback while a shard is counted
+typedef struct {
+    SOCKET socket;
+    unsigned long long id;
+    cl_mutex_t lock;            // A slow send may still run when the next one is due
+} Heartbeat;
+
+// Winsock, and no SIGPIPE from writing to a worker or coordinator that went away
+static bool sockets_init(void) {
+#ifdef _WIN32
+    WSADATA wsa_data;
+    return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+static bool parse_address(const char *text, ShardAddress *address) {
+    memset(address, 0, sizeof(ShardAddress));
+    if (strncmp(text, "unix:", 5) == 0) {
+        address->is_unix = true;
+        size_t len = strlen(text + 5);
+        if (len == 0 || len >= sizeof(address->path)) return false;
+        memcpy(address->path, text + 5, len + 1);
+        return true;
+    }
+    const char *colon = strrchr(text, ':');
+    const char *port = colon ? colon + 1 : text;
+    size_t host_len = colon ? (size_t)(colon - text) : 0;
+    // An IPv6 host is written in brackets, as in "[::1]:7070"
+    if (host_len >= 2 && text[0] == '[' && text[host_len - 1] == ']') {
+        text++;
+        host_len -= 2;
+    }
+    size_t port_len = strlen(port);
+    if (host_len >= sizeof(address->host) || port_len == 0 || port_len >= sizeof(address->port)) return false;
+    for (const char *p = port; *p; p++) {
+        if (*p < '0' || *p > '9') return false;
+    }
+    memcpy(address->host, text, host_len);
+    address->host[host_len] = '\0';
+    memcpy(address->port, port, port_len + 1);
+    return true;
+}
+
+// A socket connected to `address`, or listening on it; `error` says why not
+static SOCKET open_socket(const ShardAddress *address, bool listening, const char **error) {
+    if (address->is_unix) {
+#ifdef _WIN32
+        *error = "Unix sockets are not supported on Windows";
+        return INVALID_SOCKET;
+#else
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, address->path, strlen(address->path) + 1);
+        SOCKET fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET) {
+            *error = strerror(errno);
+            return INVALID_SOCKET;
+        }
+        // A socket file left by an earlier worker would fail the bind
+        struct stat existing;
+        if (listening && lstat(address->path, &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(address->path);
+        int status = listening ? bind(fd, (struct sockaddr *)&addr, sizeof(addr)) : connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (status == 0 && listening) status = listen(fd, SHARD_LISTEN_BACKLOG);
+        if (status != 0) {
+            *error = strerror(errno);
+            closesocket(fd);
+            return INVALID_SOCKET;
+        }
+        return fd;
+#endif
+    }
+
+    struct addrinfo hints, *found = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    int status = getaddrinfo(address->host[0] ? address->host : NULL, address->port, &hints, &found);
+    if (status != 0) {
+        *error = gai_strerror(status);
+        return INVALID_SOCKET;
+    }
+    *error = listening ? "cannot bind" : "connection refused";
+    SOCKET fd = INVALID_SOCKET;
+    for (const struct addrinfo *candidate = found; candidate; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd == INVALID_SOCKET) continue;
+        int opt = 1;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
+            if (bind(fd, candidate->ai_addr, (int)candidate->ai_addrlen) == 0 &&
+                listen(fd, SHARD_LISTEN_BACKLOG) == 0) {
+                break;
+            }
+        } else {
+            // A machine that goes away without closing the connection is
+            // noticed by keepalive probes
+            setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (char *)&opt, sizeof(opt));
+            if (connect(fd, candidate->ai_addr, (int)candidate->ai_addrlen) == 0) break;
+        }
+        closesocket(fd);
+        fd = INVALID_SOCKET;
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+static bool send_all(SOCKET socket, const char *data, size_t len) {
+    while (len > 0) {
+        int sent = send(socket, data, (int)len, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        len -= (size_t)sent;
+    }
+    return true;
+}
+
+// Send one protocol line; the line end is added. Paths make lines of any
+// length, so a long one is formatted into an allocation.
+static bool send_line(SOCKET socket, const char *format, ...) {
+    char small[1024];
+    va_list args, again;
+    va_start(args, format);
+    va_copy(again, args);
+    int len = vsnprintf(small, sizeof(small) - 1, format, args);
+    va_end(args);
+    char *line = small;
+    if (len >= 0 && (size_t)len >= sizeof(small) - 1) {
+        line = malloc((size_t)len + 2);
+        if (line) vsnprintf(line, (size_t)len + 1, format, again);
+    }
+    va_end(again);
+    if (len < 0 || !line) return false;
+    line[len] = '\n';
+    bool ok = send_all(socket, line, (size_t)len + 1);
+    if (line != small) free(line);
+    return ok;
+}
+
+// Forget the line handed out last
+static void drop_taken(LineBuffer *buffer) {
+    if (buffer->taken == 0) return;
+    buffer->length -= buffer->taken;
+    memmove(buffer->data, buffer->data + buffer->taken, buffer->length);
+    buffer->taken = 0;
+}
+
+// The next complete line in `buffer`, without its line end, or NULL if none
+// is complete yet. It stays valid until the next take_line or receive.
+static char* take_line(LineBuffer *buffer) {
+    drop_taken(buffer);
+    char *end = buffer->length > 0 ? memchr(buffer->data, '\n', buffer->length) : NULL;
+    if (!end) return NULL;
+    *end = '\0';
+    if (end > buffer->data && end[-1] == '\r') end[-1] = '\0';
+    buffer->taken = (size_t)(end - buffer->data) + 1;
+    return buffer->data;
+}
+
+// Receive what the peer sent; false once it has closed or failed, or sent a
+// line longer than SHARD_MAX_LINE
+static bool receive(SOCKET socket, LineBuffer *buffer) {
+    drop_taken(buffer);
+    if (buffer->length == buffer->capacity) {
+        if (buffer->capacity >= SHARD_MAX_LINE) return false;
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown) return false;
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    int received = recv(socket, buffer->data + buffer->length, (int)(buffer->capacity - buffer->length), 0);
+    if (received <= 0) return false;
+    buffer->length += (size_t)received;
+    return true;
+}
+
+// The next line from a blocking socket, as take_line
+static char* next_line(SOCKET socket, LineBuffer *buffer) {
+    char *line;
+    while (!(line = take_line(buffer))) {
+        if (!receive(socket, buffer)) return NULL;
+    }
+    return line;
+}
+
+static bool is_directory(const char *path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributes(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+#endif
+}
+
+static void send_heartbeat(void *ctx, const ScanProgress *progress) {
+    (void)progress;
+    Heartbeat *heartbeat = ctx;
+    cl_mutex_lock(&heartbeat->lock);
+    send_line(heartbeat->socket, "BUSY %llu", heartbeat->id);
+    cl_mutex_unlock(&heartbeat->lock);
+}
+
+// Count the shard in a SHARD line's `args` and answer it; false ends the session
+static bool count_shard(SOCKET socket, const char *root, const char *args, const CountOptions *session,
+                        bool verbose) {
+    unsigned long long id;
+    int depth;
+    int consumed = 0;
+    if (sscanf(args, "%llu %d %n", &id, &depth, &consumed) != 2 || consumed == 0 || depth < 0) {
+        send_line(socket, "ERROR Malformed SHARD line");
+        return false;
+    }
+    const char *path = args + consumed;
+    bool whole_root = strcmp(path, ".") == 0;
+    size_t root_len = strlen(root), path_len = strlen(path);
+    char *full_path = malloc(root_len + path_len + 2);
+    if (!full_path) return send_line(socket, "FAILED %llu Out of memory", id);
+    memcpy(full_path, root, root_len + 1);
+    if (!whole_root) {
+        full_path[root_len] = PATH_SEPARATOR;
+        memcpy(full_path + root_len + 1, path, path_len + 1);
+    }
+    if (!is_directory(full_path)) {
+        free(full_path);
+        return send_line(socket, "FAILED %llu No such directory", id);
+    }
+
+    CountOptions options = *session;
+    options.exclude_base = whole_root ? NULL : path;
+    options.max_depth = depth;
+    Heartbeat heartbeat;
+    heartbeat.socket = socket;
+    heartbeat.id = id;
+    cl_mutex_init(&heartbeat.lock);
+    options.on_progress = send_heartbeat;
+    options.progress_ctx = &heartbeat;
+    options.progress_interval_ms = SHARD_HEARTBEAT_MS;
+    CountResult result = {0, 0, 0, 0, 0};
+    unsigned long long started = cl_monotonic_ns();
+    count_lines_with_options(full_path, &options, &result);
+    cl_mutex_destroy(&heartbeat.lock);
+    free(full_path);
+    if (verbose) {
+        printf("Shard %llu: %s: %llu files, %llu lines (%.3f s)\n", id, path, result.total_files,
+               result.total_lines, (cl_monotonic_ns() - started) / 1e9);
+        fflush(stdout);
+    }
+    return send_line(socket, "RESULT %llu %llu %llu %llu %llu %llu", id, result.total_files, result.total_lines,
+                     result.code_lines, result.comment_lines, result.blank_lines);
+}
+
+// One coordinator's session: its header, then its shards until it hangs up
+static void serve_coordinator(SOCKET socket, const CountOptions *defaults, bool verbose) {
+    LineBuffer in;
+    memset(&in, 0, sizeof(in));
+    char *line = next_line(socket, &in);
+    if (!line || strcmp(line, SHARD_PROTOCOL) != 0) {
+        send_line(socket, "ERROR Expected %s", SHARD_PROTOCOL);
+        free(in.data);
+        return;
+    }
+
+    ExcludeList *exclude_list = create_exclude_list();
+    ExtensionMap extensions;
+    extension_map_init(&extensions);
+    CountOptions options = *defaults;
+    options.exclude_list = exclude_list;
+    options.extensions = &extensions;
+    options.use_cache = false;
+    options.classic = false;
+    char *root = NULL;
+    const char *error = exclude_list ? NULL : "Out of memory";
+    bool begun = false;
+    while (!error && (line = next_line(socket, &in)) != NULL) {
+        if (strcmp(line, "BEGIN") == 0) {
+            begun = true;
+            break;
+        } else if (strncmp(line, "ROOT ", 5) == 0) {
+            size_t len = strlen(line + 5);
+            free(root);
+            root = malloc(len + 1);
+            if (root) memcpy(root, line + 5, len + 1);
+            else error = "Out of memory";
+        } else if (strncmp(line, "EXCLUDE ", 8) == 0) {
+            add_exclude_pattern(exclude_list, line + 8);
+        } else if (strncmp(line, "EXT ", 4) == 0) {
+            char *space = strchr(line + 4, ' ');
+            if (space) *space = '\0';
+            LanguageId language = space ? language_from_name(space + 1) : LANG_UNKNOWN;
+            if (language == LANG_UNKNOWN || !extension_map_add(&extensions, line + 4, language)) {
+                error = "Invalid EXT line";
+            }
+        } else if (strcmp(line, "CLASSIC") == 0) {
+            options.classic = true;
+        } else {
+            error = "Unknown header line";
+        }
+    }
+    if (!error && (!begun || !root || root[0] == '\0')) error = begun ? "Missing ROOT" : NULL;
+    if (error) {
+        send_line(socket, "ERROR %s", error);
+    } else if (begun) {
+        if (verbose) {
+            printf("Coordinator connected: %s\n", root);
+            fflush(stdout);
+        }
+        while ((line = next_line(socket, &in)) != NULL) {
+            bool ok = strncmp(line, "SHARD ", 6) == 0 ? count_shard(socket, root, line + 6, &options, verbose)
+                                                      : send_line(socket, "ERROR Expected SHARD") && false;
+            if (!ok) break;
+        }
+        if (verbose) {
+            printf("Coordinator done: %s\n", root);
+            fflush(stdout);
+        }
+    }
+    free(root);
+    free(in.data);
+    free_exclude_list(exclude_list);
+}
+
+int shard_worker_run(const char *address_text, const CountOptions *options, bool verbose) {
+    ShardAddress address;
+    if (!parse_address(address_text, &address)) {
+        fprintf(stderr, "Error: Invalid worker address '%s' (HOST:PORT, PORT or unix:PATH)\n", address_text);
+        return 1;
+    }
+    if (!sockets_init()) {
+        fprintf(stderr, "Error: Failed to initialize sockets\n");
+        return 1;
+    }
+    const char *error = NULL;
+    SOCKET listener = open_socket(&address, true, &error);
+    if (listener == INVALID_SOCKET) {
+        fprintf(stderr, "Error: Cannot listen on '%s' (%s)\n", address_text, error);
+        return 1;
+    }
+    printf("Worker listening on %s\n", address_text);
+    fflush(stdout);
+
+    // Coordinators are served one at a time; another one waits in the backlog
+    for (;;) {
+        SOCKET client = accept(listener, NULL, NULL);
+        if (client == INVALID_SOCKET) {
+#ifndef _WIN32
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+#endif
+            fprintf(stderr, "Error: Cannot accept coordinators on '%s'\n", address_text);
+            break;
+        }
+        serve_coordinator(client, options, verbose);
+        closesocket(client);
+    }
+    closesocket(listener);
+    return 1;
+}
+
+static bool add_shard(ShardList *list, const char *path, int depth) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        Shard *grown = realloc(list->items, sizeof(Shard) * capacity);
+        if (!grown) return false;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    size_t len = strlen(path);
+    char *copy = malloc(len + 1);
+    if (!copy) return false;
+    memcpy(copy, path, len + 1);
+    Shard *shard = &list->items[list->count++];
+    shard->path = copy;
+    shard->depth = depth;
+    shard->estimate = 0;
+    shard->worker = -1;
+    shard->refusals = 0;
+    memset(shard->refused, 0, sizeof(shard->refused));
+    shard->failure = NULL;
+    shard->done = false;
+    return true;
+}
+
+static void free_shards(ShardList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i].path);
+        free(list->items[i].failure);
+    }
+    free(list->items);
+}
+
+// The root's own files, then one shard per top-level directory the matcher
+// leaves; the root's shard is sized by its file count
+static bool list_shards(const char *root, const ExcludeMatcher *matcher, ShardList *list) {
+    if (!add_shard(list, ".", 1)) return false;
+    unsigned long long files = 0;
+    bool ok = true;
+#ifdef _WIN32
+    size_t root_len = strlen(root);
+    char *search_path = malloc(root_len + 3);
+    if (!search_path) return false;
+    memcpy(search_path, root, root_len);
+    memcpy(search_path + root_len, "\\*", 3);
+    WIN32_FIND_DATA find_data;
+    HANDLE hFind = FindFirstFile(search_path, &find_data);
+    free(search_path);
+    if (hFind == INVALID_HANDLE_VALUE) return false;
+    do {
+        const char *name = find_data.cFileName;
+        bool is_dir = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    DIR *dir = opendir(root);
+    if (!dir) return false;
+    struct dirent *entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        // Symlinks are followed, as the walk does
+        bool is_dir = false;
+#ifdef DT_UNKNOWN
+        if (entry->d_type == DT_DIR) {
+            is_dir = true;
+        } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+#endif
+        {
+            struct stat entry_stat;
+            is_dir = fstatat(dirfd(dir), name, &entry_stat, 0) == 0 && S_ISDIR(entry_stat.st_mode);
+        }
+#endif
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        if (!is_dir) {
+            files++;
+        } else if (!exclude_matcher_match_path(matcher, name, true)) {
+            ok = add_shard(list, name, 0);
+        }
+#ifdef _WIN32
+    } while (ok && FindNextFile(hFind, &find_data));
+    FindClose(hFind);
+#else
+    }
+    closedir(dir);
+#endif
+    list->items[0].estimate = files;
+    return ok;
+}
+
+// BatchVisitor of the metadata pass: batch root i is shard i + 1
+static void store_estimate(void *ctx, const BatchRoot *root) {
+    Shard *shards = ctx;
+    shards[root->index + 1].estimate = root->totals.total_files + root->directories;
+}
+
+// Size the directory shards by the files and directories in their first
+// SHARD_ESTIMATE_DEPTH levels, found without opening any file
+static void estimate_shards(const char *root, ShardList *list, const CountOptions *options) {
+    int count = list->count - 1;
+    if (count <= 0) return;
+    char **paths = calloc(count, sizeof(char*));
+    if (!paths) return;
+    bool ok = true;
+    size_t root_len = strlen(root);
+    for (int i = 0; ok && i < count; i++) {
+        const char *path = list->items[i + 1].path;
+        size_t path_len = strlen(path);
+        paths[i] = malloc(root_len + path_len + 2);
+        ok = paths[i] != NULL;
+        if (!ok) break;
+        memcpy(paths[i], root, root_len);
+        paths[i][root_len] = PATH_SEPARATOR;
+        memcpy(paths[i] + root_len + 1, path, path_len + 1);
+    }
+    if (ok) {
+        CountOptions listing;
+        init_count_options(&listing);
+        listing.exclude_list = options->exclude_list;
+        listing.extensions = options->extensions;
+        listing.jobs = options->jobs;
+        listing.list_only = true;
+        listing.max_depth = SHARD_ESTIMATE_DEPTH;
+        CountResult total = {0, 0, 0, 0, 0};
+        count_lines_batch((const char *const *)paths, count, &listing, &total, store_estimate, list->items);
+    }
+    for (int i = 0; i < count; i++) free(paths[i]);
+    free(paths);
+}
+
+// Largest first; the root's own files are never split, whatever their number
+static int compare_shards(const void *a, const void *b) {
+    const Shard *x = a, *y = b;
+    if (x->estimate != y->estimate) return x->estimate < y->estimate ? 1 : -1;
+    return strcmp(x->path, y->path);
+}
+
+static bool connect_worker(ShardWorker *worker, const char *root, const CountOptions *options) {
+    ShardAddress address;
+    const char *error = "invalid address (HOST:PORT, PORT or unix:PATH)";
+    worker->socket = parse_address(worker->address, &address) ? open_socket(&address, false, &error) : INVALID_SOCKET;
+    if (worker->socket == INVALID_SOCKET) {
+        fprintf(stderr, "Warning: Cannot connect to worker %s (%s)\n", worker->address, error);
+        return false;
+    }
+    bool ok = send_line(worker->socket, "%s", SHARD_PROTOCOL) && send_line(worker->socket, "ROOT %s", root);
+    const ExcludeList *excludes = options->exclude_list;
+    for (int i = 0; ok && excludes && i < excludes->count; i++) {
+        ok = send_line(worker->socket, "EXCLUDE %s", excludes->patterns[i]);
+    }
+    const ExtensionMap *extensions = options->extensions;
+    for (int i = 0; ok && extensions && i < extensions->count; i++) {
+        ok = send_line(worker->socket, "EXT %s %s", extensions->entries[i].extension,
+                       language_name(extensions->entries[i].language));
+    }
+    if (ok && options->classic) ok = send_line(worker->socket, "CLASSIC");
+    if (ok) ok = send_line(worker->socket, "BEGIN");
+    if (!ok) {
+        fprintf(stderr, "Warning: Cannot connect to worker %s (connection lost)\n", worker->address);
+        closesocket(worker->socket);
+        return false;
+    }
+    worker->alive = true;
+    return true;
+}
+
+// Drop a worker that went away and queue its shards again
+static void lose_worker(Poller *poller, ShardList *list, ShardWorker *workers, int index, const char *reason,
+                        ShardStats *stats) {
+    ShardWorker *worker = &workers[index];
+    poller_remove(poller, worker->socket);
+    closesocket(worker->socket);
+    worker->alive = false;
+    int requeued = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (list->items[i].worker == index && !list->items[i].done) {
+            list->items[i].worker = -1;
+            requeued++;
+        }
+    }
+    stats->lost_workers++;
+    stats->reassigned += requeued;
+    fprintf(stderr, "Warning: Lost worker %s (%s); %d shards queued again\n", worker->address, reason, requeued);
+}
+
+static bool refused_by(const Shard *shard, int index) {
+    return (shard->refused[index / 8] >> (index % 8)) & 1;
+}
+
+// Whether a connected worker is left that has not refused `shard`
+static bool shard_has_taker(const Shard *shard, const ShardWorker *workers, int worker_count) {
+    for (int w = 0; w < worker_count; w++) {
+        if (workers[w].alive && !refused_by(shard, w)) return true;
+    }
+    return false;
+}
+
+// Apply a worker's answer; false if it made no sense, which loses the worker.
+// A shard the worker could not count goes back to the queue for the others.
+static bool handle_reply(ShardList *list, int index, const char *line, CountResult *result, int *finished) {
+    unsigned long long id;
+    CountResult counts;
+    int consumed = 0;
+    if (sscanf(line, "RESULT %llu %llu %llu %llu %llu %llu", &id, &counts.total_files, &counts.total_lines,
+               &counts.code_lines, &counts.comment_lines, &counts.blank_lines) == 6) {
+        consumed = -1;
+    } else if (sscanf(line, "FAILED %llu %n", &id, &consumed) != 1 || consumed == 0) {
+        return false;
+    }
+    if (id >= (unsigned long long)list->count) return false;
+    Shard *shard = &list->items[id];
+    if (shard->worker != index || shard->done) return false;
+    shard->worker = -1;
+    if (consumed > 0) {
+        shard->refused[index / 8] |= (unsigned char)(1u << (index % 8));
+        shard->refusals++;
+        size_t len = strlen(line + consumed);
+        char *reason = malloc(len + 1);
+        if (reason) {
+            memcpy(reason, line + consumed, len + 1);
+            free(shard->failure);
+            shard->failure = reason;
+        }
+        return true;
+    }
+    shard->done = true;
+    (*finished)++;
+    result->total_files += counts.total_files;
+    result->total_lines += counts.total_lines;
+    result->code_lines += counts.code_lines;
+    result->comment_lines += counts.comment_lines;
+    result->blank_lines += counts.blank_lines;
+    return true;
+}
+
+bool shard_coordinate(const char *root, const char *const *addresses, int address_count,
+                      const CountOptions *options, CountResult *result, ShardStats *stats) {
+    memset(stats, 0, sizeof(ShardStats));
+    if (address_count <= 0 || address_count > SHARD_MAX_WORKERS) return false;
+    if (!sockets_init()) {
+        fprintf(stderr, "Error: Failed to initialize sockets\n");
+        return false;
+    }
+    const ExcludeList *excludes = options->exclude_list;
+    ExcludeMatcher *matcher = exclude_matcher_create(excludes ? excludes->patterns : NULL, excludes ? excludes->count : 0);
+    ShardList list;
+    memset(&list, 0, sizeof(list));
+    if (!matcher || !list_shards(root, matcher, &list)) {
+        fprintf(stderr, "Error: Cannot list '%s'\n", root);
+        exclude_matcher_free(matcher);
+        free_shards(&list);
+        return false;
+    }
+    exclude_matcher_free(matcher);
+
+    unsigned long long started = cl_monotonic_ns();
+    estimate_shards(root, &list, options);
+    qsort(list.items, list.count, sizeof(Shard), compare_shards);
+    stats->estimate_time = (cl_monotonic_ns() - started) / 1e9;
+    stats->shards = list.count;
+
+    ShardWorker *workers = calloc(address_count, sizeof(ShardWorker));
+    Poller *poller = workers ? poller_create() : NULL;
+    int alive = 0;
+    for (int i = 0; poller && i < address_count; i++) {
+        workers[i].address = addresses[i];
+        if (!connect_worker(&workers[i], root, options)) continue;
+        if (!poller_add(poller, workers[i].socket, POLLER_IN, &workers[i])) {
+            closesocket(workers[i].socket);
+            workers[i].alive = false;
+            continue;
+        }
+        alive++;
+    }
+    stats->workers = alive;
+    if (alive == 0) fprintf(stderr, "Error: No worker could be reached\n");
+
+    int finished = 0;
+    bool failed = false;
+    PollEvent events[SHARD_MAX_WORKERS];
+    while (finished < list.count && alive > 0) {
+        // A shard refused by every worker still connected is given up
+        for (int i = 0; i < list.count; i++) {
+            Shard *shard = &list.items[i];
+            if (shard->done || shard->worker >= 0 || shard->refusals == 0) continue;
+            if (shard_has_taker(shard, workers, address_count)) continue;
+            fprintf(stderr, "Error: Cannot count '%s' on any worker: %s\n", shard->path,
+                    shard->failure ? shard->failure : "refused");
+            shard->done = true;
+            finished++;
+            failed = true;
+        }
+
+        // Hand the largest queued shards to workers with room for them, but
+        // not to one that has refused them
+        for (int w = 0; w < address_count; w++) {
+            ShardWorker *worker = &workers[w];
+            int next = 0;
+            while (worker->alive && worker->held < SHARD_PIPELINE) {
+                while (next < list.count && (list.items[next].done || list.items[next].worker >= 0 ||
+                                             refused_by(&list.items[next], w))) {
+                    next++;
+                }
+                if (next == list.count) break;
+                Shard *shard = &list.items[next];
+                if (!send_line(worker->socket, "SHARD %d %d %s", next, shard->depth, shard->path)) {
+                    lose_worker(poller, &list, workers, w, "connection lost", stats);
+                    alive--;
+                    break;
+                }
+                shard->worker = w;
+                if (worker->held++ == 0) worker->last_heard = cl_monotonic_ns();
+            }
+        }
+        if (alive == 0) break;
+
+        // Woken at least once a second to notice workers that went silent
+        int count = poller_wait(poller, events, SHARD_MAX_WORKERS, 1000);
+        if (count < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif
+            fprintf(stderr, "Error: Waiting for workers failed\n");
+            break;
+        }
+        for (int e = 0; e < count; e++) {
+            ShardWorker *worker = events[e].data;
+            int index = (int)(worker - workers);
+            if (!worker->alive) continue;
+            if (!receive(worker->socket, &worker->in)) {
+                lose_worker(poller, &list, workers, index, "connection closed", stats);
+                alive--;
+                continue;
+            }
+            worker->last_heard = cl_monotonic_ns();
+            char *line;
+            while (worker->alive && (line = take_line(&worker->in)) != NULL) {
+                if (strncmp(line, "BUSY ", 5) == 0) continue;
+                if (strncmp(line, "ERROR ", 6) == 0 || !handle_reply(&list, index, line, result, &finished)) {
+                    lose_worker(poller, &list, workers, index, strncmp(line, "ERROR ", 6) == 0 ? line + 6 : "unexpected reply",
+                                stats);
+                    alive--;
+                    break;
+                }
+                worker->held--;
+            }
+        }
+
+        unsigned long long now = cl_monotonic_ns();
+        for (int w = 0; w < address_count; w++) {
+            ShardWorker *worker = &workers[w];
+            if (worker->alive && worker->held > 0 &&
+                now - worker->last_heard > SHARD_REPLY_TIMEOUT * 1000000000ULL) {
+                char reason[64];
+                snprintf(reason, sizeof(reason), "no reply for %d s", SHARD_REPLY_TIMEOUT);
+                lose_worker(poller, &list, workers, w, reason, stats);
+                alive--;
+            }
+        }
+    }
+
+    if (finished < list.count) {
+        if (stats->workers > 0) {
+            fprintf(stderr, "Error: %d of %d shards not counted: %s\n", list.count - finished, list.count,
+                    alive == 0 ? "no worker left" : "the scan was interrupted");
+        }
+        failed = true;
+    }
+    for (int i = 0; workers && i < address_count; i++) {
+        if (workers[i].alive) closesocket(workers[i].socket);
+        free(workers[i].in.data);
+    }
+    poller_destroy(poller);
+    free(workers);
+    free_shards(&list);
+    return !failed;
+}
+
+void print_shard_stats(const ShardStats *stats) {
+    printf("Shards: %d on %d workers, sized in %.3f s", stats->shards, stats->workers, stats->estimate_time);
+    if (stats->lost_workers > 0) {
+        printf(" (%d lost, %d shards counted again)", stats->lost_workers, stats->reassigned);
+    }
+    printf("\n");
+}
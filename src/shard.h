@@ -0,0 +1,82 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "countlines.h"
+
+// One tree counted by several processes, possibly on several machines
+// (--coordinate and --worker).
+//
+// A worker (`countlines --worker ADDRESS`) listens on a TCP port or a Unix
+// socket and counts the shards a coordinator sends it, serving one
+// coordinator at a time. The coordinator (`countlines --coordinate ADDRESS
+// ... <directory>`) lists the top level of the tree itself: every top-level
+// directory the exclusions leave is a shard, and the files directly in the
+// root make one more. A quick metadata pass sizes them: a list-only batch scan
+// of each directory's first SHARD_ESTIMATE_DEPTH levels, which opens no file.
+//
+// Shards are handed out largest first, SHARD_PIPELINE at a time per worker,
+// and a worker gets its next one as soon as it returns one. A fast worker
+// thus takes more, and the big directories start early instead of holding up
+// the end of the scan. A worker whose connection drops (the process died, or
+// its machine did) loses its shards to the queue, for the others to count,
+// and so does one that holds shards but has sent nothing for
+// SHARD_REPLY_TIMEOUT seconds (hung, or stuck on a dead mount) while its
+// connection stays up. The scan fails only when no worker is left.
+//
+// The protocol is line-based text. The coordinator opens with
+//
+//   COUNTLINES 1
+//   ROOT <path>                the tree, as the workers see it
+//   EXCLUDE <pattern>          one per pattern
+//   EXT <.ext> <language>      one per extension override
+//   CLASSIC                    with --classic
+//   BEGIN
+//
+// and then sends `SHARD <id> <depth> <path>`, with the path relative to the
+// root ("." for the root itself) and max_depth 1 for the root's own files or
+// 0 for a whole directory. The worker answers each with `RESULT <id> <files>
+// <lines> <code> <comments> <blank>`, or with `FAILED <id> <reason>` if the
+// path is not there, and answers a session it cannot follow with
+// `ERROR <reason>` before closing it. A FAILED shard is offered to the other
+// workers, since one machine may lack a mount the rest have; the scan fails
+// only once every worker still connected has refused it. While a shard is being counted it sends
+// `BUSY <id>` every SHARD_HEARTBEAT_MS, as long as the scan is moving, so
+// that a long shard is not taken for a hung worker. Lines carry paths of any
+// length, up to SHARD_MAX_LINE bytes; a peer that sends a longer one is cut
+// off.
+//
+// Every worker must see the tree at the same path. Workers count with their
+// own -j and --io settings and do not use the cache.
+
+#define SHARD_PROTOCOL "COUNTLINES 1"
+#define SHARD_PIPELINE 2            // Shards a worker holds at a time
+#define SHARD_ESTIMATE_DEPTH 3      // Directory levels listed to size a shard
+#define SHARD_HEARTBEAT_MS 5000     // BUSY lines while a shard is counted
+#define SHARD_REPLY_TIMEOUT 60      // Seconds of silence before a worker holding shards is dropped
+#define SHARD_MAX_LINE (1024 * 1024) // Longest line taken from a peer
+#define SHARD_MAX_WORKERS 256
+
+typedef struct {
+    int shards;
+    int workers;                    // Connected at the start
+    int lost_workers;               // Dropped before the scan finished
+    int reassigned;                 // Shards handed out again after losing their worker
+    double estimate_time;           // Seconds spent sizing the shards
+} ShardStats;
+
+// Serve coordinators on `address` ("HOST:PORT", "PORT" for every interface,
+// or "unix:PATH") until killed; `options` supplies the worker's threads and
+// I/O backend. With `verbose`, each coordinator and shard gets a line on
+// standard output. Returns 1 if it cannot listen.
+int shard_worker_run(const char *address, const CountOptions *options, bool verbose);
+
+// Count `root` with the workers at `addresses`. `options` supplies the
+// exclusions, extension overrides and counting rules sent to them, and the
+// threads of the metadata pass. Returns false, with a message on stderr, if
+// some shard could not be counted.
+bool shard_coordinate(const char *root, const char *const *addresses, int address_count,
+                      const CountOptions *options, CountResult *result, ShardStats *stats);
+
+void print_shard_stats(const ShardStats *stats);
+
+#endif // SHARD_H
@@ -0,0 +1,281 @@
+#include "sniff.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define SNIFF_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SNIFF_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+    static inline int lowest_bit(uint64_t mask) {
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (int)index;
+    }
+    static inline int highest_bit(uint64_t mask) {
+        unsigned long index;
+        _BitScanReverse64(&index, mask);
+        return (int)index;
+    }
+#else
+    #define lowest_bit(mask) __builtin_ctzll(mask)
+    #define highest_bit(mask) (63 - __builtin_clzll(mask))
+#endif
+
+#define BLOCK_SIZE 64
+
+// Markers tools put in the header comment of the files they write
+static const char *default_markers[] = {
+    "@generated",               // Facebook tools, Bazel, Buck
+    "DO NOT EDIT",              // Go, protoc, Thrift, many others
+    "<auto-generated",          // .NET
+    "Autogenerated",
+    "autogenerated",
+    "automatically generated"
+};
+
+static const char *reason_names[SNIFF_REASON_COUNT] = { "text", "binary", "long lines", "generated", "too large" };
+
+// Bitmasks of the NUL bytes and line feeds among the 64 bytes at p
+#if defined(SNIFF_AVX2)
+
+static inline void build_masks(const unsigned char *p, uint64_t *nul, uint64_t *nl) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lf = _mm256_set1_epi8('\n');
+    uint64_t z = 0, n = 0;
+    for (int k = 0; k < 2; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + k * 32));
+        z |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) << (k * 32);
+        n |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf)) << (k * 32);
+    }
+    *nul = z;
+    *nl = n;
+}
+
+#elif defined(SNIFF_SSE2)
+
+static inline void build_masks(const unsigned char *p, uint64_t *nul, uint64_t *nl) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lf = _mm_set1_epi8('\n');
+    uint64_t z = 0, n = 0;
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + k * 16));
+        z |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << (k * 16);
+        n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf)) << (k * 16);
+    }
+    *nul = z;
+    *nl = n;
+}
+
+#else
+
+static inline void build_masks(const unsigned char *p, uint64_t *nul, uint64_t *nl) {
+    uint64_t z = 0, n = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        z |= (uint64_t)(p[i] == 0) << i;
+        n |= (uint64_t)(p[i] == '\n') << i;
+    }
+    *nul = z;
+    *nl = n;
+}
+
+#endif
+
+void sniff_options_init(SniffOptions *options) {
+    memset(options, 0, sizeof(SniffOptions));
+    options->binary = true;
+    options->max_line_length = SNIFF_DEFAULT_MAX_LINE;
+    for (size_t i = 0; i < sizeof(default_markers) / sizeof(default_markers[0]); i++) {
+        sniff_add_marker(options, default_markers[i]);
+    }
+}
+
+// How often a byte turns up in source text, roughly: lowercase letters by
+// their English frequency, then spaces, then everything else
+static int commonness(unsigned char c) {
+    static const char letters[] = "zqjxkvbpygfwmucldrhsnioate";
+    const char *letter = c >= 'a' && c <= 'z' ? strchr(letters, c) : NULL;
+    if (letter) return 2 + (int)(letter - letters);
+    if (c == ' ') return 30;
+    return (c >= 'A' && c <= 'Z') ? 1 : 0;
+}
+
+bool sniff_add_marker(SniffOptions *options, const char *marker) {
+    size_t len = strlen(marker);
+    if (len == 0 || len >= SNIFF_MAX_MARKER_LEN || options->marker_count >= SNIFF_MAX_MARKERS) return false;
+    size_t anchor = 0;
+    for (size_t i = 1; i < len; i++) {
+        if (commonness((unsigned char)marker[i]) < commonness((unsigned char)marker[anchor])) anchor = i;
+    }
+    options->anchors[options->marker_count] = (unsigned char)anchor;
+    memcpy(options->markers[options->marker_count++], marker, len + 1);
+    return true;
+}
+
+uint64_t sniff_options_hash(const SniffOptions *options) {
+    // FNV-1a over the settings, then each marker
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t fields[3] = { options->binary, options->max_line_length, options->max_size };
+    const unsigned char *p = (const unsigned char *)fields;
+    for (size_t i = 0; i < sizeof(fields); i++) hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    for (int m = 0; m < options->marker_count; m++) {
+        for (const char *c = options->markers[m]; ; c++) {
+            hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+            if (!*c) break;
+        }
+    }
+    return hash;
+}
+
+// Find `marker` by its anchor byte, so that common letters do not stop
+// the search at every other word
+static bool find_marker(const unsigned char *data, size_t len, const char *marker, size_t anchor, size_t *offset) {
+    size_t marker_len = strlen(marker);
+    if (len < marker_len) return false;
+    const unsigned char *p = data + anchor;
+    const unsigned char *last = data + len - marker_len + anchor;
+    while (p <= last) {
+        p = memchr(p, (unsigned char)marker[anchor], (size_t)(last - p) + 1);
+        if (!p) return false;
+        if (memcmp(p - anchor, marker, marker_len) == 0) {
+            *offset = (size_t)(p - anchor - data);
+            return true;
+        }
+        p++;
+    }
+    return false;
+}
+
+SniffReason sniff_block(const SniffOptions *options, const unsigned char *data, size_t len, SniffVerdict *verdict) {
+    memset(verdict, 0, sizeof(SniffVerdict));
+    size_t n = len < SNIFF_WINDOW ? len : SNIFF_WINDOW;
+    size_t max_line = options->max_line_length;
+
+    // A binary file has no line ends either, so a NUL anywhere in the window
+    // wins over a long line found before it
+    bool long_line = false;
+    size_t long_offset = 0;
+    size_t line_start = 0;
+    size_t i = 0;
+    for (; i + BLOCK_SIZE <= n; i += BLOCK_SIZE) {
+        uint64_t nul, nl;
+        build_masks(data + i, &nul, &nl);
+        if (nul && options->binary) {
+            verdict->reason = SNIFF_BINARY;
+            verdict->offset = i + lowest_bit(nul);
+            return SNIFF_BINARY;
+        }
+        if (!max_line || long_line) continue;
+        if (max_line >= BLOCK_SIZE && nl) {
+            // Lines ending within the block are shorter than the limit, so
+            // only the first line end and the last matter
+            if (i + lowest_bit(nl) - line_start <= max_line) line_start = i + highest_bit(nl) + 1;
+        } else {
+            while (nl) {
+                size_t end = i + lowest_bit(nl);
+                if (end - line_start > max_line) break;
+                line_start = end + 1;
+                nl &= nl - 1;
+            }
+        }
+        if (i + BLOCK_SIZE - line_start > max_line) {
+            long_line = true;
+            long_offset = line_start;
+        }
+    }
+    for (; i < n; i++) {
+        if (data[i] == 0 && options->binary) {
+            verdict->reason = SNIFF_BINARY;
+            verdict->offset = i;
+            return SNIFF_BINARY;
+        }
+        if (data[i] != '\n' || !max_line || long_line) continue;
+        if (i - line_start > max_line) {
+            long_line = true;
+            long_offset = line_start;
+        }
+        line_start = i + 1;
+    }
+    if (max_line && !long_line && n - line_start > max_line) {
+        long_line = true;
+        long_offset = line_start;
+    }
+    if (long_line) {
+        verdict->reason = SNIFF_LONG_LINES;
+        verdict->offset = long_offset;
+        return SNIFF_LONG_LINES;
+    }
+
+    size_t head = n < SNIFF_MARKER_WINDOW ? n : SNIFF_MARKER_WINDOW;
+    for (int m = 0; m < options->marker_count; m++) {
+        size_t offset;
+        if (find_marker(data, head, options->markers[m], options->anchors[m], &offset)) {
+            verdict->reason = SNIFF_GENERATED;
+            verdict->offset = offset;
+            verdict->marker = m;
+            return SNIFF_GENERATED;
+        }
+    }
+    return SNIFF_TEXT;
+}
+
+SniffReason sniff_size(const SniffOptions *options, unsigned long long size, SniffVerdict *verdict) {
+    memset(verdict, 0, sizeof(SniffVerdict));
+    if (!options->max_size || size <= options->max_size) return SNIFF_TEXT;
+    verdict->reason = SNIFF_TOO_LARGE;
+    verdict->size = size;
+    return SNIFF_TOO_LARGE;
+}
+
+const char* sniff_reason_name(SniffReason reason) {
+    return (reason >= 0 && reason < SNIFF_REASON_COUNT) ? reason_names[reason] : "unknown";
+}
+
+void sniff_describe(const SniffOptions *options, const SniffVerdict *verdict, char *buffer, size_t size) {
+    const char *name = sniff_reason_name(verdict->reason);
+    if (verdict->cached) {
+        snprintf(buffer, size, "%s (cached)", name);
+        return;
+    }
+    switch (verdict->reason) {
+    case SNIFF_BINARY:
+        snprintf(buffer, size, "%s (NUL byte at offset %llu)", name, verdict->offset);
+        break;
+    case SNIFF_LONG_LINES:
+        snprintf(buffer, size, "%s (line at offset %llu is over %zu bytes)", name, verdict->offset,
+                 options->max_line_length);
+        break;
+    case SNIFF_GENERATED:
+        snprintf(buffer, size, "%s (\"%s\" at offset %llu)", name, options->markers[verdict->marker], verdict->offset);
+        break;
+    case SNIFF_TOO_LARGE:
+        snprintf(buffer, size, "%s (%llu bytes, limit %llu)", name, verdict->size, options->max_size);
+        break;
+    default:
+        snprintf(buffer, size, "%s", name);
+        break;
+    }
+}
+
+void merge_sniff_stats(SniffStats *dst, const SniffStats *src) {
+    if (!dst || !src) return;
+    for (int i = 0; i < SNIFF_REASON_COUNT; i++) dst->files[i] += src->files[i];
+}
+
+void print_sniff_stats(const SniffStats *stats) {
+    unsigned long long total = 0;
+    for (int i = SNIFF_TEXT + 1; i < SNIFF_REASON_COUNT; i++) total += stats->files[i];
+    printf("Skipped: %llu files", total);
+    const char *separator = " (";
+    for (int i = SNIFF_TEXT + 1; i < SNIFF_REASON_COUNT; i++) {
+        if (stats->files[i] == 0) continue;
+        printf("%s%llu %s", separator, stats->files[i], reason_names[i]);
+        separator = ", ";
+    }
+    printf("%s\n", total ? ")" : "");
+}
@@ -0,0 +1,86 @@
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Content sniffing: whether a file is worth counting, decided from its
+// first block (--sniff).
+//
+// A file's extension says what it should hold, not what it does. With
+// sniffing on, the reader checks the first SNIFF_WINDOW bytes of every file
+// before feeding anything to the counter. A NUL byte marks a binary file, a
+// line longer than max_line_length a minified bundle or a data dump, and a
+// marker such as "@generated" within the first SNIFF_MARKER_WINDOW bytes a
+// generated file. A file over max_size is turned down on its size alone,
+// where the reader learns it (see fileio.c). A file that trips a check is
+// read no further and goes to the scan's skipped bucket instead of its
+// totals.
+//
+// NUL bytes and line ends are found 64 bytes at a time with AVX2 or SSE2
+// compares, as in the classifier, so a text file costs one pass over its
+// first block.
+
+#define SNIFF_WINDOW 8192               // Bytes of the first block that are checked, as git does
+#define SNIFF_MARKER_WINDOW 1024        // Generated markers are looked for this close to the start
+#define SNIFF_DEFAULT_MAX_LINE 4096
+#define SNIFF_MAX_MARKERS 16
+#define SNIFF_MAX_MARKER_LEN 64
+
+typedef enum {
+    SNIFF_TEXT,             // Counted
+    SNIFF_BINARY,
+    SNIFF_LONG_LINES,
+    SNIFF_GENERATED,
+    SNIFF_TOO_LARGE,
+    SNIFF_REASON_COUNT
+} SniffReason;
+
+typedef struct {
+    bool binary;                    // Skip files with a NUL byte
+    size_t max_line_length;         // 0 = no limit
+    unsigned long long max_size;    // 0 = no limit
+    char markers[SNIFF_MAX_MARKERS][SNIFF_MAX_MARKER_LEN];
+    unsigned char anchors[SNIFF_MAX_MARKERS];   // Each marker's least common byte, searched for first
+    int marker_count;               // 0 = generated files are counted
+} SniffOptions;
+
+// Why a file was skipped, with what tripped the check
+typedef struct {
+    SniffReason reason;
+    unsigned long long offset;      // Of the NUL byte, the long line or the marker
+    unsigned long long size;        // With SNIFF_TOO_LARGE
+    int marker;                     // With SNIFF_GENERATED: index into the options' markers
+    bool cached;                    // Taken from the count cache: only the reason is known
+} SniffVerdict;
+
+// Files skipped by a scan, per reason (files[SNIFF_TEXT] is unused)
+typedef struct {
+    unsigned long long files[SNIFF_REASON_COUNT];
+} SniffStats;
+
+// Every check on, with the default line limit and markers and no size limit
+void sniff_options_init(SniffOptions *options);
+
+// Add a generated-file marker; false if it is empty, too long or one too many
+bool sniff_add_marker(SniffOptions *options, const char *marker);
+
+// Fingerprint of the options, for the count cache
+uint64_t sniff_options_hash(const SniffOptions *options);
+
+// Check a file's first `len` bytes; `verdict` tells why it is skipped, if it is
+SniffReason sniff_block(const SniffOptions *options, const unsigned char *data, size_t len, SniffVerdict *verdict);
+
+// Check a file's size, when the reader knows it
+SniffReason sniff_size(const SniffOptions *options, unsigned long long size, SniffVerdict *verdict);
+
+const char* sniff_reason_name(SniffReason reason);
+
+// "binary (NUL byte at offset 812)" and the like
+void sniff_describe(const SniffOptions *options, const SniffVerdict *verdict, char *buffer, size_t size);
+
+void merge_sniff_stats(SniffStats *dst, const SniffStats *src);
+void print_sniff_stats(const SniffStats *stats);
+
+#endif // SNIFF_H
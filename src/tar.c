@@ -0,0 +1,292 @@
+#include "tar.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+// Header field offsets and lengths
+#define NAME_LEN 100
+#define SIZE_OFFSET 124
+#define SIZE_LEN 12
+#define CHECKSUM_OFFSET 148
+#define CHECKSUM_LEN 8
+#define TYPE_OFFSET 156
+#define MAGIC_OFFSET 257
+#define PREFIX_OFFSET 345
+#define PREFIX_LEN 155
+
+bool tar_open(TarReader *tar, const char *path, const char **error) {
+    const char *unused;
+    if (!error) error = &unused;
+    memset(tar, 0, sizeof(TarReader));
+    if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        tar->file = stdin;
+        return true;
+    }
+    tar->file = fopen(path, "rb");
+    if (!tar->file) {
+        *error = "cannot open the archive";
+        return false;
+    }
+    tar->owned = true;
+    tar->seekable = fseek(tar->file, 0, SEEK_CUR) == 0;
+    return true;
+}
+
+void tar_close(TarReader *tar) {
+    if (tar && tar->owned && tar->file) fclose(tar->file);
+    if (tar) tar->file = NULL;
+}
+
+const char* tar_error(const TarReader *tar) {
+    return tar->error;
+}
+
+static bool read_exact(TarReader *tar, void *buffer, size_t size) {
+    if (fread(buffer, 1, size, tar->file) == size) return true;
+    tar->error = ferror(tar->file) ? "read error" : "truncated archive";
+    return false;
+}
+
+// Seeking past the end of a file succeeds, so the last byte skipped is read
+// to notice a truncated archive
+static bool skip_bytes(TarReader *tar, unsigned long long count) {
+    if (tar->seekable && count > 1) {
+        count--;
+        while (count > 0) {
+            long step = count > (1UL << 30) ? (long)(1UL << 30) : (long)count;
+            if (fseek(tar->file, step, SEEK_CUR) != 0) {
+                tar->error = "seek error";
+                return false;
+            }
+            count -= (unsigned long long)step;
+        }
+        count = 1;
+    }
+    unsigned char scratch[8192];
+    while (count > 0) {
+        size_t step = count > sizeof(scratch) ? sizeof(scratch) : (size_t)count;
+        if (!read_exact(tar, scratch, step)) return false;
+        count -= step;
+    }
+    return true;
+}
+
+// Octal number, or GNU base-256 when the high bit of the first byte is set
+static bool parse_number(const unsigned char *field, size_t len, unsigned long long *value) {
+    *value = 0;
+    if (field[0] & 0x80) {
+        if (field[0] != 0x80) return false;     // Negative, or too large
+        for (size_t i = 1; i < len; i++) {
+            if (*value >> 56) return false;
+            *value = (*value << 8) | field[i];
+        }
+        return true;
+    }
+    size_t i = 0;
+    while (i < len && field[i] == ' ') i++;
+    bool digits = false;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        if (*value >> 61) return false;
+        *value = (*value << 3) | (unsigned)(field[i] - '0');
+        digits = true;
+    }
+    return digits || i == len || field[i] == '\0' || field[i] == ' ';
+}
+
+// The stored checksum covers the header with its own field read as spaces;
+// some old writers summed signed bytes
+static bool checksum_ok(const unsigned char *block) {
+    unsigned long long stored;
+    if (!parse_number(block + CHECKSUM_OFFSET, CHECKSUM_LEN, &stored)) return false;
+    unsigned long long sum = 0;
+    long long signed_sum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        unsigned char c = (i >= CHECKSUM_OFFSET && i < CHECKSUM_OFFSET + CHECKSUM_LEN) ? ' ' : block[i];
+        sum += c;
+        signed_sum += (signed char)c;
+    }
+    return stored == sum || (long long)stored == signed_sum;
+}
+
+static size_t field_length(const unsigned char *field, size_t len) {
+    const unsigned char *nul = memchr(field, 0, len);
+    return nul ? (size_t)(nul - field) : len;
+}
+
+// Drop leading "./" and "/" so paths are relative to the archive root
+static void set_path(TarReader *tar, const char *path, size_t len) {
+    for (;;) {
+        if (len >= 2 && path[0] == '.' && path[1] == '/') {
+            path += 2;
+            len -= 2;
+        } else if (len >= 1 && path[0] == '/') {
+            path++;
+            len--;
+        } else {
+            break;
+        }
+    }
+    if (len >= TAR_PATH_MAX) len = TAR_PATH_MAX - 1;
+    memcpy(tar->path, path, len);
+    tar->path[len] = '\0';
+}
+
+// Read a member's data (a GNU long name or pax header) into a new buffer,
+// or skip it and return NULL if it is over `limit`
+static char* read_meta(TarReader *tar, unsigned long long size, size_t limit) {
+    unsigned long long padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    if (size > limit) {
+        skip_bytes(tar, padded);
+        return NULL;
+    }
+    char *data = malloc((size_t)padded + 1);
+    if (!data) {
+        skip_bytes(tar, padded);
+        return NULL;
+    }
+    if (!read_exact(tar, data, (size_t)padded)) {
+        free(data);
+        return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+// pax records are "<length> <key>=<value>\n"; picks out path and size
+static void parse_pax(const char *data, size_t size, char *path, size_t *path_len, bool *has_path,
+                      unsigned long long *member_size, bool *has_size) {
+    size_t offset = 0;
+    while (offset < size) {
+        const char *record = data + offset;
+        char *end;
+        unsigned long length = strtoul(record, &end, 10);
+        if (end == record || *end != ' ' || length == 0 || length > size - offset) return;
+        const char *key = end + 1;
+        const char *record_end = record + length;
+        if (key >= record_end) return;
+        const char *equals = memchr(key, '=', record_end - key);
+        if (equals && record_end[-1] == '\n') {
+            const char *value = equals + 1;
+            size_t value_len = (size_t)(record_end - 1 - value);
+            size_t key_len = (size_t)(equals - key);
+            if (key_len == 4 && memcmp(key, "path", 4) == 0 && value_len < TAR_PATH_MAX) {
+                memcpy(path, value, value_len);
+                *path_len = value_len;
+                *has_path = true;
+            } else if (key_len == 4 && memcmp(key, "size", 4) == 0) {
+                *member_size = strtoull(value, NULL, 10);
+                *has_size = true;
+            }
+        }
+        offset += length;
+    }
+}
+
+bool tar_next(TarReader *tar, TarMember *member) {
+    if (!tar->file || tar->error) return false;
+    if (!skip_bytes(tar, tar->remaining + tar->padding)) return false;
+    tar->remaining = tar->padding = 0;
+
+    char long_path[TAR_PATH_MAX];
+    size_t long_len = 0;
+    bool has_path = false, has_size = false;
+    unsigned long long pax_size = 0;
+
+    for (;;) {
+        unsigned char block[TAR_BLOCK_SIZE];
+        size_t got = fread(block, 1, TAR_BLOCK_SIZE, tar->file);
+        if (got == 0 && !ferror(tar->file)) return false;   // Some writers omit the end blocks
+        if (got != TAR_BLOCK_SIZE) {
+            tar->error = ferror(tar->file) ? "read error" : "truncated archive";
+            return false;
+        }
+
+        // The archive ends with zero blocks
+        bool zero = true;
+        for (int i = 0; i < TAR_BLOCK_SIZE && zero; i++) zero = block[i] == 0;
+        if (zero) return false;
+
+        unsigned long long size;
+        if (!checksum_ok(block) || !parse_number(block + SIZE_OFFSET, SIZE_LEN, &size)) {
+            tar->error = tar->members == 0 ? "not a tar archive" : "corrupt header";
+            return false;
+        }
+        tar->members++;
+        char type = (char)block[TYPE_OFFSET];
+
+        if (type == 'L' || type == 'x') {
+            char *data = read_meta(tar, size, type == 'L' ? TAR_PATH_MAX - 1 : TAR_PAX_MAX);
+            if (tar->error) return false;
+            if (data && type == 'L') {
+                long_len = strlen(data);
+                memcpy(long_path, data, long_len);
+                has_path = true;
+            } else if (data) {
+                parse_pax(data, (size_t)size, long_path, &long_len, &has_path, &pax_size, &has_size);
+            }
+            free(data);
+            continue;
+        }
+        if (type == 'g' || type == 'K') {
+            // Global pax defaults and GNU long link targets change nothing counted
+            if (!skip_bytes(tar, (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE)) return false;
+            continue;
+        }
+
+        if (has_size) size = pax_size;
+        if (has_path) {
+            set_path(tar, long_path, long_len);
+        } else {
+            char path[PREFIX_LEN + 1 + NAME_LEN];
+            size_t len = 0;
+            if (memcmp(block + MAGIC_OFFSET, "ustar\0", 6) == 0) {
+                size_t prefix_len = field_length(block + PREFIX_OFFSET, PREFIX_LEN);
+                if (prefix_len > 0) {
+                    memcpy(path, block + PREFIX_OFFSET, prefix_len);
+                    path[prefix_len] = '/';
+                    len = prefix_len + 1;
+                }
+            }
+            size_t name_len = field_length(block, NAME_LEN);
+            memcpy(path + len, block, name_len);
+            set_path(tar, path, len + name_len);
+        }
+
+        member->path = tar->path;
+        member->size = size;
+        // Hard links, symlinks and devices store no data; GNU sparse files store holes elided
+        if (type == '0' || type == '\0' || type == '7') {
+            member->type = TAR_FILE;
+        } else if (type == '5') {
+            member->type = TAR_DIRECTORY;
+        } else {
+            member->type = TAR_OTHER;
+        }
+        // Old archives mark directories by a trailing '/' only
+        size_t path_len = strlen(tar->path);
+        if (member->type == TAR_FILE && path_len > 0 && tar->path[path_len - 1] == '/') member->type = TAR_DIRECTORY;
+        if (member->type == TAR_DIRECTORY) {
+            while (path_len > 0 && tar->path[path_len - 1] == '/') tar->path[--path_len] = '\0';
+        }
+
+        tar->remaining = size;
+        tar->padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        return true;
+    }
+}
+
+size_t tar_read(TarReader *tar, void *buffer, size_t size) {
+    if (!tar->file || tar->error || tar->remaining == 0) return 0;
+    if (size > tar->remaining) size = (size_t)tar->remaining;
+    size_t got = fread(buffer, 1, size, tar->file);
+    if (got < size) tar->error = ferror(tar->file) ? "read error" : "truncated archive";
+    tar->remaining -= got;
+    return got;
+}
@@ -0,0 +1,60 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Streaming reader for tar archives (--tar).
+//
+// Members are read in order from a file or standard input, one 512-byte
+// header at a time, and their data is handed out in whatever pieces the
+// caller asks for; nothing is buffered beyond one header, so memory does not
+// grow with the archive. Data the caller does not read is skipped, with
+// fseek when the archive is a seekable file. Understands POSIX ustar (name
+// prefix), pax extended headers (path, size) and GNU long names and base-256
+// sizes. Compressed archives are not decoded: pipe them through the
+// decompressor into "-".
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_PATH_MAX 4096
+#define TAR_PAX_MAX 65536       // Larger pax headers are skipped
+
+typedef enum {
+    TAR_FILE,
+    TAR_DIRECTORY,
+    TAR_OTHER               // Links, devices, FIFOs, sparse files: no contents to count
+} TarType;
+
+typedef struct {
+    const char *path;       // As stored, minus any leading "./" and "/"; valid until tar_next
+    TarType type;
+    unsigned long long size;
+} TarMember;
+
+typedef struct {
+    FILE *file;
+    bool owned;                     // Not standard input
+    bool seekable;
+    unsigned long long remaining;   // Unread data of the current member
+    unsigned long long padding;     // Up to the next block boundary
+    unsigned long long members;
+    const char *error;
+    char path[TAR_PATH_MAX];
+} TarReader;
+
+// Open `path`, or standard input for "-"; `error` (optional) says why not
+bool tar_open(TarReader *tar, const char *path, const char **error);
+void tar_close(TarReader *tar);
+
+// Advance to the next member, skipping what is left of the current one.
+// Returns false at the end of the archive or on an error (see tar_error).
+bool tar_next(TarReader *tar, TarMember *member);
+
+// Read up to `size` bytes of the current member; 0 once it has all been read
+size_t tar_read(TarReader *tar, void *buffer, size_t size);
+
+// Why the last call failed, NULL if it did not
+const char* tar_error(const TarReader *tar);
+
+#endif // TAR_H
@@ -0,0 +1,207 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+// Thin portability layer over native threads, locks and atomics.
+// POSIX builds use pthreads and the GCC/Clang __atomic builtins,
+// Windows builds use Win32 threads, SRW locks and Interlocked calls.
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+
+    typedef HANDLE cl_thread_t;
+    typedef SRWLOCK cl_mutex_t;
+    typedef CONDITION_VARIABLE cl_cond_t;
+
+    typedef struct {
+        void *(*fn)(void *);
+        void *arg;
+    } cl_thread_start_t;
+
+    static DWORD WINAPI cl_thread_trampoline(LPVOID param) {
+        cl_thread_start_t start = *(cl_thread_start_t *)param;
+        free(param);
+        start.fn(start.arg);
+        return 0;
+    }
+
+    static inline int cl_thread_create(cl_thread_t *thread, void *(*fn)(void *), void *arg) {
+        cl_thread_start_t *start = malloc(sizeof(cl_thread_start_t));
+        if (!start) return -1;
+        start->fn = fn;
+        start->arg = arg;
+        *thread = CreateThread(NULL, 0, cl_thread_trampoline, start, 0, NULL);
+        if (!*thread) {
+            free(start);
+            return -1;
+        }
+        return 0;
+    }
+
+    static inline void cl_thread_join(cl_thread_t thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+
+    static inline void cl_thread_detach(cl_thread_t thread) { CloseHandle(thread); }
+
+    static inline void cl_mutex_init(cl_mutex_t *m) { InitializeSRWLock(m); }
+    static inline void cl_mutex_destroy(cl_mutex_t *m) { (void)m; }
+    static inline void cl_mutex_lock(cl_mutex_t *m) { AcquireSRWLockExclusive(m); }
+    static inline void cl_mutex_unlock(cl_mutex_t *m) { ReleaseSRWLockExclusive(m); }
+
+    static inline void cl_cond_init(cl_cond_t *c) { InitializeConditionVariable(c); }
+    static inline void cl_cond_destroy(cl_cond_t *c) { (void)c; }
+    static inline void cl_cond_wait(cl_cond_t *c, cl_mutex_t *m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+    static inline void cl_cond_timedwait_ms(cl_cond_t *c, cl_mutex_t *m, int ms) { SleepConditionVariableSRW(c, m, (DWORD)ms, 0); }
+    static inline void cl_cond_signal(cl_cond_t *c) { WakeConditionVariable(c); }
+    static inline void cl_cond_broadcast(cl_cond_t *c) { WakeAllConditionVariable(c); }
+
+    static inline int cl_cpu_count(void) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (int)info.dwNumberOfProcessors;
+    }
+
+    // Monotonic wall clock in nanoseconds
+    static inline unsigned long long cl_monotonic_ns(void) {
+        static LARGE_INTEGER frequency;
+        LARGE_INTEGER counter;
+        if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&counter);
+        return (unsigned long long)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+               (unsigned long long)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+    }
+
+    static inline unsigned long long cl_cpu_time_ns(const FILETIME *kernel, const FILETIME *user) {
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel->dwLowDateTime;
+        k.HighPart = kernel->dwHighDateTime;
+        u.LowPart = user->dwLowDateTime;
+        u.HighPart = user->dwHighDateTime;
+        return (k.QuadPart + u.QuadPart) * 100ULL;
+    }
+
+    // User + kernel CPU time in nanoseconds of the calling thread, and of the whole process
+    static inline unsigned long long cl_thread_cpu_ns(void) {
+        FILETIME created, exited, kernel, user;
+        if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+        return cl_cpu_time_ns(&kernel, &user);
+    }
+
+    static inline unsigned long long cl_process_cpu_ns(void) {
+        FILETIME created, exited, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+        return cl_cpu_time_ns(&kernel, &user);
+    }
+
+    #define cl_atomic_load(p)       InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+    #define cl_atomic_store(p, v)   InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+    #define cl_atomic_add(p, v)     InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(v))
+
+    // 64-bit counters read by other threads while their owner updates them
+    #define cl_atomic_load64(p)     ((unsigned long long)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+    #define cl_atomic_store64(p, v) InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v))
+    #define cl_atomic_cas64(p, expected, desired) \
+        (InterlockedCompareExchange64((volatile LONG64 *)(p), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+    #define cl_atomic_add64(p, v)   ((unsigned long long)InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(v)))
+
+    // Largest resident set of the process so far, in bytes; 0 if unknown
+    static inline unsigned long long cl_peak_rss_bytes(void) {
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+        return (unsigned long long)counters.PeakWorkingSetSize;
+    }
+#else
+    #include <pthread.h>
+    #include <time.h>
+    #include <errno.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+
+    typedef pthread_t cl_thread_t;
+    typedef pthread_mutex_t cl_mutex_t;
+    typedef pthread_cond_t cl_cond_t;
+
+    static inline int cl_thread_create(cl_thread_t *thread, void *(*fn)(void *), void *arg) {
+        return pthread_create(thread, NULL, fn, arg) == 0 ? 0 : -1;
+    }
+
+    static inline void cl_thread_join(cl_thread_t thread) { pthread_join(thread, NULL); }
+    static inline void cl_thread_detach(cl_thread_t thread) { pthread_detach(thread); }
+
+    static inline void cl_mutex_init(cl_mutex_t *m) { pthread_mutex_init(m, NULL); }
+    static inline void cl_mutex_destroy(cl_mutex_t *m) { pthread_mutex_destroy(m); }
+    static inline void cl_mutex_lock(cl_mutex_t *m) { pthread_mutex_lock(m); }
+    static inline void cl_mutex_unlock(cl_mutex_t *m) { pthread_mutex_unlock(m); }
+
+    static inline void cl_cond_init(cl_cond_t *c) { pthread_cond_init(c, NULL); }
+    static inline void cl_cond_destroy(cl_cond_t *c) { pthread_cond_destroy(c); }
+    static inline void cl_cond_wait(cl_cond_t *c, cl_mutex_t *m) { pthread_cond_wait(c, m); }
+    static inline void cl_cond_signal(cl_cond_t *c) { pthread_cond_signal(c); }
+    static inline void cl_cond_broadcast(cl_cond_t *c) { pthread_cond_broadcast(c); }
+
+    static inline void cl_cond_timedwait_ms(cl_cond_t *c, cl_mutex_t *m, int ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(c, m, &ts);
+    }
+
+    static inline int cl_cpu_count(void) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (int)n : 1;
+    }
+
+    // Monotonic wall clock in nanoseconds
+    static inline unsigned long long cl_monotonic_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+    }
+
+    // User + kernel CPU time in nanoseconds of the calling thread, and of the whole process
+    static inline unsigned long long cl_thread_cpu_ns(void) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+    }
+
+    static inline unsigned long long cl_process_cpu_ns(void) {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0;
+        return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+    }
+
+    #define cl_atomic_load(p)       __atomic_load_n((p), __ATOMIC_SEQ_CST)
+    #define cl_atomic_store(p, v)   __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+    #define cl_atomic_add(p, v)     __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+
+    // 64-bit counters read by other threads while their owner updates them
+    #define cl_atomic_load64(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+    #define cl_atomic_store64(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+    static inline int cl_atomic_cas64(unsigned long long *p, unsigned long long expected, unsigned long long desired) {
+        return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+    #define cl_atomic_add64(p, v)   __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+
+    // Largest resident set of the process so far, in bytes; 0 if unknown
+    static inline unsigned long long cl_peak_rss_bytes(void) {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    #ifdef __APPLE__
+        return (unsigned long long)usage.ru_maxrss;
+    #else
+        return (unsigned long long)usage.ru_maxrss * 1024ULL;
+    #endif
+    }
+#endif
+
+#endif // THREADING_H
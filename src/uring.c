@@ -0,0 +1,382 @@
+#include "uring.h"
+#include "threading.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define HAVE_IO_URING 1
+    #endif
+#endif
+
+#ifndef HAVE_IO_URING
+
+UringReader* uring_reader_create(unsigned depth, const SniffOptions *sniff, const char **reason) {
+    (void)depth; (void)sniff;
+    if (reason) *reason = "not supported on this platform";
+    return NULL;
+}
+
+void uring_reader_destroy(UringReader *reader) { (void)reader; }
+
+bool uring_reader_submit(UringReader *reader, int dirfd, const char *name,
+                         BlockSink sink, UringDone done, void *ctx) {
+    (void)reader; (void)dirfd; (void)name; (void)sink; (void)done; (void)ctx;
+    return false;
+}
+
+bool uring_reader_drain(UringReader *reader) {
+    (void)reader;
+    return false;
+}
+
+const IoBackendStats* uring_reader_stats(const UringReader *reader) {
+    (void)reader;
+    return NULL;
+}
+
+#else
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdint.h>
+
+enum {
+    SLOT_FREE,
+    SLOT_OPEN,
+    SLOT_READ,
+    SLOT_CLOSE
+};
+
+typedef struct {
+    int state;
+    int fd;
+    unsigned long long offset;
+    int dirfd;
+    const char *name;
+    BlockSink sink;
+    UringDone done;
+    void *ctx;
+    unsigned char *buffer;
+} UringSlot;
+
+struct UringReader {
+    int ring_fd;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned local_tail;        // SQEs prepared up to here
+    unsigned unsubmitted;       // Prepared but not yet passed to io_uring_enter
+
+    UringSlot *slots;
+    unsigned depth;
+    unsigned *free_slots;
+    unsigned free_count;
+    unsigned char *buffers;
+    const SniffOptions *sniff;      // Optional: checks each file's first block
+
+    IoBackendStats stats;
+};
+
+// Queued SQEs are passed to the kernel once this many have built up
+#define SUBMIT_BATCH 8
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// openat, read and close through the ring all arrived in 5.6; older kernels
+// accept the ring but fail those operations, so probe instead of guessing
+static bool ops_supported(int ring_fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return false;
+
+    bool ok = sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const int needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    for (int i = 0; ok && i < 3; i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+UringReader* uring_reader_create(unsigned depth, const SniffOptions *sniff, const char **reason) {
+    if (depth == 0) depth = URING_DEFAULT_DEPTH;
+    if (depth > URING_MAX_DEPTH) depth = URING_MAX_DEPTH;
+
+    UringReader *r = calloc(1, sizeof(UringReader));
+    if (!r) {
+        if (reason) *reason = "out of memory";
+        return NULL;
+    }
+    r->ring_fd = -1;
+    r->depth = depth;
+    r->sniff = sniff;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->ring_fd = sys_io_uring_setup(depth, &params);
+    if (r->ring_fd < 0) {
+        if (reason) *reason = errno == ENOSYS ? "kernel without io_uring" : "io_uring_setup refused";
+        uring_reader_destroy(r);
+        return NULL;
+    }
+    if (!ops_supported(r->ring_fd)) {
+        if (reason) *reason = "kernel lacks io_uring openat/read/close";
+        uring_reader_destroy(r);
+        return NULL;
+    }
+
+    r->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) r->sq_map = NULL;
+    if (single) {
+        r->cq_map = r->sq_map;
+    } else if (r->sq_map) {
+        r->cq_map = mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) r->cq_map = NULL;
+    }
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) r->sqes = NULL;
+
+    r->slots = calloc(depth, sizeof(UringSlot));
+    r->free_slots = malloc(depth * sizeof(unsigned));
+    void *buffers = NULL;
+    if (posix_memalign(&buffers, IO_BUFFER_ALIGN, (size_t)depth * URING_BUFFER_SIZE) != 0) buffers = NULL;
+    r->buffers = buffers;
+
+    if (!r->sq_map || !r->cq_map || !r->sqes || !r->slots || !r->free_slots || !r->buffers) {
+        if (reason) *reason = "cannot map the io_uring rings";
+        uring_reader_destroy(r);
+        return NULL;
+    }
+
+    unsigned char *sq = r->sq_map;
+    unsigned char *cq = r->cq_map;
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    r->local_tail = *r->sq_tail;
+
+    for (unsigned i = 0; i < depth; i++) {
+        r->slots[i].buffer = r->buffers + (size_t)i * URING_BUFFER_SIZE;
+        r->free_slots[i] = depth - 1 - i;
+    }
+    r->free_count = depth;
+    return r;
+}
+
+void uring_reader_destroy(UringReader *r) {
+    if (!r) return;
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_size);
+    if (r->ring_fd >= 0) close(r->ring_fd);
+    free(r->slots);
+    free(r->free_slots);
+    free(r->buffers);
+    free(r);
+}
+
+// Every slot has at most one operation queued and the SQ ring holds at
+// least `depth` entries, so a free SQE always exists
+static struct io_uring_sqe* next_sqe(UringReader *r, unsigned slot_index) {
+    unsigned index = r->local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = slot_index;
+    r->sq_array[index] = index;
+    r->local_tail++;
+    r->unsubmitted++;
+    return sqe;
+}
+
+static void queue_open(UringReader *r, unsigned i) {
+    UringSlot *slot = &r->slots[i];
+    struct io_uring_sqe *sqe = next_sqe(r, i);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = slot->dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->name;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    slot->state = SLOT_OPEN;
+}
+
+static void queue_read(UringReader *r, unsigned i) {
+    UringSlot *slot = &r->slots[i];
+    struct io_uring_sqe *sqe = next_sqe(r, i);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->buffer;
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->off = slot->offset;
+    slot->state = SLOT_READ;
+}
+
+static void queue_close(UringReader *r, unsigned i) {
+    UringSlot *slot = &r->slots[i];
+    struct io_uring_sqe *sqe = next_sqe(r, i);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot->fd;
+    slot->state = SLOT_CLOSE;
+}
+
+static void release_slot(UringReader *r, unsigned i) {
+    r->slots[i].state = SLOT_FREE;
+    r->free_slots[r->free_count++] = i;
+}
+
+// Check a file's first block, and its size when it fills the block
+static bool turned_down(const UringReader *r, const UringSlot *slot, size_t len, SniffVerdict *verdict) {
+    struct stat st;
+    if (len == URING_BUFFER_SIZE && r->sniff->max_size && fstat(slot->fd, &st) == 0 &&
+        sniff_size(r->sniff, (unsigned long long)st.st_size, verdict) != SNIFF_TEXT) {
+        return true;
+    }
+    return sniff_block(r->sniff, slot->buffer, len, verdict) != SNIFF_TEXT;
+}
+
+static void complete(UringReader *r, unsigned i, int res) {
+    UringSlot *slot = &r->slots[i];
+    switch (slot->state) {
+    case SLOT_OPEN:
+        if (res < 0) {
+            slot->done(slot->ctx, false, NULL);
+            release_slot(r, i);
+            return;
+        }
+        slot->fd = res;
+        slot->offset = 0;
+        queue_read(r, i);
+        return;
+    case SLOT_READ:
+        if (res == -EINTR || res == -EAGAIN) {
+            queue_read(r, i);
+        } else if (res > 0) {
+            SniffVerdict verdict;
+            if (slot->offset == 0 && r->sniff && turned_down(r, slot, (size_t)res, &verdict)) {
+                r->stats.files++;
+                r->stats.bytes += (unsigned long long)res;
+                slot->done(slot->ctx, true, &verdict);
+                queue_close(r, i);
+                return;
+            }
+            slot->sink(slot->ctx, slot->buffer, (size_t)res);
+            slot->offset += (unsigned long long)res;
+            r->stats.bytes += (unsigned long long)res;
+            queue_read(r, i);
+        } else {
+            // End of file (or a read error): the file is done, the descriptor still needs closing
+            if (res == 0) r->stats.files++;
+            slot->done(slot->ctx, res == 0, NULL);
+            queue_close(r, i);
+        }
+        return;
+    default:
+        release_slot(r, i);
+        return;
+    }
+}
+
+// Publish queued SQEs and wait for at least `wait` completions, then handle
+// every completion that is ready
+static void enter_and_reap(UringReader *r, unsigned wait) {
+    __atomic_store_n(r->sq_tail, r->local_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int ret = sys_io_uring_enter(r->ring_fd, r->unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0) {
+            r->unsubmitted -= (unsigned)ret < r->unsubmitted ? (unsigned)ret : r->unsubmitted;
+            break;
+        }
+        if (errno == EINTR) continue;
+        // EAGAIN / EBUSY: the completion queue is full; reap below, then retry later
+        break;
+    }
+
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        unsigned slot = (unsigned)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        complete(r, slot, res);
+        tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool uring_reader_submit(UringReader *r, int dirfd, const char *name,
+                         BlockSink sink, UringDone done, void *ctx) {
+    if (!r) return false;
+    unsigned long long start = cl_monotonic_ns();
+
+    while (r->free_count == 0) enter_and_reap(r, 1);
+
+    unsigned i = r->free_slots[--r->free_count];
+    UringSlot *slot = &r->slots[i];
+    slot->dirfd = dirfd;
+    slot->name = name;
+    slot->sink = sink;
+    slot->done = done;
+    slot->ctx = ctx;
+    slot->fd = -1;
+    queue_open(r, i);
+
+    if (r->unsubmitted >= SUBMIT_BATCH) enter_and_reap(r, 0);
+
+    r->stats.nanoseconds += cl_monotonic_ns() - start;
+    return true;
+}
+
+bool uring_reader_drain(UringReader *r) {
+    if (!r || r->free_count == r->depth) return false;
+    unsigned long long start = cl_monotonic_ns();
+    while (r->free_count < r->depth) enter_and_reap(r, 1);
+    r->stats.nanoseconds += cl_monotonic_ns() - start;
+    return true;
+}
+
+const IoBackendStats* uring_reader_stats(const UringReader *r) {
+    return r ? &r->stats : NULL;
+}
+
+#endif
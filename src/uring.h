@@ -0,0 +1,47 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include "fileio.h"
+
+// Asynchronous file reading through io_uring (Linux 5.6+).
+//
+// Each worker owns one UringReader with `depth` slots. A slot carries one
+// file through openat -> read ... read -> close, one operation in flight at a
+// time, with its own buffer. Submissions are batched: new files only queue
+// SQEs, and the ring is entered when enough are queued or a slot is needed.
+// Completed reads are handed to the file's sink on the submitting thread,
+// in file order, so sinks need no locking.
+//
+// On other platforms, or when the kernel refuses io_uring (old kernel,
+// seccomp, kernel.io_uring_disabled), uring_reader_create returns NULL and
+// callers use the blocking FileReader instead.
+
+#define URING_DEFAULT_DEPTH 32
+#define URING_MAX_DEPTH 4096
+#define URING_BUFFER_SIZE (128 * 1024)
+
+// Called once per file: after its last block (ok) or when it could not be
+// opened or read. `verdict` is set, with ok, when sniffing turned the file
+// down on its first block; nothing was fed to the sink then.
+typedef void (*UringDone)(void *ctx, bool ok, const SniffVerdict *verdict);
+
+typedef struct UringReader UringReader;
+
+// `sniff` (optional) checks each file's first block as FileReader does;
+// `reason` (optional) receives why io_uring is unavailable
+UringReader* uring_reader_create(unsigned depth, const SniffOptions *sniff, const char **reason);
+void uring_reader_destroy(UringReader *reader);
+
+// Queue `name` (relative to `dirfd`); `name` and `dirfd` must stay valid until `done`
+// runs. Blocks, completing earlier files, while every slot is busy.
+bool uring_reader_submit(UringReader *reader, int dirfd, const char *name,
+                         BlockSink sink, UringDone done, void *ctx);
+
+// Complete every queued file; returns false if nothing was in flight
+bool uring_reader_drain(UringReader *reader);
+
+// Files, bytes and wall time spent submitting and completing
+const IoBackendStats* uring_reader_stats(const UringReader *reader);
+
+#endif // URING_H
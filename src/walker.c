@@ -0,0 +1,1680 @@
+#include "countlines.h"
+#include "workpool.h"
+#include "uring.h"
+#include "tar.h"
+#include "dedupe.h"
+
+// Directory traversal on top of the work-stealing pool. Directories and
+// files are separate work items: a directory item lists its entries and
+// pushes one item per subdirectory and per text file. Every worker counts
+// into its own CountResult, merged once the pool drains, so the counting
+// hot path never touches shared state. A git index (walk_index) or a tar
+// archive (walk_tar) takes the place of the listing; the other options are
+// described where they are implemented.
+//
+// Exclusions are matched against each entry name as it is listed, using the
+// compiled matcher and the state carried by the parent's directory item, so
+// excluded directories are never opened and no path is scanned twice.
+//
+// On POSIX systems no full path is resolved by the kernel after the root:
+// entry types come from readdir's d_type (fstatat relative to the directory
+// only when the filesystem reports DT_UNKNOWN, or for symlinks, which are
+// followed as stat() did), subdirectories are opened with openat against the
+// parent's descriptor and files with openat against their directory's. A
+// symlink is not followed to a directory the walk is already inside: every
+// node records its directory's device and inode when it is opened, and the
+// link's target is looked up along the node's ancestors. (On Windows,
+// directory symlinks and junctions are not followed at all.) Each
+// directory node keeps its DIR open while items that need its descriptor are
+// queued, tracked by a reference count of its own. At most
+// options->max_open_dirs handles are kept that way: a directory opened past
+// the limit counts its files as it lists them and closes its handle when the
+// listing ends, and its subdirectories are opened through their path.
+//
+// A node stores only its own name and holds its parent for as long as it
+// lives, so the nodes form a tree in which every path component is kept
+// once, however deep the directories below it. A full path is built only when
+// something needs one (Windows, callbacks, progress, profiles and opening a
+// directory whose parent's handle is gone), in a buffer each worker reuses,
+// walking from the node up to the root. No fixed length applies: a directory
+// whose path the kernel refuses as too long is opened one component at a time,
+// each checked against the directory it was when listed.
+
+enum {
+    WALK_DIR,
+    WALK_FILE,
+    WALK_INDEX,
+    WALK_TAR
+};
+
+#define TAR_CHUNK_SIZE (64 * 1024)     // Member data fed to the counter at a time
+#define WALK_MIN_OPEN_DIRS 16          // Default handle limit, whatever the descriptor limit
+#define WALK_MAX_OPEN_DIRS 65536
+
+// Breakdown groups: files in the root, one per top-level directory, overflow
+#define GROUP_ROOT 0
+#define GROUP_OTHER (BREAKDOWN_MAX_DIRECTORIES + 1)
+#define GROUP_COUNT (BREAKDOWN_MAX_DIRECTORIES + 2)
+
+// A root of a batch: its items still queued or in flight below it, and
+// whether it could be opened. Its counts are sharded in WorkerResult.roots.
+typedef struct {
+    const char *path;
+    int index;
+    int pending;
+    bool opened;
+} WalkRoot;
+
+typedef struct {
+    CountResult result;
+    unsigned long long directories;
+    SniffStats skipped;
+} RootShard;
+
+// A growable buffer full paths are built in, one of each per worker
+typedef struct {
+    char *data;
+    size_t capacity;
+} PathBuffer;
+
+// A file's bytes held until it is known whether to count them
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;                // It could not grow, and part of the file is missing
+} HeldBytes;
+
+typedef struct {
+    CountResult result;
+    unsigned long long mismatches;
+    FileReader reader;
+    PathBuffer file_path;       // Scratch for full file paths
+    PathBuffer dir_path;        // Scratch for directory paths handed to callbacks
+    UringReader *uring;         // With IO_URING, when the kernel supports it
+    CacheEntryList cache_entries;   // Entries for the next cache file
+    unsigned long long cache_hits;
+    unsigned long long cache_misses;
+    unsigned long long directories;
+    CountResult languages[LANG_COUNT];  // Breakdown shard, when one was requested
+    CountResult *groups;
+    int group_capacity;
+    ScanProfile profile;        // Profile shard, when one was requested
+    DedupeStats dedupe;         // Copies left out, with options->dedupe
+    HeldBytes held;             // With options->dedupe: a file that may be a copy
+    SniffStats skipped;         // Files turned down, with options->sniff
+    RootShard *roots;           // With a batch: this worker's share of each root
+    bool unreadable;            // The git index or tar archive could not be read
+    unsigned long long cpu_started;     // Thread CPU clock at this worker's first item
+    bool cpu_tracked;
+    // Totals published for progress reports; only the owner writes them
+    unsigned long long shown_files;
+    unsigned long long shown_lines;
+    unsigned long long shown_blank;
+    unsigned long long shown_comments;
+    unsigned long long shown_directories;
+    char pad[64];
+} WorkerResult;
+
+typedef struct {
+    const CountOptions *options;
+    const ExcludeMatcher *matcher;
+    int state_words;
+    CountCache *cache;
+    DedupeTable *dedupe;                // With options->dedupe
+    WorkerResult *workers;
+    int worker_count;
+    bool self_check;
+    unsigned long long started;         // For progress reports
+    unsigned long long next_progress;
+    char **group_names;                 // GROUP_COUNT entries, NULL without a breakdown
+    int group_count;                    // Only written by the worker listing the root
+    WalkRoot *roots;                    // With a batch, root_count entries
+    int root_count;
+    BatchVisitor on_root;
+    void *root_ctx;
+    int max_open_dirs;
+    int open_dirs;                      // Directory handles open now
+    unsigned long long peak_open_dirs;
+    unsigned long long dir_nodes;       // Directory nodes alive now, and their bytes
+    unsigned long long dir_bytes;
+    unsigned long long peak_dir_nodes;
+    unsigned long long peak_dir_bytes;
+} WalkContext;
+
+typedef struct DirNode DirNode;
+struct DirNode {
+    DirNode *parent;            // Referenced for as long as this node lives, for its path
+    WalkRoot *root;             // With a batch: the root this directory lies below
+    int refs;                   // Held while dir_refs is not zero, and by each child node
+    int dir_refs;               // Listing + queued children not yet opened + queued files
+    int depth;                  // 0 for the root
+    bool by_path;               // Opened through its path; holds no reference to the parent's handle
+#ifndef _WIN32
+    DIR *dir;                   // Open from listing until dir_refs drops to zero
+    dev_t dev;                  // Identity of the directory, set once it is opened
+    ino_t ino;
+#endif
+    int group;                  // Breakdown group of the files below
+    size_t name_len;
+    char *name;                 // Entry name in the parent, the scanned path for the root;
+                                // points into the same allocation
+    uint64_t exclude_state[];   // Matcher state for this directory's entries
+};
+
+typedef struct {
+    DirNode *dir;
+    LanguageId language;
+    int group;                  // Breakdown group
+    char name[];                // Relative to dir (with options->git, possibly several components)
+} FileTask;
+
+static size_t dir_node_size(const WalkContext *ctx, size_t name_len) {
+    return sizeof(DirNode) + sizeof(uint64_t) * ctx->state_words + name_len + 1;
+}
+
+// Raise a peak shared by the workers to `value`
+static void raise_peak(unsigned long long *peak, unsigned long long value) {
+    unsigned long long seen = cl_atomic_load64(peak);
+    while (value > seen && !cl_atomic_cas64(peak, seen, value)) seen = cl_atomic_load64(peak);
+}
+
+// A node for directory `name` below `parent`. It holds the parent until it is
+// freed, and the parent's handle until it has been opened unless `by_path`.
+static DirNode* create_dir_node(WalkContext *ctx, DirNode *parent, const char *name, size_t name_len, bool by_path) {
+    size_t size = dir_node_size(ctx, name_len);
+    DirNode *node = malloc(size);
+    if (!node) return NULL;
+
+    node->parent = parent;
+    node->root = parent ? parent->root : NULL;
+    node->refs = 1;
+    node->dir_refs = 1;
+    node->depth = parent ? parent->depth + 1 : 0;
+    node->by_path = by_path || !parent;
+#ifndef _WIN32
+    node->dir = NULL;
+    node->dev = 0;
+    node->ino = 0;
+#endif
+    node->group = parent ? parent->group : GROUP_ROOT;
+    node->name_len = name_len;
+    node->name = (char*)(node->exclude_state + ctx->state_words);
+    memcpy(node->name, name, name_len);
+    node->name[name_len] = '\0';
+    if (parent) {
+        cl_atomic_add(&parent->refs, 1);
+        if (!by_path) cl_atomic_add(&parent->dir_refs, 1);
+    }
+
+    raise_peak(&ctx->peak_dir_nodes, cl_atomic_add64(&ctx->dir_nodes, 1) + 1);
+    raise_peak(&ctx->peak_dir_bytes, cl_atomic_add64(&ctx->dir_bytes, size) + size);
+    return node;
+}
+
+static void release_dir_node(WalkContext *ctx, DirNode *node) {
+    while (node && cl_atomic_add(&node->refs, -1) == 1) {
+        DirNode *parent = node->parent;
+        cl_atomic_add64(&ctx->dir_nodes, -1);
+        cl_atomic_add64(&ctx->dir_bytes, -(unsigned long long)dir_node_size(ctx, node->name_len));
+        free(node);
+        node = parent;
+    }
+}
+
+// Drop a reference to the directory's handle, closing it with the last one
+static void release_dir_handle(WalkContext *ctx, DirNode *node) {
+    if (cl_atomic_add(&node->dir_refs, -1) != 1) return;
+#ifndef _WIN32
+    if (node->dir) {
+        closedir(node->dir);
+        node->dir = NULL;
+        cl_atomic_add(&ctx->open_dirs, -1);
+    }
+#endif
+    release_dir_node(ctx, node);
+}
+
+// Full path of `node`, followed by `name` when given, built in `buffer` from
+// the names of the node and its ancestors, the last component first
+static const char* build_path(PathBuffer *buffer, const DirNode *node, const char *name) {
+    size_t name_len = name ? strlen(name) : 0;
+    size_t len = name ? name_len + 1 : 0;
+    for (const DirNode *n = node; n; n = n->parent) len += n->name_len + (n->parent ? 1 : 0);
+    if (len + 1 > buffer->capacity) {
+        char *grown = realloc(buffer->data, (len + 1) * 2);
+        if (!grown) return NULL;
+        buffer->data = grown;
+        buffer->capacity = (len + 1) * 2;
+    }
+    char *end = buffer->data + len;
+    *end = '\0';
+    if (name) {
+        end -= name_len;
+        memcpy(end, name, name_len);
+        *--end = PATH_SEPARATOR;
+    }
+    for (const DirNode *n = node; n; n = n->parent) {
+        end -= n->name_len;
+        memcpy(end, n->name, n->name_len);
+        if (n->parent) *--end = PATH_SEPARATOR;
+    }
+    return buffer->data;
+}
+
+// Path of a directory in the worker's scratch buffer, for callbacks and reports
+static const char* dir_path(WorkerResult *worker, const DirNode *node) {
+    const char *path = build_path(&worker->dir_path, node, NULL);
+    return path ? path : node->name;
+}
+
+// Phases timed inside a directory listing, left out of its enumerate time
+#define LISTING_NESTED (PROFILE_MASK(PHASE_METADATA) | PROFILE_MASK(PHASE_EXCLUDE))
+// An archive's members are also read and counted inside its listing
+#define ARCHIVE_NESTED (LISTING_NESTED | PROFILE_MASK(PHASE_READ) | PROFILE_MASK(PHASE_CLASSIFY))
+
+// The worker's profile shard, NULL unless the scan is profiled (--profile).
+// Each worker times its own phases into a ScanProfile of its own, merged
+// with the results.
+static ScanProfile* worker_profile(const WalkContext *ctx, WorkerResult *worker) {
+    return ctx->options->profile ? &worker->profile : NULL;
+}
+
+// Thread CPU time of the worker since its first item. It is sampled when
+// the worker runs out of work, which is also the last thing it does.
+static void track_cpu(WorkerResult *worker) {
+    unsigned long long now = cl_thread_cpu_ns();
+    if (!worker->cpu_tracked) {
+        worker->cpu_tracked = true;
+        worker->cpu_started = now;
+    }
+    worker->profile.cpu_ns = now - worker->cpu_started;
+}
+
+static unsigned long long bytes_read(const FileReader *reader) {
+    unsigned long long bytes = 0;
+    for (int i = 0; i < IO_MODE_COUNT; i++) bytes += reader->stats.backends[i].bytes;
+    return bytes;
+}
+
+// Match a directory entry against the exclude patterns, timed when profiling
+static bool exclude_entry(const WalkContext *ctx, int worker_id, const DirNode *dir, const char *name,
+                          bool is_dir, uint64_t *child_state) {
+    ScanProfile *profile = worker_profile(ctx, &ctx->workers[worker_id]);
+    if (!profile) return exclude_matcher_step(ctx->matcher, dir->exclude_state, name, is_dir, child_state);
+
+    ProfileStamp start = profile_now();
+    bool excluded = exclude_matcher_step(ctx->matcher, dir->exclude_state, name, is_dir, child_state);
+    profile_phase(profile, PHASE_EXCLUDE, start);
+    return excluded;
+}
+
+static void push_directory(WorkPool *pool, int worker_id, DirNode *node) {
+    if (node->root) cl_atomic_add(&node->root->pending, 1);
+    WorkItem item;
+    item.kind = WALK_DIR;
+    item.data = node;
+    workpool_push(pool, worker_id, item);
+}
+
+// Breakdown group for a new top-level directory. A breakdown is sharded
+// like the totals: every worker adds each file to its own per-language and
+// per-group arrays, indexed directly by LanguageId and by the group number of
+// the file's top-level directory. Group numbers are handed out here by the
+// one worker that lists the root, at most BREAKDOWN_MAX_DIRECTORIES of them,
+// so a shard never outgrows that however many directories lie below.
+static int add_group(WalkContext *ctx, const char *name, size_t len) {
+    if (ctx->group_count > BREAKDOWN_MAX_DIRECTORIES) return GROUP_OTHER;
+    char *copy = malloc(len + 1);
+    if (!copy) return GROUP_OTHER;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    ctx->group_names[ctx->group_count] = copy;
+    return ctx->group_count++;
+}
+
+// Breakdown group of a file at relative path `path`, given the group of the
+// previous one; only the worker listing the root calls this
+static int path_group(WalkContext *ctx, const char *path, int previous) {
+    const char *slash = strchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : 0;
+    if (len == 0) return GROUP_ROOT;
+    if (previous != GROUP_ROOT && previous != GROUP_OTHER &&
+        strncmp(ctx->group_names[previous], path, len) == 0 && ctx->group_names[previous][len] == '\0') {
+        return previous;
+    }
+    for (int group = GROUP_ROOT + 1; group < ctx->group_count; group++) {
+        if (strncmp(ctx->group_names[group], path, len) == 0 && ctx->group_names[group][len] == '\0') return group;
+    }
+    return add_group(ctx, path, len);
+}
+
+// Queue a subdirectory unless the matcher excludes it or it lies too deep;
+// `by_path` when the parent does not keep its handle for it
+static void add_directory(WorkPool *pool, int worker_id, WalkContext *ctx, DirNode *parent, const char *name,
+                          bool by_path) {
+    if (ctx->options->max_depth > 0 && parent->depth + 1 >= ctx->options->max_depth) return;
+    size_t len = strlen(name);
+    DirNode *node = create_dir_node(ctx, parent, name, len, by_path);
+    if (!node) return;
+    if (exclude_entry(ctx, worker_id, parent, name, true, node->exclude_state)) {
+        release_dir_handle(ctx, node);
+        if (!by_path) release_dir_handle(ctx, parent);
+        return;
+    }
+    // Only the root lies at depth 0; its subdirectories start the groups
+    if (ctx->group_names && parent->depth == 0) node->group = add_group(ctx, name, len);
+    push_directory(pool, worker_id, node);
+}
+
+static FileTask* create_file_task(DirNode *dir, const char *name, LanguageId language, int group) {
+    size_t len = strlen(name);
+    FileTask *task = malloc(sizeof(FileTask) + len + 1);
+    if (!task) return NULL;
+    task->dir = dir;
+    task->language = language;
+    task->group = group;
+    memcpy(task->name, name, len + 1);
+    return task;
+}
+
+static void push_file(WorkPool *pool, int worker_id, DirNode *dir, const char *name, LanguageId language,
+                      int group) {
+    FileTask *task = create_file_task(dir, name, language, group);
+    if (!task) return;
+    cl_atomic_add(&dir->dir_refs, 1);
+    if (dir->root) cl_atomic_add(&dir->root->pending, 1);
+
+    WorkItem item;
+    item.kind = WALK_FILE;
+    item.data = task;
+    workpool_push(pool, worker_id, item);
+}
+
+static bool walk_file(WalkContext *ctx, WorkerResult *worker, FileTask *task, bool may_defer);
+
+// Queue a text file unless the matcher or the caller's filter excludes it;
+// with `count_now` it is counted at once instead, while its directory is open
+static void add_file(WorkPool *pool, int worker_id, WalkContext *ctx, DirNode *dir, const char *name,
+                     bool count_now) {
+    const CountOptions *options = ctx->options;
+    LanguageId language = language_from_filename_mapped(options->extensions, name);
+    if (language == LANG_UNKNOWN) return;
+    if (exclude_entry(ctx, worker_id, dir, name, false, NULL)) return;
+    if (options->want_file &&
+        !options->want_file(options->visitor_ctx, dir_path(&ctx->workers[worker_id], dir), name, language)) {
+        return;
+    }
+    if (!count_now) {
+        push_file(pool, worker_id, dir, name, language, dir->group);
+        return;
+    }
+    FileTask *task = create_file_task(dir, name, language, dir->group);
+    if (!task) return;
+    walk_file(ctx, &ctx->workers[worker_id], task, false);
+    free(task);
+}
+
+// Full path of a queued file in the worker's scratch buffer
+static const char* file_path(WorkerResult *worker, const FileTask *task) {
+    return build_path(&worker->file_path, task->dir, task->name);
+}
+
+// Count a directory listed (or an archive, or a directory in one), in its
+// batch root's shard too; the root's own listing marks it opened
+static void count_directory(WorkerResult *worker, DirNode *node) {
+    worker->directories++;
+    if (!node->root) return;
+    worker->roots[node->root->index].directories++;
+    if (node->depth == 0) node->root->opened = true;
+}
+
+#ifndef _WIN32
+// Whether the directory identified by `dev` and `ino` is `node` or one of its
+// ancestors, so that following a symlink to it would walk in a loop
+static bool on_ancestor_chain(const DirNode *node, dev_t dev, ino_t ino) {
+    for (; node; node = node->parent) {
+        if (node->ino == ino && node->dev == dev) return true;
+    }
+    return false;
+}
+
+// Open a directory through its path, as for the root or when its parent
+// keeps no handle for it. A path the kernel refuses as too long is opened one
+// component at a time from the root.
+static int open_by_path(WorkerResult *worker, const DirNode *node) {
+    const char *path = build_path(&worker->dir_path, node, NULL);
+    if (!path) return -1;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 || errno != ENAMETOOLONG) return fd;
+
+    const DirNode **chain = malloc(sizeof(DirNode*) * (node->depth + 1));
+    if (!chain) return -1;
+    for (const DirNode *n = node; n; n = n->parent) chain[n->depth] = n;
+    // Each step re-resolves a name that may be a symlink, with no ELOOP limit
+    // on the whole: every ancestor must still be the directory it was when
+    // walked, and the last must not be one of them
+    fd = open(chain[0]->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; fd >= 0 && i <= node->depth; i++) {
+        if (i > 0) {
+            int next = openat(fd, chain[i]->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            close(fd);
+            if ((fd = next) < 0) break;
+        }
+        struct stat dir_stat;
+        bool looped = fstat(fd, &dir_stat) != 0 ||
+                      (i < node->depth ? dir_stat.st_dev != chain[i]->dev || dir_stat.st_ino != chain[i]->ino
+                                       : on_ancestor_chain(node->parent, dir_stat.st_dev, dir_stat.st_ino));
+        if (looped) {
+            close(fd);
+            fd = -1;
+            errno = ELOOP;
+        }
+    }
+    free((void *)chain);
+    return fd;
+}
+
+// Give a directory its handle from `fd`, counted against the limit. Returns
+// the number of handles open with it, or 0 if it could not be had.
+static int open_dir_handle(WalkContext *ctx, DirNode *node, int fd) {
+    node->dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!node->dir) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    int open_dirs = cl_atomic_add(&ctx->open_dirs, 1) + 1;
+    raise_peak(&ctx->peak_open_dirs, (unsigned long long)open_dirs);
+    return open_dirs;
+}
+#endif
+
+static void walk_directory(WorkPool *pool, int worker_id, WalkContext *ctx, DirNode *node) {
+    WorkerResult *worker = &ctx->workers[worker_id];
+#ifdef _WIN32
+    const char *search_path = build_path(&worker->dir_path, node, "*");
+    WIN32_FIND_DATA find_data;
+    HANDLE hFind = search_path ? FindFirstFile(search_path, &find_data) : INVALID_HANDLE_VALUE;
+    if (!node->by_path) release_dir_handle(ctx, node->parent);
+
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    count_directory(worker, node);
+    if (ctx->options->on_directory) {
+        ctx->options->on_directory(ctx->options->visitor_ctx, CWD_FD, dir_path(worker, node));
+    }
+
+    do {
+        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
+            continue;
+        }
+
+        // Directory symlinks and junctions are not followed, so none can loop
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                add_directory(pool, worker_id, ctx, node, find_data.cFileName, false);
+            }
+        } else {
+            add_file(pool, worker_id, ctx, node, find_data.cFileName, false);
+        }
+    } while (FindNextFile(hFind, &find_data));
+
+    FindClose(hFind);
+#else
+    // Open relative to the parent's handle; the root, and any directory whose
+    // parent keeps no handle for it, goes through its path
+    int fd;
+    if (!node->by_path) {
+        fd = openat(dirfd(node->parent->dir), node->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        release_dir_handle(ctx, node->parent);
+    } else {
+        fd = open_by_path(worker, node);
+    }
+    int open_dirs = open_dir_handle(ctx, node, fd);
+    if (open_dirs == 0) return;
+    struct stat dir_stat;
+    if (fstat(dirfd(node->dir), &dir_stat) == 0) {
+        node->dev = dir_stat.st_dev;
+        node->ino = dir_stat.st_ino;
+    }
+    // Past the limit the handle is closed as soon as the listing ends, so
+    // nothing is queued that would need it
+    bool keep_open = open_dirs <= ctx->max_open_dirs;
+    int dir_fd = dirfd(node->dir);
+    ScanProfile *profile = worker_profile(ctx, worker);
+    count_directory(worker, node);
+    if (ctx->options->on_directory) {
+        ctx->options->on_directory(ctx->options->visitor_ctx, dir_fd, dir_path(worker, node));
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(node->dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        bool is_dir = false;
+        bool is_file = false;
+#ifdef DT_UNKNOWN
+        if (entry->d_type == DT_DIR) {
+            is_dir = true;
+        } else if (entry->d_type == DT_REG) {
+            is_file = true;
+        } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+#endif
+        {
+            ProfileStamp start = {0, 0};
+            if (profile) start = profile_now();
+            struct stat file_stat;
+            if (fstatat(dir_fd, name, &file_stat, 0) == 0) {
+                // A link back to a directory the walk is inside would never end
+                is_dir = S_ISDIR(file_stat.st_mode) && !on_ancestor_chain(node, file_stat.st_dev, file_stat.st_ino);
+                is_file = S_ISREG(file_stat.st_mode);
+            }
+            if (profile) profile_phase(profile, PHASE_METADATA, start);
+        }
+
+        if (is_dir) {
+            add_directory(pool, worker_id, ctx, node, name, !keep_open);
+        } else if (is_file) {
+            add_file(pool, worker_id, ctx, node, name, !keep_open);
+        }
+    }
+#endif
+}
+
+// Queue the tracked text files below the scanned directory from the git index
+// (options->git), in place of listing any directory. Each file item is named
+// by its path relative to the scanned directory and opened with openat
+// against that directory's descriptor. Index entries carry their file type,
+// so a tracked regular file is counted without any stat; only symlinks get an
+// fstatat, to follow them to a file as the walk does. The index is sorted by
+// path, so the files of each top-level directory arrive together and get
+// their breakdown group as they come.
+static void walk_index(WorkPool *pool, int worker_id, WalkContext *ctx, DirNode *root) {
+    const CountOptions *options = ctx->options;
+    const GitRepo *repo = options->git;
+    WorkerResult *worker = &ctx->workers[worker_id];
+    GitIndex index;
+    const char *error = NULL;
+    if (!git_index_open(&index, repo, &error)) {
+        fprintf(stderr, "Error: Cannot read git index '%s' (%s)\n", repo->index_path, error);
+        worker->unreadable = true;
+        return;
+    }
+
+#ifdef _WIN32
+    int dir_fd = CWD_FD;
+#else
+    if (open_dir_handle(ctx, root, open_by_path(worker, root)) == 0) {
+        git_index_close(&index);
+        return;
+    }
+    int dir_fd = dirfd(root->dir);
+#endif
+    ScanProfile *profile = worker_profile(ctx, worker);
+    count_directory(worker, root);
+    if (options->on_directory) options->on_directory(options->visitor_ctx, dir_fd, root->name);
+
+    size_t prefix_len = strlen(repo->prefix);
+    char conflicted[GIT_PATH_MAX] = "";     // Last path seen with a merge stage
+    int group = GROUP_ROOT;
+    GitIndexEntry entry;
+    while (git_index_next(&index, &entry)) {
+        uint32_t type = entry.mode & GIT_MODE_TYPE;
+        if (entry.skip_worktree || (type != GIT_MODE_FILE && type != GIT_MODE_SYMLINK)) continue;
+        const char *path = entry.path;
+        if (prefix_len > 0) {
+            if (entry.path_len <= prefix_len + 1 || memcmp(path, repo->prefix, prefix_len) != 0 ||
+                path[prefix_len] != '/') {
+                continue;
+            }
+            path += prefix_len + 1;
+        }
+        // A conflicted path has one entry per side
+        if (entry.stage > 0) {
+            if (strcmp(conflicted, entry.path) == 0) continue;
+            memcpy(conflicted, entry.path, entry.path_len + 1);
+        }
+
+        const char *name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        LanguageId language = language_from_filename_mapped(options->extensions, name);
+        if (language == LANG_UNKNOWN) continue;
+
+        ProfileStamp start = {0, 0};
+        if (profile) start = profile_now();
+        bool excluded = exclude_matcher_match_path(ctx->matcher, path, false);
+        if (profile) start = profile_phase(profile, PHASE_EXCLUDE, start);
+        if (excluded) continue;
+        if (type == GIT_MODE_SYMLINK) {
+#ifdef _WIN32
+            const char *full_path = build_path(&worker->file_path, root, path);
+            DWORD attributes = full_path ? GetFileAttributes(full_path) : INVALID_FILE_ATTRIBUTES;
+            bool is_file = attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+            struct stat file_stat;
+            bool is_file = fstatat(dir_fd, path, &file_stat, 0) == 0 && S_ISREG(file_stat.st_mode);
+#endif
+            if (profile) profile_phase(profile, PHASE_METADATA, start);
+            if (!is_file) continue;
+        }
+        if (options->want_file && !options->want_file(options->visitor_ctx, root->name, path, language)) continue;
+
+        if (ctx->group_names) group = path_group(ctx, path, group);
+        push_file(pool, worker_id, root, path, language, group);
+    }
+    git_index_close(&index);
+}
+
+static void merge_result(CountResult *dst, const CountResult *src) {
+    dst->total_lines += src->total_lines;
+    dst->total_files += src->total_files;
+    dst->blank_lines += src->blank_lines;
+    dst->comment_lines += src->comment_lines;
+    dst->code_lines += src->code_lines;
+}
+
+// Add a counted file to the worker's totals and breakdown shard
+static void add_counts(const WalkContext *ctx, WorkerResult *worker, const FileTask *task, const CountResult *file) {
+    merge_result(&worker->result, file);
+    if (task->dir->root) merge_result(&worker->roots[task->dir->root->index].result, file);
+    if (ctx->options->on_file) {
+        ctx->options->on_file(ctx->options->visitor_ctx, dir_path(worker, task->dir), task->name, task->language,
+                              file);
+    }
+    if (!ctx->group_names) return;
+
+    int group = task->group;
+    merge_result(&worker->languages[task->language], file);
+    if (group >= worker->group_capacity) {
+        int capacity = worker->group_capacity ? worker->group_capacity * 2 : 16;
+        if (capacity <= group) capacity = group + 1;
+        if (capacity > GROUP_COUNT) capacity = GROUP_COUNT;
+        CountResult *grown = realloc(worker->groups, sizeof(CountResult) * capacity);
+        if (!grown) return;
+        memset(grown + worker->group_capacity, 0, sizeof(CountResult) * (capacity - worker->group_capacity));
+        worker->groups = grown;
+        worker->group_capacity = capacity;
+    }
+    merge_result(&worker->groups[group], file);
+}
+
+// Put a file sniffing turned down in the worker's skipped bucket. With
+// options->sniff each worker's reader checks a file's first block before
+// counting it (see sniff.h); archive members are checked the same way as they
+// stream past. The verdict is cached like a count, under a fingerprint of the
+// sniff options.
+static void skip_file(const WalkContext *ctx, WorkerResult *worker, const FileTask *task, const SniffVerdict *verdict) {
+    worker->skipped.files[verdict->reason]++;
+    if (task->dir->root) worker->roots[task->dir->root->index].skipped.files[verdict->reason]++;
+    if (ctx->options->on_skip) {
+        ctx->options->on_skip(ctx->options->visitor_ctx, dir_path(worker, task->dir), task->name, task->language,
+                              verdict);
+    }
+}
+
+// Merge every worker's shard of a finished batch root and hand it to the
+// caller. count_lines_batch runs many roots on one pool: every root's
+// directory (or archive) item is queued up front, spread over the workers,
+// and each root keeps a count of its items still queued or in flight. Listing
+// a directory adds one per entry it queues, finishing an item takes one away.
+// Counts go to the worker's shard for the root as well as its totals, so a
+// root is reported while the other roots are still being counted. A batch
+// keeps no breakdown and uses neither the cache, nor the git index, nor
+// deduplication.
+static void report_root(const WalkContext *ctx, const WalkRoot *root) {
+    BatchRoot report;
+    memset(&report, 0, sizeof(report));
+    report.path = root->path;
+    report.index = root->index;
+    report.ok = root->opened;
+    for (int i = 0; i < ctx->worker_count; i++) {
+        const RootShard *shard = &ctx->workers[i].roots[root->index];
+        merge_result(&report.totals, &shard->result);
+        report.directories += shard->directories;
+        merge_sniff_stats(&report.skipped, &shard->skipped);
+    }
+    report.elapsed = (cl_monotonic_ns() - ctx->started) / 1e9;
+    ctx->on_root(ctx->root_ctx, &report);
+}
+
+// An item below a batch root is done; whoever finishes the root's last one
+// reports it. Every worker updates its shard before its own decrement, so
+// the last one sees all of them.
+static void finish_root_item(const WalkContext *ctx, WalkRoot *root) {
+    if (root && cl_atomic_add(&root->pending, -1) == 1) report_root(ctx, root);
+}
+
+// Answer a file from the persistent cache when its identity, size and mtime
+// match a cached entry. Otherwise *cacheable tells whether `key` may be
+// stored once the file has been counted.
+static bool count_from_cache(const WalkContext *ctx, WorkerResult *worker, int dir_fd, const char *name,
+                             const FileTask *task, CacheEntry *key, bool *cacheable) {
+    ScanProfile *profile = ctx->cache ? worker_profile(ctx, worker) : NULL;
+    ProfileStamp start = {0, 0};
+    if (profile) start = profile_now();
+    *cacheable = ctx->cache && count_cache_key(ctx->cache, dir_fd, name, task->language, key);
+    if (profile) profile_phase(profile, PHASE_METADATA, start);
+    if (!*cacheable) return false;
+
+    const CacheEntry *hit = count_cache_lookup(ctx->cache, key);
+    if (!hit || hit->skipped >= SNIFF_REASON_COUNT) return false;
+
+    if (hit->skipped != SNIFF_TEXT) {
+        SniffVerdict verdict;
+        memset(&verdict, 0, sizeof(verdict));
+        verdict.reason = (SniffReason)hit->skipped;
+        verdict.cached = true;
+        skip_file(ctx, worker, task, &verdict);
+        cache_entry_list_add(&worker->cache_entries, hit);
+        worker->cache_hits++;
+        return true;
+    }
+
+    CountResult file;
+    file.total_files = 1;
+    file.total_lines = hit->lines;
+    file.blank_lines = hit->blank;
+    file.comment_lines = hit->comments;
+    file.code_lines = hit->lines - hit->blank - hit->comments;
+    add_counts(ctx, worker, task, &file);
+    cache_entry_list_add(&worker->cache_entries, hit);
+    worker->cache_hits++;
+    return true;
+}
+
+// Add a freshly counted file to the worker's totals and the next cache
+static void record_file(const WalkContext *ctx, WorkerResult *worker, const FileTask *task,
+                        const CountResult *file, bool cacheable, CacheEntry *key) {
+    add_counts(ctx, worker, task, file);
+    if (!ctx->cache) return;
+
+    worker->cache_misses++;
+    if (cacheable && file->total_files == 1 && file->total_lines <= UINT32_MAX) {
+        key->lines = (uint32_t)file->total_lines;
+        key->blank = (uint32_t)file->blank_lines;
+        key->comments = (uint32_t)file->comment_lines;
+        cache_entry_list_add(&worker->cache_entries, key);
+    }
+}
+
+// Skip a file sniffing turned down, and store the verdict in the next cache
+static void record_skipped(const WalkContext *ctx, WorkerResult *worker, const FileTask *task,
+                           const SniffVerdict *verdict, bool cacheable, CacheEntry *key) {
+    skip_file(ctx, worker, task, verdict);
+    if (!ctx->cache) return;
+
+    worker->cache_misses++;
+    if (cacheable) {
+        key->skipped = (uint16_t)verdict->reason;
+        cache_entry_list_add(&worker->cache_entries, key);
+    }
+}
+
+static void count_file(const WalkContext *ctx, WorkerResult *worker, int dir_fd, const char *name,
+                       const FileTask *task) {
+    LanguageId language = task->language;
+    CacheEntry key;
+    bool cacheable;
+    if (count_from_cache(ctx, worker, dir_fd, name, task, &key, &cacheable)) return;
+
+    CountResult file = {0, 0, 0, 0, 0};
+    if (ctx->options->classic) {
+        file.total_lines = count_lines_classic_at(&worker->reader, dir_fd, name, &file);
+    } else {
+        file.total_lines = count_lines_at(&worker->reader, dir_fd, name, language, &file);
+    }
+    if (worker->reader.verdict.reason != SNIFF_TEXT) {
+        record_skipped(ctx, worker, task, &worker->reader.verdict, cacheable, &key);
+        return;
+    }
+    record_file(ctx, worker, task, &file, cacheable, &key);
+}
+
+// A copy of a file counted already: its counts go to the worker's DedupeStats
+static void add_duplicate(WorkerResult *worker, const DedupeEntry *entry) {
+    DedupeStats *stats = &worker->dedupe;
+    stats->files++;
+    stats->bytes += entry->size;
+    stats->counts.total_files++;
+    stats->counts.total_lines += entry->lines;
+    stats->counts.blank_lines += entry->blank;
+    stats->counts.comment_lines += entry->comments;
+    stats->counts.code_lines += entry->lines - entry->blank - entry->comments;
+}
+
+// Store the counts of a file just counted under its hashes in `key`. Returns
+// false, having recorded the file as a copy, if the same contents were
+// stored first.
+static bool dedupe_store(const WalkContext *ctx, WorkerResult *worker, DedupeEntry *key, const CountResult *file) {
+    if (file->total_lines > UINT32_MAX) return true;
+    key->lines = (uint32_t)file->total_lines;
+    key->blank = (uint32_t)file->blank_lines;
+    key->comments = (uint32_t)file->comment_lines;
+    if (dedupe_table_insert(ctx->dedupe, key)) return true;
+    add_duplicate(worker, key);
+    return false;
+}
+
+// Counts a file and hashes its contents from the same reads
+typedef struct {
+    FileCounter counter;
+    ContentHasher hasher;
+} HashedCount;
+
+static void hashed_count_feed(void *arg, const unsigned char *data, size_t len) {
+    HashedCount *count = arg;
+    content_hasher_feed(&count->hasher, data, len);
+    file_counter_feed(&count->counter, data, len);
+}
+
+static bool file_size_at(int dir_fd, const char *name, uint64_t *size) {
+    struct stat file_stat;
+#ifdef _WIN32
+    (void)dir_fd;
+    if (stat(name, &file_stat) != 0) return false;
+#else
+    if (fstatat(dir_fd, name, &file_stat, 0) != 0) return false;
+#endif
+    *size = (uint64_t)file_stat.st_size;
+    return true;
+}
+
+static bool held_reserve(HeldBytes *held, size_t size) {
+    if (size <= held->capacity) return true;
+    size_t capacity = held->capacity ? held->capacity : 64 * 1024;
+    while (capacity < size) capacity *= 2;
+    unsigned char *data = realloc(held->data, capacity);
+    if (!data) return false;
+    held->data = data;
+    held->capacity = capacity;
+    return true;
+}
+
+// Hashes a file and holds its bytes, to be counted only if it is no copy
+typedef struct {
+    ContentHasher hasher;
+    HeldBytes *held;
+} HeldRead;
+
+static void held_read_feed(void *arg, const unsigned char *data, size_t len) {
+    HeldRead *read = arg;
+    content_hasher_feed(&read->hasher, data, len);
+    HeldBytes *held = read->held;
+    if (held->failed || !held_reserve(held, held->length + len)) {
+        held->failed = true;
+        return;
+    }
+    memcpy(held->data + held->length, data, len);
+    held->length += len;
+}
+
+// Count a file unless it is a copy of one counted already (options->dedupe),
+// looked up in the DedupeTable the workers share (see dedupe.h). A file whose
+// size matches an earlier one is hashed first, with its bytes held; a copy
+// goes to the worker's DedupeStats unclassified, anything else is counted
+// from the held bytes. Any other file is hashed as it is counted. Either way
+// it is read once. Copies are told apart by content hashes the cache does not
+// keep, so a deduplicated scan neither reads nor writes the cache. It does not
+// use the ring either: a candidate is hashed before it is known whether to
+// count it.
+static void dedupe_file(const WalkContext *ctx, WorkerResult *worker, int dir_fd, const char *name,
+                        const FileTask *task) {
+    ScanProfile *profile = worker_profile(ctx, worker);
+    DedupeEntry key;
+    memset(&key, 0, sizeof(key));
+    key.language = (uint16_t)task->language;
+    ProfileStamp start = {0, 0};
+    if (profile) start = profile_now();
+    bool sized = file_size_at(dir_fd, name, &key.size);
+    bool candidate = sized && key.size <= DEDUPE_HOLD_MAX && dedupe_table_add_size(ctx->dedupe, key.size, task->language);
+    if (profile) profile_phase(profile, PHASE_METADATA, start);
+
+    HashedCount count;
+    file_counter_init(&count.counter, task->language, ctx->options->classic);
+    bool counted = false;
+    if (candidate) {
+        HeldRead read;
+        content_hasher_init(&read.hasher);
+        read.held = &worker->held;
+        read.held->length = 0;
+        read.held->failed = !held_reserve(read.held, (size_t)key.size);
+        if (!file_reader_read_at(&worker->reader, dir_fd, name, held_read_feed, &read)) return;
+        if (worker->reader.verdict.reason != SNIFF_TEXT) {
+            skip_file(ctx, worker, task, &worker->reader.verdict);
+            return;
+        }
+        key.full = content_hasher_finish(&read.hasher);
+        DedupeEntry found;
+        if (dedupe_table_find(ctx->dedupe, &key, &found)) {
+            add_duplicate(worker, &found);
+            return;
+        }
+        if (!read.held->failed) {
+            if (profile) start = profile_now();
+            file_counter_feed(&count.counter, read.held->data, read.held->length);
+            if (profile) profile_phase(profile, PHASE_CLASSIFY, start);
+            counted = true;
+        }
+    }
+    if (!counted) {
+        // Not held, or not all of it (out of memory): count it as it is hashed
+        content_hasher_init(&count.hasher);
+        if (!file_reader_read_at(&worker->reader, dir_fd, name, hashed_count_feed, &count)) return;
+        if (worker->reader.verdict.reason != SNIFF_TEXT) {
+            skip_file(ctx, worker, task, &worker->reader.verdict);
+            return;
+        }
+        key.full = content_hasher_finish(&count.hasher);
+    }
+    CountResult file = {0, 0, 0, 0, 0};
+    file.total_lines = file_counter_finish(&count.counter, &file);
+    if (sized && !dedupe_store(ctx, worker, &key, &file)) return;
+    add_counts(ctx, worker, task, &file);
+}
+
+// A file being read through the worker's io_uring; owns its task until done
+typedef struct {
+    WalkContext *ctx;
+    WorkerResult *worker;
+    FileTask *task;
+    FileCounter counter;
+    CacheEntry key;
+    bool cacheable;
+    ScanProfile *profile;
+    unsigned long long started;         // When profiling: submission time
+    unsigned long long bytes;
+} AsyncFile;
+
+static void async_file_feed(void *arg, const unsigned char *data, size_t len) {
+    AsyncFile *file = arg;
+    file->bytes += len;
+    if (!file->profile) {
+        file_counter_feed(&file->counter, data, len);
+        return;
+    }
+    ProfileStamp start = profile_now();
+    file_counter_feed(&file->counter, data, len);
+    profile_phase(file->profile, PHASE_CLASSIFY, start);
+}
+
+static void async_file_done(void *arg, bool ok, const SniffVerdict *verdict) {
+    AsyncFile *file = arg;
+    CountResult counts = {0, 0, 0, 0, 0};
+    if (verdict) {
+        record_skipped(file->ctx, file->worker, file->task, verdict, file->cacheable, &file->key);
+    } else {
+        if (ok) counts.total_lines = file_counter_finish(&file->counter, &counts);
+        record_file(file->ctx, file->worker, file->task, &counts, file->cacheable, &file->key);
+    }
+    if (file->profile) {
+        profile_file(file->profile, dir_path(file->worker, file->task->dir), file->task->name,
+                     cl_monotonic_ns() - file->started, file->bytes);
+    }
+    WalkRoot *root = file->task->dir->root;
+    release_dir_handle(file->ctx, file->task->dir);
+    free(file->task);
+    finish_root_item(file->ctx, root);
+    free(file);
+}
+
+// Hand a file to the worker's io_uring; returns false if it must be counted synchronously
+static bool count_file_async(WalkContext *ctx, WorkerResult *worker, FileTask *task) {
+#ifdef _WIN32
+    (void)ctx; (void)worker; (void)task;
+    return false;
+#else
+    int dir_fd = dirfd(task->dir->dir);
+    AsyncFile *file = malloc(sizeof(AsyncFile));
+    if (!file) return false;
+
+    file->profile = worker_profile(ctx, worker);
+    file->started = file->profile ? cl_monotonic_ns() : 0;
+    file->bytes = 0;
+    if (count_from_cache(ctx, worker, dir_fd, task->name, task, &file->key, &file->cacheable)) {
+        if (file->profile) {
+            profile_file(file->profile, dir_path(worker, task->dir), task->name, cl_monotonic_ns() - file->started, 0);
+        }
+        free(file);
+        WalkRoot *root = task->dir->root;
+        release_dir_handle(ctx, task->dir);
+        free(task);
+        finish_root_item(ctx, root);
+        return true;
+    }
+
+    file->ctx = ctx;
+    file->worker = worker;
+    file->task = task;
+    file_counter_init(&file->counter, task->language, ctx->options->classic);
+    if (!file->profile) {
+        return uring_reader_submit(worker->uring, dir_fd, task->name, async_file_feed, async_file_done, file);
+    }
+
+    // Submitting may wait for and complete earlier reads; their lexing is
+    // timed on its own
+    ScanProfile *profile = file->profile;
+    ProfileStamp classified = profile_total(profile, PROFILE_MASK(PHASE_CLASSIFY));
+    ProfileStamp start = profile_now();
+    bool submitted = uring_reader_submit(worker->uring, dir_fd, task->name, async_file_feed, async_file_done, file);
+    profile_phase_except(profile, PHASE_READ, start, PROFILE_MASK(PHASE_CLASSIFY), classified);
+    return submitted;
+#endif
+}
+
+// Finish this worker's in-flight reads before it goes looking for work
+static bool walk_idle(WorkPool *pool, int worker_id, void *user) {
+    (void)pool;
+    WalkContext *ctx = user;
+    WorkerResult *worker = &ctx->workers[worker_id];
+    ScanProfile *profile = worker_profile(ctx, worker);
+    if (!profile) return uring_reader_drain(worker->uring);
+
+    bool progressed = false;
+    if (worker->uring) {
+        ProfileStamp classified = profile_total(profile, PROFILE_MASK(PHASE_CLASSIFY));
+        ProfileStamp start = profile_now();
+        progressed = uring_reader_drain(worker->uring);
+        profile_phase_except(profile, PHASE_READ, start, PROFILE_MASK(PHASE_CLASSIFY), classified);
+    }
+    track_cpu(worker);
+    return progressed;
+}
+
+// Publish this worker's totals and, when a report is due, sum every
+// worker's and hand them to the progress callback. The reporter is whichever
+// worker first notices the interval has passed.
+static void report_progress(WalkContext *ctx, WorkerResult *worker, const DirNode *directory) {
+    cl_atomic_store64(&worker->shown_files, worker->result.total_files);
+    cl_atomic_store64(&worker->shown_lines, worker->result.total_lines);
+    cl_atomic_store64(&worker->shown_blank, worker->result.blank_lines);
+    cl_atomic_store64(&worker->shown_comments, worker->result.comment_lines);
+    cl_atomic_store64(&worker->shown_directories, worker->directories);
+
+    unsigned long long now = cl_monotonic_ns();
+    unsigned long long due = cl_atomic_load64(&ctx->next_progress);
+    unsigned long long interval = (unsigned long long)ctx->options->progress_interval_ms * 1000000ULL;
+    if (now < due || !cl_atomic_cas64(&ctx->next_progress, due, now + interval)) return;
+
+    ScanProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    for (int i = 0; i < ctx->worker_count; i++) {
+        WorkerResult *w = &ctx->workers[i];
+        progress.totals.total_files += cl_atomic_load64(&w->shown_files);
+        progress.totals.total_lines += cl_atomic_load64(&w->shown_lines);
+        progress.totals.blank_lines += cl_atomic_load64(&w->shown_blank);
+        progress.totals.comment_lines += cl_atomic_load64(&w->shown_comments);
+        progress.directories += cl_atomic_load64(&w->shown_directories);
+    }
+    progress.totals.code_lines = progress.totals.total_lines - progress.totals.blank_lines - progress.totals.comment_lines;
+    progress.elapsed = (now - ctx->started) / 1e9;
+    progress.current_directory = dir_path(worker, directory);
+    ctx->options->on_progress(ctx->options->progress_ctx, &progress);
+}
+
+// Count a member's data through the worker's fixed buffer, hashing it too
+// when given a hasher. Returns false, leaving the rest of the data unread,
+// if options->sniff turns the member down on its first chunk.
+static bool count_tar_member(const WalkContext *ctx, TarReader *tar, unsigned char *buffer, LanguageId language,
+                             ScanProfile *profile, ContentHasher *hasher, CountResult *file, SniffVerdict *verdict) {
+    const SniffOptions *sniff = ctx->options->sniff;
+    FileCounter counter;
+    file_counter_init(&counter, language, ctx->options->classic);
+    for (bool first = true; ; first = false) {
+        ProfileStamp start = {0, 0};
+        if (profile) start = profile_now();
+        size_t got = tar_read(tar, buffer, TAR_CHUNK_SIZE);
+        if (profile) start = profile_phase(profile, PHASE_READ, start);
+        if (got == 0) break;
+        if (first && sniff && sniff_block(sniff, buffer, got, verdict) != SNIFF_TEXT) return false;
+        if (hasher) content_hasher_feed(hasher, buffer, got);
+        file_counter_feed(&counter, buffer, got);
+        if (profile) profile_phase(profile, PHASE_CLASSIFY, start);
+    }
+    file->total_lines = file_counter_finish(&counter, file);
+    return true;
+}
+
+// Count the text files of the archive at root->name (options->tar) as they
+// stream past, in order, feeding each one's data to a FileCounter through one
+// fixed buffer. Nothing is queued or stored, so memory stays the same whatever
+// the archive holds, and the count runs on the worker that took the item.
+static void walk_tar(WalkContext *ctx, WorkerResult *worker, DirNode *root) {
+    const CountOptions *options = ctx->options;
+    TarReader tar;
+    const char *error = NULL;
+    if (!tar_open(&tar, root->name, &error)) {
+        fprintf(stderr, "Error: Cannot read tar archive '%s' (%s)\n", root->name, error);
+        worker->unreadable = true;
+        return;
+    }
+    unsigned char *buffer = options->list_only ? NULL : malloc(TAR_CHUNK_SIZE);
+    FileTask *task = malloc(sizeof(FileTask) + TAR_PATH_MAX);
+    if ((!buffer && !options->list_only) || !task) {
+        worker->unreadable = true;
+        free(buffer);
+        free(task);
+        tar_close(&tar);
+        return;
+    }
+    task->dir = root;
+    task->group = GROUP_ROOT;
+
+    ScanProfile *profile = worker_profile(ctx, worker);
+    count_directory(worker, root);
+    TarMember member;
+    while (tar_next(&tar, &member)) {
+        if (member.type == TAR_OTHER || member.path[0] == '\0') continue;
+        bool is_dir = member.type == TAR_DIRECTORY;
+        const char *name = strrchr(member.path, '/');
+        name = name ? name + 1 : member.path;
+        LanguageId language = is_dir ? LANG_UNKNOWN : language_from_filename_mapped(options->extensions, name);
+        if (!is_dir && language == LANG_UNKNOWN) continue;
+
+        ProfileStamp start = {0, 0};
+        if (profile) start = profile_now();
+        bool excluded = exclude_matcher_match_path(ctx->matcher, member.path, is_dir);
+        if (profile) profile_phase(profile, PHASE_EXCLUDE, start);
+        if (excluded) continue;
+        if (is_dir) {
+            count_directory(worker, root);
+            continue;
+        }
+        if (options->want_file && !options->want_file(options->visitor_ctx, root->name, member.path, language)) {
+            continue;
+        }
+
+        task->language = language;
+        memcpy(task->name, member.path, strlen(member.path) + 1);
+        if (ctx->group_names) task->group = path_group(ctx, member.path, task->group);
+        CountResult file = {0, 0, 0, 0, 0};
+        if (options->list_only) {
+            file.total_files = 1;
+        } else {
+            // The stream cannot be read twice, so every member is hashed as
+            // it is counted and a copy is only left out of the totals
+            ContentHasher hasher;
+            if (ctx->dedupe) content_hasher_init(&hasher);
+            SniffVerdict verdict;
+            if (options->sniff && sniff_size(options->sniff, member.size, &verdict) != SNIFF_TEXT) {
+                skip_file(ctx, worker, task, &verdict);
+                continue;
+            }
+            unsigned long long started = profile ? cl_monotonic_ns() : 0;
+            bool counted = count_tar_member(ctx, &tar, buffer, language, profile, ctx->dedupe ? &hasher : NULL, &file,
+                                            &verdict);
+            if (profile) profile_file(profile, root->name, task->name, cl_monotonic_ns() - started, member.size);
+            if (!counted) {
+                skip_file(ctx, worker, task, &verdict);
+                continue;
+            }
+            if (ctx->dedupe && !tar_error(&tar)) {
+                DedupeEntry key;
+                memset(&key, 0, sizeof(key));
+                key.size = member.size;
+                key.language = (uint16_t)language;
+                key.full = content_hasher_finish(&hasher);
+                if (!dedupe_store(ctx, worker, &key, &file)) continue;
+            }
+        }
+        add_counts(ctx, worker, task, &file);
+        if (options->on_progress) report_progress(ctx, worker, root);
+    }
+    if (tar_error(&tar)) {
+        fprintf(stderr, "Error: Cannot read tar archive '%s' (%s)\n", root->name, tar_error(&tar));
+        worker->unreadable = true;
+    }
+    free(buffer);
+    free(task);
+    tar_close(&tar);
+}
+
+// Count a file, queued or met in a listing past the handle limit. Returns
+// false if it went to the worker's ring, which finishes it; only a queued
+// file (`may_defer`) may go there.
+static bool walk_file(WalkContext *ctx, WorkerResult *worker, FileTask *task, bool may_defer) {
+    ScanProfile *profile = worker_profile(ctx, worker);
+    if (ctx->self_check) {
+        const char *path = file_path(worker, task);
+        if (path && !self_check_file(path, task->language, &worker->result)) {
+            worker->mismatches++;
+        }
+        return true;
+    }
+    if (ctx->options->list_only) {
+        CountResult file = {0, 1, 0, 0, 0};
+        add_counts(ctx, worker, task, &file);
+        if (ctx->options->on_progress) report_progress(ctx, worker, task->dir);
+        return true;
+    }
+
+    if (ctx->options->on_progress) report_progress(ctx, worker, task->dir);
+    if (may_defer && worker->uring && count_file_async(ctx, worker, task)) return false;
+    unsigned long long started = profile ? cl_monotonic_ns() : 0;
+    unsigned long long bytes_before = profile ? bytes_read(&worker->reader) : 0;
+#ifdef _WIN32
+    int dir_fd = CWD_FD;
+    const char *name = file_path(worker, task);
+#else
+    int dir_fd = dirfd(task->dir->dir);
+    const char *name = task->name;
+#endif
+    if (name && ctx->dedupe) {
+        dedupe_file(ctx, worker, dir_fd, name, task);
+    } else if (name) {
+        count_file(ctx, worker, dir_fd, name, task);
+    }
+    if (profile) {
+        profile_file(profile, dir_path(worker, task->dir), task->name, cl_monotonic_ns() - started,
+                     bytes_read(&worker->reader) - bytes_before);
+    }
+    return true;
+}
+
+static void walk_handler(WorkPool *pool, int worker_id, WorkItem item, void *user) {
+    WalkContext *ctx = user;
+
+    WorkerResult *worker = &ctx->workers[worker_id];
+    ScanProfile *profile = worker_profile(ctx, worker);
+    if (profile && !worker->cpu_tracked) track_cpu(worker);
+
+    if (item.kind != WALK_FILE) {
+        DirNode *node = item.data;
+        unsigned mask = item.kind == WALK_TAR ? ARCHIVE_NESTED : LISTING_NESTED;
+        ProfileStamp start = {0, 0}, nested = {0, 0};
+        if (profile) {
+            nested = profile_total(profile, mask);
+            start = profile_now();
+        }
+        if (item.kind == WALK_TAR) {
+            walk_tar(ctx, worker, node);
+        } else if (item.kind == WALK_INDEX) {
+            walk_index(pool, worker_id, ctx, node);
+        } else {
+            walk_directory(pool, worker_id, ctx, node);
+        }
+        if (profile) {
+            profile_phase_except(profile, PHASE_ENUMERATE, start, mask, nested);
+            profile_directory(profile, dir_path(worker, node), cl_monotonic_ns() - start.wall);
+        }
+        if (ctx->options->on_progress) report_progress(ctx, worker, node);
+        WalkRoot *root = node->root;
+        release_dir_handle(ctx, node);
+        finish_root_item(ctx, root);
+        return;
+    }
+
+    FileTask *task = item.data;
+    if (!walk_file(ctx, worker, task, true)) return;
+    WalkRoot *root = task->dir->root;
+    release_dir_handle(ctx, task->dir);
+    free(task);
+    finish_root_item(ctx, root);
+}
+
+// Initialize count options with single-threaded defaults
+void init_count_options(CountOptions *options) {
+    if (!options) return;
+    memset(options, 0, sizeof(CountOptions));
+    options->jobs = 1;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const BreakdownEntry *x = a, *y = b;
+    if (x->result.total_lines != y->result.total_lines) {
+        return x->result.total_lines < y->result.total_lines ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static const char* group_name(const WalkContext *ctx, int group) {
+    if (group == GROUP_ROOT) return ".";
+    if (group == GROUP_OTHER) return "(other)";
+    return ctx->group_names[group];
+}
+
+// Merge every worker's shard into `out`, dropping empty entries
+static void build_breakdown(const WalkContext *ctx, CountBreakdown *out) {
+    memset(out, 0, sizeof(CountBreakdown));
+    out->languages = calloc(LANG_COUNT, sizeof(BreakdownEntry));
+    out->directories = calloc(GROUP_COUNT, sizeof(BreakdownEntry));
+    if (!out->languages || !out->directories) {
+        free_count_breakdown(out);
+        return;
+    }
+
+    for (int language = 0; language < LANG_COUNT; language++) {
+        BreakdownEntry *entry = &out->languages[out->language_count];
+        memset(entry, 0, sizeof(BreakdownEntry));
+        for (int i = 0; i < ctx->worker_count; i++) {
+            merge_result(&entry->result, &ctx->workers[i].languages[language]);
+        }
+        if (entry->result.total_files == 0) continue;
+        entry->name = language_name((LanguageId)language);
+        out->language_count++;
+    }
+
+    size_t names_size = 0;
+    for (int group = 0; group < GROUP_COUNT; group++) {
+        BreakdownEntry *entry = &out->directories[out->directory_count];
+        memset(entry, 0, sizeof(BreakdownEntry));
+        for (int i = 0; i < ctx->worker_count; i++) {
+            if (group < ctx->workers[i].group_capacity) {
+                merge_result(&entry->result, &ctx->workers[i].groups[group]);
+            }
+        }
+        if (entry->result.total_files == 0) continue;
+        entry->name = group_name(ctx, group);
+        names_size += strlen(entry->name) + 1;
+        out->directory_count++;
+    }
+
+    // Directory names move into the breakdown's own storage
+    out->names = malloc(names_size ? names_size : 1);
+    if (!out->names) {
+        free_count_breakdown(out);
+        return;
+    }
+    out->names_size = names_size;
+    char *name = out->names;
+    for (int i = 0; i < out->directory_count; i++) {
+        size_t len = strlen(out->directories[i].name) + 1;
+        memcpy(name, out->directories[i].name, len);
+        out->directories[i].name = name;
+        name += len;
+    }
+
+    qsort(out->languages, out->language_count, sizeof(BreakdownEntry), compare_entries);
+    qsort(out->directories, out->directory_count, sizeof(BreakdownEntry), compare_entries);
+}
+
+static void free_workers(WalkContext *ctx) {
+    for (int i = 0; ctx->workers && i < ctx->worker_count; i++) free(ctx->workers[i].roots);
+    free(ctx->workers);
+    free(ctx->roots);
+}
+
+// Half the process's descriptor limit, leaving the rest to the files being
+// read, the cache and the caller
+static int default_open_dir_limit(void) {
+#ifdef _WIN32
+    return WALK_MAX_OPEN_DIRS;
+#else
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY ||
+        limit.rlim_cur / 2 > WALK_MAX_OPEN_DIRS) {
+        return WALK_MAX_OPEN_DIRS;
+    }
+    return limit.rlim_cur / 2 < WALK_MIN_OPEN_DIRS ? WALK_MIN_OPEN_DIRS : (int)(limit.rlim_cur / 2);
+#endif
+}
+
+// Queue the item reading a root: its directory listing, git index or archive
+static void push_root(WorkPool *pool, int worker_id, int kind, DirNode *root) {
+    if (kind == WALK_DIR) {
+        push_directory(pool, worker_id, root);
+        return;
+    }
+    if (root->root) cl_atomic_add(&root->root->pending, 1);
+    WorkItem item;
+    item.kind = kind;
+    item.data = root;
+    workpool_push(pool, worker_id, item);
+}
+
+// Scan `paths`: one directory, or with on_root set a batch of roots, each
+// reported on its own as it finishes. `*readable` (optional) turns false if
+// the git index or tar archive to be counted could not be read.
+static unsigned long long run_walk(const char *const *paths, int path_count, const CountOptions *options,
+                                   CountResult *result, bool self_check, BatchVisitor on_root, void *root_ctx,
+                                   bool *readable) {
+    if (!paths || path_count <= 0 || !options || !result) return 0;
+    bool batch = on_root != NULL;
+    const char *dirpath = paths[0];
+    if (options->breakdown) memset(options->breakdown, 0, sizeof(CountBreakdown));
+    unsigned long long started = cl_monotonic_ns();
+    if (options->profile) {
+        int slowest_limit = options->profile->slowest_limit;
+        scan_profile_free(options->profile);
+        scan_profile_init(options->profile, slowest_limit);
+    }
+
+    int jobs = options->jobs;
+    if (jobs <= 0) jobs = cl_cpu_count();
+
+    // Patterns are matched relative to dirpath (or exclude_base above it); the
+    // root itself is only excluded through exclude_base
+    const ExcludeList *list = options->exclude_list;
+    ExcludeMatcher *matcher = exclude_matcher_create(list ? list->patterns : NULL, list ? list->count : 0);
+    if (!matcher) return 0;
+
+    WalkContext ctx;
+    ctx.options = options;
+    ctx.matcher = matcher;
+    ctx.state_words = exclude_matcher_state_words(matcher);
+    ctx.self_check = self_check;
+    ctx.worker_count = jobs;
+    ctx.started = cl_monotonic_ns();
+    ctx.next_progress = ctx.started + (unsigned long long)options->progress_interval_ms * 1000000ULL;
+    ctx.group_count = GROUP_ROOT + 1;
+    bool want_groups = options->breakdown && !self_check && !batch;
+    ctx.group_names = want_groups ? calloc(GROUP_COUNT, sizeof(char*)) : NULL;
+    ctx.workers = calloc(jobs, sizeof(WorkerResult));
+    ctx.root_count = batch ? path_count : 0;
+    ctx.roots = batch ? calloc(path_count, sizeof(WalkRoot)) : NULL;
+    ctx.on_root = on_root;
+    ctx.root_ctx = root_ctx;
+    ctx.max_open_dirs = options->max_open_dirs > 0 ? options->max_open_dirs : default_open_dir_limit();
+    ctx.open_dirs = 0;
+    ctx.peak_open_dirs = 0;
+    ctx.dir_nodes = 0;
+    ctx.dir_bytes = 0;
+    ctx.peak_dir_nodes = 0;
+    ctx.peak_dir_bytes = 0;
+    bool ready = ctx.workers && (!batch || ctx.roots) && (!want_groups || ctx.group_names);
+    for (int i = 0; ready && batch && i < jobs; i++) {
+        ctx.workers[i].roots = calloc(path_count, sizeof(RootShard));
+        ready = ctx.workers[i].roots != NULL;
+    }
+    // A batch creates its roots once the pool is up, reporting any it cannot
+    DirNode *root = batch ? NULL : create_dir_node(&ctx, NULL, dirpath, strlen(dirpath), false);
+    bool excluded = root && exclude_matcher_path_state(matcher, options->exclude_base, root->exclude_state);
+    if (!ready || (!batch && (!root || excluded))) {
+        free_workers(&ctx);
+        free(ctx.group_names);
+        free(root);
+        exclude_matcher_free(matcher);
+        return 0;
+    }
+
+    ctx.dedupe = NULL;
+    if (options->dedupe && !self_check && !options->list_only && !batch) {
+        ctx.dedupe = dedupe_table_create();
+        if (!ctx.dedupe) {
+            free_workers(&ctx);
+            free(ctx.group_names);
+            free(root);
+            exclude_matcher_free(matcher);
+            return 0;
+        }
+    }
+
+    ctx.cache = NULL;
+    if (options->use_cache && !self_check && !options->list_only && !options->tar && !ctx.dedupe && !batch) {
+        size_t cache_path_len = strlen(dirpath) + sizeof(CACHE_FILE_NAME) + 1;
+        char *cache_path = malloc(cache_path_len);
+        if (cache_path) {
+            snprintf(cache_path, cache_path_len, "%s%c%s", dirpath, PATH_SEPARATOR, CACHE_FILE_NAME);
+            uint64_t config = count_cache_config(options->classic, options->sniff ? sniff_options_hash(options->sniff) : 0);
+            ctx.cache = count_cache_open(cache_path, config, options->rebuild_cache);
+            free(cache_path);
+        }
+    }
+
+    int readers = 0;
+    while (readers < jobs && file_reader_init(&ctx.workers[readers].reader, options->io_mode)) {
+        if (options->profile) {
+            scan_profile_init(&ctx.workers[readers].profile, options->profile->slowest_limit);
+            ctx.workers[readers].reader.profile = &ctx.workers[readers].profile;
+        }
+        if (!self_check) ctx.workers[readers].reader.sniff = options->sniff;
+        readers++;
+    }
+
+    // Self-check reads every file in place, list_only reads none, an archive
+    // is read as one stream and deduplication hashes a file before counting
+    // it, so none of them uses the ring
+    if (options->io_mode == IO_URING && !self_check && !options->list_only && !options->tar && !ctx.dedupe) {
+        const char *reason = NULL;
+        for (int i = 0; i < readers; i++) {
+            ctx.workers[i].uring = uring_reader_create((unsigned)options->io_depth, options->sniff, &reason);
+            if (!ctx.workers[i].uring) break;
+        }
+        if (reason) {
+            fprintf(stderr, "Warning: io_uring unavailable (%s); using blocking reads\n", reason);
+            for (int i = 0; i < readers; i++) {
+                uring_reader_destroy(ctx.workers[i].uring);
+                ctx.workers[i].uring = NULL;
+            }
+        }
+    }
+
+    WorkPool *pool = readers == jobs ? workpool_create(jobs, walk_handler, &ctx) : NULL;
+    if (!pool) {
+        for (int i = 0; i < readers; i++) {
+            file_reader_free(&ctx.workers[i].reader);
+            uring_reader_destroy(ctx.workers[i].uring);
+        }
+        free_workers(&ctx);
+        free(ctx.group_names);
+        free(root);
+        count_cache_close(ctx.cache);
+        dedupe_table_destroy(ctx.dedupe);
+        exclude_matcher_free(matcher);
+        return 0;
+    }
+
+    workpool_set_idle_handler(pool, walk_idle);
+    int root_kind = options->tar ? WALK_TAR : options->git && !batch ? WALK_INDEX : WALK_DIR;
+    if (!batch) {
+        push_root(pool, 0, root_kind, root);
+    } else {
+        // Roots are spread over the workers, so every one starts on its own
+        for (int i = 0; i < path_count; i++) {
+            WalkRoot *walk_root = &ctx.roots[i];
+            walk_root->path = paths[i];
+            walk_root->index = i;
+            DirNode *node = create_dir_node(&ctx, NULL, paths[i], strlen(paths[i]), false);
+            if (!node || exclude_matcher_path_state(matcher, options->exclude_base, node->exclude_state)) {
+                walk_root->opened = node != NULL;
+                if (node) release_dir_handle(&ctx, node);
+                report_root(&ctx, walk_root);
+                continue;
+            }
+            node->root = walk_root;
+            push_root(pool, i % jobs, root_kind, node);
+        }
+    }
+    workpool_run(pool);
+
+    unsigned long long mismatches = 0;
+    unsigned long long cache_hits = 0, cache_misses = 0;
+    for (int i = 0; i < jobs; i++) {
+        merge_result(result, &ctx.workers[i].result);
+        mismatches += ctx.workers[i].mismatches;
+        if (readable && ctx.workers[i].unreadable) *readable = false;
+        cache_hits += ctx.workers[i].cache_hits;
+        cache_misses += ctx.workers[i].cache_misses;
+        const IoBackendStats *uring_stats = uring_reader_stats(ctx.workers[i].uring);
+        if (uring_stats) ctx.workers[i].reader.stats.backends[IO_URING] = *uring_stats;
+        merge_io_stats(options->io_stats, &ctx.workers[i].reader.stats);
+        file_reader_free(&ctx.workers[i].reader);
+        uring_reader_destroy(ctx.workers[i].uring);
+        free(ctx.workers[i].file_path.data);
+        free(ctx.workers[i].dir_path.data);
+        free(ctx.workers[i].held.data);
+        merge_scan_profile(options->profile, &ctx.workers[i].profile);
+    }
+    if (options->dedupe_stats) {
+        memset(options->dedupe_stats, 0, sizeof(DedupeStats));
+        for (int i = 0; i < jobs; i++) {
+            options->dedupe_stats->files += ctx.workers[i].dedupe.files;
+            options->dedupe_stats->bytes += ctx.workers[i].dedupe.bytes;
+            merge_result(&options->dedupe_stats->counts, &ctx.workers[i].dedupe.counts);
+        }
+    }
+    dedupe_table_destroy(ctx.dedupe);
+    if (options->sniff_stats) {
+        memset(options->sniff_stats, 0, sizeof(SniffStats));
+        for (int i = 0; i < jobs; i++) merge_sniff_stats(options->sniff_stats, &ctx.workers[i].skipped);
+    }
+    if (options->profile) {
+        options->profile->threads = jobs;
+        options->profile->wall_ns = cl_monotonic_ns() - started;
+        options->profile->open_directory_limit = ctx.max_open_dirs;
+        options->profile->peak_open_directories = (int)ctx.peak_open_dirs;
+        options->profile->peak_directories = ctx.peak_dir_nodes;
+        options->profile->peak_directory_bytes = ctx.peak_dir_bytes;
+        options->profile->peak_rss = cl_peak_rss_bytes();
+    }
+
+    if (ctx.cache) {
+        CacheEntryList *lists = malloc(sizeof(CacheEntryList) * jobs);
+        if (lists) {
+            for (int i = 0; i < jobs; i++) lists[i] = ctx.workers[i].cache_entries;
+            if (options->cache_stats) {
+                memset(options->cache_stats, 0, sizeof(CacheStats));
+                options->cache_stats->hits = cache_hits;
+                options->cache_stats->misses = cache_misses;
+            }
+            count_cache_save(ctx.cache, lists, jobs, cache_misses, options->cache_stats);
+            free(lists);
+        }
+        for (int i = 0; i < jobs; i++) cache_entry_list_free(&ctx.workers[i].cache_entries);
+        count_cache_close(ctx.cache);
+    }
+
+    if (ctx.group_names) {
+        build_breakdown(&ctx, options->breakdown);
+        for (int i = GROUP_ROOT + 1; i < ctx.group_count; i++) free(ctx.group_names[i]);
+        free(ctx.group_names);
+    }
+    for (int i = 0; i < jobs; i++) free(ctx.workers[i].groups);
+
+    workpool_destroy(pool);
+    free_workers(&ctx);
+    exclude_matcher_free(matcher);
+    return mismatches;
+}
+
+// Count lines in directory tree using options->jobs workers; false if the git
+// index or tar archive to be counted could not be read
+bool count_lines_with_options(const char *dirpath, const CountOptions *options, CountResult *result) {
+    bool readable = true;
+    run_walk(&dirpath, 1, options, result, false, NULL, NULL, &readable);
+    return readable;
+}
+
+// Walk the tree like count_lines_with_options, cross-checking every file;
+// returns the number of files whose counts differ from the reference
+unsigned long long self_check_directory(const char *dirpath, const CountOptions *options, CountResult *result) {
+    return run_walk(&dirpath, 1, options, result, true, NULL, NULL, NULL);
+}
+
+// Count every root on one pool of options->jobs workers, handing each to
+// on_root as soon as it is done; `result` receives the totals of them all.
+// options->git, dedupe, use_cache and breakdown do not apply to a batch.
+void count_lines_batch(const char *const *roots, int root_count, const CountOptions *options, CountResult *result,
+                       BatchVisitor on_root, void *ctx) {
+    if (!on_root) return;
+    run_walk(roots, root_count, options, result, false, on_root, ctx, NULL);
+}
+
+// Recursively count lines in directory
+void count_lines_in_directory(const char *dirpath, const ExcludeList *exclude_list, CountResult *result) {
+    CountOptions options;
+    init_count_options(&options);
+    options.exclude_list = exclude_list;
+    count_lines_with_options(dirpath, &options, result);
+}
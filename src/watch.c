@@ -0,0 +1,617 @@
+// pipe2 is a GNU extension in glibc's unistd.h
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include "watch.h"
+#include "threading.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
+
+// Anything that can change a count: file contents, entries appearing,
+// disappearing or moving, and the watched directory itself going away
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+// A counted (or to be counted) file, by full path
+typedef struct WatchedFile WatchedFile;
+struct WatchedFile {
+    WatchedFile *next;          // Hash chain
+    WatchedFile *next_dirty;
+    bool dirty;                 // Queued for a recount
+    uint32_t hash;
+    CountResult counts;         // All zero until first counted
+    char path[];
+};
+
+typedef struct WatchedDir WatchedDir;
+struct WatchedDir {
+    WatchedDir *next;           // Hash chain, by watch descriptor
+    int wd;
+    char path[];
+};
+
+struct Watcher {
+    int inotify_fd;
+    int stop_pipe[2];
+    char *root;
+    size_t root_len;
+    CountOptions options;       // Caller's options with the watcher's visitors
+    ExcludeMatcher *matcher;
+    FileReader reader;          // For recounts
+    bool limit_warned;          // inotify watch limit reached
+
+    cl_mutex_t lock;            // Guards the tables while a scan's workers fill them
+    CountResult totals;
+    unsigned long long changed_files;
+    WatchedFile **files;
+    size_t file_buckets;
+    size_t file_count;
+    WatchedDir **dirs;
+    size_t dir_buckets;
+    size_t dir_count;
+
+    WatchedFile *dirty;         // Files to recount
+    char **new_dirs;            // Directories to scan
+    int new_dir_count;
+    int new_dir_capacity;
+    bool overflowed;            // Events were lost; rescan everything
+};
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// Double the file table (a power of two) once it holds as many files as buckets
+static bool grow_files(Watcher *watcher) {
+    size_t buckets = watcher->file_buckets ? watcher->file_buckets * 2 : 1024;
+    WatchedFile **table = calloc(buckets, sizeof(WatchedFile*));
+    if (!table) return false;
+    for (size_t i = 0; i < watcher->file_buckets; i++) {
+        WatchedFile *file = watcher->files[i];
+        while (file) {
+            WatchedFile *next = file->next;
+            file->next = table[file->hash & (buckets - 1)];
+            table[file->hash & (buckets - 1)] = file;
+            file = next;
+        }
+    }
+    free(watcher->files);
+    watcher->files = table;
+    watcher->file_buckets = buckets;
+    return true;
+}
+
+static WatchedFile* find_file(const Watcher *watcher, const char *path, uint32_t hash) {
+    if (!watcher->file_buckets) return NULL;
+    for (WatchedFile *file = watcher->files[hash & (watcher->file_buckets - 1)]; file; file = file->next) {
+        if (file->hash == hash && strcmp(file->path, path) == 0) return file;
+    }
+    return NULL;
+}
+
+static WatchedFile* add_file(Watcher *watcher, const char *path) {
+    uint32_t hash = hash_path(path);
+    WatchedFile *file = find_file(watcher, path, hash);
+    if (file) return file;
+
+    if (watcher->file_count >= watcher->file_buckets && !grow_files(watcher)) return NULL;
+    size_t len = strlen(path);
+    file = calloc(1, sizeof(WatchedFile) + len + 1);
+    if (!file) return NULL;
+    file->hash = hash;
+    memcpy(file->path, path, len + 1);
+    size_t bucket = hash & (watcher->file_buckets - 1);
+    file->next = watcher->files[bucket];
+    watcher->files[bucket] = file;
+    watcher->file_count++;
+    return file;
+}
+
+static void remove_file(Watcher *watcher, WatchedFile *file) {
+    WatchedFile **link = &watcher->files[file->hash & (watcher->file_buckets - 1)];
+    while (*link != file) link = &(*link)->next;
+    *link = file->next;
+    watcher->file_count--;
+    free(file);
+}
+
+static void subtract_result(CountResult *dst, const CountResult *src) {
+    dst->total_lines -= src->total_lines;
+    dst->total_files -= src->total_files;
+    dst->blank_lines -= src->blank_lines;
+    dst->comment_lines -= src->comment_lines;
+    dst->code_lines -= src->code_lines;
+}
+
+static void add_result(CountResult *dst, const CountResult *src) {
+    dst->total_lines += src->total_lines;
+    dst->total_files += src->total_files;
+    dst->blank_lines += src->blank_lines;
+    dst->comment_lines += src->comment_lines;
+    dst->code_lines += src->code_lines;
+}
+
+// Replace a file's counts, applying the difference to the totals
+static void set_counts(Watcher *watcher, WatchedFile *file, const CountResult *counts) {
+    if (memcmp(&file->counts, counts, sizeof(CountResult)) == 0) return;
+    subtract_result(&watcher->totals, &file->counts);
+    add_result(&watcher->totals, counts);
+    file->counts = *counts;
+    watcher->changed_files++;
+}
+
+static WatchedDir* find_dir(const Watcher *watcher, int wd) {
+    if (!watcher->dir_buckets) return NULL;
+    for (WatchedDir *dir = watcher->dirs[(unsigned)wd & (watcher->dir_buckets - 1)]; dir; dir = dir->next) {
+        if (dir->wd == wd) return dir;
+    }
+    return NULL;
+}
+
+static void remove_dir(Watcher *watcher, WatchedDir *dir) {
+    WatchedDir **link = &watcher->dirs[(unsigned)dir->wd & (watcher->dir_buckets - 1)];
+    while (*link != dir) link = &(*link)->next;
+    *link = dir->next;
+    watcher->dir_count--;
+    free(dir);
+}
+
+static void add_dir(Watcher *watcher, int wd, const char *path) {
+    // The same directory reached again (through a symlink) keeps its first path
+    if (find_dir(watcher, wd)) return;
+
+    if (watcher->dir_count >= watcher->dir_buckets) {
+        size_t buckets = watcher->dir_buckets ? watcher->dir_buckets * 2 : 256;
+        WatchedDir **table = calloc(buckets, sizeof(WatchedDir*));
+        if (!table) return;
+        for (size_t i = 0; i < watcher->dir_buckets; i++) {
+            WatchedDir *dir = watcher->dirs[i];
+            while (dir) {
+                WatchedDir *next = dir->next;
+                dir->next = table[(unsigned)dir->wd & (buckets - 1)];
+                table[(unsigned)dir->wd & (buckets - 1)] = dir;
+                dir = next;
+            }
+        }
+        free(watcher->dirs);
+        watcher->dirs = table;
+        watcher->dir_buckets = buckets;
+    }
+
+    size_t len = strlen(path);
+    WatchedDir *dir = malloc(sizeof(WatchedDir) + len + 1);
+    if (!dir) return;
+    dir->wd = wd;
+    memcpy(dir->path, path, len + 1);
+    size_t bucket = (unsigned)wd & (watcher->dir_buckets - 1);
+    dir->next = watcher->dirs[bucket];
+    watcher->dirs[bucket] = dir;
+    watcher->dir_count++;
+}
+
+// True if `path` is `prefix` or lies below it
+static bool path_within(const char *path, const char *prefix, size_t prefix_len) {
+    return strncmp(path, prefix, prefix_len) == 0 && (path[prefix_len] == '\0' || path[prefix_len] == '/');
+}
+
+// Path relative to the watched root, for exclusion matching
+static const char* relative_path(const Watcher *watcher, const char *path) {
+    const char *rel = path + watcher->root_len;
+    while (*rel == '/') rel++;
+    return rel;
+}
+
+// DirectoryVisitor: watch every directory a scan opens
+static void watch_directory(void *ctx, int dir_fd, const char *path) {
+    (void)dir_fd;
+    Watcher *watcher = ctx;
+    int wd = inotify_add_watch(watcher->inotify_fd, path, WATCH_MASK);
+
+    cl_mutex_lock(&watcher->lock);
+    if (wd >= 0) {
+        add_dir(watcher, wd, path);
+    } else if (!watcher->limit_warned) {
+        watcher->limit_warned = true;
+        fprintf(stderr, "Warning: cannot watch '%s' (%s); changes below it are missed\n", path, strerror(errno));
+    }
+    cl_mutex_unlock(&watcher->lock);
+}
+
+// FileVisitor: remember every counted file
+static void record_file(void *ctx, const char *dir_path, const char *name, LanguageId language,
+                        const CountResult *counts) {
+    (void)language;
+    Watcher *watcher = ctx;
+    size_t dir_len = strlen(dir_path);
+    size_t name_len = strlen(name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) return;
+    memcpy(path, dir_path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+
+    cl_mutex_lock(&watcher->lock);
+    WatchedFile *file = add_file(watcher, path);
+    if (file) set_counts(watcher, file, counts);
+    cl_mutex_unlock(&watcher->lock);
+    free(path);
+}
+
+// Count `path` and everything below it into the tables
+static void scan_tree(Watcher *watcher, const char *path) {
+    CountOptions options = watcher->options;
+    const char *rel = relative_path(watcher, path);
+    options.exclude_base = *rel ? rel : NULL;
+    // Only the root may hold a cache file
+    if (*rel) options.use_cache = false;
+
+    CountResult ignored = {0, 0, 0, 0, 0};
+    count_lines_with_options(path, &options, &ignored);
+}
+
+static void mark_dirty(Watcher *watcher, WatchedFile *file) {
+    if (file->dirty) return;
+    file->dirty = true;
+    file->next_dirty = watcher->dirty;
+    watcher->dirty = file;
+}
+
+static void file_changed(Watcher *watcher, const char *path, const char *name) {
+    if (language_from_filename_mapped(watcher->options.extensions, name) == LANG_UNKNOWN) return;
+    if (exclude_matcher_match_path(watcher->matcher, relative_path(watcher, path), false)) return;
+    WatchedFile *file = add_file(watcher, path);
+    if (file) mark_dirty(watcher, file);
+}
+
+static void directory_added(Watcher *watcher, const char *path) {
+    if (exclude_matcher_match_path(watcher->matcher, relative_path(watcher, path), true)) return;
+    if (watcher->new_dir_count == watcher->new_dir_capacity) {
+        int capacity = watcher->new_dir_capacity ? watcher->new_dir_capacity * 2 : 16;
+        char **grown = realloc(watcher->new_dirs, sizeof(char*) * capacity);
+        if (!grown) return;
+        watcher->new_dirs = grown;
+        watcher->new_dir_capacity = capacity;
+    }
+    size_t len = strlen(path);
+    char *copy = malloc(len + 1);
+    if (!copy) return;
+    memcpy(copy, path, len + 1);
+    watcher->new_dirs[watcher->new_dir_count++] = copy;
+}
+
+// A directory went away or moved: stop watching below it and recount its
+// files, which finds them gone (or back, if something took its place)
+static void directory_removed(Watcher *watcher, const char *path) {
+    size_t len = strlen(path);
+    for (size_t i = 0; i < watcher->dir_buckets; i++) {
+        WatchedDir *dir = watcher->dirs[i];
+        while (dir) {
+            WatchedDir *next = dir->next;
+            if (path_within(dir->path, path, len)) {
+                inotify_rm_watch(watcher->inotify_fd, dir->wd);
+                remove_dir(watcher, dir);
+            }
+            dir = next;
+        }
+    }
+    for (size_t i = 0; i < watcher->file_buckets; i++) {
+        for (WatchedFile *file = watcher->files[i]; file; file = file->next) {
+            if (path_within(file->path, path, len)) mark_dirty(watcher, file);
+        }
+    }
+}
+
+static void handle_event(Watcher *watcher, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        watcher->overflowed = true;
+        return;
+    }
+    WatchedDir *dir = find_dir(watcher, event->wd);
+    if (!dir) return;
+    if (event->mask & IN_IGNORED) {
+        remove_dir(watcher, dir);
+        return;
+    }
+    if (event->mask & IN_DELETE_SELF) {
+        // The entry goes with the rest of the tree, so its path cannot be the prefix
+        size_t len = strlen(dir->path);
+        char *path = malloc(len + 1);
+        if (!path) return;
+        memcpy(path, dir->path, len + 1);
+        directory_removed(watcher, path);
+        free(path);
+        return;
+    }
+    if (event->len == 0 || event->name[0] == '\0') return;
+
+    size_t dir_len = strlen(dir->path);
+    size_t name_len = strlen(event->name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) return;
+    memcpy(path, dir->path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, event->name, name_len + 1);
+
+    if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_DELETE | IN_MOVED_FROM)) directory_removed(watcher, path);
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) directory_added(watcher, path);
+    } else {
+        file_changed(watcher, path, event->name);
+    }
+    free(path);
+}
+
+// Read every queued event; false if the descriptor failed
+static bool read_events(Watcher *watcher) {
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(watcher->inotify_fd, buffer, sizeof(buffer));
+        if (len < 0 && errno == EINTR) continue;
+        if (len < 0) return errno == EAGAIN;
+        if (len == 0) return false;
+
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            handle_event(watcher, event);
+        }
+    }
+}
+
+static bool has_pending(const Watcher *watcher) {
+    return watcher->dirty || watcher->new_dir_count > 0 || watcher->overflowed;
+}
+
+// Forget every file and watch; used before a full rescan
+static void reset_tables(Watcher *watcher) {
+    for (size_t i = 0; i < watcher->dir_buckets; i++) {
+        WatchedDir *dir = watcher->dirs[i];
+        while (dir) {
+            WatchedDir *next = dir->next;
+            inotify_rm_watch(watcher->inotify_fd, dir->wd);
+            free(dir);
+            dir = next;
+        }
+        watcher->dirs[i] = NULL;
+    }
+    watcher->dir_count = 0;
+    for (size_t i = 0; i < watcher->file_buckets; i++) {
+        WatchedFile *file = watcher->files[i];
+        while (file) {
+            WatchedFile *next = file->next;
+            free(file);
+            file = next;
+        }
+        watcher->files[i] = NULL;
+    }
+    watcher->file_count = 0;
+    watcher->dirty = NULL;
+    memset(&watcher->totals, 0, sizeof(CountResult));
+}
+
+static void recount_file(Watcher *watcher, WatchedFile *file) {
+    struct stat file_stat;
+    const char *name = strrchr(file->path, '/');
+    name = name ? name + 1 : file->path;
+
+    CountResult counts = {0, 0, 0, 0, 0};
+    if (stat(file->path, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+        if (watcher->options.classic) {
+            counts.total_lines = count_lines_classic_at(&watcher->reader, CWD_FD, file->path, &counts);
+        } else {
+            counts.total_lines = count_lines_at(&watcher->reader, CWD_FD, file->path,
+                                                language_from_filename_mapped(watcher->options.extensions, name),
+                                                &counts);
+        }
+    }
+    // Gone, no longer a file, or unreadable: it no longer counts
+    set_counts(watcher, file, &counts);
+    if (counts.total_files == 0) remove_file(watcher, file);
+}
+
+// Apply everything gathered since the last update
+static void apply_changes(Watcher *watcher) {
+    if (watcher->overflowed) {
+        watcher->overflowed = false;
+        CountResult before = watcher->totals;
+        unsigned long long changed = watcher->changed_files;
+        reset_tables(watcher);
+        scan_tree(watcher, watcher->root);
+        // Every file was counted afresh; report an update only if the totals moved
+        watcher->changed_files = changed + (memcmp(&before, &watcher->totals, sizeof(CountResult)) != 0);
+        for (int i = 0; i < watcher->new_dir_count; i++) free(watcher->new_dirs[i]);
+        watcher->new_dir_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < watcher->new_dir_count; i++) {
+        scan_tree(watcher, watcher->new_dirs[i]);
+        free(watcher->new_dirs[i]);
+    }
+    watcher->new_dir_count = 0;
+
+    WatchedFile *file = watcher->dirty;
+    watcher->dirty = NULL;
+    while (file) {
+        WatchedFile *next = file->next_dirty;
+        file->dirty = false;
+        recount_file(watcher, file);
+        file = next;
+    }
+}
+
+Watcher* watcher_create(const char **reason) {
+    Watcher *watcher = calloc(1, sizeof(Watcher));
+    if (!watcher) {
+        if (reason) *reason = "out of memory";
+        return NULL;
+    }
+    watcher->stop_pipe[0] = watcher->stop_pipe[1] = -1;
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->inotify_fd < 0 || pipe2(watcher->stop_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        if (reason) *reason = strerror(errno);
+        if (watcher->inotify_fd >= 0) close(watcher->inotify_fd);
+        free(watcher);
+        return NULL;
+    }
+    cl_mutex_init(&watcher->lock);
+    return watcher;
+}
+
+void watcher_destroy(Watcher *watcher) {
+    if (!watcher) return;
+    reset_tables(watcher);
+    free(watcher->files);
+    free(watcher->dirs);
+    for (int i = 0; i < watcher->new_dir_count; i++) free(watcher->new_dirs[i]);
+    free(watcher->new_dirs);
+    if (watcher->matcher) {
+        exclude_matcher_free(watcher->matcher);
+        file_reader_free(&watcher->reader);
+    }
+    free(watcher->root);
+    close(watcher->inotify_fd);
+    close(watcher->stop_pipe[0]);
+    close(watcher->stop_pipe[1]);
+    cl_mutex_destroy(&watcher->lock);
+    free(watcher);
+}
+
+bool watcher_scan(Watcher *watcher, const char *path, const CountOptions *options, CountResult *result) {
+    struct stat root_stat;
+    if (watcher->root || stat(path, &root_stat) != 0 || !S_ISDIR(root_stat.st_mode)) return false;
+
+    // Paths are joined with '/', so the root must not end in one
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') len--;
+    watcher->root = malloc(len + 1);
+    if (!watcher->root) return false;
+    memcpy(watcher->root, path, len);
+    watcher->root[len] = '\0';
+    watcher->root_len = len;
+
+    const ExcludeList *list = options->exclude_list;
+    watcher->matcher = exclude_matcher_create(list ? list->patterns : NULL, list ? list->count : 0);
+    if (!watcher->matcher) return false;
+    if (!file_reader_init(&watcher->reader, options->io_mode)) {
+        exclude_matcher_free(watcher->matcher);
+        watcher->matcher = NULL;
+        return false;
+    }
+
+    watcher->options = *options;
+    watcher->options.on_directory = watch_directory;
+    watcher->options.on_file = record_file;
+    watcher->options.visitor_ctx = watcher;
+
+    CountOptions first = watcher->options;
+    count_lines_with_options(watcher->root, &first, result);
+    // Later scans only cover new directories, so they get no breakdown, profile or progress
+    watcher->options.breakdown = NULL;
+    watcher->options.profile = NULL;
+    watcher->options.on_progress = NULL;
+    watcher->changed_files = 0;
+    return true;
+}
+
+static long long difference(unsigned long long after, unsigned long long before) {
+    return (long long)(after - before);
+}
+
+int watcher_run(Watcher *watcher, WatchCallback on_change, void *ctx) {
+    struct pollfd fds[2];
+    fds[0].fd = watcher->inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watcher->stop_pipe[0];
+    fds[1].events = POLLIN;
+
+    CountResult reported = watcher->totals;
+    unsigned long long pending_since = 0;
+    for (;;) {
+        // Sleep until an event arrives; then until the tree settles
+        int timeout = -1;
+        unsigned long long now = cl_monotonic_ns();
+        if (pending_since) {
+            unsigned long long waited_ms = (now - pending_since) / 1000000ULL;
+            timeout = waited_ms >= WATCH_MAX_DELAY_MS ? 0 : WATCH_SETTLE_MS;
+        }
+
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (fds[1].revents) return 0;
+        if (ready > 0 && fds[0].revents) {
+            if (!read_events(watcher)) return -1;
+            if (has_pending(watcher) && !pending_since) pending_since = cl_monotonic_ns();
+            now = cl_monotonic_ns();
+            if (!pending_since || (now - pending_since) / 1000000ULL < WATCH_MAX_DELAY_MS) continue;
+        }
+        if (!pending_since) continue;
+
+        pending_since = 0;
+        watcher->changed_files = 0;
+        apply_changes(watcher);
+        if (watcher->changed_files == 0) continue;
+
+        WatchUpdate update;
+        update.totals = watcher->totals;
+        update.delta.files = difference(watcher->totals.total_files, reported.total_files);
+        update.delta.lines = difference(watcher->totals.total_lines, reported.total_lines);
+        update.delta.code = difference(watcher->totals.code_lines, reported.code_lines);
+        update.delta.comments = difference(watcher->totals.comment_lines, reported.comment_lines);
+        update.delta.blank = difference(watcher->totals.blank_lines, reported.blank_lines);
+        update.changed_files = watcher->changed_files;
+        reported = watcher->totals;
+        if (on_change) on_change(ctx, &update);
+    }
+}
+
+void watcher_stop(Watcher *watcher) {
+    char byte = 1;
+    ssize_t written = write(watcher->stop_pipe[1], &byte, 1);
+    (void)written;  // A full pipe is already readable
+}
+
+#else
+
+// inotify is Linux-only; other platforms have no watch mode
+
+struct Watcher {
+    int unused;
+};
+
+Watcher* watcher_create(const char **reason) {
+    if (reason) *reason = "watch mode needs inotify (Linux)";
+    return NULL;
+}
+
+void watcher_destroy(Watcher *watcher) {
+    (void)watcher;
+}
+
+bool watcher_scan(Watcher *watcher, const char *path, const CountOptions *options, CountResult *result) {
+    (void)watcher; (void)path; (void)options; (void)result;
+    return false;
+}
+
+int watcher_run(Watcher *watcher, WatchCallback on_change, void *ctx) {
+    (void)watcher; (void)on_change; (void)ctx;
+    return -1;
+}
+
+void watcher_stop(Watcher *watcher) {
+    (void)watcher;
+}
+
+#endif
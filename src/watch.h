@@ -0,0 +1,59 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "countlines.h"
+
+// Live line counts for a directory tree.
+//
+// watcher_scan counts the tree once like count_lines_with_options, keeping
+// every file's counts and putting an inotify watch on every directory it
+// opens. watcher_run then sleeps on the inotify descriptor. Touched files are
+// recounted on their own and the difference between their old and new counts
+// is applied to the totals. New or moved-in directories are scanned, and
+// removed or moved-out ones drop their files. Events are gathered until the
+// tree has been quiet for WATCH_SETTLE_MS (at most WATCH_MAX_DELAY_MS), so a
+// burst of writes is applied as one update. A quiet tree costs no CPU.
+//
+// Linux only: elsewhere watcher_create returns NULL.
+
+#define WATCH_SETTLE_MS 100
+#define WATCH_MAX_DELAY_MS 1000
+
+// Signed change of the totals
+typedef struct {
+    long long files;
+    long long lines;
+    long long code;
+    long long comments;
+    long long blank;
+} CountDelta;
+
+typedef struct {
+    CountResult totals;
+    CountDelta delta;                   // Since the previous update
+    unsigned long long changed_files;   // Added, removed or recounted with different counts
+                                        // (1 after a full rescan)
+} WatchUpdate;
+
+// Called from watcher_run after each batch of changes that moved any counts
+typedef void (*WatchCallback)(void *ctx, const WatchUpdate *update);
+
+typedef struct Watcher Watcher;
+
+// `reason` (optional) receives why watching is unavailable
+Watcher* watcher_create(const char **reason);
+void watcher_destroy(Watcher *watcher);
+
+// Initial full scan of `path`; the options (excludes, jobs, I/O mode, rules)
+// also apply to later recounts. Call once, before watcher_run. Returns false
+// if the scan could not start.
+bool watcher_scan(Watcher *watcher, const char *path, const CountOptions *options, CountResult *result);
+
+// Apply changes until watcher_stop is called (returns 0) or reading events
+// fails (returns -1)
+int watcher_run(Watcher *watcher, WatchCallback on_change, void *ctx);
+
+// Make watcher_run return; safe from any thread, also before it started
+void watcher_stop(Watcher *watcher);
+
+#endif // WATCH_H
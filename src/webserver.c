@@ -1,5 +1,11 @@
 #include "webserver.h"
+#include "poller.h"
+#include "threading.h"
+#include "watch.h"
+#include "assets.h"
 #include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <time.h>
 
 #ifdef _WIN32
@@ -9,15 +15,111 @@
     typedef int socklen_t;
 #else
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <netinet/in.h>
     #include <arpa/inet.h>
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <errno.h>
+    #include <signal.h>
     #define closesocket close
     #define SOCKET int
     #define INVALID_SOCKET -1
     #define SOCKET_ERROR -1
 #endif
 
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// The server is one event loop plus a pool of count workers. The loop owns
+// every socket: it accepts, reads requests, serves static files inline and
+// writes all responses without blocking. /api/count requests become jobs for
+// the worker pool; a worker builds the response and posts it back through a
+// mailbox, waking the loop through a pipe. When every worker is busy and
+// queue_limit jobs are already waiting, new scans are answered with 503 and
+// Retry-After instead of queueing without bound.
+//
+// /api/watch streams live totals for as long as the client stays, so it runs
+// on a thread of its own rather than holding a count worker. The loop keeps
+// reading the connection and stops the watcher when the client goes away.
+//
+// Static files come from an AssetCache loaded when the server starts. A
+// response to them is its header in `out` plus a pointer to the cached body,
+// and both go out in one scatter-gather send, so the body is never copied
+// into a connection's buffer.
+
+enum {
+    CONN_READING,       // Collecting the request head
+    CONN_WAITING,       // A count job owns the response
+    CONN_WRITING        // Flushing `out`; closed once it is empty and no job remains
+};
+
+typedef struct Connection Connection;
+struct Connection {
+    SOCKET socket;
+    int state;
+    bool job_active;            // A worker will still post output for this connection
+    bool closed;                // Socket gone; freed when the job posts its last output
+    Watcher *watcher;           // /api/watch: destroyed when its job posts its last output
+    Connection *prev;
+    Connection *next;
+    unsigned long long last_active;
+    HttpBuffer out;
+    size_t out_sent;
+    const char *body;           // Static asset sent after `out`, owned by the asset cache
+    size_t body_length;
+    size_t body_sent;
+    size_t request_len;
+    char request[MAX_REQUEST_SIZE];
+};
+
+typedef struct CountJob CountJob;
+typedef struct Message Message;
+struct Message {
+    Message *next;
+    Connection *conn;
+    HttpBuffer data;
+    bool last;                  // The job is over; the connection closes after this output
+};
+
+struct CountJob {
+    CountJob *next;
+    Connection *conn;
+    Message *finish;
+    bool stream;                // /api/count/stream: Server-Sent Events while the scan runs
+    char query[];
+};
+
+typedef struct {
+    WebServerOptions options;
+    Poller *poller;
+    SOCKET listen_socket;
+    ResultCache *cache;         // NULL when disabled
+    const AssetCache *assets;   // NULL if it could not be loaded
+    Connection *connections;
+    int connection_count;
+    int watch_count;
+
+    cl_mutex_t lock;            // Guards everything below
+    cl_cond_t job_ready;
+    CountJob *job_head;
+    CountJob *job_tail;
+    int jobs_in_flight;         // Queued plus running
+    bool stopping;
+    Message *mail_head;
+    Message *mail_tail;
+#ifndef _WIN32
+    int wake_pipe[2];
+#endif
+
+    cl_thread_t *threads;
+    int thread_count;
+} WebServer;
+
+// Poll timeout; bounds how late idle connections are noticed
+#define WEB_POLL_INTERVAL_MS 1000
+
 // URL decode helper
 void url_decode(char *dst, const char *src) {
     char a, b;
@@ -41,134 +143,164 @@ void url_decode(char *dst, const char *src) {
     *dst++ = '\0';
 }
 
-// Get query parameter value
-char* get_query_param(const char *query_string, const char *param) {
-    if (!query_string || !param) return NULL;
-    
-    static char value[1024];
-    char search[256];
-    snprintf(search, sizeof(search), "%s=", param);
-    
-    const char *start = strstr(query_string, search);
-    if (!start) return NULL;
-    
-    start += strlen(search);
-    const char *end = strchr(start, '&');
-    
-    size_t len;
-    if (end) {
-        len = end - start;
-    } else {
-        len = strlen(start);
-    }
-    
-    if (len >= sizeof(value)) len = sizeof(value) - 1;
-    strncpy(value, start, len);
-    value[len] = '\0';
-    
-    char decoded[1024];
-    url_decode(decoded, value);
-    strcpy(value, decoded);
-    
-    return value;
-}
-
-// Send HTTP response
-void send_http_response(int client_socket, const char *status, const char *content_type, const char *body) {
-    char response[MAX_RESPONSE_SIZE];
-    int body_len = body ? strlen(body) : 0;
-    
-    snprintf(response, sizeof(response),
-        "HTTP/1.1 %s\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %d\r\n"
-        "Access-Control-Allow-Origin: *\r\n"
-        "Connection: close\r\n"
-        "\r\n"
-        "%s",
-        status, content_type, body_len, body ? body : "");
-    
-    send(client_socket, response, strlen(response), 0);
-}
+// Copy the decoded value of `param` into `value`; returns false if it is absent.
+// Decoding never lengthens a string, so it is done in place.
+bool get_query_param(const char *query_string, const char *param, char *value, size_t value_size) {
+    if (!query_string || !param || !value || value_size == 0) return false;
 
-// Send file response
-void send_file_response(int client_socket, const char *filepath) {
-    FILE *file = fopen(filepath, "rb");
-    if (!file) {
-        const char *error_body = "<html><body><h1>404 Not Found</h1></body></html>";
-        send_http_response(client_socket, "404 Not Found", "text/html", error_body);
-        return;
-    }
-    
-    // Determine content type
-    const char *content_type = "text/html";
-    const char *ext = strrchr(filepath, '.');
-    if (ext) {
-        if (strcmp(ext, ".html") == 0) content_type = "text/html";
-        else if (strcmp(ext, ".css") == 0) content_type = "text/css";
-        else if (strcmp(ext, ".js") == 0) content_type = "application/javascript";
-        else if (strcmp(ext, ".json") == 0) content_type = "application/json";
-    }
-    
-    // Read file content
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char *content = malloc(file_size + 1);
-    if (!content) {
-        fclose(file);
-        const char *error_body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
-        send_http_response(client_socket, "500 Internal Server Error", "text/html", error_body);
-        return;
+    size_t param_len = strlen(param);
+    const char *field = query_string;
+    while (field) {
+        if (strncmp(field, param, param_len) == 0 && field[param_len] == '=') {
+            const char *start = field + param_len + 1;
+            const char *end = strchr(start, '&');
+            size_t len = end ? (size_t)(end - start) : strlen(start);
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, start, len);
+            value[len] = '\0';
+            url_decode(value, value);
+            return true;
+        }
+        field = strchr(field, '&');
+        if (field) field++;
     }
-    
-    size_t bytes_read = fread(content, 1, file_size, file);
-    content[bytes_read] = '\0';
-    fclose(file);
-    
-    if (bytes_read != (size_t)file_size) {
-        free(content);
-        const char *error_body = "<html><body><h1>500 Internal Server Error</h1></body></html>";
-        send_http_response(client_socket, "500 Internal Server Error", "text/html", error_body);
-        return;
+    return false;
+}
+
+bool http_buffer_append(HttpBuffer *buffer, const void *data, size_t len) {
+    if (buffer->length + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+        while (capacity < buffer->length + len) capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown) return false;
+        buffer->data = grown;
+        buffer->capacity = capacity;
     }
-    
-    // Send response
+    memcpy(buffer->data + buffer->length, data, len);
+    buffer->length += len;
+    return true;
+}
+
+void http_buffer_free(HttpBuffer *buffer) {
+    if (!buffer) return;
+    free(buffer->data);
+    memset(buffer, 0, sizeof(HttpBuffer));
+}
+
+// Append a complete response; extra_headers, if any, are "Name: value\r\n" lines
+void http_response_bytes(HttpBuffer *out, const char *status, const char *content_type,
+                         const char *extra_headers, const void *body, size_t body_len) {
     char header[1024];
-    snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\n"
         "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
+        "Content-Length: %lu\r\n"
         "Access-Control-Allow-Origin: *\r\n"
+        "%s"
         "Connection: close\r\n"
         "\r\n",
-        content_type, file_size);
-    
-    send(client_socket, header, strlen(header), 0);
-    send(client_socket, content, file_size, 0);
-    
-    free(content);
+        status, content_type, (unsigned long)body_len, extra_headers ? extra_headers : "");
+    if (header_len < 0 || (size_t)header_len >= sizeof(header)) return;
+
+    http_buffer_append(out, header, (size_t)header_len);
+    if (body_len > 0) http_buffer_append(out, body, body_len);
 }
 
-// Handle API count endpoint
-void handle_api_count(int client_socket, const char *query_string) {
-    char *path_param = get_query_param(query_string, "path");
-    
-    if (!path_param || strlen(path_param) == 0) {
-        const char *error_json = "{\"error\":\"Missing path parameter\"}";
-        send_http_response(client_socket, "400 Bad Request", "application/json", error_json);
-        return;
+void http_response(HttpBuffer *out, const char *status, const char *content_type, const char *body) {
+    http_response_bytes(out, status, content_type, NULL, body, body ? strlen(body) : 0);
+}
+
+bool http_buffer_printf(HttpBuffer *buffer, const char *format, ...) {
+    char small[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (len < 0) return false;
+    if ((size_t)len < sizeof(small)) return http_buffer_append(buffer, small, (size_t)len);
+
+    char *large = malloc((size_t)len + 1);
+    if (!large) return false;
+    va_start(args, format);
+    vsnprintf(large, (size_t)len + 1, format, args);
+    va_end(args);
+    bool ok = http_buffer_append(buffer, large, (size_t)len);
+    free(large);
+    return ok;
+}
+
+// Append `value` as a quoted JSON string
+void json_append_string(HttpBuffer *json, const char *value) {
+    http_buffer_append(json, "\"", 1);
+    const char *run = value;
+    for (const char *p = value; ; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '\0' && c != '"' && c != '\\' && c >= 0x20) continue;
+        http_buffer_append(json, run, (size_t)(p - run));
+        if (c == '\0') break;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            http_buffer_append(json, escaped, 2);
+        } else {
+            http_buffer_printf(json, "\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    http_buffer_append(json, "\"", 1);
+}
+
+// A parsed /api/count request; on failure `status` and `error_json` describe it
+typedef struct {
+    char path[1024];
+    ExcludeList *exclude_list;
+    bool profiled;              // ?profile=true or ?profile=N (slowest entries kept)
+    ScanProfile profile;        // Filled in by run_count when profiled; always freeable
+    const char *status;
+    const char *error_json;
+} CountRequest;
+
+static bool parse_count_request(const char *query_string, CountRequest *request) {
+    request->exclude_list = NULL;
+    request->profiled = false;
+    scan_profile_init(&request->profile, 0);
+    request->status = NULL;
+    request->error_json = NULL;
+
+    if (!get_query_param(query_string, "path", request->path, sizeof(request->path)) || strlen(request->path) == 0) {
+        request->status = "400 Bad Request";
+        request->error_json = "{\"error\":\"Missing path parameter\"}";
+        return false;
+    }
+
+    char profile_value[16];
+    if (get_query_param(query_string, "profile", profile_value, sizeof(profile_value))) {
+        int slowest = PROFILE_DEFAULT_SLOWEST;
+        if (isdigit((unsigned char)profile_value[0])) {
+            char *end;
+            long value = strtol(profile_value, &end, 10);
+            if (*end != '\0' || value > PROFILE_MAX_SLOWEST) {
+                request->status = "400 Bad Request";
+                request->error_json = "{\"error\":\"Invalid profile parameter\"}";
+                return false;
+            }
+            slowest = (int)value;
+        } else if (strcmp(profile_value, "true") != 0 && profile_value[0] != '\0') {
+            request->status = "400 Bad Request";
+            request->error_json = "{\"error\":\"Invalid profile parameter\"}";
+            return false;
+        }
+        request->profiled = true;
+        scan_profile_init(&request->profile, slowest);
     }
-    
+
     // Create exclude list
     ExcludeList *exclude_list = create_exclude_list();
     if (!exclude_list) {
-        const char *error_json = "{\"error\":\"Failed to initialize exclude list\"}";
-        send_http_response(client_socket, "500 Internal Server Error", "application/json", error_json);
-        return;
+        request->status = "500 Internal Server Error";
+        request->error_json = "{\"error\":\"Failed to initialize exclude list\"}";
+        return false;
     }
-    
+
     // Add default exclusions
     add_exclude_pattern(exclude_list, ".git");
     add_exclude_pattern(exclude_list, ".svn");
@@ -177,17 +309,14 @@ void handle_api_count(int client_socket, const char *query_string) {
     add_exclude_pattern(exclude_list, "__pycache__");
     add_exclude_pattern(exclude_list, ".vs");
     add_exclude_pattern(exclude_list, ".vscode");
-    
+
     // Parse exclude patterns from query string
-    char *query_copy = malloc(strlen(query_string) + 1);
-    strcpy(query_copy, query_string);
-    
-    char *param_start = query_copy;
+    const char *param_start = query_string;
     while (param_start) {
         if (strncmp(param_start, "exclude=", 8) == 0) {
-            char *value_start = param_start + 8;
-            char *param_end = strchr(value_start, '&');
-            
+            const char *value_start = param_start + 8;
+            const char *param_end = strchr(value_start, '&');
+
             char exclude_value[256];
             if (param_end) {
                 size_t len = param_end - value_start;
@@ -198,206 +327,1182 @@ void handle_api_count(int client_socket, const char *query_string) {
                 strncpy(exclude_value, value_start, sizeof(exclude_value) - 1);
                 exclude_value[sizeof(exclude_value) - 1] = '\0';
             }
-            
+
             char decoded[256];
             url_decode(decoded, exclude_value);
             add_exclude_pattern(exclude_list, decoded);
         }
-        
+
         param_start = strchr(param_start, '&');
         if (param_start) param_start++;
     }
-    
-    free(query_copy);
-    
+
     // Check if path exists
+    bool exists, is_directory;
 #ifdef _WIN32
-    DWORD attributes = GetFileAttributes(path_param);
-    if (attributes == INVALID_FILE_ATTRIBUTES) {
+    DWORD attributes = GetFileAttributes(request->path);
+    exists = attributes != INVALID_FILE_ATTRIBUTES;
+    is_directory = exists && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat path_stat;
+    exists = stat(request->path, &path_stat) == 0;
+    is_directory = exists && S_ISDIR(path_stat.st_mode);
+#endif
+    if (!exists) {
         free_exclude_list(exclude_list);
-        const char *error_json = "{\"error\":\"Path does not exist\"}";
-        send_http_response(client_socket, "404 Not Found", "application/json", error_json);
-        return;
+        request->status = "404 Not Found";
+        request->error_json = "{\"error\":\"Path does not exist\"}";
+        return false;
     }
-    if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    if (!is_directory) {
         free_exclude_list(exclude_list);
-        const char *error_json = "{\"error\":\"Path is not a directory\"}";
-        send_http_response(client_socket, "400 Bad Request", "application/json", error_json);
+        request->status = "400 Bad Request";
+        request->error_json = "{\"error\":\"Path is not a directory\"}";
+        return false;
+    }
+
+    request->exclude_list = exclude_list;
+    return true;
+}
+
+// Count lines, or reuse a recent count of the same tree; `options` carries
+// the excludes and any progress callback. A profiled request always scans.
+static bool run_count(CountRequest *request, CountOptions *options, ResultCache *cache, CachedCount *counted) {
+    options->exclude_list = request->exclude_list;
+    memset(counted, 0, sizeof(CachedCount));
+    if (cache && !request->profiled) return result_cache_count(cache, request->path, options, counted);
+
+    options->breakdown = &counted->breakdown;
+    if (request->profiled) options->profile = &request->profile;
+    unsigned long long start = cl_monotonic_ns();
+    count_lines_with_options(request->path, options, &counted->result);
+    counted->processing_time = (cl_monotonic_ns() - start) / 1e9;
+    return true;
+}
+
+static void json_append_breakdown(HttpBuffer *json, const BreakdownEntry *entries, int count) {
+    http_buffer_append(json, "[", 1);
+    for (int i = 0; i < count; i++) {
+        const CountResult *result = &entries[i].result;
+        http_buffer_append(json, i > 0 ? ",{\"name\":" : "{\"name\":", i > 0 ? 9 : 8);
+        json_append_string(json, entries[i].name);
+        http_buffer_printf(json,
+            ",\"total_files\":%llu,\"total_lines\":%llu,\"code_lines\":%llu,"
+            "\"comment_lines\":%llu,\"blank_lines\":%llu}",
+            result->total_files, result->total_lines, result->code_lines,
+            result->comment_lines, result->blank_lines);
+    }
+    http_buffer_append(json, "]", 1);
+}
+
+static void json_append_latency(HttpBuffer *json, const unsigned long long *buckets) {
+    http_buffer_append(json, "[", 1);
+    bool first = true;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        if (buckets[i] == 0) continue;
+        unsigned long long limit = profile_bucket_limit_us(i);
+        if (!first) http_buffer_append(json, ",", 1);
+        if (limit) {
+            http_buffer_printf(json, "{\"below_us\":%llu,\"count\":%llu}", limit, buckets[i]);
+        } else {
+            http_buffer_printf(json, "{\"below_us\":null,\"count\":%llu}", buckets[i]);
+        }
+        first = false;
+    }
+    http_buffer_append(json, "]", 1);
+}
+
+// Slowest first, like the --profile report
+static void json_append_slowest(HttpBuffer *json, const SlowestList *list, bool files) {
+    http_buffer_append(json, "[", 1);
+    for (int i = list->count - 1; i >= 0; i--) {
+        const ProfileEntry *entry = &list->entries[i];
+        http_buffer_append(json, i < list->count - 1 ? ",{\"path\":" : "{\"path\":", i < list->count - 1 ? 9 : 8);
+        json_append_string(json, entry->path);
+        http_buffer_printf(json, ",\"seconds\":%.6f", entry->ns / 1e9);
+        if (files) http_buffer_printf(json, ",\"bytes\":%llu", entry->bytes);
+        http_buffer_append(json, "}", 1);
+    }
+    http_buffer_append(json, "]", 1);
+}
+
+static void json_append_profile(HttpBuffer *json, const ScanProfile *profile) {
+    http_buffer_printf(json,
+        "{\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"threads\":%d,\"phases\":{",
+        profile->wall_ns / 1e9, profile->cpu_ns / 1e9, profile->threads);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseTime *time = &profile->phases[i];
+        http_buffer_printf(json, "%s\"%s\":{\"calls\":%llu,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f}",
+                           i > 0 ? "," : "", profile_phase_name((ProfilePhase)i),
+                           time->calls, time->wall_ns / 1e9, time->cpu_ns / 1e9);
+    }
+    http_buffer_append(json, "},\"file_latency\":", 17);
+    json_append_latency(json, profile->file_histogram);
+    http_buffer_append(json, ",\"directory_latency\":", 21);
+    json_append_latency(json, profile->directory_histogram);
+    http_buffer_append(json, ",\"slowest_files\":", 17);
+    json_append_slowest(json, &profile->slowest_files, true);
+    http_buffer_append(json, ",\"slowest_directories\":", 23);
+    json_append_slowest(json, &profile->slowest_directories, false);
+    http_buffer_printf(json,
+        ",\"memory\":{\"peak_directories\":%llu,\"peak_directory_bytes\":%llu,"
+        "\"peak_open_directories\":%d,\"open_directory_limit\":%d,\"process_peak_rss_bytes\":%llu}}",
+        profile->peak_directories, profile->peak_directory_bytes, profile->peak_open_directories,
+        profile->open_directory_limit, profile->peak_rss);
+}
+
+// `profile` is NULL unless the request asked for one
+static void json_append_count(HttpBuffer *json, const CachedCount *counted, const char *target_path,
+                              const ScanProfile *profile) {
+    const CountResult *result = &counted->result;
+    http_buffer_printf(json,
+        "{"
+        "\"total_files\":%llu,"
+        "\"total_lines\":%llu,"
+        "\"code_lines\":%llu,"
+        "\"comment_lines\":%llu,"
+        "\"blank_lines\":%llu,"
+        "\"processing_time\":%.3f,"
+        "\"cache_hit\":%s,"
+        "\"cache_age\":%.3f,"
+        "\"target_path\":",
+        result->total_files,
+        result->total_lines,
+        result->code_lines,
+        result->comment_lines,
+        result->blank_lines,
+        counted->processing_time,
+        counted->hit ? "true" : "false",
+        counted->age);
+    json_append_string(json, target_path);
+    http_buffer_append(json, ",\"languages\":", 13);
+    json_append_breakdown(json, counted->breakdown.languages, counted->breakdown.language_count);
+    http_buffer_append(json, ",\"directories\":", 15);
+    json_append_breakdown(json, counted->breakdown.directories, counted->breakdown.directory_count);
+    if (profile) {
+        http_buffer_append(json, ",\"profile\":", 11);
+        json_append_profile(json, profile);
+    }
+    http_buffer_append(json, "}", 1);
+}
+
+// Handle API count endpoint
+void handle_api_count(HttpBuffer *out, const char *query_string, ResultCache *cache) {
+    CountRequest request;
+    if (!parse_count_request(query_string, &request)) {
+        http_response(out, request.status, "application/json", request.error_json);
         return;
     }
-#else
-    struct stat path_stat;
-    if (stat(path_param, &path_stat) != 0) {
-        free_exclude_list(exclude_list);
+
+    CountOptions options;
+    init_count_options(&options);
+    CachedCount counted;
+    if (!run_count(&request, &options, cache, &counted)) {
+        free_exclude_list(request.exclude_list);
+        scan_profile_free(&request.profile);
         const char *error_json = "{\"error\":\"Path does not exist\"}";
-        send_http_response(client_socket, "404 Not Found", "application/json", error_json);
+        http_response(out, "404 Not Found", "application/json", error_json);
         return;
     }
-    if (!S_ISDIR(path_stat.st_mode)) {
-        free_exclude_list(exclude_list);
-        const char *error_json = "{\"error\":\"Path is not a directory\"}";
-        send_http_response(client_socket, "400 Bad Request", "application/json", error_json);
+
+    HttpBuffer json = {NULL, 0, 0};
+    json_append_count(&json, &counted, request.path, request.profiled ? &request.profile : NULL);
+    http_response_bytes(out, "200 OK", "application/json", NULL, json.data, json.length);
+    http_buffer_free(&json);
+    free_count_breakdown(&counted.breakdown);
+
+    free_exclude_list(request.exclude_list);
+    scan_profile_free(&request.profile);
+}
+
+void init_web_server_options(WebServerOptions *options) {
+    if (!options) return;
+    options->port = WEB_PORT;
+    options->backlog = WEB_DEFAULT_BACKLOG;
+    options->workers = WEB_DEFAULT_WORKERS;
+    options->queue_limit = WEB_DEFAULT_QUEUE;
+    options->max_connections = WEB_DEFAULT_MAX_CONNECTIONS;
+    options->cache_ttl = RESULT_CACHE_DEFAULT_TTL;
+}
+
+static bool set_nonblocking(SOCKET socket) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static bool would_block(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Wake the event loop from a worker thread. Windows has no pipe that
+// WSAPoll accepts, so there the loop polls with a short timeout instead.
+static void wake_loop(WebServer *server) {
+#ifdef _WIN32
+    (void)server;
+#else
+    char byte = 1;
+    ssize_t written = write(server->wake_pipe[1], &byte, 1);
+    (void)written;  // A full pipe already guarantees a wakeup
+#endif
+}
+
+static void post_message(WebServer *server, Message *message) {
+    cl_mutex_lock(&server->lock);
+    if (server->mail_tail) {
+        server->mail_tail->next = message;
+    } else {
+        server->mail_head = message;
+    }
+    server->mail_tail = message;
+    // Watch jobs run outside the count pool and are not in jobs_in_flight
+    if (message->last && !message->conn->watcher) server->jobs_in_flight--;
+    cl_mutex_unlock(&server->lock);
+
+    wake_loop(server);
+}
+
+// Hand the job's final output to the event loop. Its message is allocated
+// when the job is queued, so the end of a job is never lost.
+static void finish_job(WebServer *server, CountJob *job, HttpBuffer *data) {
+    Message *message = job->finish;
+    message->next = NULL;
+    message->conn = job->conn;
+    message->data = *data;
+    message->last = true;
+    post_message(server, message);
+}
+
+// Post part of a running job's output; dropped if memory runs out
+static void post_output(WebServer *server, Connection *conn, HttpBuffer *data) {
+    Message *message = malloc(sizeof(Message));
+    if (!message) {
+        http_buffer_free(data);
         return;
     }
-#endif
-    
-    // Count lines
-    CountResult result = {0, 0, 0, 0, 0};
-    clock_t start_time = clock();
-    count_lines_in_directory(path_param, exclude_list, &result);
-    clock_t end_time = clock();
-    double elapsed_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
-    
-    // Build JSON response
-    char json_response[4096];
-    snprintf(json_response, sizeof(json_response),
+    message->next = NULL;
+    message->conn = conn;
+    message->data = *data;
+    message->last = false;
+    memset(data, 0, sizeof(HttpBuffer));
+    post_message(server, message);
+}
+
+typedef struct {
+    WebServer *server;
+    Connection *conn;
+    double last_elapsed;
+    unsigned long long last_files;
+} StreamContext;
+
+static void sse_event(HttpBuffer *out, const char *event, const char *data, size_t len) {
+    http_buffer_printf(out, "event: %s\ndata: ", event);
+    http_buffer_append(out, data, len);
+    http_buffer_append(out, "\n\n", 2);
+}
+
+// ProgressCallback: one "progress" event with the running totals. The rate
+// is measured over the interval since the previous event.
+static void stream_progress(void *arg, const ScanProgress *progress) {
+    StreamContext *stream = arg;
+    const CountResult *totals = &progress->totals;
+    double span = progress->elapsed - stream->last_elapsed;
+    double rate = span > 0 ? (totals->total_files - stream->last_files) / span : 0.0;
+    stream->last_elapsed = progress->elapsed;
+    stream->last_files = totals->total_files;
+
+    HttpBuffer json = {NULL, 0, 0};
+    http_buffer_printf(&json,
         "{"
         "\"total_files\":%llu,"
         "\"total_lines\":%llu,"
         "\"code_lines\":%llu,"
         "\"comment_lines\":%llu,"
         "\"blank_lines\":%llu,"
-        "\"processing_time\":%.3f,"
-        "\"target_path\":\"%s\""
-        "}",
-        result.total_files,
-        result.total_lines,
-        result.code_lines,
-        result.comment_lines,
-        result.blank_lines,
-        elapsed_time,
-        path_param
-    );
-    
-    send_http_response(client_socket, "200 OK", "application/json", json_response);
-    
-    free_exclude_list(exclude_list);
-}
-
-// Handle HTTP request
-void handle_http_request(int client_socket) {
-    char request[MAX_REQUEST_SIZE];
-    int received = recv(client_socket, request, sizeof(request) - 1, 0);
-    
-    if (received <= 0) {
-        closesocket(client_socket);
+        "\"directories\":%llu,"
+        "\"elapsed\":%.3f,"
+        "\"files_per_second\":%.1f,"
+        "\"current_directory\":",
+        totals->total_files,
+        totals->total_lines,
+        totals->code_lines,
+        totals->comment_lines,
+        totals->blank_lines,
+        progress->directories,
+        progress->elapsed,
+        rate);
+    json_append_string(&json, progress->current_directory);
+    http_buffer_append(&json, "}", 1);
+
+    HttpBuffer event = {NULL, 0, 0};
+    sse_event(&event, "progress", json.data, json.length);
+    http_buffer_free(&json);
+    post_output(stream->server, stream->conn, &event);
+}
+
+// /api/count/stream: "progress" events every WEB_PROGRESS_INTERVAL_MS, then
+// one "result" event with the same JSON as /api/count, or an "error" event
+static void run_count_stream(WebServer *server, CountJob *job) {
+    HttpBuffer out = {NULL, 0, 0};
+    const char *header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    http_buffer_append(&out, header, strlen(header));
+
+    CountRequest request;
+    if (!parse_count_request(job->query, &request)) {
+        sse_event(&out, "error", request.error_json, strlen(request.error_json));
+        finish_job(server, job, &out);
         return;
     }
-    
-    request[received] = '\0';
-    
-    // Parse request line
+
+    // Headers go out before the scan starts, so the client sees the stream open
+    post_output(server, job->conn, &out);
+
+    StreamContext stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.server = server;
+    stream.conn = job->conn;
+
+    CountOptions options;
+    init_count_options(&options);
+    options.on_progress = stream_progress;
+    options.progress_ctx = &stream;
+    options.progress_interval_ms = WEB_PROGRESS_INTERVAL_MS;
+
+    CachedCount counted;
+    if (run_count(&request, &options, server->cache, &counted)) {
+        HttpBuffer json = {NULL, 0, 0};
+        json_append_count(&json, &counted, request.path, request.profiled ? &request.profile : NULL);
+        sse_event(&out, "result", json.data, json.length);
+        http_buffer_free(&json);
+        free_count_breakdown(&counted.breakdown);
+    } else {
+        const char *error_json = "{\"error\":\"Path does not exist\"}";
+        sse_event(&out, "error", error_json, strlen(error_json));
+    }
+    finish_job(server, job, &out);
+    free_exclude_list(request.exclude_list);
+    scan_profile_free(&request.profile);
+}
+
+typedef struct {
+    WebServer *server;
+    CountJob *job;
+    Watcher *watcher;
+} WatchJob;
+
+// WatchCallback: one "update" event with the new totals and their change
+static void stream_watch_update(void *arg, const WatchUpdate *update) {
+    WatchJob *watch = arg;
+    const CountResult *totals = &update->totals;
+    HttpBuffer json = {NULL, 0, 0};
+    http_buffer_printf(&json,
+        "{"
+        "\"total_files\":%llu,"
+        "\"total_lines\":%llu,"
+        "\"code_lines\":%llu,"
+        "\"comment_lines\":%llu,"
+        "\"blank_lines\":%llu,"
+        "\"changed_files\":%llu,"
+        "\"delta\":{"
+        "\"total_files\":%lld,"
+        "\"total_lines\":%lld,"
+        "\"code_lines\":%lld,"
+        "\"comment_lines\":%lld,"
+        "\"blank_lines\":%lld}}",
+        totals->total_files,
+        totals->total_lines,
+        totals->code_lines,
+        totals->comment_lines,
+        totals->blank_lines,
+        update->changed_files,
+        update->delta.files,
+        update->delta.lines,
+        update->delta.code,
+        update->delta.comments,
+        update->delta.blank);
+
+    HttpBuffer event = {NULL, 0, 0};
+    sse_event(&event, "update", json.data, json.length);
+    http_buffer_free(&json);
+    post_output(watch->server, watch->job->conn, &event);
+}
+
+// /api/watch: one "result" event with the same JSON as /api/count, then an
+// "update" event whenever files change, until the client disconnects
+static void* watch_worker(void *arg) {
+    WatchJob *watch = arg;
+    WebServer *server = watch->server;
+    CountJob *job = watch->job;
+
+    HttpBuffer out = {NULL, 0, 0};
+    const char *header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    http_buffer_append(&out, header, strlen(header));
+
+    CountRequest request;
+    if (!parse_count_request(job->query, &request)) {
+        sse_event(&out, "error", request.error_json, strlen(request.error_json));
+        finish_job(server, job, &out);
+        free(job);
+        free(watch);
+        return NULL;
+    }
+
+    CountOptions options;
+    init_count_options(&options);
+    options.exclude_list = request.exclude_list;
+    CachedCount counted;
+    memset(&counted, 0, sizeof(counted));
+    options.breakdown = &counted.breakdown;
+    if (request.profiled) options.profile = &request.profile;
+
+    unsigned long long start = cl_monotonic_ns();
+    if (watcher_scan(watch->watcher, request.path, &options, &counted.result)) {
+        counted.processing_time = (cl_monotonic_ns() - start) / 1e9;
+        HttpBuffer json = {NULL, 0, 0};
+        json_append_count(&json, &counted, request.path, request.profiled ? &request.profile : NULL);
+        sse_event(&out, "result", json.data, json.length);
+        http_buffer_free(&json);
+        free_count_breakdown(&counted.breakdown);
+        post_output(server, job->conn, &out);
+
+        scan_profile_free(&request.profile);
+        watcher_run(watch->watcher, stream_watch_update, watch);
+    } else {
+        const char *error_json = "{\"error\":\"Path does not exist\"}";
+        sse_event(&out, "error", error_json, strlen(error_json));
+    }
+
+    // The loop destroys the watcher once this last output arrives
+    finish_job(server, job, &out);
+    free_exclude_list(request.exclude_list);
+    scan_profile_free(&request.profile);
+    free(job);
+    free(watch);
+    return NULL;
+}
+
+static void* count_worker(void *arg) {
+    WebServer *server = arg;
+    for (;;) {
+        cl_mutex_lock(&server->lock);
+        while (!server->job_head && !server->stopping) {
+            cl_cond_wait(&server->job_ready, &server->lock);
+        }
+        CountJob *job = server->job_head;
+        if (!job) {
+            cl_mutex_unlock(&server->lock);
+            break;
+        }
+        server->job_head = job->next;
+        if (!server->job_head) server->job_tail = NULL;
+        cl_mutex_unlock(&server->lock);
+
+        if (job->stream) {
+            run_count_stream(server, job);
+        } else {
+            HttpBuffer out = {NULL, 0, 0};
+            handle_api_count(&out, job->query, server->cache);
+            finish_job(server, job, &out);
+        }
+        free(job);
+    }
+    return NULL;
+}
+
+// Hand a count request to the worker pool; false if the pool is saturated
+static bool queue_count_job(WebServer *server, Connection *conn, const char *query, bool stream) {
+    size_t len = strlen(query);
+    CountJob *job = malloc(sizeof(CountJob) + len + 1);
+    Message *finish = malloc(sizeof(Message));
+    if (!job || !finish) {
+        free(job);
+        free(finish);
+        return false;
+    }
+    job->next = NULL;
+    job->conn = conn;
+    job->finish = finish;
+    job->stream = stream;
+    memcpy(job->query, query, len + 1);
+
+    cl_mutex_lock(&server->lock);
+    if (server->jobs_in_flight >= server->thread_count + server->options.queue_limit) {
+        cl_mutex_unlock(&server->lock);
+        free(finish);
+        free(job);
+        return false;
+    }
+    server->jobs_in_flight++;
+    if (server->job_tail) {
+        server->job_tail->next = job;
+    } else {
+        server->job_head = job;
+    }
+    server->job_tail = job;
+    cl_cond_signal(&server->job_ready);
+    cl_mutex_unlock(&server->lock);
+
+    conn->job_active = true;
+    return true;
+}
+
+// Start an /api/watch stream on its own thread; false if none can be started
+static bool start_watch(WebServer *server, Connection *conn, const char *query, HttpBuffer *error) {
+    if (server->watch_count >= WEB_MAX_WATCHES) return false;
+
+    const char *reason = NULL;
+    Watcher *watcher = watcher_create(&reason);
+    if (!watcher) {
+        HttpBuffer json = {NULL, 0, 0};
+        http_buffer_append(&json, "{\"error\":", 9);
+        json_append_string(&json, reason ? reason : "watch unavailable");
+        http_buffer_append(&json, "}", 1);
+        http_response_bytes(error, "501 Not Implemented", "application/json", NULL, json.data, json.length);
+        http_buffer_free(&json);
+        return true;
+    }
+
+    size_t len = strlen(query);
+    WatchJob *watch = malloc(sizeof(WatchJob));
+    CountJob *job = malloc(sizeof(CountJob) + len + 1);
+    Message *finish = malloc(sizeof(Message));
+    cl_thread_t thread;
+    if (watch && job && finish) {
+        job->next = NULL;
+        job->conn = conn;
+        job->finish = finish;
+        job->stream = true;
+        memcpy(job->query, query, len + 1);
+        watch->server = server;
+        watch->job = job;
+        watch->watcher = watcher;
+        conn->watcher = watcher;
+        conn->job_active = true;
+        if (cl_thread_create(&thread, watch_worker, watch) == 0) {
+            cl_thread_detach(thread);
+            server->watch_count++;
+            return true;
+        }
+        conn->watcher = NULL;
+        conn->job_active = false;
+    }
+    free(watch);
+    free(job);
+    free(finish);
+    watcher_destroy(watcher);
+    return false;
+}
+
+static int strncasecmp_ascii(const char *a, const char *b, size_t n) {
+    for (; n > 0; a++, b++, n--) {
+        int ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : (unsigned char)*a;
+        int cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : (unsigned char)*b;
+        if (ca != cb || ca == 0) return ca - cb;
+    }
+    return 0;
+}
+
+// Copy the value of request header `name` into `value`; false if it is absent
+static bool get_request_header(const char *request, const char *name, char *value, size_t value_size) {
+    size_t name_len = strlen(name);
+    const char *line = strchr(request, '\n');
+    while (line) {
+        line++;
+        if (*line == '\r' || *line == '\n' || *line == '\0') return false;    // End of the head
+        const char *end = strchr(line, '\n');
+        if (strncasecmp_ascii(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *start = line + name_len + 1;
+            while (*start == ' ' || *start == '\t') start++;
+            size_t len = end ? (size_t)(end - start) : strlen(start);
+            while (len > 0 && (start[len - 1] == '\r' || start[len - 1] == ' ' || start[len - 1] == '\t')) len--;
+            if (len >= value_size) len = value_size - 1;
+            memcpy(value, start, len);
+            value[len] = '\0';
+            return true;
+        }
+        line = end;
+    }
+    return false;
+}
+
+// Whether an If-None-Match list names `etag`; weak tags match too, as RFC 9110 asks
+static bool etag_matches(const char *list, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '*') return true;
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+        const char *end = p;
+        while (*end && *end != ',') end++;
+        size_t len = (size_t)(end - p);
+        while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t')) len--;
+        if (len == etag_len && memcmp(p, etag, len) == 0) return true;
+        p = end;
+    }
+    return false;
+}
+
+// Whether an Accept-Encoding list allows gzip: "gzip", "x-gzip" or "*", unless given q=0
+static bool accepts_gzip(const char *list) {
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        const char *end = p;
+        while (*end && *end != ',' && *end != ';' && *end != ' ' && *end != '\t') end++;
+        size_t len = (size_t)(end - p);
+        bool gzip = (len == 4 && strncasecmp_ascii(p, "gzip", 4) == 0) ||
+                    (len == 6 && strncasecmp_ascii(p, "x-gzip", 6) == 0) || (len == 1 && *p == '*');
+        const char *next = strchr(end, ',');
+        const char *q = strstr(end, "q=");
+        double quality = (q && (!next || q < next)) ? strtod(q + 2, NULL) : 1.0;
+        if (gzip && quality > 0) return true;
+        if (!next) return false;
+        p = next;
+    }
+    return false;
+}
+
+// Answer a static file from the asset cache: 304 when the client's copy is
+// current, otherwise the header into `out` and the cached body on the side
+static void asset_response(const AssetCache *assets, Connection *conn, const char *path) {
+    const Asset *asset = asset_cache_find(assets, path);
+    if (!asset) {
+        const char *error_body = "<html><body><h1>404 Not Found</h1></body></html>";
+        http_response(&conn->out, "404 Not Found", "text/html", error_body);
+        return;
+    }
+
+    char value[1024];
+    bool gzip = asset->gzip_data && get_request_header(conn->request, "Accept-Encoding", value, sizeof(value)) &&
+                accepts_gzip(value);
+    const char *etag = gzip ? asset->gzip_etag : asset->etag;
+    if (get_request_header(conn->request, "If-None-Match", value, sizeof(value)) && etag_matches(value, etag)) {
+        http_buffer_printf(&conn->out,
+            "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: %s\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n"
+            "\r\n", etag);
+        return;
+    }
+
+    conn->body = gzip ? asset->gzip_data : asset->data;
+    conn->body_length = gzip ? asset->gzip_size : asset->size;
+    conn->body_sent = 0;
+    http_buffer_printf(&conn->out,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %lu\r\n"
+        "%s"
+        "ETag: %s\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        asset->content_type, (unsigned long)conn->body_length, gzip ? "Content-Encoding: gzip\r\n" : "", etag);
+}
+
+static void busy_response(HttpBuffer *out) {
+    char retry[64];
+    snprintf(retry, sizeof(retry), "Retry-After: %d\r\n", WEB_RETRY_AFTER_SECONDS);
+    const char *error_json = "{\"error\":\"Server busy, retry later\"}";
+    http_response_bytes(out, "503 Service Unavailable", "application/json", retry, error_json, strlen(error_json));
+}
+
+static void free_connection(WebServer *server, Connection *conn) {
+    if (conn->prev) conn->prev->next = conn->next;
+    else server->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    server->connection_count--;
+    http_buffer_free(&conn->out);
+    free(conn);
+}
+
+// Close the socket; the connection itself lives on until its job has finished
+static void close_connection(WebServer *server, Connection *conn) {
+    if (!conn->closed) {
+        poller_remove(server->poller, conn->socket);
+        closesocket(conn->socket);
+        conn->closed = true;
+        if (conn->watcher) watcher_stop(conn->watcher);
+    }
+    if (!conn->job_active) free_connection(server, conn);
+}
+
+// Register interest in writability only while there is something to write.
+// Watch connections are also read, to notice the client leaving.
+static void update_interest(WebServer *server, Connection *conn) {
+    int events = 0;
+    if (conn->state == CONN_READING || conn->watcher) events = POLLER_IN;
+    bool pending = conn->out_sent < conn->out.length || conn->body_sent < conn->body_length;
+    if (conn->state != CONN_READING && pending) events |= POLLER_OUT;
+    poller_modify(server->poller, conn->socket, events, conn);
+}
+
+// Send what is left of `out` followed by what is left of the body in one
+// call, without copying either; returns the bytes sent or -1
+static long send_pending(Connection *conn) {
+    size_t lengths[2] = { conn->out.length - conn->out_sent, conn->body_length - conn->body_sent };
+    const char *data[2] = { conn->out.data + conn->out_sent, conn->body ? conn->body + conn->body_sent : NULL };
+    int count = 0;
+#ifdef _WIN32
+    WSABUF buffers[2];
+    for (int i = 0; i < 2; i++) {
+        if (lengths[i] == 0) continue;
+        buffers[count].buf = (char *)data[i];
+        buffers[count].len = lengths[i] > (1 << 30) ? (1 << 30) : (ULONG)lengths[i];
+        count++;
+    }
+    DWORD sent = 0;
+    if (WSASend(conn->socket, buffers, (DWORD)count, &sent, 0, NULL, NULL) == SOCKET_ERROR) return -1;
+    return (long)sent;
+#else
+    struct iovec buffers[2];
+    for (int i = 0; i < 2; i++) {
+        if (lengths[i] == 0) continue;
+        buffers[count].iov_base = (void *)data[i];
+        buffers[count].iov_len = lengths[i] > (1 << 30) ? (1 << 30) : lengths[i];
+        count++;
+    }
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = buffers;
+    message.msg_iovlen = count;
+    return (long)sendmsg(conn->socket, &message, MSG_NOSIGNAL);
+#endif
+}
+
+// Write as much of `out` and the body as the socket takes; closes the
+// connection once both are fully sent and no job will add more. Returns
+// false if it was closed.
+static bool flush_connection(WebServer *server, Connection *conn) {
+    while (conn->out_sent < conn->out.length || conn->body_sent < conn->body_length) {
+        long sent = send_pending(conn);
+        if (sent < 0) {
+            if (would_block()) break;
+            close_connection(server, conn);
+            return false;
+        }
+        size_t head = conn->out.length - conn->out_sent;
+        if ((size_t)sent <= head) {
+            conn->out_sent += (size_t)sent;
+        } else {
+            conn->out_sent = conn->out.length;
+            conn->body_sent += (size_t)sent - head;
+        }
+        conn->last_active = cl_monotonic_ns();
+    }
+
+    if (conn->out_sent == conn->out.length && conn->body_sent == conn->body_length) {
+        conn->out.length = 0;
+        conn->out_sent = 0;
+        conn->body = NULL;
+        conn->body_length = 0;
+        conn->body_sent = 0;
+        if (conn->state == CONN_WRITING && !conn->job_active) {
+            close_connection(server, conn);
+            return false;
+        }
+    }
+    update_interest(server, conn);
+    return true;
+}
+
+// Whether `path` is the endpoint `route` or lies below it: "/api/count"
+// matches "/api/count" and "/api/count/..." but not "/api/countX"
+static bool route_matches(const char *path, const char *route) {
+    size_t len = strlen(route);
+    return strncmp(path, route, len) == 0 && (path[len] == '\0' || path[len] == '/' || path[len] == '?');
+}
+
+static void dispatch_request(WebServer *server, Connection *conn) {
     char method[16], path[1024], version[16];
-    if (sscanf(request, "%15s %1023s %15s", method, path, version) != 3) {
+    conn->state = CONN_WRITING;
+
+    // Parse request line
+    if (sscanf(conn->request, "%15s %1023s %15s", method, path, version) != 3) {
         const char *error_body = "<html><body><h1>400 Bad Request</h1></body></html>";
-        send_http_response(client_socket, "400 Bad Request", "text/html", error_body);
-        closesocket(client_socket);
+        http_response(&conn->out, "400 Bad Request", "text/html", error_body);
         return;
     }
-    
+
     // Only handle GET requests
     if (strcmp(method, "GET") != 0) {
         const char *error_body = "<html><body><h1>405 Method Not Allowed</h1></body></html>";
-        send_http_response(client_socket, "405 Method Not Allowed", "text/html", error_body);
-        closesocket(client_socket);
+        http_response(&conn->out, "405 Method Not Allowed", "text/html", error_body);
         return;
     }
-    
+
     // Separate path and query string
     char *query_string = strchr(path, '?');
     if (query_string) {
         *query_string = '\0';
         query_string++;
     }
-    
+
     // Route request
-    if (strncmp(path, "/api/count", 10) == 0) {
-        handle_api_count(client_socket, query_string ? query_string : "");
-    } else if (strcmp(path, "/") == 0 || strcmp(path, "/index.html") == 0) {
-        char filepath[MAX_PATH_LEN];
-        snprintf(filepath, sizeof(filepath), "%s/index.html", WEB_DIR);
-        send_file_response(client_socket, filepath);
+    bool stream = strcmp(path, "/api/count/stream") == 0;
+    if (strcmp(path, "/api/watch") == 0) {
+        if (start_watch(server, conn, query_string ? query_string : "", &conn->out)) {
+            if (conn->out.length == 0) conn->state = CONN_WAITING;
+        } else {
+            busy_response(&conn->out);
+        }
+    } else if (stream || route_matches(path, "/api/count")) {
+        if (queue_count_job(server, conn, query_string ? query_string : "", stream)) {
+            conn->state = CONN_WAITING;
+        } else {
+            busy_response(&conn->out);
+        }
     } else {
-        char filepath[MAX_PATH_LEN];
-        snprintf(filepath, sizeof(filepath), "%s%s", WEB_DIR, path);
-        send_file_response(client_socket, filepath);
+        asset_response(server->assets, conn, strcmp(path, "/") == 0 ? "/index.html" : path);
     }
-    
-    closesocket(client_socket);
 }
 
-// Start web server
+// Read what has arrived; the request is handled once its head is complete
+static void read_request(WebServer *server, Connection *conn) {
+    size_t room = sizeof(conn->request) - 1 - conn->request_len;
+    int received = recv(conn->socket, conn->request + conn->request_len, (int)room, 0);
+    if (received < 0 && would_block()) return;
+    if (received <= 0) {
+        close_connection(server, conn);
+        return;
+    }
+
+    conn->request_len += (size_t)received;
+    conn->request[conn->request_len] = '\0';
+    conn->last_active = cl_monotonic_ns();
+
+    // Only GET is served, so the head is the whole request. An oversized
+    // head is cut off and handled as is, as the old single recv() did.
+    if (strstr(conn->request, "\r\n\r\n") || strstr(conn->request, "\n\n") ||
+        conn->request_len == sizeof(conn->request) - 1) {
+        dispatch_request(server, conn);
+        flush_connection(server, conn);
+    }
+}
+
+static void accept_connections(WebServer *server) {
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        SOCKET client_socket = accept(server->listen_socket, (struct sockaddr*)&client_addr, &client_len);
+        if (client_socket == INVALID_SOCKET) return;
+
+        if (!set_nonblocking(client_socket)) {
+            closesocket(client_socket);
+            continue;
+        }
+
+        Connection *conn = NULL;
+        if (server->connection_count < server->options.max_connections) {
+            conn = malloc(sizeof(Connection));
+        }
+        if (!conn) {
+            // Over the limit: a best-effort 503 fits in any fresh socket buffer
+            HttpBuffer busy = {NULL, 0, 0};
+            busy_response(&busy);
+            if (busy.data) send(client_socket, busy.data, (int)busy.length, MSG_NOSIGNAL);
+            http_buffer_free(&busy);
+            closesocket(client_socket);
+            continue;
+        }
+
+        memset(conn, 0, offsetof(Connection, request));
+        conn->socket = client_socket;
+        conn->state = CONN_READING;
+        conn->last_active = cl_monotonic_ns();
+        conn->request[0] = '\0';
+        if (!poller_add(server->poller, client_socket, POLLER_IN, conn)) {
+            closesocket(client_socket);
+            free(conn);
+            continue;
+        }
+
+        conn->next = server->connections;
+        if (server->connections) server->connections->prev = conn;
+        server->connections = conn;
+        server->connection_count++;
+    }
+}
+
+// A watch client sent something: data is ignored, end of stream closes it
+static void read_watch_client(WebServer *server, Connection *conn) {
+    char discard[256];
+    int received = recv(conn->socket, discard, sizeof(discard), 0);
+    if (received == 0 || (received < 0 && !would_block())) close_connection(server, conn);
+}
+
+// Move output posted by workers onto its connections
+static void deliver_messages(WebServer *server) {
+    cl_mutex_lock(&server->lock);
+    Message *message = server->mail_head;
+    server->mail_head = NULL;
+    server->mail_tail = NULL;
+    cl_mutex_unlock(&server->lock);
+
+    while (message) {
+        Message *next = message->next;
+        Connection *conn = message->conn;
+        if (message->last) {
+            conn->job_active = false;
+            if (conn->watcher) {
+                watcher_destroy(conn->watcher);
+                conn->watcher = NULL;
+                server->watch_count--;
+            }
+        }
+
+        if (conn->closed) {
+            if (message->last) free_connection(server, conn);
+        } else {
+            if (message->last) {
+                conn->state = CONN_WRITING;
+                conn->last_active = cl_monotonic_ns();
+            }
+            if (message->data.length > 0 &&
+                !http_buffer_append(&conn->out, message->data.data, message->data.length)) {
+                close_connection(server, conn);
+            } else {
+                flush_connection(server, conn);
+            }
+        }
+        http_buffer_free(&message->data);
+        free(message);
+        message = next;
+    }
+}
+
+// Drop connections that stalled while sending a request or reading a response
+static void expire_idle_connections(WebServer *server) {
+    unsigned long long now = cl_monotonic_ns();
+    unsigned long long limit = (unsigned long long)WEB_IDLE_TIMEOUT_MS * 1000000ULL;
+    Connection *conn = server->connections;
+    while (conn) {
+        Connection *next = conn->next;
+        if (!conn->closed && conn->state != CONN_WAITING && now - conn->last_active > limit) {
+            close_connection(server, conn);
+        }
+        conn = next;
+    }
+}
+
+static int run_event_loop(WebServer *server) {
+    PollEvent events[64];
+    for (;;) {
+        int timeout = WEB_POLL_INTERVAL_MS;
+#ifdef _WIN32
+        if (cl_atomic_load(&server->jobs_in_flight) > 0) timeout = 10;
+#endif
+        int count = poller_wait(server->poller, events, 64, timeout);
+        if (count < 0) {
+            fprintf(stderr, "Event loop failed\n");
+            return 1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            void *data = events[i].data;
+            if (data == &server->listen_socket) {
+                accept_connections(server);
+                continue;
+            }
+            if (data == server->cache) {
+                result_cache_process_events(server->cache);
+                continue;
+            }
+#ifndef _WIN32
+            if (data == server->wake_pipe) {
+                char drain[256];
+                while (read(server->wake_pipe[0], drain, sizeof(drain)) > 0) {}
+                continue;
+            }
+#endif
+            Connection *conn = data;
+            if (conn->state == CONN_READING && (events[i].events & (POLLER_IN | POLLER_ERR))) {
+                read_request(server, conn);
+            } else if (events[i].events & POLLER_OUT) {
+                flush_connection(server, conn);
+            } else if (conn->watcher && (events[i].events & (POLLER_IN | POLLER_ERR))) {
+                read_watch_client(server, conn);
+            } else if (events[i].events & POLLER_ERR) {
+                close_connection(server, conn);
+            }
+        }
+
+        deliver_messages(server);
+        expire_idle_connections(server);
+    }
+}
+
+static void stop_workers(WebServer *server) {
+    cl_mutex_lock(&server->lock);
+    server->stopping = true;
+    cl_cond_broadcast(&server->job_ready);
+    cl_mutex_unlock(&server->lock);
+    for (int i = 0; i < server->thread_count; i++) cl_thread_join(server->threads[i]);
+    free(server->threads);
+}
+
+static int serve(WebServer *server) {
+    server->poller = poller_create();
+    if (!server->poller || !poller_add(server->poller, server->listen_socket, POLLER_IN, &server->listen_socket)) {
+        fprintf(stderr, "Failed to create event loop\n");
+        poller_destroy(server->poller);
+        return 1;
+    }
+#ifndef _WIN32
+    if (pipe(server->wake_pipe) != 0 || !set_nonblocking(server->wake_pipe[0]) ||
+        !set_nonblocking(server->wake_pipe[1]) ||
+        !poller_add(server->poller, server->wake_pipe[0], POLLER_IN, server->wake_pipe)) {
+        fprintf(stderr, "Failed to create event loop\n");
+        poller_destroy(server->poller);
+        return 1;
+    }
+#endif
+
+    // Without inotify the cache still works, bounded by the TTL alone
+    if (server->options.cache_ttl > 0) {
+        server->cache = result_cache_create(server->options.cache_ttl);
+        int event_fd = result_cache_event_fd(server->cache);
+        if (event_fd >= 0) poller_add(server->poller, event_fd, POLLER_IN, server->cache);
+    }
+
+    cl_mutex_init(&server->lock);
+    cl_cond_init(&server->job_ready);
+    int workers = server->options.workers > 0 ? server->options.workers : cl_cpu_count();
+    server->threads = malloc(sizeof(cl_thread_t) * workers);
+    while (server->threads && server->thread_count < workers &&
+           cl_thread_create(&server->threads[server->thread_count], count_worker, server) == 0) {
+        server->thread_count++;
+    }
+
+    int status = 1;
+    if (server->thread_count > 0) {
+        status = run_event_loop(server);
+    } else {
+        fprintf(stderr, "Failed to start count workers\n");
+    }
+
+    stop_workers(server);
+    result_cache_destroy(server->cache);
+    cl_cond_destroy(&server->job_ready);
+    cl_mutex_destroy(&server->lock);
+#ifndef _WIN32
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+#endif
+    poller_destroy(server->poller);
+    return status;
+}
+
 int start_web_server(int port) {
+    WebServerOptions options;
+    init_web_server_options(&options);
+    options.port = port;
+    return start_web_server_with_options(&options);
+}
+
+// Start web server
+int start_web_server_with_options(const WebServerOptions *options) {
 #ifdef _WIN32
     WSADATA wsa_data;
     if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
         fprintf(stderr, "Failed to initialize Winsock\n");
         return 1;
     }
+#else
+    // A client that disconnects mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 #endif
-    
-    SOCKET server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == INVALID_SOCKET) {
+
+    WebServer server;
+    memset(&server, 0, sizeof(server));
+    server.options = *options;
+
+    server.listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server.listen_socket == INVALID_SOCKET) {
         fprintf(stderr, "Failed to create socket\n");
 #ifdef _WIN32
         WSACleanup();
 #endif
         return 1;
     }
-    
+
     // Set socket options to reuse address
     int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
-    
+    setsockopt(server.listen_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+
     struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
-    
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-        fprintf(stderr, "Failed to bind socket to port %d\n", port);
-        closesocket(server_socket);
+    server_addr.sin_port = htons(options->port);
+
+    if (bind(server.listen_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to bind socket to port %d\n", options->port);
+        closesocket(server.listen_socket);
 #ifdef _WIN32
         WSACleanup();
 #endif
         return 1;
     }
-    
-    if (listen(server_socket, 10) == SOCKET_ERROR) {
+
+    if (listen(server.listen_socket, options->backlog) == SOCKET_ERROR || !set_nonblocking(server.listen_socket)) {
         fprintf(stderr, "Failed to listen on socket\n");
-        closesocket(server_socket);
+        closesocket(server.listen_socket);
 #ifdef _WIN32
         WSACleanup();
 #endif
         return 1;
     }
-    
+
+    // Static files are read once; editing them takes a restart
+    AssetCache *assets = asset_cache_load(WEB_DIR);
+    server.assets = assets;
+
     printf("\n");
     printf("======================================\n");
     printf("  CountLines Web Server Started\n");
     printf("======================================\n");
-    printf("  Port: %d\n", port);
-    printf("  URL:  http://localhost:%d\n", port);
+    printf("  Port: %d\n", options->port);
+    printf("  URL:  http://localhost:%d\n", options->port);
+    printf("  Assets: %d files, %lu KB from %s/\n", assets ? assets->count : 0,
+           (unsigned long)((asset_cache_size(assets) + 1023) / 1024), WEB_DIR);
     printf("======================================\n");
     printf("Press Ctrl+C to stop the server\n\n");
-    
-    // Main server loop
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        SOCKET client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket == INVALID_SOCKET) {
-            continue;
-        }
-        
-        handle_http_request(client_socket);
-    }
-    
-    closesocket(server_socket);
+    fflush(stdout);
+
+    int status = serve(&server);
+    asset_cache_destroy(assets);
+
+    closesocket(server.listen_socket);
 #ifdef _WIN32
     WSACleanup();
 #endif
-    
-    return 0;
+
+    return status;
 }
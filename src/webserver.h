@@ -2,25 +2,59 @@
 #define WEBSERVER_H
 
 #include "countlines.h"
+#include "resultcache.h"
 
 #define WEB_PORT 8080
 #define WEB_DIR "web"
 #define MAX_REQUEST_SIZE 8192
-#define MAX_RESPONSE_SIZE 65536
 
-// Start the web server
-int start_web_server(int port);
+#define WEB_DEFAULT_BACKLOG 128
+#define WEB_DEFAULT_WORKERS 4       // Concurrent /api/count scans
+#define WEB_DEFAULT_QUEUE 16        // Scans waiting for a worker before requests get 503
+#define WEB_DEFAULT_MAX_CONNECTIONS 1024
+#define WEB_IDLE_TIMEOUT_MS 30000   // Connections that send nothing for this long are dropped
+#define WEB_RETRY_AFTER_SECONDS 2
+#define WEB_PROGRESS_INTERVAL_MS 250    // Between /api/count/stream progress events
+#define WEB_MAX_WATCHES 16          // Concurrent /api/watch streams, each on its own thread
+
+// Options for the web server
+typedef struct {
+    int port;
+    int backlog;            // listen() backlog
+    int workers;            // Threads running count jobs; <= 0 = one per CPU
+    int queue_limit;        // Count jobs allowed to wait for a busy worker
+    int max_connections;    // Open client connections; further clients get 503
+    int cache_ttl;          // Seconds /api/count results are reused; 0 = no result cache
+} WebServerOptions;
+
+// Growable byte buffer holding a response (headers and body) until it is sent
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} HttpBuffer;
 
-// HTTP request handler
-void handle_http_request(int client_socket);
+void init_web_server_options(WebServerOptions *options);
+
+// Start the web server; runs until the event loop fails
+int start_web_server(int port);
+int start_web_server_with_options(const WebServerOptions *options);
 
-// API endpoint handlers
-void handle_api_count(int client_socket, const char *query_string);
+// API endpoint handlers. They only build the response, so they may run on any
+// thread; /api/count runs on the count worker pool. `cache` may be NULL.
+// /api/count/stream is served by the worker pool directly, since it writes
+// its events to the connection while the scan runs.
+void handle_api_count(HttpBuffer *out, const char *query_string, ResultCache *cache);
 
 // Helper functions
-void send_http_response(int client_socket, const char *status, const char *content_type, const char *body);
-void send_file_response(int client_socket, const char *filepath);
+bool http_buffer_append(HttpBuffer *buffer, const void *data, size_t len);
+bool http_buffer_printf(HttpBuffer *buffer, const char *format, ...);
+void json_append_string(HttpBuffer *json, const char *value);
+void http_buffer_free(HttpBuffer *buffer);
+void http_response(HttpBuffer *out, const char *status, const char *content_type, const char *body);
+void http_response_bytes(HttpBuffer *out, const char *status, const char *content_type,
+                         const char *extra_headers, const void *body, size_t body_len);
 void url_decode(char *dst, const char *src);
-char* get_query_param(const char *query_string, const char *param);
+bool get_query_param(const char *query_string, const char *param, char *value, size_t value_size);
 
 #endif // WEBSERVER_H
@@ -0,0 +1,260 @@
+#include "workpool.h"
+#include <string.h>
+
+// Per-worker double-ended queue. The owner pushes and pops at the tail
+// (depth-first, cache friendly), thieves take from the head (oldest and
+// usually largest subtrees). Each deque has its own lock, so the only
+// contention is between an owner and a thief on the same deque.
+typedef struct {
+    cl_mutex_t lock;
+    WorkItem *items;
+    size_t head;
+    size_t capacity;
+    int size;
+    char pad[64];
+} WorkDeque;
+
+typedef struct {
+    WorkPool *pool;
+    int id;
+} WorkerArg;
+
+struct WorkPool {
+    int worker_count;
+    WorkDeque *deques;
+    WorkHandler handler;
+    WorkIdleHandler idle_handler;
+    void *user;
+
+    cl_mutex_t idle_lock;
+    cl_cond_t idle_cond;
+    int idle;
+    int done;
+};
+
+static bool deque_init(WorkDeque *dq) {
+    cl_mutex_init(&dq->lock);
+    dq->capacity = 64;
+    dq->head = 0;
+    dq->size = 0;
+    dq->items = malloc(sizeof(WorkItem) * dq->capacity);
+    return dq->items != NULL;
+}
+
+static bool deque_grow(WorkDeque *dq) {
+    size_t new_capacity = dq->capacity * 2;
+    WorkItem *items = malloc(sizeof(WorkItem) * new_capacity);
+    if (!items) return false;
+
+    // Unwrap the ring into the front of the new buffer
+    for (int i = 0; i < dq->size; i++) {
+        items[i] = dq->items[(dq->head + i) % dq->capacity];
+    }
+    free(dq->items);
+    dq->items = items;
+    dq->capacity = new_capacity;
+    dq->head = 0;
+    return true;
+}
+
+static bool deque_push_tail(WorkDeque *dq, WorkItem item) {
+    cl_mutex_lock(&dq->lock);
+    if ((size_t)dq->size == dq->capacity && !deque_grow(dq)) {
+        cl_mutex_unlock(&dq->lock);
+        return false;
+    }
+    dq->items[(dq->head + dq->size) % dq->capacity] = item;
+    cl_atomic_store(&dq->size, dq->size + 1);
+    cl_mutex_unlock(&dq->lock);
+    return true;
+}
+
+static bool deque_pop_tail(WorkDeque *dq, WorkItem *out) {
+    if (cl_atomic_load(&dq->size) == 0) return false;
+
+    cl_mutex_lock(&dq->lock);
+    bool found = dq->size > 0;
+    if (found) {
+        *out = dq->items[(dq->head + dq->size - 1) % dq->capacity];
+        cl_atomic_store(&dq->size, dq->size - 1);
+    }
+    cl_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static bool deque_steal_head(WorkDeque *dq, WorkItem *out) {
+    if (cl_atomic_load(&dq->size) == 0) return false;
+
+    cl_mutex_lock(&dq->lock);
+    bool found = dq->size > 0;
+    if (found) {
+        *out = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->capacity;
+        cl_atomic_store(&dq->size, dq->size - 1);
+    }
+    cl_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Create work pool
+WorkPool* workpool_create(int workers, WorkHandler handler, void *user) {
+    if (workers < 1 || !handler) return NULL;
+
+    WorkPool *pool = calloc(1, sizeof(WorkPool));
+    if (!pool) return NULL;
+
+    pool->deques = calloc(workers, sizeof(WorkDeque));
+    if (!pool->deques) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->worker_count = workers;
+    pool->handler = handler;
+    pool->user = user;
+    for (int i = 0; i < workers; i++) {
+        if (!deque_init(&pool->deques[i])) {
+            pool->worker_count = i + 1;
+            workpool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    cl_mutex_init(&pool->idle_lock);
+    cl_cond_init(&pool->idle_cond);
+    return pool;
+}
+
+// Free work pool memory
+void workpool_destroy(WorkPool *pool) {
+    if (!pool) return;
+
+    for (int i = 0; i < pool->worker_count; i++) {
+        free(pool->deques[i].items);
+        cl_mutex_destroy(&pool->deques[i].lock);
+    }
+    free(pool->deques);
+    cl_mutex_destroy(&pool->idle_lock);
+    cl_cond_destroy(&pool->idle_cond);
+    free(pool);
+}
+
+int workpool_worker_count(const WorkPool *pool) {
+    return pool ? pool->worker_count : 0;
+}
+
+void workpool_set_idle_handler(WorkPool *pool, WorkIdleHandler idle_handler) {
+    if (pool) pool->idle_handler = idle_handler;
+}
+
+// Push work item and wake a sleeping worker if there is one
+void workpool_push(WorkPool *pool, int worker_id, WorkItem item) {
+    if (!deque_push_tail(&pool->deques[worker_id], item)) {
+        // Out of memory for the deque: run the item inline rather than drop it
+        pool->handler(pool, worker_id, item, pool->user);
+        return;
+    }
+
+    // Pairs with the idle++ / re-scan in find_work (both sides are seq_cst)
+    if (cl_atomic_load(&pool->idle) > 0) {
+        cl_mutex_lock(&pool->idle_lock);
+        cl_cond_signal(&pool->idle_cond);
+        cl_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+static bool try_get_work(WorkPool *pool, int id, WorkItem *out) {
+    if (deque_pop_tail(&pool->deques[id], out)) return true;
+
+    for (int i = 1; i < pool->worker_count; i++) {
+        int victim = (id + i) % pool->worker_count;
+        if (deque_steal_head(&pool->deques[victim], out)) return true;
+    }
+    return false;
+}
+
+static bool any_work_queued(WorkPool *pool) {
+    for (int i = 0; i < pool->worker_count; i++) {
+        if (cl_atomic_load(&pool->deques[i].size) > 0) return true;
+    }
+    return false;
+}
+
+// Block until an item is available; returns false once the whole pool is drained
+static bool find_work(WorkPool *pool, int id, WorkItem *out) {
+    for (;;) {
+        if (try_get_work(pool, id, out)) return true;
+
+        // Deferred work must be finished before this worker counts as idle
+        if (pool->idle_handler && pool->idle_handler(pool, id, pool->user)) continue;
+
+        cl_mutex_lock(&pool->idle_lock);
+        cl_atomic_add(&pool->idle, 1);
+        for (;;) {
+            if (pool->done) {
+                cl_mutex_unlock(&pool->idle_lock);
+                return false;
+            }
+            if (any_work_queued(pool)) break;
+            if (cl_atomic_load(&pool->idle) == pool->worker_count) {
+                // Nobody is running a handler, so nobody can push more work
+                pool->done = 1;
+                cl_cond_broadcast(&pool->idle_cond);
+                cl_mutex_unlock(&pool->idle_lock);
+                return false;
+            }
+            cl_cond_timedwait_ms(&pool->idle_cond, &pool->idle_lock, 50);
+        }
+        cl_atomic_add(&pool->idle, -1);
+        cl_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+static void worker_loop(WorkPool *pool, int id) {
+    WorkItem item;
+    while (find_work(pool, id, &item)) {
+        pool->handler(pool, id, item, pool->user);
+    }
+}
+
+static void *worker_thread(void *arg) {
+    WorkerArg *worker = arg;
+    worker_loop(worker->pool, worker->id);
+    return NULL;
+}
+
+// Run all queued work to completion on worker_count threads
+void workpool_run(WorkPool *pool) {
+    if (!pool) return;
+
+    pool->idle = 0;
+    pool->done = 0;
+
+    int extra = pool->worker_count - 1;
+    cl_thread_t *threads = NULL;
+    WorkerArg *args = NULL;
+    int started = 0;
+
+    if (extra > 0) {
+        threads = malloc(sizeof(cl_thread_t) * extra);
+        args = malloc(sizeof(WorkerArg) * extra);
+        if (threads && args) {
+            for (int i = 0; i < extra; i++) {
+                args[i].pool = pool;
+                args[i].id = i + 1;
+                if (cl_thread_create(&threads[i], worker_thread, &args[i]) != 0) break;
+                started++;
+            }
+        }
+        // Workers that failed to start are simply counted as idle forever
+        cl_atomic_add(&pool->idle, extra - started);
+    }
+
+    worker_loop(pool, 0);
+
+    for (int i = 0; i < started; i++) {
+        cl_thread_join(threads[i]);
+    }
+    free(threads);
+    free(args);
+}
@@ -0,0 +1,39 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+#include "threading.h"
+
+// A unit of work: the handler decides what `kind` means and owns `data`
+typedef struct {
+    int kind;
+    void *data;
+} WorkItem;
+
+typedef struct WorkPool WorkPool;
+
+// Called once per item on whichever worker popped or stole it.
+// Handlers may push follow-up items onto their own worker's deque.
+typedef void (*WorkHandler)(WorkPool *pool, int worker_id, WorkItem item, void *user);
+
+// Called when a worker finds no queued item, before it steals or sleeps.
+// Lets handlers that defer work (asynchronous I/O) finish it; return true if
+// anything was done, so the worker scans for new items again.
+typedef bool (*WorkIdleHandler)(WorkPool *pool, int worker_id, void *user);
+
+// Create a pool with `workers` workers (the calling thread of workpool_run is worker 0)
+WorkPool* workpool_create(int workers, WorkHandler handler, void *user);
+void workpool_destroy(WorkPool *pool);
+
+int workpool_worker_count(const WorkPool *pool);
+
+void workpool_set_idle_handler(WorkPool *pool, WorkIdleHandler idle_handler);
+
+// Push an item onto a worker's deque. Before workpool_run any worker id may be used;
+// from inside a handler, pass the handler's own worker_id.
+void workpool_push(WorkPool *pool, int worker_id, WorkItem item);
+
+// Run until every deque is empty and every worker is idle
+void workpool_run(WorkPool *pool);
+
+#endif // WORKPOOL_H
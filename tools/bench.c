@@ -0,0 +1,1623 @@
+/*
+ * countlines_bench - reproducible benchmarks for the counting pipeline.
+ *
+ * Generates a deterministic synthetic source tree (depth, fan-out, file size
+ * distribution, language mix and comment density are configurable; the same
+ * seed always yields the same bytes), then times each stage on its own and
+ * the whole scan end to end:
+ *
+ *   traversal         directory walk and exclude matching, no file is read
+ *   is_text_file      language lookup by file name
+ *   is_excluded       one path against the exclude list's own matcher
+ *   exclude_matcher   the same paths against a matcher compiled by the bench
+ *   count_lines_in_file   every counted file on its own, one thread
+ *   end_to_end        count_lines_with_options over the whole tree
+ *
+ * Every benchmark runs once to warm the page cache, then --repeat times.
+ * Throughput uses the median run; latency percentiles are per run for the
+ * tree walks, per file for count_lines_in_file and per call (averaged over
+ * batches of BATCH_SIZE calls) for the name and path lookups. The generator
+ * also knows how many lines of each kind it wrote, so every run that counts
+ * is checked against it.
+ *
+ * Results go to stdout as a table, and with --json / --csv as
+ * machine-readable files meant to be diffed between versions.
+ *
+ * --check runs correctness fixtures instead: small trees and inputs built
+ * to hit the edge cases a generated tree never does (a symlink loop, git
+ * indexes and tar archives that are valid, truncated or malformed), each
+ * counted or parsed and compared with what it must give.
+ *
+ * Usage: countlines_bench [options]   (--help lists them)
+ */
+
+#include "countlines.h"
+#include "threading.h"
+#include "tar.h"
+#include <math.h>
+#include <errno.h>
+#include <stdarg.h>
+#ifdef _WIN32
+    #include <direct.h>
+    #include <process.h>
+    #include <sys/stat.h>
+#endif
+
+#ifndef COUNTLINES_VERSION
+#define COUNTLINES_VERSION "unknown"
+#endif
+
+#define STAMP_FILE_NAME ".countlines-bench"
+#define STAMP_FORMAT 1
+#define BATCH_SIZE 64
+#define MAX_MIX (LANG_COUNT + 1)    // Every language once, plus "other"
+#define MAX_MARKER_LEN 16
+#define MAX_SIZE_FACTOR 64      // Log-normal sizes are capped at this many times the mean
+
+#define DEFAULT_MIX "c:4,c_header:2,cpp:2,python:3,javascript:2,java:2,go:1,rust:1,html:1,shell:1,other:1"
+
+// The CLI's default exclusions; the lookups add patterns that hit the tree
+static const char *default_excludes[] = {
+    ".git", ".svn", ".hg", "node_modules", "__pycache__", ".vs", ".vscode"
+};
+static const char *lookup_excludes[] = {
+    "*.min.js", "dir1/dir2", "**/dir3/*.dat", "build/"
+};
+
+// First extension and comment markers of every language, from the same
+// descriptors the lexer tables are generated from
+typedef struct {
+    const char *extensions;
+    const char *line_comments;
+    const char *block_comments;
+} Syntax;
+
+static const Syntax syntaxes[LANG_COUNT] = {
+    { "", "", "" },
+#define LANGUAGE(id, name, extensions, line_comments, block_comments, strings) { extensions, line_comments, block_comments },
+#include "languages.def"
+#undef LANGUAGE
+};
+
+typedef enum {
+    SIZE_FIXED,
+    SIZE_UNIFORM,       // 0 .. 2 * mean
+    SIZE_LOGNORMAL      // sigma 1, capped at MAX_SIZE_FACTOR * mean
+} SizeDistribution;
+
+static const char *size_distribution_names[] = { "fixed", "uniform", "lognormal" };
+
+// One language of the mix; LANG_UNKNOWN stands for files that are not counted
+typedef struct {
+    LanguageId language;
+    unsigned weight;
+    char extension[MAX_EXTENSION_LEN];
+    char line_comment[MAX_MARKER_LEN];
+    char block_open[MAX_MARKER_LEN];
+    char block_close[MAX_MARKER_LEN];
+} MixEntry;
+
+typedef struct {
+    int depth;
+    int fanout;
+    int files_per_dir;
+    SizeDistribution size_distribution;
+    unsigned long mean_size;
+    double comment_density;
+    double blank_density;
+    unsigned long long seed;
+    const char *mix_spec;
+    MixEntry mix[MAX_MIX];
+    int mix_count;
+    unsigned total_weight;
+} TreeSpec;
+
+typedef struct {
+    char *path;                 // Full path
+    size_t relative_offset;     // path + relative_offset is relative to the root
+    size_t name_offset;         // path + name_offset is the file name
+    LanguageId language;
+    unsigned long long bytes;
+} TreeFile;
+
+typedef struct {
+    char *root;
+    TreeFile *files;
+    size_t file_count;
+    size_t file_capacity;
+    char **directories;         // In creation order, parents first
+    size_t directory_count;
+    size_t directory_capacity;
+    unsigned long long bytes;
+    unsigned long long text_files;
+    unsigned long long text_bytes;
+    CountResult expected;       // What counting every text file must report
+} Tree;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+typedef struct {
+    unsigned long long state;
+} Rng;
+
+typedef struct {
+    double *values;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+typedef struct {
+    const char *name;
+    int iterations;
+    unsigned long long items;       // Per iteration
+    unsigned long long bytes;       // Per iteration, 0 if nothing is read
+    double seconds;                 // Median iteration
+    const char *latency_of;         // "run", "file" or "call"
+    double p50, p90, p99, max;      // Nanoseconds
+    bool counts_checked;
+    bool counts_match;
+} BenchResult;
+
+typedef struct {
+    int repeat;
+    int jobs;
+    IoMode io_mode;
+    const char *only;
+    ExcludeList *walk_excludes;     // Exclude nothing generated, so walks can be checked
+    ExcludeList *lookup_excludes;   // Also match part of the tree
+    BenchResult results[8];
+    int result_count;
+    bool all_match;
+} BenchRun;
+
+// splitmix64: tiny, and stable across platforms and compilers
+static unsigned long long rng_next(Rng *rng) {
+    unsigned long long z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static unsigned rng_below(Rng *rng, unsigned bound) {
+    return (unsigned)(rng_next(rng) % bound);
+}
+
+// Uniform in [0, 1)
+static double rng_unit(Rng *rng) {
+    return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool buffer_reserve(Buffer *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) return true;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    char *grown = realloc(buffer->data, capacity);
+    if (!grown) return false;
+    buffer->data = grown;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_printf(Buffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0 || !buffer_reserve(buffer, (size_t)needed + 1)) return false;
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, (size_t)needed + 1, format, args);
+    va_end(args);
+    buffer->length += (size_t)needed;
+    return true;
+}
+
+// Copy the first entry of a space separated descriptor list, decoding \s
+// and dropping the line-start flag '^'
+static void first_marker(const char *list, char *out, size_t out_size) {
+    size_t n = 0;
+    if (*list == '^') list++;
+    while (*list && *list != ' ' && n + 1 < out_size) {
+        if (list[0] == '\\' && list[1] == 's') {
+            out[n++] = ' ';
+            list += 2;
+        } else {
+            out[n++] = *list++;
+        }
+    }
+    out[n] = '\0';
+}
+
+// Second entry of a list ("/* */" -> "*/")
+static void second_marker(const char *list, char *out, size_t out_size) {
+    const char *space = strchr(list, ' ');
+    first_marker(space ? space + 1 : "", out, out_size);
+}
+
+// Parse "c:4,python:2,other:1" (weights default to 1)
+static bool parse_mix(const char *spec, TreeSpec *tree) {
+    tree->mix_count = 0;
+    tree->total_weight = 0;
+    const char *p = spec;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        char item[64];
+        if (len == 0 || len >= sizeof(item) || tree->mix_count == MAX_MIX) return false;
+        memcpy(item, p, len);
+        item[len] = '\0';
+
+        unsigned weight = 1;
+        char *colon = strchr(item, ':');
+        if (colon) {
+            *colon = '\0';
+            char *weight_end = NULL;
+            long parsed = strtol(colon + 1, &weight_end, 10);
+            if (*weight_end != '\0' || parsed < 0 || parsed > 1000000) return false;
+            weight = (unsigned)parsed;
+        }
+
+        MixEntry *entry = &tree->mix[tree->mix_count];
+        memset(entry, 0, sizeof(MixEntry));
+        entry->weight = weight;
+        if (strcmp(item, "other") == 0) {
+            entry->language = LANG_UNKNOWN;
+            strcpy(entry->extension, ".dat");
+        } else {
+            entry->language = language_from_name(item);
+            if (entry->language == LANG_UNKNOWN) {
+                fprintf(stderr, "Error: Unknown language '%s' in --languages\n", item);
+                return false;
+            }
+            const Syntax *syntax = &syntaxes[entry->language];
+            first_marker(syntax->extensions, entry->extension, sizeof(entry->extension));
+            first_marker(syntax->line_comments, entry->line_comment, sizeof(entry->line_comment));
+            first_marker(syntax->block_comments, entry->block_open, sizeof(entry->block_open));
+            second_marker(syntax->block_comments, entry->block_close, sizeof(entry->block_close));
+        }
+        tree->total_weight += weight;
+        tree->mix_count++;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return tree->total_weight > 0;
+}
+
+static const MixEntry* pick_language(const TreeSpec *spec, Rng *rng) {
+    unsigned pick = rng_below(rng, spec->total_weight);
+    for (int i = 0; i < spec->mix_count; i++) {
+        if (pick < spec->mix[i].weight) return &spec->mix[i];
+        pick -= spec->mix[i].weight;
+    }
+    return &spec->mix[spec->mix_count - 1];
+}
+
+static unsigned long long pick_size(const TreeSpec *spec, Rng *rng) {
+    double mean = (double)spec->mean_size;
+    switch (spec->size_distribution) {
+        case SIZE_FIXED:
+            return spec->mean_size;
+        case SIZE_UNIFORM:
+            return (unsigned long long)(rng_unit(rng) * 2.0 * mean);
+        case SIZE_LOGNORMAL:
+        default: {
+            // Box-Muller; mu is chosen so the mean before capping is `mean`
+            double u1 = 1.0 - rng_unit(rng);
+            double u2 = rng_unit(rng);
+            double normal = sqrt(-2.0 * log(u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+            double size = exp(log(mean > 1.0 ? mean : 1.0) - 0.5 + normal);
+            if (size > mean * MAX_SIZE_FACTOR) size = mean * MAX_SIZE_FACTOR;
+            return (unsigned long long)size;
+        }
+    }
+}
+
+static const char *words[] = {
+    "alpha", "buffer", "count", "delta", "entry", "field", "group", "handle",
+    "index", "join", "kernel", "length", "merge", "node", "offset", "parse"
+};
+
+static void append_indent(Buffer *out, Rng *rng) {
+    unsigned levels = rng_below(rng, 4);
+    for (unsigned i = 0; i < levels; i++) buffer_printf(out, "    ");
+}
+
+// Comment text: letters and spaces only, so no language sees a marker in it
+static void append_words(Buffer *out, Rng *rng) {
+    unsigned count = 2 + rng_below(rng, 8);
+    for (unsigned i = 0; i < count; i++) {
+        buffer_printf(out, " %s", words[rng_below(rng, sizeof(words) / sizeof(words[0]))]);
+    }
+}
+
+// Code: identifiers, digits, '=' and '+', which open no comment or string in
+// any supported language
+static void append_code(Buffer *out, Rng *rng) {
+    append_indent(out, rng);
+    buffer_printf(out, "v%u = v%u", rng_below(rng, 1000), rng_below(rng, 1000));
+    unsigned terms = rng_below(rng, 7);
+    for (unsigned i = 0; i < terms; i++) buffer_printf(out, " + %u", rng_below(rng, 100000));
+    buffer_printf(out, "\n");
+}
+
+// Append lines until the file reaches `size` bytes, tallying what they are
+static void generate_source(const TreeSpec *spec, const MixEntry *entry, unsigned long long size,
+                            Rng *rng, Buffer *out, CountResult *counts) {
+    bool has_line = entry->line_comment[0] != '\0';
+    bool has_block = entry->block_open[0] != '\0' && entry->block_close[0] != '\0';
+    while (out->length < size) {
+        double kind = rng_unit(rng);
+        if (kind < spec->blank_density) {
+            if (rng_below(rng, 4) == 0) append_indent(out, rng);
+            buffer_printf(out, "\n");
+            counts->blank_lines++;
+            counts->total_lines++;
+        } else if (kind < spec->blank_density + spec->comment_density && (has_line || has_block)) {
+            unsigned style = rng_below(rng, 4);
+            append_indent(out, rng);
+            if (has_line && (!has_block || style != 0)) {
+                buffer_printf(out, "%s", entry->line_comment);
+                append_words(out, rng);
+                buffer_printf(out, "\n");
+                counts->comment_lines++;
+                counts->total_lines++;
+            } else if (style < 2 || !has_line) {
+                buffer_printf(out, "%s", entry->block_open);
+                append_words(out, rng);
+                buffer_printf(out, " %s\n", entry->block_close);
+                counts->comment_lines++;
+                counts->total_lines++;
+            } else {
+                unsigned inner = 1 + rng_below(rng, 4);
+                buffer_printf(out, "%s\n", entry->block_open);
+                for (unsigned i = 0; i < inner; i++) {
+                    append_words(out, rng);
+                    buffer_printf(out, "\n");
+                }
+                buffer_printf(out, "%s\n", entry->block_close);
+                counts->comment_lines += inner + 2;
+                counts->total_lines += inner + 2;
+            }
+        } else {
+            append_code(out, rng);
+            counts->code_lines++;
+            counts->total_lines++;
+        }
+    }
+}
+
+static void generate_binary(unsigned long long size, Rng *rng, Buffer *out) {
+    if (!buffer_reserve(out, (size_t)size)) return;
+    for (unsigned long long i = 0; i < size; i++) out->data[out->length++] = (char)rng_next(rng);
+}
+
+static bool make_directory(const char *path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+static bool path_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static bool write_file(const char *path, const void *data, size_t len) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(data, 1, len, file) == len;
+    return fclose(file) == 0 && ok;
+}
+
+static char* join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    char *path = malloc(dir_len + 1 + name_len + 1);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_len);
+    path[dir_len] = PATH_SEPARATOR;
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+static bool tree_add_directory(Tree *tree, char *path) {
+    if (tree->directory_count == tree->directory_capacity) {
+        size_t capacity = tree->directory_capacity ? tree->directory_capacity * 2 : 64;
+        char **grown = realloc(tree->directories, capacity * sizeof(char*));
+        if (!grown) return false;
+        tree->directories = grown;
+        tree->directory_capacity = capacity;
+    }
+    tree->directories[tree->directory_count++] = path;
+    return true;
+}
+
+static TreeFile* tree_add_file(Tree *tree) {
+    if (tree->file_count == tree->file_capacity) {
+        size_t capacity = tree->file_capacity ? tree->file_capacity * 2 : 256;
+        TreeFile *grown = realloc(tree->files, capacity * sizeof(TreeFile));
+        if (!grown) return NULL;
+        tree->files = grown;
+        tree->file_capacity = capacity;
+    }
+    return &tree->files[tree->file_count++];
+}
+
+// Lay out (and, when `write` is set, create) one directory and everything
+// below it. The random stream is consumed the same way either way, so an
+// existing tree can be listed without touching it.
+static bool generate_directory(const TreeSpec *spec, Tree *tree, Rng *rng, Buffer *content,
+                               const char *path, int level, bool write) {
+    if (write && !make_directory(path)) {
+        fprintf(stderr, "Error: Cannot create directory '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    if (level > 0) {
+        char *copy = malloc(strlen(path) + 1);
+        if (!copy) return false;
+        strcpy(copy, path);
+        if (!tree_add_directory(tree, copy)) {
+            free(copy);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < spec->files_per_dir; i++) {
+        const MixEntry *entry = pick_language(spec, rng);
+        unsigned long long size = pick_size(spec, rng);
+        char name[64];
+        snprintf(name, sizeof(name), "file%d%s", i, entry->extension);
+
+        TreeFile *file = tree_add_file(tree);
+        if (!file || !(file->path = join_path(path, name))) return false;
+        file->relative_offset = strlen(tree->root) + 1;
+        file->name_offset = strlen(path) + 1;
+        file->language = entry->language;
+
+        content->length = 0;
+        CountResult counts = {0, 0, 0, 0, 0};
+        if (entry->language == LANG_UNKNOWN) {
+            generate_binary(size, rng, content);
+        } else {
+            generate_source(spec, entry, size, rng, content, &counts);
+            counts.total_files = 1;
+            tree->text_files++;
+            tree->text_bytes += content->length;
+            tree->expected.total_files++;
+            tree->expected.total_lines += counts.total_lines;
+            tree->expected.blank_lines += counts.blank_lines;
+            tree->expected.comment_lines += counts.comment_lines;
+            tree->expected.code_lines += counts.code_lines;
+        }
+        file->bytes = content->length;
+        tree->bytes += content->length;
+
+        if (write && !write_file(file->path, content->data, content->length)) {
+            fprintf(stderr, "Error: Cannot write '%s': %s\n", file->path, strerror(errno));
+            return false;
+        }
+    }
+
+    if (level == spec->depth) return true;
+    for (int i = 0; i < spec->fanout; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "dir%d", i);
+        char *child = join_path(path, name);
+        if (!child) return false;
+        bool ok = generate_directory(spec, tree, rng, content, child, level + 1, write);
+        free(child);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+static void format_stamp(const TreeSpec *spec, char *out, size_t out_size) {
+    snprintf(out, out_size,
+             "countlines-bench %d\ndepth=%d fanout=%d files=%d sizes=%s:%lu comments=%.3f blank=%.3f seed=%llu\nlanguages=%s\n",
+             STAMP_FORMAT, spec->depth, spec->fanout, spec->files_per_dir,
+             size_distribution_names[spec->size_distribution], spec->mean_size,
+             spec->comment_density, spec->blank_density, spec->seed, spec->mix_spec);
+}
+
+static bool read_stamp(const char *path, char *out, size_t out_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    size_t len = fread(out, 1, out_size - 1, file);
+    fclose(file);
+    out[len] = '\0';
+    return true;
+}
+
+// Generate the tree at `root`, or list it without writing if a tree with the
+// same parameters is already there
+static bool build_tree(const TreeSpec *spec, const char *root, Tree *tree, bool *reused) {
+    memset(tree, 0, sizeof(Tree));
+    tree->root = malloc(strlen(root) + 1);
+    if (!tree->root) return false;
+    strcpy(tree->root, root);
+
+    char stamp[1024], existing[1024];
+    format_stamp(spec, stamp, sizeof(stamp));
+    char *stamp_path = join_path(root, STAMP_FILE_NAME);
+    if (!stamp_path) return false;
+
+    *reused = false;
+    if (path_exists(root)) {
+        if (!read_stamp(stamp_path, existing, sizeof(existing))) {
+            fprintf(stderr, "Error: '%s' exists and is not a benchmark tree\n", root);
+            free(stamp_path);
+            return false;
+        }
+        if (strcmp(stamp, existing) != 0) {
+            fprintf(stderr, "Error: '%s' holds a tree generated with other parameters; "
+                            "remove it or choose another --tree\n", root);
+            free(stamp_path);
+            return false;
+        }
+        *reused = true;
+    }
+
+    Rng rng = { spec->seed };
+    Buffer content = { NULL, 0, 0 };
+    bool ok = generate_directory(spec, tree, &rng, &content, root, 0, !*reused);
+    free(content.data);
+    // The stamp goes last, so an interrupted run leaves no reusable tree
+    if (ok && !*reused && !write_file(stamp_path, stamp, strlen(stamp))) {
+        fprintf(stderr, "Error: Cannot write '%s': %s\n", stamp_path, strerror(errno));
+        ok = false;
+    }
+    free(stamp_path);
+    return ok;
+}
+
+// Delete a generated tree: its files, its directories deepest first, the root
+static void remove_tree(const Tree *tree) {
+    if (!tree->root) return;
+    for (size_t i = 0; i < tree->file_count; i++) remove(tree->files[i].path);
+    char *stamp_path = join_path(tree->root, STAMP_FILE_NAME);
+    if (stamp_path) remove(stamp_path);
+    free(stamp_path);
+    for (size_t i = tree->directory_count; i > 0; i--) {
+#ifdef _WIN32
+        _rmdir(tree->directories[i - 1]);
+#else
+        rmdir(tree->directories[i - 1]);
+#endif
+    }
+#ifdef _WIN32
+    _rmdir(tree->root);
+#else
+    rmdir(tree->root);
+#endif
+}
+
+static void free_tree(Tree *tree) {
+    for (size_t i = 0; i < tree->file_count; i++) free(tree->files[i].path);
+    for (size_t i = 0; i < tree->directory_count; i++) free(tree->directories[i]);
+    free(tree->files);
+    free(tree->directories);
+    free(tree->root);
+}
+
+static bool samples_add(Samples *samples, double value) {
+    if (samples->count == samples->capacity) {
+        size_t capacity = samples->capacity ? samples->capacity * 2 : 64;
+        double *grown = realloc(samples->values, capacity * sizeof(double));
+        if (!grown) return false;
+        samples->values = grown;
+        samples->capacity = capacity;
+    }
+    samples->values[samples->count++] = value;
+    return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const Samples *sorted, double p) {
+    if (sorted->count == 0) return 0.0;
+    size_t rank = (size_t)ceil(p / 100.0 * sorted->count);
+    if (rank == 0) rank = 1;
+    return sorted->values[rank - 1];
+}
+
+static bool wanted(const BenchRun *run, const char *name) {
+    if (!run->only) return true;
+    size_t len = strlen(name);
+    for (const char *p = run->only; (p = strstr(p, name)) != NULL; p += len) {
+        bool starts = p == run->only || p[-1] == ',';
+        bool ends = p[len] == '\0' || p[len] == ',';
+        if (starts && ends) return true;
+    }
+    return false;
+}
+
+// Record a benchmark from its per-iteration times and latency samples
+static void finish_result(BenchRun *run, const char *name, const char *latency_of,
+                          unsigned long long items, unsigned long long bytes,
+                          Samples *iterations, Samples *latency) {
+    BenchResult *result = &run->results[run->result_count++];
+    memset(result, 0, sizeof(BenchResult));
+    result->name = name;
+    result->latency_of = latency_of;
+    result->iterations = (int)iterations->count;
+    result->items = items;
+    result->bytes = bytes;
+
+    qsort(iterations->values, iterations->count, sizeof(double), compare_doubles);
+    result->seconds = percentile(iterations, 50) / 1e9;
+    qsort(latency->values, latency->count, sizeof(double), compare_doubles);
+    result->p50 = percentile(latency, 50);
+    result->p90 = percentile(latency, 90);
+    result->p99 = percentile(latency, 99);
+    result->max = latency->count ? latency->values[latency->count - 1] : 0.0;
+}
+
+static bool same_counts(const CountResult *a, const CountResult *b) {
+    return a->total_files == b->total_files && a->total_lines == b->total_lines &&
+           a->blank_lines == b->blank_lines && a->comment_lines == b->comment_lines &&
+           a->code_lines == b->code_lines;
+}
+
+static void check_counts(BenchRun *run, const char *name, const CountResult *expected, const CountResult *counted) {
+    BenchResult *result = &run->results[run->result_count - 1];
+    result->counts_checked = true;
+    result->counts_match = same_counts(expected, counted);
+    if (result->counts_match) return;
+    run->all_match = false;
+    fprintf(stderr, "Warning: %s counted %llu files, %llu lines (%llu code, %llu comments, %llu blank); "
+                    "the generator wrote %llu files, %llu lines (%llu code, %llu comments, %llu blank)\n",
+            name, counted->total_files, counted->total_lines, counted->code_lines,
+            counted->comment_lines, counted->blank_lines,
+            expected->total_files, expected->total_lines, expected->code_lines,
+            expected->comment_lines, expected->blank_lines);
+}
+
+// Whole-tree walks: traversal (list_only) and end_to_end
+static void bench_walk(BenchRun *run, const Tree *tree, const char *name, bool list_only) {
+    CountOptions options;
+    init_count_options(&options);
+    options.exclude_list = run->walk_excludes;
+    options.jobs = run->jobs;
+    options.io_mode = run->io_mode;
+    options.list_only = list_only;
+
+    Samples iterations = { NULL, 0, 0 };
+    CountResult counted;
+    for (int i = 0; i <= run->repeat; i++) {
+        memset(&counted, 0, sizeof(counted));
+        unsigned long long start = cl_monotonic_ns();
+        count_lines_with_options(tree->root, &options, &counted);
+        unsigned long long elapsed = cl_monotonic_ns() - start;
+        if (i > 0) samples_add(&iterations, (double)elapsed);
+    }
+    finish_result(run, name, "run", tree->text_files, list_only ? 0 : tree->text_bytes, &iterations, &iterations);
+    free(iterations.values);
+
+    CountResult expected = tree->expected;
+    if (list_only) {
+        memset(&expected, 0, sizeof(expected));
+        expected.total_files = tree->text_files;
+    }
+    check_counts(run, name, &expected, &counted);
+}
+
+static void bench_count_lines_in_file(BenchRun *run, const Tree *tree) {
+    Samples iterations = { NULL, 0, 0 };
+    Samples latency = { NULL, 0, 0 };
+    CountResult counted;
+    for (int i = 0; i <= run->repeat; i++) {
+        memset(&counted, 0, sizeof(counted));
+        unsigned long long start = cl_monotonic_ns();
+        for (size_t f = 0; f < tree->file_count; f++) {
+            if (tree->files[f].language == LANG_UNKNOWN) continue;
+            unsigned long long file_start = cl_monotonic_ns();
+            counted.total_lines += count_lines_in_file(tree->files[f].path, &counted);
+            if (i > 0) samples_add(&latency, (double)(cl_monotonic_ns() - file_start));
+        }
+        unsigned long long elapsed = cl_monotonic_ns() - start;
+        if (i > 0) samples_add(&iterations, (double)elapsed);
+    }
+    finish_result(run, "count_lines_in_file", "file", tree->text_files, tree->text_bytes, &iterations, &latency);
+    free(iterations.values);
+    free(latency.values);
+    check_counts(run, "count_lines_in_file", &tree->expected, &counted);
+}
+
+typedef enum {
+    LOOKUP_TEXT_FILE,
+    LOOKUP_EXCLUDED,
+    LOOKUP_MATCHER
+} LookupKind;
+
+// Name and path lookups: far too quick to time one by one, so each latency
+// sample is the mean of a batch of BATCH_SIZE calls
+static void bench_lookup(BenchRun *run, const Tree *tree, const char *name, LookupKind kind) {
+    const ExcludeList *list = run->lookup_excludes;
+    ExcludeMatcher *matcher = kind == LOOKUP_MATCHER ? exclude_matcher_create(list->patterns, list->count) : NULL;
+    if (kind == LOOKUP_MATCHER && !matcher) return;
+
+    Samples iterations = { NULL, 0, 0 };
+    Samples latency = { NULL, 0, 0 };
+    volatile unsigned long long hits = 0;
+    for (int i = 0; i <= run->repeat; i++) {
+        unsigned long long start = cl_monotonic_ns();
+        for (size_t f = 0; f < tree->file_count; f += BATCH_SIZE) {
+            size_t end = f + BATCH_SIZE < tree->file_count ? f + BATCH_SIZE : tree->file_count;
+            unsigned long long batch_start = cl_monotonic_ns();
+            for (size_t j = f; j < end; j++) {
+                const TreeFile *file = &tree->files[j];
+                switch (kind) {
+                    case LOOKUP_TEXT_FILE:
+                        hits += is_text_file(file->path + file->name_offset);
+                        break;
+                    case LOOKUP_EXCLUDED:
+                        hits += is_excluded(file->path + file->relative_offset, list);
+                        break;
+                    case LOOKUP_MATCHER:
+                        hits += exclude_matcher_match_path(matcher, file->path + file->relative_offset, false);
+                        break;
+                }
+            }
+            if (i > 0) samples_add(&latency, (double)(cl_monotonic_ns() - batch_start) / (double)(end - f));
+        }
+        unsigned long long elapsed = cl_monotonic_ns() - start;
+        if (i > 0) samples_add(&iterations, (double)elapsed);
+    }
+    finish_result(run, name, "call", tree->file_count, 0, &iterations, &latency);
+    free(iterations.values);
+    free(latency.values);
+    exclude_matcher_free(matcher);
+}
+
+// Paths a fixture created, removed in reverse order once the checks are done
+typedef struct {
+    const char *dir;
+    char **paths;
+    size_t path_count;
+    size_t path_capacity;
+    int failed;
+} CheckRun;
+
+// Full path of fixture entry `name`, recorded for removal
+static char* check_path(CheckRun *checks, const char *name) {
+    char *path = join_path(checks->dir, name);
+    if (!path) return NULL;
+    if (checks->path_count == checks->path_capacity) {
+        size_t capacity = checks->path_capacity ? checks->path_capacity * 2 : 32;
+        char **grown = realloc(checks->paths, capacity * sizeof(char*));
+        if (!grown) {
+            free(path);
+            return NULL;
+        }
+        checks->paths = grown;
+        checks->path_capacity = capacity;
+    }
+    checks->paths[checks->path_count++] = path;
+    return path;
+}
+
+// Create fixture directory `name`; returns its full path, NULL on failure
+static const char* check_directory(CheckRun *checks, const char *name) {
+    const char *path = check_path(checks, name);
+    return path && make_directory(path) ? path : NULL;
+}
+
+static bool check_file(CheckRun *checks, const char *name, const void *data, size_t len) {
+    const char *path = check_path(checks, name);
+    return path && write_file(path, data, len);
+}
+
+static void check_report(CheckRun *checks, const char *name, bool ok, const char *detail) {
+    if (!ok) checks->failed++;
+    printf("  %-24s %s%s%s\n", name, ok ? "ok" : "FAILED", detail ? ": " : "", detail ? detail : "");
+}
+
+static void check_counts_of(CheckRun *checks, const char *name, const CountResult *expected,
+                            const CountResult *counted) {
+    char detail[160];
+    snprintf(detail, sizeof(detail), "%llu files, %llu lines (expected %llu files, %llu lines)",
+             counted->total_files, counted->total_lines, expected->total_files, expected->total_lines);
+    check_report(checks, name, same_counts(expected, counted), same_counts(expected, counted) ? NULL : detail);
+}
+
+// A directory symlink back up the tree must not be followed round the loop.
+// The walk is capped at 8 levels, so a walker that loops ends with far too
+// many files instead of hanging.
+static void check_symlink_loop(CheckRun *checks, int jobs) {
+#ifdef _WIN32
+    (void)jobs;
+    check_report(checks, "symlink_loop", true, "skipped, no symlinks");
+#else
+    static const char line[] = "int x;\n";
+    const char *root = check_directory(checks, "loop");
+    bool ok = root && check_file(checks, "loop/main.c", line, strlen(line)) &&
+              check_directory(checks, "loop/a") && check_file(checks, "loop/a/a.c", line, strlen(line));
+    const char *up = ok ? check_path(checks, "loop/a/up") : NULL;
+    const char *self = ok ? check_path(checks, "loop/a/self") : NULL;
+    const char *alias = ok ? check_path(checks, "loop/alias") : NULL;
+    ok = up && self && alias && symlink("..", up) == 0 && symlink(".", self) == 0 && symlink("a", alias) == 0;
+    if (!ok) {
+        check_report(checks, "symlink_loop", false, strerror(errno));
+        return;
+    }
+
+    CountOptions options;
+    init_count_options(&options);
+    options.jobs = jobs;
+    options.max_depth = 8;
+    CountResult counted = {0, 0, 0, 0, 0};
+    count_lines_with_options(root, &options, &counted);
+    // main.c, a/a.c and alias/a.c: a link to a directory off the path is followed
+    CountResult expected = { 3, 3, 0, 0, 3 };
+    check_counts_of(checks, "symlink_loop", &expected, &counted);
+#endif
+}
+
+static void put_be16(Buffer *out, unsigned value) {
+    unsigned char bytes[2] = { (unsigned char)(value >> 8), (unsigned char)value };
+    if (buffer_reserve(out, 2)) {
+        memcpy(out->data + out->length, bytes, 2);
+        out->length += 2;
+    }
+}
+
+static void put_be32(Buffer *out, unsigned long value) {
+    put_be16(out, (unsigned)(value >> 16) & 0xffff);
+    put_be16(out, (unsigned)value & 0xffff);
+}
+
+static void put_bytes(Buffer *out, const void *data, size_t len) {
+    if (buffer_reserve(out, len)) {
+        memcpy(out->data + out->length, data, len);
+        out->length += len;
+    }
+}
+
+// One git index entry for a regular file: zeroed stat data and object hash,
+// then the flags and the path. Version 4 writes `path` as the suffix left
+// after dropping `strip` bytes of the previous path; earlier versions pad the
+// entry with NULs to a multiple of 8 bytes.
+static void put_index_entry(Buffer *out, unsigned version, const char *path, unsigned strip, unsigned flags) {
+    static const unsigned char zeros[40] = {0};
+    size_t start = out->length;
+    put_bytes(out, zeros, 24);
+    put_be32(out, GIT_MODE_FILE | 0644);
+    put_bytes(out, zeros, 12);
+    put_bytes(out, zeros, 20);
+    size_t len = strlen(path);
+    put_be16(out, flags | (unsigned)(len < 0xfff ? len : 0xfff));
+    if (version == 4) {
+        unsigned char byte = (unsigned char)strip;     // Fixtures strip under 128 bytes
+        put_bytes(out, &byte, 1);
+        put_bytes(out, path, len + 1);
+    } else {
+        put_bytes(out, path, len);
+        size_t padded = (out->length - start + 8) & ~(size_t)7;
+        put_bytes(out, zeros, padded - (out->length - start));
+    }
+}
+
+// Replace the fixture repository's index with `count` entries of `paths`
+// (and `strips` with version 4), declaring `declared` entries in the header
+static bool write_index(CheckRun *checks, const char *index_path, unsigned version, unsigned declared,
+                        const char *const *paths, const unsigned *strips, const unsigned *flags, int count) {
+    static const unsigned char hash[20] = {0};
+    Buffer index = { NULL, 0, 0 };
+    put_bytes(&index, "DIRC", 4);
+    put_be32(&index, version);
+    put_be32(&index, declared);
+    for (int i = 0; i < count; i++) {
+        put_index_entry(&index, version, paths[i], strips ? strips[i] : 0, flags ? flags[i] : 0);
+    }
+    put_bytes(&index, hash, sizeof(hash));
+    bool ok = index.data && write_file(index_path, index.data, index.length);
+    free(index.data);
+    if (!ok) check_report(checks, "git_index", false, "cannot write the fixture index");
+    return ok;
+}
+
+// Open the fixture repository's index; true if it is accepted
+static bool open_index(const char *root, const char **error) {
+    GitRepo repo;
+    GitIndex index;
+    if (!git_repo_open(&repo, root, error) || !git_index_open(&index, &repo, error)) return false;
+    GitIndexEntry entry;
+    while (git_index_next(&index, &entry)) {}
+    git_index_close(&index);
+    return true;
+}
+
+// The index must be refused as corrupt, not for any other reason
+static void check_index_refused(CheckRun *checks, const char *name, const char *root) {
+    const char *error = NULL;
+    bool opened = open_index(root, &error);
+    bool refused = !opened && error && strcmp(error, "corrupt index") == 0;
+    check_report(checks, name, refused, refused ? NULL : opened ? "accepted" : error);
+}
+
+// Well-formed indexes of versions 2 and 4 must give their tracked files and
+// nothing else; truncated and malformed ones must be refused, not read past
+// their end
+static void check_git_index(CheckRun *checks, int jobs) {
+    static const char line[] = "int x;\n";
+    const char *root = check_directory(checks, "git");
+    bool ok = root && check_directory(checks, "git/.git") && check_directory(checks, "git/src") &&
+              check_file(checks, "git/src/a.c", line, strlen(line)) &&
+              check_file(checks, "git/src/b.c", line, strlen(line)) &&
+              check_file(checks, "git/untracked.c", line, strlen(line));
+    const char *index_path = ok ? check_path(checks, "git/.git/index") : NULL;
+    if (!index_path) {
+        check_report(checks, "git_index", false, "cannot create the fixture repository");
+        return;
+    }
+
+    CountOptions options;
+    init_count_options(&options);
+    options.jobs = jobs;
+    GitRepo repo;
+    CountResult expected = { 2, 2, 0, 0, 2 };
+    static const char *const full[] = { "src/a.c", "src/b.c" };
+    static const char *const v4_paths[] = { "src/a.c", "b.c" };
+    static const unsigned v4_strips[] = { 0, 3 };
+
+    if (write_index(checks, index_path, 2, 2, full, NULL, NULL, 2)) {
+        CountResult counted = {0, 0, 0, 0, 0};
+        if (git_repo_open(&repo, root, NULL)) {
+            options.git = &repo;
+            count_lines_with_options(root, &options, &counted);
+        }
+        check_counts_of(checks, "git_index_v2", &expected, &counted);
+    }
+    if (write_index(checks, index_path, 4, 2, v4_paths, v4_strips, NULL, 2)) {
+        CountResult counted = {0, 0, 0, 0, 0};
+        if (git_repo_open(&repo, root, NULL)) {
+            options.git = &repo;
+            count_lines_with_options(root, &options, &counted);
+        }
+        check_counts_of(checks, "git_index_v4", &expected, &counted);
+    }
+
+    // The header promises a third entry the table does not hold
+    if (write_index(checks, index_path, 2, 3, full, NULL, NULL, 2)) {
+        check_index_refused(checks, "git_index_truncated", root);
+    }
+    // Version 4 dropping more of the previous path than there is
+    static const unsigned bad_strips[] = { 0, 40 };
+    if (write_index(checks, index_path, 4, 2, v4_paths, bad_strips, NULL, 2)) {
+        check_index_refused(checks, "git_index_bad_prefix", root);
+    }
+    // Extended flags exist from version 3 on
+    static const unsigned extended[] = { 0x4000, 0 };
+    if (write_index(checks, index_path, 2, 2, full, NULL, extended, 2)) {
+        check_index_refused(checks, "git_index_extended_v2", root);
+    }
+    // Cut in the middle of the first entry's fixed part, before the checksum
+    static const unsigned char zeros[50] = {0};
+    Buffer cut = { NULL, 0, 0 };
+    put_bytes(&cut, "DIRC", 4);
+    put_be32(&cut, 2);
+    put_be32(&cut, 1);
+    put_bytes(&cut, zeros, sizeof(zeros));
+    if (cut.data && write_file(index_path, cut.data, cut.length)) {
+        check_index_refused(checks, "git_index_cut", root);
+    }
+    free(cut.data);
+}
+
+// Fill in a tar header's checksum: the sum of its bytes, the field itself
+// read as spaces
+static void seal_tar_header(unsigned char *block) {
+    memset(block + 148, ' ', 8);
+    unsigned sum = 0;
+    for (int i = 0; i < 512; i++) sum += block[i];
+    char checksum[8];
+    snprintf(checksum, sizeof(checksum), "%06o", sum);
+    memcpy(block + 148, checksum, 7);
+}
+
+// One 512-byte ustar header. The size is octal unless `base256`, as GNU tar
+// writes sizes too large for the field; `prefix` (optional) is the ustar
+// name prefix.
+static void put_tar_header(Buffer *out, const char *name, char type, unsigned long long size, bool base256,
+                           const char *prefix) {
+    unsigned char block[512];
+    memset(block, 0, sizeof(block));
+    memcpy(block, name, strlen(name) < 100 ? strlen(name) : 100);
+    memcpy(block + 100, "0000644", 8);
+    memcpy(block + 108, "0000000", 8);
+    memcpy(block + 116, "0000000", 8);
+    if (base256) {
+        block[124] = 0x80;
+        for (int i = 11; i > 0; i--, size >>= 8) block[124 + i] = (unsigned char)size;
+    } else {
+        char octal[13];
+        snprintf(octal, sizeof(octal), "%011llo", size);
+        memcpy(block + 124, octal, 12);
+    }
+    memcpy(block + 136, "00000000000", 12);
+    block[156] = (unsigned char)type;
+    memcpy(block + 257, "ustar\0" "00", 8);
+    if (prefix) memcpy(block + 345, prefix, strlen(prefix));
+    seal_tar_header(block);
+    put_bytes(out, block, sizeof(block));
+}
+
+// Member data, padded with NULs to the next block
+static void put_tar_data(Buffer *out, const void *data, size_t len) {
+    static const unsigned char zeros[512] = {0};
+    put_bytes(out, data, len);
+    if (len % 512) put_bytes(out, zeros, 512 - len % 512);
+}
+
+// Append a pax record, "<length> <key>=<value>\n", whose length counts its
+// own digits. A `length` other than 0 is written instead.
+static void add_pax_record(Buffer *records, const char *key, const char *value, size_t length) {
+    size_t body = strlen(key) + strlen(value) + 3;
+    if (length == 0) {
+        length = body + 1;
+        while (length != body + (size_t)snprintf(NULL, 0, "%zu", length)) length++;
+    }
+    size_t size = (size_t)snprintf(NULL, 0, "%zu %s=%s\n", length, key, value);
+    if (!buffer_reserve(records, size + 1)) return;
+    snprintf(records->data + records->length, size + 1, "%zu %s=%s\n", length, key, value);
+    records->length += size;
+}
+
+// A pax extended header holding `records`, which it frees
+static void put_pax(Buffer *out, Buffer *records) {
+    put_tar_header(out, "PaxHeader", 'x', records->length, false, NULL);
+    put_tar_data(out, records->data, records->length);
+    free(records->data);
+    memset(records, 0, sizeof(Buffer));
+}
+
+// List the archive's members; their paths must be `paths`, and the reader
+// must end with `error` (NULL for the end of a valid archive)
+static void check_tar_members(CheckRun *checks, const char *name, const char *archive,
+                              const char *const *paths, int count, const char *error) {
+    TarReader tar;
+    const char *open_error = NULL;
+    if (!tar_open(&tar, archive, &open_error)) {
+        check_report(checks, name, false, open_error);
+        return;
+    }
+    TarMember member;
+    int seen = 0;
+    bool ok = true;
+    char detail[160] = "";
+    while (tar_next(&tar, &member)) {
+        if (member.type != TAR_FILE) continue;
+        if (seen >= count || strcmp(member.path, paths[seen]) != 0) {
+            snprintf(detail, sizeof(detail), "unexpected member '%.100s'", member.path);
+            ok = false;
+            break;
+        }
+        seen++;
+    }
+    const char *ended = tar_error(&tar);
+    if (ok && seen != count) {
+        snprintf(detail, sizeof(detail), "%d of %d members", seen, count);
+        ok = false;
+    } else if (ok && (error ? !ended || strcmp(ended, error) != 0 : ended != NULL)) {
+        snprintf(detail, sizeof(detail), "ended with %s, expected %s", ended ? ended : "no error",
+                 error ? error : "no error");
+        ok = false;
+    }
+    tar_close(&tar);
+    check_report(checks, name, ok, ok ? NULL : detail);
+}
+
+// Write `archive` to fixture file `name`; returns its path
+static const char* check_archive(CheckRun *checks, const char *name, Buffer *archive) {
+    const char *path = archive->data ? check_path(checks, name) : NULL;
+    bool ok = path && write_file(path, archive->data, archive->length);
+    free(archive->data);
+    memset(archive, 0, sizeof(Buffer));
+    if (!ok) check_report(checks, name, false, "cannot write the fixture archive");
+    return ok ? path : NULL;
+}
+
+// Every kind of member name and size the reader understands must list and
+// count; truncated and malformed archives must stop with an error instead of
+// reading garbage
+static void check_tar(CheckRun *checks, int jobs) {
+    static const char line[] = "int x;\n";
+    size_t line_len = strlen(line);
+    static const unsigned char zeros[1024] = {0};
+    Buffer archive = { NULL, 0, 0 };
+    Buffer records = { NULL, 0, 0 };
+
+    char long_name[201];
+    memset(long_name, 'n', 196);
+    memcpy(long_name + 196, "/l.c", 5);
+    char *huge_pax = malloc(TAR_PAX_MAX + 2);
+    if (!huge_pax) return;
+    memset(huge_pax, 'p', TAR_PAX_MAX + 1);
+    memcpy(huge_pax + TAR_PAX_MAX - 3, ".c", 3);
+
+    put_tar_header(&archive, "./src/a.c", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    put_tar_header(&archive, "b.c", '0', line_len, false, "deep/dir");
+    put_tar_data(&archive, line, line_len);
+    // GNU long name: the path in a member of its own, with its NUL
+    put_tar_header(&archive, "././@LongLink", 'L', strlen(long_name) + 1, false, NULL);
+    put_tar_data(&archive, long_name, strlen(long_name) + 1);
+    put_tar_header(&archive, "truncated", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    // pax path and size override the header's
+    add_pax_record(&records, "path", "pax/c.c", 0);
+    add_pax_record(&records, "size", "7", 0);
+    put_pax(&archive, &records);
+    put_tar_header(&archive, "ignored.c", '0', 0, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    put_tar_header(&archive, "big/d.c", '0', line_len, true, NULL);
+    put_tar_data(&archive, line, line_len);
+    // A record longer than its header is ignored, as is a header over TAR_PAX_MAX
+    add_pax_record(&records, "path", "evil.c", 999);
+    put_pax(&archive, &records);
+    put_tar_header(&archive, "e.c", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    add_pax_record(&records, "path", huge_pax, 0);
+    put_pax(&archive, &records);
+    put_tar_header(&archive, "f.c", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    put_bytes(&archive, zeros, sizeof(zeros));
+    free(huge_pax);
+
+    static const char *valid_paths[7] = { "src/a.c", "deep/dir/b.c", NULL, "pax/c.c", "big/d.c", "e.c", "f.c" };
+    valid_paths[2] = long_name;
+    const char *valid = check_archive(checks, "valid.tar", &archive);
+    if (valid) {
+        check_tar_members(checks, "tar_members", valid, valid_paths, 7, NULL);
+        CountOptions options;
+        init_count_options(&options);
+        options.jobs = jobs;
+        options.tar = true;
+        CountResult counted = {0, 0, 0, 0, 0};
+        if (count_lines_with_options(valid, &options, &counted)) {
+            CountResult expected = { 7, 7, 0, 0, 7 };
+            check_counts_of(checks, "tar_count", &expected, &counted);
+        } else {
+            check_report(checks, "tar_count", false, "archive reported unreadable");
+        }
+    }
+
+    // Cut 300 bytes into the second header
+    put_tar_header(&archive, "a.c", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    put_tar_header(&archive, "b.c", '0', line_len, false, NULL);
+    archive.length -= 212;
+    const char *cut_header = check_archive(checks, "cut_header.tar", &archive);
+    static const char *const a_path[] = { "a.c" };
+    if (cut_header) check_tar_members(checks, "tar_cut_header", cut_header, a_path, 1, "truncated archive");
+
+    // A member promising more data than the archive holds
+    put_tar_header(&archive, "a.c", '0', 4096, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    const char *cut_data = check_archive(checks, "cut_data.tar", &archive);
+    if (cut_data) check_tar_members(checks, "tar_cut_data", cut_data, a_path, 1, "truncated archive");
+
+    // A base-256 size with the sign bit set is negative
+    put_tar_header(&archive, "a.c", '0', line_len, false, NULL);
+    put_tar_data(&archive, line, line_len);
+    put_tar_header(&archive, "b.c", '0', 0, true, NULL);
+    unsigned char *header = (unsigned char *)archive.data + archive.length - 512;
+    header[124] = 0xff;
+    seal_tar_header(header);
+    put_bytes(&archive, zeros, sizeof(zeros));
+    const char *negative = check_archive(checks, "negative.tar", &archive);
+    if (negative) check_tar_members(checks, "tar_negative_size", negative, a_path, 1, "corrupt header");
+
+    // One flipped byte fails the header checksum
+    put_tar_header(&archive, "a.c", '0', line_len, false, NULL);
+    archive.data[0] = 'b';
+    put_tar_data(&archive, line, line_len);
+    const char *checksum = check_archive(checks, "checksum.tar", &archive);
+    if (checksum) check_tar_members(checks, "tar_bad_checksum", checksum, a_path, 0, "not a tar archive");
+}
+
+// Run every fixture in a scratch directory below `dir`. Returns the number
+// that failed.
+static int run_checks(const char *dir, int jobs) {
+    CheckRun checks;
+    memset(&checks, 0, sizeof(checks));
+    checks.dir = dir;
+    if (!make_directory(dir)) {
+        fprintf(stderr, "Error: Cannot create directory '%s': %s\n", dir, strerror(errno));
+        return 1;
+    }
+    printf("CountLines checks %s\n", COUNTLINES_VERSION);
+
+    check_symlink_loop(&checks, jobs);
+    check_git_index(&checks, jobs);
+    check_tar(&checks, jobs);
+
+    for (size_t i = checks.path_count; i > 0; i--) {
+        if (remove(checks.paths[i - 1]) != 0) {
+#ifdef _WIN32
+            _rmdir(checks.paths[i - 1]);
+#else
+            rmdir(checks.paths[i - 1]);
+#endif
+        }
+        free(checks.paths[i - 1]);
+    }
+    free(checks.paths);
+#ifdef _WIN32
+    _rmdir(dir);
+#else
+    rmdir(dir);
+#endif
+    printf("%d failed\n", checks.failed);
+    return checks.failed;
+}
+
+// Latency with a unit that keeps three significant digits readable
+static void format_duration(double ns, char *out, size_t out_size) {
+    if (ns < 1e3) snprintf(out, out_size, "%.1fns", ns);
+    else if (ns < 1e6) snprintf(out, out_size, "%.1fus", ns / 1e3);
+    else if (ns < 1e9) snprintf(out, out_size, "%.1fms", ns / 1e6);
+    else snprintf(out, out_size, "%.2fs", ns / 1e9);
+}
+
+static double items_per_second(const BenchResult *r) {
+    return r->seconds > 0 ? r->items / r->seconds : 0.0;
+}
+
+static double mb_per_second(const BenchResult *r) {
+    return r->seconds > 0 ? (r->bytes / (1024.0 * 1024.0)) / r->seconds : 0.0;
+}
+
+static void print_table(const BenchRun *run, const TreeSpec *spec, const Tree *tree, bool reused) {
+    printf("CountLines benchmark %s (classifier: %s)\n", COUNTLINES_VERSION, classifier_backend_name());
+    printf("Tree: %s%s\n", tree->root, reused ? " (reused)" : "");
+    printf("  %zu directories, %zu files (%llu counted), %.1f MB, %llu lines\n",
+           tree->directory_count + 1, tree->file_count, tree->text_files,
+           tree->bytes / (1024.0 * 1024.0), tree->expected.total_lines);
+    printf("  depth %d, fan-out %d, %d files per directory, %s sizes around %lu bytes, seed %llu\n",
+           spec->depth, spec->fanout, spec->files_per_dir,
+           size_distribution_names[spec->size_distribution], spec->mean_size, spec->seed);
+    printf("Runs: %d after a warm-up, %d jobs, %s I/O\n\n", run->repeat, run->jobs, io_mode_name(run->io_mode));
+
+    printf("  %-20s %10s %10s %12s %10s %6s %10s %10s %10s %10s\n",
+           "Benchmark", "Items", "Median (s)", "Items/s", "MB/s", "Per", "p50", "p90", "p99", "Max");
+    for (int i = 0; i < run->result_count; i++) {
+        const BenchResult *r = &run->results[i];
+        char p50[16], p90[16], p99[16], max[16], mb[16];
+        format_duration(r->p50, p50, sizeof(p50));
+        format_duration(r->p90, p90, sizeof(p90));
+        format_duration(r->p99, p99, sizeof(p99));
+        format_duration(r->max, max, sizeof(max));
+        if (r->bytes) snprintf(mb, sizeof(mb), "%.1f", mb_per_second(r));
+        else snprintf(mb, sizeof(mb), "-");
+        printf("  %-20s %10llu %10.4f %12.0f %10s %6s %10s %10s %10s %10s%s\n",
+               r->name, r->items, r->seconds, items_per_second(r), mb, r->latency_of,
+               p50, p90, p99, max, r->counts_checked && !r->counts_match ? "  MISMATCH" : "");
+    }
+}
+
+static void write_json(FILE *out, const BenchRun *run, const TreeSpec *spec, const Tree *tree) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"version\": \"%s\",\n", COUNTLINES_VERSION);
+    fprintf(out, "  \"classifier\": \"%s\",\n", classifier_backend_name());
+    fprintf(out, "  \"config\": {\"seed\": %llu, \"depth\": %d, \"fanout\": %d, \"files_per_dir\": %d, "
+                 "\"size_distribution\": \"%s\", \"mean_size\": %lu, \"comment_density\": %.3f, "
+                 "\"blank_density\": %.3f, \"languages\": \"%s\", \"jobs\": %d, \"io_mode\": \"%s\", \"repeat\": %d},\n",
+            spec->seed, spec->depth, spec->fanout, spec->files_per_dir,
+            size_distribution_names[spec->size_distribution], spec->mean_size, spec->comment_density,
+            spec->blank_density, spec->mix_spec, run->jobs, io_mode_name(run->io_mode), run->repeat);
+    fprintf(out, "  \"tree\": {\"directories\": %zu, \"files\": %zu, \"text_files\": %llu, \"bytes\": %llu, "
+                 "\"text_bytes\": %llu, \"lines\": %llu, \"code\": %llu, \"comments\": %llu, \"blank\": %llu},\n",
+            tree->directory_count + 1, tree->file_count, tree->text_files, tree->bytes, tree->text_bytes,
+            tree->expected.total_lines, tree->expected.code_lines, tree->expected.comment_lines,
+            tree->expected.blank_lines);
+    fprintf(out, "  \"counts_match\": %s,\n", run->all_match ? "true" : "false");
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (int i = 0; i < run->result_count; i++) {
+        const BenchResult *r = &run->results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"iterations\": %d, \"items\": %llu, \"bytes\": %llu, "
+                     "\"seconds\": %.6f, \"items_per_second\": %.1f, \"mb_per_second\": %.2f, "
+                     "\"latency_per\": \"%s\", \"latency_ns\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+                r->name, r->iterations, r->items, r->bytes, r->seconds, items_per_second(r), mb_per_second(r),
+                r->latency_of, r->p50, r->p90, r->p99, r->max);
+        if (r->counts_checked) fprintf(out, ", \"counts_match\": %s", r->counts_match ? "true" : "false");
+        fprintf(out, "}%s\n", i + 1 < run->result_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void write_csv(FILE *out, const BenchRun *run) {
+    fprintf(out, "benchmark,iterations,items,bytes,seconds,items_per_second,mb_per_second,latency_per,p50_ns,p90_ns,p99_ns,max_ns\n");
+    for (int i = 0; i < run->result_count; i++) {
+        const BenchResult *r = &run->results[i];
+        fprintf(out, "%s,%d,%llu,%llu,%.6f,%.1f,%.2f,%s,%.1f,%.1f,%.1f,%.1f\n",
+                r->name, r->iterations, r->items, r->bytes, r->seconds, items_per_second(r),
+                mb_per_second(r), r->latency_of, r->p50, r->p90, r->p99, r->max);
+    }
+}
+
+// Write a report to `path` ("-" = stdout)
+static bool write_report(const char *path, const BenchRun *run, const TreeSpec *spec, const Tree *tree, bool json) {
+    FILE *out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    if (json) write_json(out, run, spec, tree);
+    else write_csv(out, run);
+    return out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+}
+
+static void print_bench_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("\nGenerates a deterministic synthetic source tree and benchmarks CountLines on it.\n");
+    printf("\nTree options:\n");
+    printf("  --tree DIR            Generate into DIR and keep it; a later run with the same\n");
+    printf("                        parameters reuses it (default: a temporary tree, removed after)\n");
+    printf("  --generate-only       Generate the tree and exit (needs --tree)\n");
+    printf("  --depth N             Directory levels below the root (default: 4)\n");
+    printf("  --fanout N            Subdirectories per directory (default: 4)\n");
+    printf("  --files N             Files per directory (default: 12)\n");
+    printf("  --sizes DIST:BYTES    File size distribution fixed, uniform or lognormal,\n");
+    printf("                        and its mean (default: lognormal:8192)\n");
+    printf("  --languages MIX       Weighted language mix by name or id; 'other' adds files\n");
+    printf("                        that are not counted (default: %s)\n", DEFAULT_MIX);
+    printf("  --comments F          Fraction of comment lines (default: 0.2)\n");
+    printf("  --blank F             Fraction of blank lines (default: 0.1)\n");
+    printf("  --seed N              Random seed (default: 1)\n");
+    printf("\nRun options:\n");
+    printf("  --repeat N            Timed runs per benchmark, after one warm-up (default: 5)\n");
+    printf("  -j, --jobs N          Worker threads for the tree walks (default: 0 = one per CPU)\n");
+    printf("  --io MODE             I/O mode for end_to_end: auto, read, mmap, direct, uring\n");
+    printf("  --only LIST           Comma separated benchmarks: traversal, is_text_file,\n");
+    printf("                        is_excluded, exclude_matcher, count_lines_in_file, end_to_end\n");
+    printf("  --check               Run the correctness fixtures instead of the benchmarks\n");
+    printf("  --json FILE           Also write the results as JSON ('-' = stdout, no table)\n");
+    printf("  --csv FILE            Also write the results as CSV ('-' = stdout, no table)\n");
+    printf("  -h, --help            Show this help message\n");
+}
+
+static bool is_option(const char *arg, const char *name) {
+    size_t name_len = strlen(name);
+    return strncmp(arg, name, name_len) == 0 && (arg[name_len] == '\0' || arg[name_len] == '=');
+}
+
+// Value of option argv[*i] ("--name VALUE" or "--name=VALUE")
+static const char* option_value(int argc, char *argv[], int *i, const char *name) {
+    size_t name_len = strlen(name);
+    if (argv[*i][name_len] == '=') return argv[*i] + name_len + 1;
+    if (*i + 1 < argc) return argv[++*i];
+    fprintf(stderr, "Error: %s option requires a value\n", name);
+    return NULL;
+}
+
+static bool parse_long(const char *value, const char *name, long min, long max, long *out) {
+    char *end = NULL;
+    long parsed = value ? strtol(value, &end, 10) : 0;
+    if (!value || *value == '\0' || *end != '\0' || parsed < min || parsed > max) {
+        fprintf(stderr, "Error: %s option requires a number between %ld and %ld\n", name, min, max);
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+static bool parse_fraction(const char *value, const char *name, double *out) {
+    char *end = NULL;
+    double parsed = value ? strtod(value, &end) : -1.0;
+    if (!value || *value == '\0' || *end != '\0' || parsed < 0.0 || parsed > 1.0) {
+        fprintf(stderr, "Error: %s option requires a fraction between 0 and 1\n", name);
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+static bool parse_sizes(const char *value, TreeSpec *spec) {
+    const char *colon = value ? strchr(value, ':') : NULL;
+    size_t name_len = colon ? (size_t)(colon - value) : 0;
+    for (int i = 0; colon && i < (int)(sizeof(size_distribution_names) / sizeof(size_distribution_names[0])); i++) {
+        if (strlen(size_distribution_names[i]) == name_len && strncmp(value, size_distribution_names[i], name_len) == 0) {
+            long mean;
+            if (!parse_long(colon + 1, "--sizes", 0, 256L * 1024 * 1024, &mean)) return false;
+            spec->size_distribution = (SizeDistribution)i;
+            spec->mean_size = (unsigned long)mean;
+            return true;
+        }
+    }
+    fprintf(stderr, "Error: --sizes expects fixed, uniform or lognormal and a mean, e.g. lognormal:8192\n");
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    TreeSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.depth = 4;
+    spec.fanout = 4;
+    spec.files_per_dir = 12;
+    spec.size_distribution = SIZE_LOGNORMAL;
+    spec.mean_size = 8192;
+    spec.comment_density = 0.2;
+    spec.blank_density = 0.1;
+    spec.seed = 1;
+    spec.mix_spec = DEFAULT_MIX;
+
+    BenchRun run;
+    memset(&run, 0, sizeof(run));
+    run.repeat = 5;
+    run.jobs = 0;
+    run.io_mode = IO_AUTO;
+    run.all_match = true;
+
+    const char *tree_dir = NULL;
+    const char *json_path = NULL;
+    const char *csv_path = NULL;
+    bool generate_only = false;
+    bool check = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = NULL;
+        long number;
+        bool ok = true;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_bench_usage(argv[0]);
+            return 0;
+        } else if (strcmp(arg, "--generate-only") == 0) {
+            generate_only = true;
+        } else if (strcmp(arg, "--check") == 0) {
+            check = true;
+        } else if (is_option(arg, "--tree")) {
+            ok = (tree_dir = option_value(argc, argv, &i, "--tree")) != NULL;
+        } else if (is_option(arg, "--depth")) {
+            ok = parse_long(option_value(argc, argv, &i, "--depth"), "--depth", 0, 16, &number);
+            spec.depth = (int)number;
+        } else if (is_option(arg, "--fanout")) {
+            ok = parse_long(option_value(argc, argv, &i, "--fanout"), "--fanout", 0, 1000, &number);
+            spec.fanout = (int)number;
+        } else if (is_option(arg, "--files")) {
+            ok = parse_long(option_value(argc, argv, &i, "--files"), "--files", 0, 100000, &number);
+            spec.files_per_dir = (int)number;
+        } else if (is_option(arg, "--sizes")) {
+            ok = parse_sizes(option_value(argc, argv, &i, "--sizes"), &spec);
+        } else if (is_option(arg, "--languages")) {
+            ok = (spec.mix_spec = option_value(argc, argv, &i, "--languages")) != NULL;
+        } else if (is_option(arg, "--comments")) {
+            ok = parse_fraction(option_value(argc, argv, &i, "--comments"), "--comments", &spec.comment_density);
+        } else if (is_option(arg, "--blank")) {
+            ok = parse_fraction(option_value(argc, argv, &i, "--blank"), "--blank", &spec.blank_density);
+        } else if (is_option(arg, "--seed")) {
+            value = option_value(argc, argv, &i, "--seed");
+            char *end = NULL;
+            spec.seed = value ? strtoull(value, &end, 10) : 0;
+            if (!value || *value == '\0' || *end != '\0') {
+                fprintf(stderr, "Error: --seed option requires a number\n");
+                ok = false;
+            }
+        } else if (is_option(arg, "--repeat")) {
+            ok = parse_long(option_value(argc, argv, &i, "--repeat"), "--repeat", 1, 10000, &number);
+            run.repeat = (int)number;
+        } else if (strcmp(arg, "-j") == 0 || is_option(arg, "--jobs")) {
+            ok = parse_long(option_value(argc, argv, &i, arg[1] == 'j' ? "-j" : "--jobs"), "--jobs", 0, 1024, &number);
+            run.jobs = (int)number;
+        } else if (is_option(arg, "--io")) {
+            value = option_value(argc, argv, &i, "--io");
+            if (!value || !parse_io_mode(value, &run.io_mode)) {
+                fprintf(stderr, "Error: Unknown I/O mode '%s'\n", value ? value : "");
+                ok = false;
+            }
+        } else if (is_option(arg, "--only")) {
+            ok = (run.only = option_value(argc, argv, &i, "--only")) != NULL;
+        } else if (is_option(arg, "--json")) {
+            ok = (json_path = option_value(argc, argv, &i, "--json")) != NULL;
+        } else if (is_option(arg, "--csv")) {
+            ok = (csv_path = option_value(argc, argv, &i, "--csv")) != NULL;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            ok = false;
+        }
+        if (!ok) return 1;
+    }
+
+    if (generate_only && !tree_dir) {
+        fprintf(stderr, "Error: --generate-only needs --tree\n");
+        return 1;
+    }
+    if (!parse_mix(spec.mix_spec, &spec)) {
+        fprintf(stderr, "Error: Invalid --languages mix '%s'\n", spec.mix_spec);
+        return 1;
+    }
+    if (spec.comment_density + spec.blank_density > 1.0) {
+        fprintf(stderr, "Error: --comments and --blank add up to more than 1\n");
+        return 1;
+    }
+    if (run.jobs <= 0) run.jobs = cl_cpu_count();
+
+    char *temp_dir = NULL;
+    if (!tree_dir || check) {
+        const char *base = getenv("TMPDIR");
+        if (!base) base = getenv("TEMP");
+        if (!base) base = "/tmp";
+#ifdef _WIN32
+        int pid = _getpid();
+#else
+        int pid = (int)getpid();
+#endif
+        char name[64];
+        snprintf(name, sizeof(name), "countlines-%s-%d", check ? "check" : "bench", pid);
+        temp_dir = join_path(base, name);
+        if (!temp_dir) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        if (check) {
+            int failed = run_checks(temp_dir, run.jobs);
+            free(temp_dir);
+            return failed == 0 ? 0 : 1;
+        }
+        tree_dir = temp_dir;
+    }
+
+    Tree tree;
+    bool reused = false;
+    unsigned long long start = cl_monotonic_ns();
+    if (!build_tree(&spec, tree_dir, &tree, &reused)) {
+        if (tree_dir == temp_dir) remove_tree(&tree);
+        free_tree(&tree);
+        free(temp_dir);
+        return 1;
+    }
+    if (!reused) {
+        fprintf(stderr, "Generated %zu files (%.1f MB) in %.2f s\n", tree.file_count,
+                tree.bytes / (1024.0 * 1024.0), (cl_monotonic_ns() - start) / 1e9);
+    }
+    if (generate_only) {
+        free_tree(&tree);
+        free(temp_dir);
+        return 0;
+    }
+
+    run.walk_excludes = create_exclude_list();
+    run.lookup_excludes = create_exclude_list();
+    if (!run.walk_excludes || !run.lookup_excludes) {
+        if (tree_dir == temp_dir) remove_tree(&tree);
+        free_tree(&tree);
+        free(temp_dir);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(default_excludes) / sizeof(default_excludes[0]); i++) {
+        add_exclude_pattern(run.walk_excludes, default_excludes[i]);
+        add_exclude_pattern(run.lookup_excludes, default_excludes[i]);
+    }
+    for (size_t i = 0; i < sizeof(lookup_excludes) / sizeof(lookup_excludes[0]); i++) {
+        add_exclude_pattern(run.lookup_excludes, lookup_excludes[i]);
+    }
+
+    if (wanted(&run, "traversal")) bench_walk(&run, &tree, "traversal", true);
+    if (wanted(&run, "is_text_file")) bench_lookup(&run, &tree, "is_text_file", LOOKUP_TEXT_FILE);
+    if (wanted(&run, "is_excluded")) bench_lookup(&run, &tree, "is_excluded", LOOKUP_EXCLUDED);
+    if (wanted(&run, "exclude_matcher")) bench_lookup(&run, &tree, "exclude_matcher", LOOKUP_MATCHER);
+    if (wanted(&run, "count_lines_in_file")) bench_count_lines_in_file(&run, &tree);
+    if (wanted(&run, "end_to_end")) bench_walk(&run, &tree, "end_to_end", false);
+
+    bool to_stdout = (json_path && strcmp(json_path, "-") == 0) || (csv_path && strcmp(csv_path, "-") == 0);
+    if (!to_stdout) print_table(&run, &spec, &tree, reused);
+    bool ok = true;
+    if (json_path) ok = write_report(json_path, &run, &spec, &tree, true) && ok;
+    if (csv_path) ok = write_report(csv_path, &run, &spec, &tree, false) && ok;
+
+    if (tree_dir == temp_dir) remove_tree(&tree);
+    free_tree(&tree);
+    free_exclude_list(run.walk_excludes);
+    free_exclude_list(run.lookup_excludes);
+    free(temp_dir);
+    return ok && run.all_match ? 0 : 1;
+}
@@ -0,0 +1,619 @@
+/*
+ * genlang - build-time generator for the per-language lexer tables.
+ *
+ * Reads the descriptors in src/languages.def and writes a C source file with
+ * one DFA per distinct comment/string syntax. A DFA state captures the lexical
+ * context (code, line comment, block comment or string), any partially
+ * matched marker and the class of the current line so far, so the runtime
+ * needs exactly one table lookup per byte and no per-character branches.
+ *
+ * Usage: genlang <output.c>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_MARKER 8
+#define MAX_MARKERS 8
+#define MAX_STATES 256
+#define SKIP_BYTES 8
+#define EXT_KEY_BYTES 8
+#define EXT_HASH_MAX_SLOTS 4096
+
+enum { LINE_BLANK, LINE_COMMENT, LINE_CODE };
+enum { CTX_CODE, CTX_LINE, CTX_BLOCK, CTX_STRING };
+enum { STOP_ALL, STOP_IN, STOP_NOT_IN };
+
+typedef struct {
+    char text[MAX_MARKER + 1];
+    int len;
+    int line_start;         // Only at line start, case-insensitive
+} Marker;
+
+typedef struct {
+    int kind;               // CTX_LINE, CTX_BLOCK or CTX_STRING
+    int index;
+    const Marker *marker;
+} Opener;
+
+typedef struct {
+    const char *id;
+    const char *name;
+    const char *extensions;
+    const char *line_comments;
+    const char *block_comments;
+    const char *strings;
+} Descriptor;
+
+typedef struct {
+    Marker line[MAX_MARKERS];
+    int line_count;
+    Marker block_open[MAX_MARKERS];
+    Marker block_close[MAX_MARKERS];
+    int block_count;
+    Marker string[MAX_MARKERS];
+    int string_escape[MAX_MARKERS];
+    int string_multiline[MAX_MARKERS];
+    int string_count;
+    Opener openers[3 * MAX_MARKERS];
+    int opener_count;
+} Syntax;
+
+// One lexer configuration; zero-filled so configurations compare with memcmp
+typedef struct {
+    unsigned char ctx;
+    unsigned char which;
+    unsigned char progress;
+    unsigned char escape;
+    unsigned char status;
+    unsigned char ended;
+    unsigned char pending_len;
+    unsigned char pending[MAX_MARKER];
+} Config;
+
+typedef struct {
+    Config states[MAX_STATES];
+    int count;
+    unsigned char transitions[MAX_STATES][256];
+} Dfa;
+
+static const Descriptor descriptors[] = {
+#define LANGUAGE(id, name, extensions, line_comments, block_comments, strings) \
+    { #id, name, extensions, line_comments, block_comments, strings },
+#include "languages.def"
+#undef LANGUAGE
+};
+
+#define DESCRIPTOR_COUNT ((int)(sizeof(descriptors) / sizeof(descriptors[0])))
+
+static void fail(const char *message, const char *detail) {
+    fprintf(stderr, "genlang: %s: %s\n", message, detail);
+    exit(1);
+}
+
+// Split a space separated list; returns the next token or NULL at the end
+static const char* next_token(const char *p, char *token, size_t size) {
+    while (*p == ' ') p++;
+    if (!*p) return NULL;
+
+    size_t len = 0;
+    while (*p && *p != ' ') {
+        char ch = *p++;
+        if (ch == '\\' && *p == 's') {
+            ch = ' ';
+            p++;
+        }
+        if (len + 1 >= size) fail("token too long", token);
+        token[len++] = ch;
+    }
+    token[len] = '\0';
+    return p;
+}
+
+static void make_marker(Marker *m, const char *text, int line_start) {
+    memset(m, 0, sizeof(Marker));
+    m->len = (int)strlen(text);
+    if (m->len == 0 || m->len > MAX_MARKER) fail("bad marker length", text);
+    memcpy(m->text, text, m->len);
+    m->line_start = line_start;
+}
+
+static void parse_syntax(const Descriptor *d, Syntax *syntax) {
+    char token[64];
+    const char *p;
+    memset(syntax, 0, sizeof(Syntax));
+
+    for (p = d->line_comments; (p = next_token(p, token, sizeof(token))) != NULL; ) {
+        if (syntax->line_count == MAX_MARKERS) fail("too many line comments", d->id);
+        int line_start = token[0] == '^';
+        make_marker(&syntax->line[syntax->line_count++], token + line_start, line_start);
+    }
+
+    for (p = d->block_comments; (p = next_token(p, token, sizeof(token))) != NULL; ) {
+        if (syntax->block_count == MAX_MARKERS) fail("too many block comments", d->id);
+        make_marker(&syntax->block_open[syntax->block_count], token, 0);
+        if ((p = next_token(p, token, sizeof(token))) == NULL) fail("unpaired block comment", d->id);
+        make_marker(&syntax->block_close[syntax->block_count], token, 0);
+        syntax->block_count++;
+    }
+
+    for (p = d->strings; (p = next_token(p, token, sizeof(token))) != NULL; ) {
+        if (syntax->string_count == MAX_MARKERS) fail("too many strings", d->id);
+        int i = syntax->string_count++;
+        char *flags = strchr(token + 1, ':');
+        if (flags) *flags++ = '\0';
+        make_marker(&syntax->string[i], token, 0);
+        syntax->string_escape[i] = flags && strchr(flags, 'e') != NULL;
+        syntax->string_multiline[i] = flags && strchr(flags, 'm') != NULL;
+    }
+
+    for (int i = 0; i < syntax->line_count; i++) {
+        Opener o = { CTX_LINE, i, &syntax->line[i] };
+        syntax->openers[syntax->opener_count++] = o;
+    }
+    for (int i = 0; i < syntax->block_count; i++) {
+        Opener o = { CTX_BLOCK, i, &syntax->block_open[i] };
+        syntax->openers[syntax->opener_count++] = o;
+    }
+    for (int i = 0; i < syntax->string_count; i++) {
+        Opener o = { CTX_STRING, i, &syntax->string[i] };
+        syntax->openers[syntax->opener_count++] = o;
+    }
+}
+
+static int is_space(unsigned char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\f' || ch == '\v';
+}
+
+static unsigned char max_status(unsigned char a, unsigned char b) {
+    return a > b ? a : b;
+}
+
+static int marker_char_matches(const Marker *m, int pos, unsigned char ch) {
+    if (m->line_start) return tolower(ch) == tolower((unsigned char)m->text[pos]);
+    return ch == (unsigned char)m->text[pos];
+}
+
+static int opener_eligible(const Opener *o, const Config *c) {
+    return !o->marker->line_start || c->status == LINE_BLANK;
+}
+
+static int opener_matches_prefix(const Opener *o, const unsigned char *text, int len) {
+    if (len > o->marker->len) return 0;
+    for (int i = 0; i < len; i++) {
+        if (!marker_char_matches(o->marker, i, text[i])) return 0;
+    }
+    return 1;
+}
+
+static int is_opener_prefix(const Syntax *s, const Config *c, const unsigned char *text, int len) {
+    for (int i = 0; i < s->opener_count; i++) {
+        if (opener_eligible(&s->openers[i], c) && opener_matches_prefix(&s->openers[i], text, len)) return 1;
+    }
+    return 0;
+}
+
+// Longest eligible opener that is a prefix of text (ties go to the earlier opener)
+static const Opener* longest_complete_opener(const Syntax *s, const Config *c, const unsigned char *text, int len) {
+    const Opener *best = NULL;
+    for (int i = 0; i < s->opener_count; i++) {
+        const Opener *o = &s->openers[i];
+        if (o->marker->len <= len && opener_eligible(o, c) && opener_matches_prefix(o, text, o->marker->len)) {
+            if (!best || o->marker->len > best->marker->len) best = o;
+        }
+    }
+    return best;
+}
+
+static int has_longer_opener(const Syntax *s, const Config *c, const unsigned char *text, int len) {
+    for (int i = 0; i < s->opener_count; i++) {
+        const Opener *o = &s->openers[i];
+        if (o->marker->len > len && opener_eligible(o, c) && opener_matches_prefix(o, text, len)) return 1;
+    }
+    return 0;
+}
+
+static void commit(const Syntax *s, Config *c, const Opener *o) {
+    (void)s;
+    c->pending_len = 0;
+    memset(c->pending, 0, sizeof(c->pending));
+    c->ctx = (unsigned char)o->kind;
+    c->which = (unsigned char)o->index;
+    c->progress = 0;
+    c->escape = 0;
+    if (o->kind == CTX_STRING) {
+        c->status = LINE_CODE;
+    } else {
+        c->status = max_status(c->status, LINE_COMMENT);
+    }
+}
+
+// KMP-style progress of `closer` after appending ch to its first `progress` bytes
+static unsigned char advance_closer(const Marker *closer, int progress, unsigned char ch) {
+    unsigned char text[MAX_MARKER + 1];
+    memcpy(text, closer->text, progress);
+    text[progress] = ch;
+    int len = progress + 1;
+
+    for (int k = len < closer->len ? len : closer->len; k > 0; k--) {
+        if (memcmp(text + len - k, closer->text, k) == 0) return (unsigned char)k;
+    }
+    return 0;
+}
+
+static void step_byte(const Syntax *s, Config *c, unsigned char ch);
+
+static void refeed(const Syntax *s, Config *c, const unsigned char *text, int len) {
+    for (int i = 0; i < len; i++) step_byte(s, c, text[i]);
+}
+
+// Resolve a pending partial marker whose extension by ch failed
+static void resolve_pending(const Syntax *s, Config *c) {
+    unsigned char saved[MAX_MARKER];
+    int len = c->pending_len;
+    memcpy(saved, c->pending, len);
+    c->pending_len = 0;
+    memset(c->pending, 0, sizeof(c->pending));
+
+    const Opener *o = longest_complete_opener(s, c, saved, len);
+    if (o) {
+        commit(s, c, o);
+        refeed(s, c, saved + o->marker->len, len - o->marker->len);
+    } else {
+        if (!is_space(saved[0])) c->status = LINE_CODE;
+        refeed(s, c, saved + 1, len - 1);
+    }
+}
+
+static void code_step(const Syntax *s, Config *c, unsigned char ch) {
+    unsigned char text[MAX_MARKER + 1];
+    int len = c->pending_len;
+    memcpy(text, c->pending, len);
+    text[len++] = ch;
+
+    if (len <= MAX_MARKER && is_opener_prefix(s, c, text, len)) {
+        memcpy(c->pending, text, len);
+        c->pending_len = (unsigned char)len;
+        const Opener *o = longest_complete_opener(s, c, text, len);
+        if (o && o->marker->len == len && !has_longer_opener(s, c, text, len)) {
+            commit(s, c, o);
+        }
+        return;
+    }
+
+    if (c->pending_len == 0) {
+        if (!is_space(ch)) c->status = LINE_CODE;
+        return;
+    }
+
+    resolve_pending(s, c);
+    step_byte(s, c, ch);
+}
+
+// Every byte except '\n' (which is handled in step)
+static void step_byte(const Syntax *s, Config *c, unsigned char ch) {
+    switch (c->ctx) {
+    case CTX_CODE:
+        code_step(s, c, ch);
+        break;
+    case CTX_LINE:
+        break;
+    case CTX_BLOCK: {
+        const Marker *closer = &s->block_close[c->which];
+        c->progress = advance_closer(closer, c->progress, ch);
+        if (c->progress == closer->len) {
+            c->ctx = CTX_CODE;
+            c->which = 0;
+            c->progress = 0;
+        }
+        break;
+    }
+    case CTX_STRING: {
+        if (!is_space(ch)) c->status = LINE_CODE;
+        if (c->escape) {
+            c->escape = 0;
+            c->progress = 0;
+            break;
+        }
+        if (s->string_escape[c->which] && ch == '\\') {
+            c->escape = 1;
+            c->progress = 0;
+            break;
+        }
+        const Marker *closer = &s->string[c->which];
+        c->progress = advance_closer(closer, c->progress, ch);
+        if (c->progress == closer->len) {
+            c->ctx = CTX_CODE;
+            c->which = 0;
+            c->progress = 0;
+        }
+        break;
+    }
+    }
+}
+
+static void flush_pending(const Syntax *s, Config *c) {
+    while (c->ctx == CTX_CODE && c->pending_len > 0) {
+        resolve_pending(s, c);
+    }
+}
+
+static Config step(const Syntax *s, Config c, unsigned char ch) {
+    c.ended = 0;
+
+    if (ch != '\n') {
+        step_byte(s, &c, ch);
+        return c;
+    }
+
+    flush_pending(s, &c);
+    unsigned char line_class = c.status;
+
+    switch (c.ctx) {
+    case CTX_LINE:
+        c.ctx = CTX_CODE;
+        c.which = 0;
+        break;
+    case CTX_STRING:
+        if (c.escape) {
+            c.escape = 0;
+        } else if (!s->string_multiline[c.which]) {
+            c.ctx = CTX_CODE;
+            c.which = 0;
+        }
+        break;
+    default:
+        break;
+    }
+
+    c.progress = 0;
+    c.status = c.ctx == CTX_BLOCK ? LINE_COMMENT : LINE_BLANK;
+    c.ended = (unsigned char)(1 + line_class);
+    return c;
+}
+
+static unsigned char eof_class(const Syntax *s, Config c) {
+    flush_pending(s, &c);
+    return c.status;
+}
+
+static int find_or_add(Dfa *dfa, const Config *c, const char *id) {
+    for (int i = 0; i < dfa->count; i++) {
+        if (memcmp(&dfa->states[i], c, sizeof(Config)) == 0) return i;
+    }
+    if (dfa->count == MAX_STATES) fail("too many DFA states", id);
+    dfa->states[dfa->count] = *c;
+    return dfa->count++;
+}
+
+static void build_dfa(const Syntax *s, Dfa *dfa, const char *id) {
+    Config start;
+    memset(&start, 0, sizeof(Config));
+    dfa->count = 0;
+    find_or_add(dfa, &start, id);
+
+    for (int i = 0; i < dfa->count; i++) {
+        for (int b = 0; b < 256; b++) {
+            Config next = step(s, dfa->states[i], (unsigned char)b);
+            dfa->transitions[i][b] = (unsigned char)find_or_add(dfa, &next, id);
+        }
+    }
+}
+
+static void emit_state_info(FILE *out, const Syntax *s, const Dfa *dfa, int i) {
+    const Config *c = &dfa->states[i];
+    unsigned char stop[256], keep[256];
+    int stop_count = 0, keep_count = 0;
+
+    for (int b = 0; b < 256; b++) {
+        if (dfa->transitions[i][b] != i) stop[stop_count++] = (unsigned char)b;
+        else keep[keep_count++] = (unsigned char)b;
+    }
+
+    // States entered by '\n' must be visited so the ended line is tallied
+    int mode = STOP_ALL;
+    const unsigned char *bytes = NULL;
+    int count = 0;
+    if (c->ended == 0) {
+        if (stop_count <= SKIP_BYTES) {
+            mode = STOP_IN;
+            bytes = stop;
+            count = stop_count;
+        } else if (keep_count <= SKIP_BYTES) {
+            mode = STOP_NOT_IN;
+            bytes = keep;
+            count = keep_count;
+        }
+    }
+
+    fprintf(out, "    { %d, %d, %d, %d, {", c->ended, eof_class(s, *c), mode, count);
+    for (int k = 0; k < SKIP_BYTES; k++) {
+        fprintf(out, "%s%d", k ? ", " : " ", k < count ? bytes[k] : 0);
+    }
+    fprintf(out, " } },\n");
+}
+
+static void emit_dfa(FILE *out, const Syntax *s, const Dfa *dfa, int index, const char *names) {
+    fprintf(out, "/* %s */\n", names);
+    fprintf(out, "static const unsigned char syntax%d_transitions[%d][256] = {\n", index, dfa->count);
+    for (int i = 0; i < dfa->count; i++) {
+        fprintf(out, "    {");
+        for (int b = 0; b < 256; b++) {
+            if (b % 32 == 0) fprintf(out, "\n        ");
+            fprintf(out, "%d,", dfa->transitions[i][b]);
+        }
+        fprintf(out, "\n    },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const LexerStateInfo syntax%d_states[%d] = {\n", index, dfa->count);
+    for (int i = 0; i < dfa->count; i++) emit_state_info(out, s, dfa, i);
+    fprintf(out, "};\n\n");
+}
+
+static int same_syntax(const Descriptor *a, const Descriptor *b) {
+    return strcmp(a->line_comments, b->line_comments) == 0 &&
+           strcmp(a->block_comments, b->block_comments) == 0 &&
+           strcmp(a->strings, b->strings) == 0;
+}
+
+// Same key as language_from_filename() in lexer.c builds: the bytes after
+// the dot, little-endian, zero padded
+static unsigned long long pack_extension(const char *ext) {
+    unsigned long long key = 0;
+    for (int i = 0; ext[i]; i++) key |= (unsigned long long)(unsigned char)ext[i] << (8 * i);
+    return key;
+}
+
+// Multiplicative hash (key * multiplier) >> shift. The generator searches for
+// a multiplier that maps every extension to its own slot, so the runtime
+// lookup is one multiply, one load and one compare.
+static void emit_extension_hash(FILE *out) {
+    static unsigned long long keys[EXT_HASH_MAX_SLOTS];
+    static int languages[EXT_HASH_MAX_SLOTS];
+    static unsigned long long slots[EXT_HASH_MAX_SLOTS];
+    static int slot_language[EXT_HASH_MAX_SLOTS];
+    int count = 0;
+
+    for (int i = 0; i < DESCRIPTOR_COUNT; i++) {
+        char token[64];
+        const char *p = descriptors[i].extensions;
+        while ((p = next_token(p, token, sizeof(token))) != NULL) {
+            size_t len = strlen(token);
+            if (token[0] != '.' || len < 2) fail("extension must start with '.'", token);
+            if (len - 1 > EXT_KEY_BYTES) fail("extension longer than 8 bytes", token);
+            if (count == EXT_HASH_MAX_SLOTS / 2) fail("too many extensions", token);
+            unsigned long long key = pack_extension(token + 1);
+            for (int j = 0; j < count; j++) {
+                if (keys[j] == key) fail("duplicate extension", token);
+            }
+            keys[count] = key;
+            languages[count] = i + 1;
+            count++;
+        }
+    }
+
+    int bits = 1;
+    while ((1 << bits) < 2 * count) bits++;
+
+    // Deterministic xorshift sequence so the output is reproducible
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    for (; (1 << bits) <= EXT_HASH_MAX_SLOTS; bits++) {
+        int size = 1 << bits;
+        for (int attempt = 0; attempt < 1000000; attempt++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            unsigned long long multiplier = seed | 1;
+
+            memset(slots, 0, sizeof(slots[0]) * size);
+            int ok = 1;
+            for (int j = 0; j < count && ok; j++) {
+                int slot = (int)((keys[j] * multiplier) >> (64 - bits));
+                if (slots[slot]) ok = 0;
+                slots[slot] = keys[j];
+                slot_language[slot] = languages[j];
+            }
+            if (!ok) continue;
+
+            fprintf(out, "const ExtensionHash extension_hash = { 0x%016llXULL, %d };\n\n", multiplier, 64 - bits);
+            fprintf(out, "const ExtensionSlot extension_slots[%d] = {\n", size);
+            for (int j = 0; j < size; j++) {
+                if (!slots[j]) {
+                    fprintf(out, "    { 0, LANG_UNKNOWN },\n");
+                } else {
+                    fprintf(out, "    { 0x%016llXULL, LANG_%s },\n", slots[j], descriptors[slot_language[j] - 1].id);
+                }
+            }
+            fprintf(out, "};\n");
+            fprintf(stderr, "genlang: %d extensions in a %d-slot perfect hash\n", count, size);
+            return;
+        }
+    }
+    fail("no perfect hash multiplier found", "increase EXT_HASH_MAX_SLOTS");
+}
+
+// FNV-1a of everything generated so far, appended as language_tables_hash.
+// It changes whenever a table does, so persisted counts can be invalidated.
+static void append_fingerprint(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) fail("cannot reopen output", path);
+    unsigned long long hash = 1469598103934665603ULL;
+    int ch;
+    while ((ch = fgetc(in)) != EOF) {
+        hash ^= (unsigned char)ch;
+        hash *= 1099511628211ULL;
+    }
+    fclose(in);
+
+    FILE *out = fopen(path, "ab");
+    if (!out) fail("cannot reopen output", path);
+    fprintf(out, "\nconst unsigned long long language_tables_hash = 0x%016llXULL;\n", hash);
+    if (fclose(out) != 0) fail("cannot write output", path);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <output.c>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) fail("cannot open output", argv[1]);
+
+    int syntax_of[DESCRIPTOR_COUNT];
+    int syntax_count = 0;
+    int total_states = 0;
+    static Dfa dfa;
+
+    fprintf(out, "/* Generated by tools/genlang.c from src/languages.def. Do not edit. */\n\n");
+    fprintf(out, "#include \"lexer.h\"\n\n");
+
+    for (int i = 0; i < DESCRIPTOR_COUNT; i++) {
+        syntax_of[i] = -1;
+        for (int j = 0; j < i; j++) {
+            if (same_syntax(&descriptors[i], &descriptors[j])) {
+                syntax_of[i] = syntax_of[j];
+                break;
+            }
+        }
+        if (syntax_of[i] >= 0) continue;
+
+        char names[512] = "";
+        for (int j = i; j < DESCRIPTOR_COUNT; j++) {
+            if (same_syntax(&descriptors[i], &descriptors[j]) && strlen(names) + strlen(descriptors[j].name) + 3 < sizeof(names)) {
+                if (names[0]) strcat(names, ", ");
+                strcat(names, descriptors[j].name);
+            }
+        }
+
+        Syntax syntax;
+        parse_syntax(&descriptors[i], &syntax);
+        build_dfa(&syntax, &dfa, descriptors[i].id);
+        syntax_of[i] = syntax_count++;
+        total_states += dfa.count;
+        emit_dfa(out, &syntax, &dfa, syntax_of[i], names);
+        fprintf(out, "static const LexerTable syntax%d = { %d, syntax%d_transitions, syntax%d_states };\n\n",
+                syntax_of[i], dfa.count, syntax_of[i], syntax_of[i]);
+    }
+
+    fprintf(out, "const LanguageInfo language_table[LANG_COUNT] = {\n");
+    fprintf(out, "    { \"Unknown\", \"unknown\", 0 },\n");
+    for (int i = 0; i < DESCRIPTOR_COUNT; i++) {
+        char id[64];
+        size_t k;
+        for (k = 0; descriptors[i].id[k] && k + 1 < sizeof(id); k++) id[k] = (char)tolower((unsigned char)descriptors[i].id[k]);
+        id[k] = '\0';
+        fprintf(out, "    { \"%s\", \"%s\", &syntax%d },\n", descriptors[i].name, id, syntax_of[i]);
+    }
+    fprintf(out, "};\n\n");
+
+    emit_extension_hash(out);
+
+    if (fclose(out) != 0) fail("cannot write output", argv[1]);
+    append_fingerprint(argv[1]);
+    fprintf(stderr, "genlang: %d languages, %d syntaxes, %d DFA states\n", DESCRIPTOR_COUNT, syntax_count, total_states);
+    return 0;
+}